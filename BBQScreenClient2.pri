@@ -9,15 +9,19 @@ message("You are running qmake on a generated .pro file. This may not work!")
 
 HEADERS += ./stdafx.h \
     ./screenform.h \
+    ./wallform.h \
     ./mainwindow.h \
-    ./QStreamDecoder.h \
-    ./ShrinkableQLabel.h
+    ./ShrinkableQLabel.h \
+    ./FrameItem.h
 SOURCES += ./main.cpp \
     ./mainwindow.cpp \
     ./screenform.cpp \
-    ./QStreamDecoder.cpp \
+    ./wallform.cpp \
     ./stdafx.cpp \
-    ./ShrinkableQLabel.cpp
+    ./ShrinkableQLabel.cpp \
+    ./FrameItem.cpp
 FORMS += ./mainwindow.ui \
     ./screenform.ui
 RESOURCES += mainwindow.qrc
+
+include(core/bbqcore.pri)
@@ -0,0 +1,210 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "stdafx.h"
+#include "FrameItem.h"
+
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QPainter>
+#include <QtGui/QPaintEngine>
+#include <QtOpenGL/QGLWidget>
+
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+
+#ifndef GL_UNSIGNED_INT_8_8_8_8_REV
+#define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
+#endif
+
+//----------------------------------------------------
+FrameItem::FrameItem(QGraphicsItem* parent /* = 0 */) : QGraphicsItem(parent),
+	mSmooth(false),
+	mTexture(0),
+	mTextureContext(0),
+	mUploadedBytes(0)
+{
+}
+//----------------------------------------------------
+FrameItem::~FrameItem()
+{
+	releaseTexture();
+}
+//----------------------------------------------------
+void FrameItem::setFrame(const QImage& frame, const QRegion& dirty)
+{
+	if (frame.size() != mFrame.size())
+	{
+		prepareGeometryChange();
+		mPendingDirty = QRegion(frame.rect());
+	}
+	else
+	{
+		mPendingDirty += dirty;
+	}
+
+	// Decoded frames are RGB32 already, anything else is converted once here
+	mFrame = (frame.format() == QImage::Format_RGB32) ? frame : frame.convertToFormat(QImage::Format_RGB32);
+	update();
+}
+//----------------------------------------------------
+void FrameItem::setSmooth(bool smooth)
+{
+	mSmooth = smooth;
+	update();
+}
+//----------------------------------------------------
+qint64 FrameItem::uploadedBytes() const
+{
+	return mUploadedBytes;
+}
+//----------------------------------------------------
+QRectF FrameItem::boundingRect() const
+{
+	return QRectF(0, 0, mFrame.width(), mFrame.height());
+}
+//----------------------------------------------------
+static bool hasFixedFunctionPipeline()
+{
+	// glBegin and the fixed function matrices the GL2 engine loads for us
+	// only exist on desktop GL with the compatibility profile
+	const QOpenGLContext* context = QOpenGLContext::currentContext();
+	if (!context || context->isOpenGLES())
+		return false;
+
+	return context->format().profile() != QSurfaceFormat::CoreProfile;
+}
+//----------------------------------------------------
+void FrameItem::releaseTexture()
+{
+	if (mTexture == 0)
+		return;
+
+	// The texture went away with its context if the viewport is gone or
+	// got a new context, otherwise it is deleted with its context current
+	if (!mTextureWidget.isNull() && mTextureWidget->context() == mTextureContext)
+	{
+		mTextureWidget->makeCurrent();
+		glDeleteTextures(1, &mTexture);
+	}
+
+	mTexture = 0;
+	mTextureSize = QSize();
+	mTextureWidget = 0;
+	mTextureContext = 0;
+}
+//----------------------------------------------------
+void FrameItem::uploadDirty()
+{
+	if (mTexture == 0)
+		glGenTextures(1, &mTexture);
+
+	glBindTexture(GL_TEXTURE_2D, mTexture);
+
+	if (mTextureSize != mFrame.size())
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, mFrame.width(), mFrame.height(), 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		mTextureSize = mFrame.size();
+		mPendingDirty = QRegion(mFrame.rect());
+	}
+
+	if (mPendingDirty.isEmpty())
+		return;
+
+	// Rows of the pooled frames are padded to a whole number of 32 bits
+	// pixels, the unpack row length skips the padding. 0xFFRRGGBB words are
+	// what GL calls BGRA with reversed components, on any endianness.
+	const int bytesPerPixel = 4;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, mFrame.bytesPerLine() / bytesPerPixel);
+
+	QVector<QRect> rects = mPendingDirty.rects();
+	for (auto it = rects.constBegin(); it != rects.constEnd(); ++it)
+	{
+		const QRect r = it->intersected(mFrame.rect());
+		const uchar* origin = mFrame.constScanLine(r.y()) + r.x() * bytesPerPixel;
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x(), r.y(), r.width(), r.height(), GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, origin);
+		mUploadedBytes += (qint64) r.width() * r.height() * bytesPerPixel;
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	mPendingDirty = QRegion();
+}
+//----------------------------------------------------
+void FrameItem::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget)
+{
+	Q_UNUSED(option);
+
+	if (mFrame.isNull())
+		return;
+
+	QGLWidget* glWidget = qobject_cast<QGLWidget*>(widget);
+	if (painter->paintEngine()->type() != QPaintEngine::OpenGL2 || !glWidget || !hasFixedFunctionPipeline())
+	{
+		painter->setRenderHint(QPainter::SmoothPixmapTransform, mSmooth);
+		painter->drawImage(QPointF(0, 0), mFrame);
+		return;
+	}
+
+	// The GL2 engine loads the item transform (scale and rotation) in the
+	// fixed function matrices before handing over
+	painter->beginNativePainting();
+
+	// A texture made on another viewport or context (the viewport was
+	// replaced or its context recreated) is not valid here, start over
+	if (mTexture != 0 && (mTextureWidget != glWidget || mTextureContext != glWidget->context()))
+	{
+		releaseTexture();
+		glWidget->makeCurrent();
+	}
+
+	if (mTexture == 0)
+	{
+		mTextureWidget = glWidget;
+		mTextureContext = glWidget->context();
+	}
+
+	uploadDirty();
+
+	const GLint filter = mSmooth ? GL_LINEAR : GL_NEAREST;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+
+	const GLfloat w = mFrame.width(), h = mFrame.height();
+	glEnable(GL_TEXTURE_2D);
+	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+	glBegin(GL_QUADS);
+	glTexCoord2f(0.0f, 0.0f); glVertex2f(0.0f, 0.0f);
+	glTexCoord2f(1.0f, 0.0f); glVertex2f(w, 0.0f);
+	glTexCoord2f(1.0f, 1.0f); glVertex2f(w, h);
+	glTexCoord2f(0.0f, 1.0f); glVertex2f(0.0f, h);
+	glEnd();
+	glDisable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	painter->endNativePainting();
+}
+//----------------------------------------------------
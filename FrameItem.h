@@ -0,0 +1,70 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef FRAMEITEM_H
+#define FRAMEITEM_H
+
+#include <QGraphicsItem>
+#include <QImage>
+#include <QPointer>
+#include <QRegion>
+
+class QGLContext;
+class QGLWidget;
+
+// Scene item displaying the decoded frames. On an OpenGL viewport the frame
+// lives in a texture that is kept from one frame to the next: only the dirty
+// rectangles of each frame are uploaded, so the upload bandwidth follows
+// what changed on the device screen rather than its resolution. Other paint
+// engines, and GL contexts without the fixed function pipeline (GLES, ANGLE,
+// core profiles), draw the image as is.
+class FrameItem : public QGraphicsItem
+{
+public:
+	FrameItem(QGraphicsItem* parent = 0);
+	~FrameItem();
+
+	// Displays a new frame of which only the dirty area changed since the
+	// previous one. A different size uploads the whole frame.
+	void setFrame(const QImage& frame, const QRegion& dirty);
+	void setSmooth(bool smooth);
+
+	// Bytes sent to the texture since the item was created
+	qint64 uploadedBytes() const;
+
+	QRectF boundingRect() const;
+	void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget);
+
+protected:
+	void uploadDirty();
+	void releaseTexture();
+
+protected:
+	QImage mFrame;
+	QRegion mPendingDirty;
+	bool mSmooth;
+
+	// The texture belongs to the context of the viewport it was created on
+	unsigned int mTexture;
+	QSize mTextureSize;
+	QPointer<QGLWidget> mTextureWidget;
+	const QGLContext* mTextureContext;
+	qint64 mUploadedBytes;
+};
+
+#endif // FRAMEITEM_H
@@ -45,6 +45,7 @@ extern "C" {
 #include "libswresample/swresample.h"
 #include "libavutil/opt.h"
 #include "libavutil/channel_layout.h"
+#include "libavutil/cpu.h"
 }
 }
 
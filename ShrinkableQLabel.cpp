@@ -7,6 +7,7 @@
 
 //----------------------------------------------------
 ShrinkableQLabel::ShrinkableQLabel(QWidget* parent /* = 0 */) : QGraphicsView(parent),
+	mRotation(0),
 	mHighQuality(false)
 {
 	this->setFocusPolicy(Qt::FocusPolicy::NoFocus);
@@ -27,31 +28,60 @@ ShrinkableQLabel::ShrinkableQLabel(QWidget* parent /* = 0 */) : QGraphicsView(pa
 	viewport()->setAttribute(Qt::WA_OpaquePaintEvent);
 	viewport()->setAttribute(Qt::WA_NoSystemBackground);
 
-	// Setup our scene (which is just the pixmap)
+	// Setup our scene (which is just the frame)
 	mScene = new QGraphicsScene(this);
 	setScene(mScene);
-	mPixmapItem = new QGraphicsPixmapItem(0);
-	mScene->addItem(mPixmapItem);
+	mFrameItem = new FrameItem(0);
+	mScene->addItem(mFrameItem);
 }
 //----------------------------------------------------
 void ShrinkableQLabel::setHighQuality(bool high)
 {
 	mHighQuality = high;
+	mFrameItem->setSmooth(high);
 }
 //----------------------------------------------------
 void ShrinkableQLabel::setImage(const QImage& aPicture)
 {
-	mSource = aPicture;
-	_displayImage();
+	updateImage(aPicture, QRegion(aPicture.rect()));
+}
+//----------------------------------------------------
+void ShrinkableQLabel::updateImage(const QImage& aPicture, const QRegion& dirty)
+{
+	const bool resized = (aPicture.size() != mFrameItem->boundingRect().size().toSize());
+	mFrameItem->setFrame(aPicture, dirty);
+
+	if (resized)
+		_fitScene();
+}
+//----------------------------------------------------
+void ShrinkableQLabel::setRotation(int angle)
+{
+	if (angle == mRotation)
+		return;
+
+	mRotation = angle;
+	_fitScene();
+}
+//----------------------------------------------------
+void ShrinkableQLabel::_fitScene()
+{
+	// Rotate the frame in the scene rather than its pixels, and move it back
+	// to the origin so the scene rect is the rotated frame
+	QTransform t;
+	t.rotate(mRotation);
+	QRectF bounds = t.mapRect(mFrameItem->boundingRect());
+	t *= QTransform::fromTranslate(-bounds.x(), -bounds.y());
+
+	mFrameItem->setTransform(t);
+	mScene->setSceneRect(0, 0, bounds.width(), bounds.height());
 	fitInView(0, 0, mScene->width(), mScene->height(), Qt::KeepAspectRatio);
 }
 //----------------------------------------------------
-void ShrinkableQLabel::_displayImage()
+void ShrinkableQLabel::resizeEvent(QResizeEvent* event)
 {
-	QPixmap pixmap = QPixmap::fromImage(mSource);
-	mPixmapItem->setTransformationMode(mHighQuality ? Qt::SmoothTransformation : Qt::TransformationMode::FastTransformation);
-	mPixmapItem->setPixmap(pixmap);
-	mScene->setSceneRect(mPixmapItem->boundingRect());
+	QGraphicsView::resizeEvent(event);
+	fitInView(0, 0, mScene->width(), mScene->height(), Qt::KeepAspectRatio);
 }
 //----------------------------------------------------
 QSizeF ShrinkableQLabel::getRenderSize()
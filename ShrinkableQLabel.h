@@ -4,6 +4,7 @@
 #include <QPixmap>
 #include <QtGui/QPaintEvent>
 #include <QtWidgets/QGraphicsView>
+#include "FrameItem.h"
 
 class ShrinkableQLabel : public QGraphicsView
 {
@@ -13,6 +14,8 @@ public:
 	ShrinkableQLabel(QWidget* parent = 0);
 	~ShrinkableQLabel() {};
 	void setImage(const QImage& aPicture);
+	void updateImage(const QImage& aPicture, const QRegion& dirty);
+	void setRotation(int angle);
 	void setHighQuality(bool high);
 	QSizeF getRenderSize();
 
@@ -21,11 +24,12 @@ public:
 	void mouseMoveEvent(QMouseEvent *event) { event->ignore(); }
 
 protected:
-	void _displayImage();
+	void resizeEvent(QResizeEvent* event);
+	void _fitScene();
 	QGraphicsScene* mScene;
-	QGraphicsPixmapItem* mPixmapItem;
+	FrameItem* mFrameItem;
 
-	QImage mSource;
+	int mRotation;
 	bool mHighQuality;
 };
 
@@ -0,0 +1,401 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "AdbJobRunner.h"
+
+#include <QDebug>
+
+//------------------------------------------
+AdbJobRunner::AdbJobRunner(QObject* parent) :
+	QObject(parent),
+	mRunning(false),
+	mFailedStep(-1),
+	mElapsedMs(0)
+{
+}
+//------------------------------------------
+AdbJobRunner::~AdbJobRunner()
+{
+	// Without telling an owner that may be half destroyed
+	blockSignals(true);
+	cancel();
+}
+//------------------------------------------
+void AdbJobRunner::setProgram(const QString& program)
+{
+	mProgram = program;
+}
+//------------------------------------------
+const QString& AdbJobRunner::program() const
+{
+	return mProgram;
+}
+//------------------------------------------
+int AdbJobRunner::addStep(const QString& name, const QStringList& args, const QList<int>& dependsOn,
+	int timeoutMs, bool optional)
+{
+	if (mRunning)
+		return -1;
+
+	// Steps depend on earlier ones only, so a job always ends
+	for (QList<int>::const_iterator it = dependsOn.begin(); it != dependsOn.end(); ++it)
+	{
+		if (*it < 0 || *it >= mSteps.size())
+			return -1;
+	}
+
+	AdbStep step;
+	step.name = name;
+	step.args = args;
+	step.dependsOn = dependsOn;
+	step.timeoutMs = timeoutMs;
+	step.optional = optional;
+	step.state = AS_PENDING;
+	step.error = ADB_OK;
+	step.exitCode = 0;
+	step.elapsedMs = 0;
+	step.process = nullptr;
+	step.timer = nullptr;
+
+	mSteps.push_back(step);
+	return mSteps.size() - 1;
+}
+//------------------------------------------
+bool AdbJobRunner::start()
+{
+	if (mRunning || mSteps.isEmpty())
+		return false;
+
+	mRunning = true;
+	mFailedStep = -1;
+	mElapsedMs = 0;
+	mClock.start();
+
+	schedule();
+	return true;
+}
+//------------------------------------------
+void AdbJobRunner::cancel()
+{
+	if (!mRunning)
+		return;
+
+	for (int id = 0; id < mSteps.size(); id++)
+	{
+		AdbStep& step = mSteps[id];
+		if (step.state == AS_PENDING || step.state == AS_RUNNING)
+			endStep(id, ADB_CANCELED);
+	}
+
+	finish(false);
+}
+//------------------------------------------
+void AdbJobRunner::clear()
+{
+	cancel();
+	mSteps.clear();
+	mFailedStep = -1;
+}
+//------------------------------------------
+void AdbJobRunner::skip(int id)
+{
+	if (id >= 0 && id < mSteps.size() && mSteps[id].state == AS_PENDING)
+		mSteps[id].state = AS_SKIPPED;
+}
+//------------------------------------------
+bool AdbJobRunner::isRunning() const
+{
+	return mRunning;
+}
+//------------------------------------------
+const AdbStep* AdbJobRunner::step(int id) const
+{
+	return (id >= 0 && id < mSteps.size()) ? &mSteps[id] : nullptr;
+}
+//------------------------------------------
+int AdbJobRunner::stepCount() const
+{
+	return mSteps.size();
+}
+//------------------------------------------
+int AdbJobRunner::stepCount(AdbStepState state) const
+{
+	int count = 0;
+	for (QVector<AdbStep>::const_iterator it = mSteps.begin(); it != mSteps.end(); ++it)
+	{
+		if (it->state == state)
+			count++;
+	}
+
+	return count;
+}
+//------------------------------------------
+qint64 AdbJobRunner::elapsedMs() const
+{
+	return mRunning ? mClock.elapsed() : mElapsedMs;
+}
+//------------------------------------------
+int AdbJobRunner::failedStep() const
+{
+	return mFailedStep;
+}
+//------------------------------------------
+AdbError AdbJobRunner::parseError(const QString& output)
+{
+	// adb reports on stderr, but the shell of older devices on stdout
+	// (and always exits with 0)
+	const QString text = output.toLower();
+
+	if (text.contains("device not found") || text.contains("no devices/emulators found"))
+		return ADB_DEVICE_NOT_FOUND;
+	if (text.contains("device offline"))
+		return ADB_DEVICE_OFFLINE;
+	if (text.contains("unauthorized"))
+		return ADB_UNAUTHORIZED;
+	if (text.contains("no such file or directory") || text.contains(": not found"))
+		return ADB_NO_SUCH_FILE;
+	if (text.contains("unable to chmod") || text.contains("permission denied") || text.contains("operation not permitted"))
+		return ADB_PERMISSION_DENIED;
+
+	return ADB_OK;
+}
+//------------------------------------------
+QString AdbJobRunner::errorString(AdbError error)
+{
+	switch (error)
+	{
+	case ADB_OK:
+		return "ok";
+	case ADB_FAILED_TO_START:
+		return "adb could not be started";
+	case ADB_TIMEOUT:
+		return "timed out";
+	case ADB_EXIT_CODE:
+		return "adb returned an error";
+	case ADB_DEVICE_NOT_FOUND:
+		return "device not found";
+	case ADB_DEVICE_OFFLINE:
+		return "device offline";
+	case ADB_UNAUTHORIZED:
+		return "device unauthorized";
+	case ADB_NO_SUCH_FILE:
+		return "no such file";
+	case ADB_PERMISSION_DENIED:
+		return "permission denied";
+	case ADB_CANCELED:
+		return "canceled";
+	}
+
+	return "unknown error";
+}
+//------------------------------------------
+bool AdbJobRunner::isSatisfied(const AdbStep& step) const
+{
+	switch (step.state)
+	{
+	case AS_DONE:
+	case AS_SKIPPED:
+		return true;
+	case AS_FAILED:
+		return step.optional;
+	default:
+		return false;
+	}
+}
+//------------------------------------------
+void AdbJobRunner::schedule()
+{
+	if (!mRunning)
+		return;
+
+	bool pending = false;
+	for (int id = 0; id < mSteps.size(); id++)
+	{
+		AdbStep& step = mSteps[id];
+		if (step.state == AS_RUNNING)
+		{
+			pending = true;
+			continue;
+		}
+		if (step.state != AS_PENDING)
+			continue;
+
+		pending = true;
+
+		bool ready = true;
+		for (QList<int>::const_iterator dep = step.dependsOn.begin(); dep != step.dependsOn.end(); ++dep)
+		{
+			if (!isSatisfied(mSteps[*dep]))
+			{
+				ready = false;
+				break;
+			}
+		}
+
+		if (ready)
+			startStep(id);
+	}
+
+	if (!pending)
+		finish(true);
+}
+//------------------------------------------
+void AdbJobRunner::startStep(int id)
+{
+	AdbStep& step = mSteps[id];
+	step.state = AS_RUNNING;
+	step.clock.start();
+
+	step.process = new QProcess(this);
+	connect(step.process, SIGNAL(finished(int, QProcess::ExitStatus)), this, SLOT(onProcessFinished(int, QProcess::ExitStatus)));
+	connect(step.process, SIGNAL(error(QProcess::ProcessError)), this, SLOT(onProcessError(QProcess::ProcessError)));
+	mStepIndex.insert(step.process, id);
+
+	if (step.timeoutMs > 0)
+	{
+		step.timer = new QTimer(this);
+		step.timer->setSingleShot(true);
+		connect(step.timer, SIGNAL(timeout()), this, SLOT(onStepTimeout()));
+		mStepIndex.insert(step.timer, id);
+		step.timer->start(step.timeoutMs);
+	}
+
+	step.process->start(mProgram, step.args);
+}
+//------------------------------------------
+void AdbJobRunner::endStep(int id, AdbError error)
+{
+	AdbStep& step = mSteps[id];
+	step.error = error;
+	step.elapsedMs = (step.state == AS_RUNNING) ? step.clock.elapsed() : 0;
+	step.state = (error == ADB_OK) ? AS_DONE : (error == ADB_CANCELED) ? AS_CANCELED : AS_FAILED;
+
+	if (step.timer)
+	{
+		mStepIndex.remove(step.timer);
+		step.timer->stop();
+		step.timer->deleteLater();
+		step.timer = nullptr;
+	}
+
+	if (step.process)
+	{
+		mStepIndex.remove(step.process);
+		step.process->disconnect(this);
+		if (step.process->state() != QProcess::NotRunning)
+			step.process->kill();
+		step.process->deleteLater();
+		step.process = nullptr;
+	}
+}
+//------------------------------------------
+void AdbJobRunner::finish(bool ok)
+{
+	if (!mRunning)
+		return;
+
+	mRunning = false;
+	mElapsedMs = mClock.elapsed();
+	emit finished(ok);
+}
+//------------------------------------------
+void AdbJobRunner::emitOutput(const QString& text, bool error)
+{
+	const QStringList lines = text.split('\n', QString::SkipEmptyParts);
+	for (QStringList::const_iterator it = lines.begin(); it != lines.end(); ++it)
+	{
+		const QString line = it->trimmed();
+		if (!line.isEmpty())
+			emit output(line, error);
+	}
+}
+//------------------------------------------
+void AdbJobRunner::onProcessFinished(int exitCode, QProcess::ExitStatus status)
+{
+	const int id = mStepIndex.value(QObject::sender(), -1);
+	if (id < 0)
+		return;
+
+	AdbStep& step = mSteps[id];
+	step.exitCode = exitCode;
+	step.output = QString::fromUtf8(step.process->readAllStandardOutput());
+	step.errorOutput = QString::fromUtf8(step.process->readAllStandardError());
+	emitOutput(step.output, false);
+	emitOutput(step.errorOutput, true);
+
+	AdbError error = parseError(step.errorOutput);
+	if (error == ADB_OK)
+		error = parseError(step.output);
+	if (error == ADB_OK && (status != QProcess::NormalExit || exitCode != 0))
+		error = ADB_EXIT_CODE;
+
+	endStep(id, error);
+
+	// The device is gone: nothing else can work
+	const bool deviceError = (error == ADB_DEVICE_NOT_FOUND || error == ADB_DEVICE_OFFLINE || error == ADB_UNAUTHORIZED);
+	if (error != ADB_OK && (!step.optional || deviceError))
+	{
+		qDebug() << "ADB step " << step.name << " failed: " << errorString(error);
+		mFailedStep = id;
+		emit stepFinished(id);
+		cancel();
+		return;
+	}
+
+	emit stepFinished(id);
+	schedule();
+}
+//------------------------------------------
+void AdbJobRunner::onProcessError(QProcess::ProcessError error)
+{
+	// A crash or a kill also ends with finished()
+	if (error != QProcess::FailedToStart)
+		return;
+
+	const int id = mStepIndex.value(QObject::sender(), -1);
+	if (id < 0)
+		return;
+
+	qDebug() << "Cannot start " << mProgram << " for step " << mSteps[id].name;
+	endStep(id, ADB_FAILED_TO_START);
+	mFailedStep = id;
+	emit stepFinished(id);
+	cancel();
+}
+//------------------------------------------
+void AdbJobRunner::onStepTimeout()
+{
+	const int id = mStepIndex.value(QObject::sender(), -1);
+	if (id < 0)
+		return;
+
+	qDebug() << "ADB step " << mSteps[id].name << " timed out after " << mSteps[id].timeoutMs << " ms";
+	endStep(id, ADB_TIMEOUT);
+
+	if (mSteps[id].optional)
+	{
+		emit stepFinished(id);
+		schedule();
+		return;
+	}
+
+	mFailedStep = id;
+	emit stepFinished(id);
+	cancel();
+}
+//------------------------------------------
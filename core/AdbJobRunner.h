@@ -0,0 +1,161 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _ADBJOBRUNNER_H_
+#define _ADBJOBRUNNER_H_
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QList>
+#include <QHash>
+#include <QProcess>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// Longest an adb call may take (the first one can start the adb server)
+#define ADB_STEP_TIMEOUT_MS 10000
+
+enum AdbError
+{
+	ADB_OK,
+	ADB_FAILED_TO_START,
+	ADB_TIMEOUT,
+	ADB_EXIT_CODE,
+	ADB_DEVICE_NOT_FOUND,
+	ADB_DEVICE_OFFLINE,
+	ADB_UNAUTHORIZED,
+	ADB_NO_SUCH_FILE,
+	ADB_PERMISSION_DENIED,
+	ADB_CANCELED
+};
+
+enum AdbStepState
+{
+	AS_PENDING,
+	AS_RUNNING,
+	AS_DONE,
+	AS_FAILED,
+	AS_SKIPPED,
+	AS_CANCELED
+};
+
+struct AdbStep
+{
+	QString name;
+	QStringList args;
+	QList<int> dependsOn;
+	int timeoutMs;
+
+	// Its failure doesn't stop the steps that depend on it (unless the
+	// device itself is the problem)
+	bool optional;
+
+	AdbStepState state;
+	AdbError error;
+	int exitCode;
+	QString output;
+	QString errorOutput;
+	qint64 elapsedMs;
+
+	QProcess* process;
+	QTimer* timer;
+	QElapsedTimer clock;
+};
+
+// Runs a job of adb calls without blocking: each step starts as soon as the
+// steps it depends on are done (independent ones run side by side), has a
+// timeout, and its output is parsed for the usual adb and shell errors. A
+// step can be skipped from a stepFinished() handler, before it starts.
+class AdbJobRunner : public QObject
+{
+	Q_OBJECT;
+
+public:
+	// ctor
+	AdbJobRunner(QObject* parent = 0);
+
+	// dtor
+	~AdbJobRunner();
+
+	void setProgram(const QString& program);
+	const QString& program() const;
+
+	// Returns the id of the step, or -1 if it's running or a dependency isn't
+	// an earlier step
+	int addStep(const QString& name, const QStringList& args, const QList<int>& dependsOn = QList<int>(),
+		int timeoutMs = ADB_STEP_TIMEOUT_MS, bool optional = false);
+
+	// Returns false if there's no step, or if it's already running
+	bool start();
+
+	// Kills the running steps, and emits finished(false) if it was running
+	void cancel();
+
+	// Forgets the steps of the last job
+	void clear();
+
+	// A pending step won't run, and counts as done for the steps that depend on it
+	void skip(int id);
+
+	bool isRunning() const;
+	const AdbStep* step(int id) const;
+	int stepCount() const;
+	int stepCount(AdbStepState state) const;
+	qint64 elapsedMs() const;
+
+	// The step that stopped the job, -1 if none did
+	int failedStep() const;
+
+	// First error reported in the output of an adb call, ADB_OK if none
+	static AdbError parseError(const QString& output);
+	static QString errorString(AdbError error);
+
+signals:
+	void stepFinished(int id);
+	void output(const QString& line, bool error);
+	void finished(bool ok);
+
+protected slots:
+	void onProcessFinished(int exitCode, QProcess::ExitStatus status);
+	void onProcessError(QProcess::ProcessError error);
+	void onStepTimeout();
+
+protected:
+	void schedule();
+	void startStep(int id);
+	void endStep(int id, AdbError error);
+	void finish(bool ok);
+	bool isSatisfied(const AdbStep& step) const;
+	void emitOutput(const QString& text, bool error);
+
+protected:
+	QString mProgram;
+	QVector<AdbStep> mSteps;
+
+	// Step of each process and timeout timer
+	QHash<QObject*, int> mStepIndex;
+
+	bool mRunning;
+	int mFailedStep;
+	QElapsedTimer mClock;
+	qint64 mElapsedMs;
+};
+
+#endif
@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "CpuUsage.h"
+
+#include <QDateTime>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+//------------------------------------------
+qint64 processCpuTimeNs()
+{
+#if defined(_WIN32) || defined(_WIN64)
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+	return (qint64) (k.QuadPart + u.QuadPart) * 100;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return ((qint64) usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL
+		+ ((qint64) usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+#endif
+}
+//------------------------------------------
+CpuUsageMeter::CpuUsageMeter() :
+	mCpuStart(0),
+	mWallStart(-1)
+{
+}
+//------------------------------------------
+void CpuUsageMeter::start()
+{
+	mCpuStart = processCpuTimeNs();
+	mWallStart = QDateTime::currentMSecsSinceEpoch();
+}
+//------------------------------------------
+bool CpuUsageMeter::isStarted() const
+{
+	return mWallStart >= 0;
+}
+//------------------------------------------
+qint64 CpuUsageMeter::elapsedMs() const
+{
+	return QDateTime::currentMSecsSinceEpoch() - mWallStart;
+}
+//------------------------------------------
+double CpuUsageMeter::utilization() const
+{
+	qint64 wallMs = qMax((qint64) 1, elapsedMs());
+	return (processCpuTimeNs() - mCpuStart) / 1000000.0 / wallMs;
+}
+//------------------------------------------
@@ -0,0 +1,47 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _CPUUSAGE_H_
+#define _CPUUSAGE_H_
+
+#include <QtGlobal>
+
+// User + system CPU time consumed by the whole process, in nanoseconds
+qint64 processCpuTimeNs();
+
+// Measures the CPU used by the process over a period of time
+class CpuUsageMeter
+{
+public:
+	// ctor
+	CpuUsageMeter();
+
+	void start();
+	bool isStarted() const;
+
+	qint64 elapsedMs() const;
+
+	// CPU time over wall time since start(), 1.0 being one core busy
+	double utilization() const;
+
+protected:
+	qint64 mCpuStart;
+	qint64 mWallStart;
+};
+
+#endif
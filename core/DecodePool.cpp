@@ -0,0 +1,227 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "DecodePool.h"
+
+#include <algorithm>
+
+// Index of the pool worker running on this thread, -1 outside of the pool
+static thread_local int sWorkerIndex = -1;
+static thread_local DecodePool* sWorkerPool = nullptr;
+
+//------------------------------------------
+DecodePool::DecodePool(int threadCount) :
+	mPending(0),
+	mNextWorker(0),
+	mStolen(0),
+	mRunning(true)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	for (int i = 0; i < threadCount; ++i)
+		mWorkers.push_back(std::unique_ptr<Worker>(new Worker));
+
+	// Workers are started once all the queues exist, as they steal from each other
+	for (int i = 0; i < threadCount; ++i)
+		mWorkers[i]->thread = std::thread(&DecodePool::workerLoop, this, i);
+}
+//------------------------------------------
+DecodePool::~DecodePool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mRunning = false;
+	}
+	mWakeUp.notify_all();
+
+	for (auto it = mWorkers.begin(); it != mWorkers.end(); ++it)
+		(*it)->thread.join();
+}
+//------------------------------------------
+DecodePool& DecodePool::global()
+{
+	static DecodePool pool;
+	return pool;
+}
+//------------------------------------------
+int DecodePool::threadCount() const
+{
+	return (int) mWorkers.size();
+}
+//------------------------------------------
+unsigned long long DecodePool::stolenJobs() const
+{
+	return mStolen;
+}
+//------------------------------------------
+void DecodePool::submit(const DecodeJob& job, bool urgent)
+{
+	int index;
+	if (sWorkerPool == this)
+		index = sWorkerIndex;
+	else
+		index = mNextWorker++ % mWorkers.size();
+
+	{
+		std::lock_guard<std::mutex> lock(mWorkers[index]->mutex);
+		if (urgent)
+			mWorkers[index]->jobs.push_front(job);
+		else
+			mWorkers[index]->jobs.push_back(job);
+	}
+
+	// Taking the lock makes sure a worker about to sleep sees the new job
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mPending++;
+	}
+	mWakeUp.notify_one();
+}
+//------------------------------------------
+bool DecodePool::popJob(int index, DecodeJob& job)
+{
+	// Oldest job of our own queue first, to keep the latency of each session bounded
+	{
+		Worker* own = mWorkers[index].get();
+		std::lock_guard<std::mutex> lock(own->mutex);
+		if (!own->jobs.empty())
+		{
+			job = std::move(own->jobs.front());
+			own->jobs.pop_front();
+			return true;
+		}
+	}
+
+	// Then steal from the back of the others' queues
+	const int count = (int) mWorkers.size();
+	for (int i = 1; i < count; ++i)
+	{
+		Worker* victim = mWorkers[(index + i) % count].get();
+		std::lock_guard<std::mutex> lock(victim->mutex);
+		if (!victim->jobs.empty())
+		{
+			job = std::move(victim->jobs.back());
+			victim->jobs.pop_back();
+			mStolen++;
+			return true;
+		}
+	}
+
+	return false;
+}
+//------------------------------------------
+void DecodePool::workerLoop(int index)
+{
+	sWorkerIndex = index;
+	sWorkerPool = this;
+
+	while (true)
+	{
+		DecodeJob job;
+		if (popJob(index, job))
+		{
+			mPending--;
+			job();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mWakeUp.wait(lock, [this] { return mPending > 0 || !mRunning; });
+
+		if (!mRunning && mPending <= 0)
+			break;
+	}
+}
+//------------------------------------------
+DecodeStrand::DecodeStrand(DecodePool& pool) :
+	mState(new State)
+{
+	mState->pool = &pool;
+	mState->scheduled = false;
+	mState->urgent = false;
+}
+//------------------------------------------
+DecodeStrand::~DecodeStrand()
+{
+	wait();
+}
+//------------------------------------------
+void DecodeStrand::post(const DecodeJob& job)
+{
+	bool schedule = false;
+	{
+		std::lock_guard<std::mutex> lock(mState->mutex);
+		mState->jobs.push_back(job);
+
+		if (!mState->scheduled)
+		{
+			mState->scheduled = true;
+			schedule = true;
+		}
+	}
+
+	if (schedule)
+	{
+		std::shared_ptr<State> state = mState;
+		mState->pool->submit([state] { runNext(state); }, mState->urgent);
+	}
+}
+//------------------------------------------
+void DecodeStrand::runNext(const std::shared_ptr<State>& state)
+{
+	DecodeJob job;
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		job = std::move(state->jobs.front());
+	}
+
+	job();
+
+	// One job per turn, so that a busy session doesn't starve the others
+	bool more;
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->jobs.pop_front();
+		more = !state->jobs.empty();
+		state->scheduled = more;
+	}
+
+	if (more)
+		state->pool->submit([state] { runNext(state); }, state->urgent);
+	else
+		state->idle.notify_all();
+}
+//------------------------------------------
+void DecodeStrand::setUrgent(bool urgent)
+{
+	mState->urgent = urgent;
+}
+//------------------------------------------
+int DecodeStrand::pending() const
+{
+	std::lock_guard<std::mutex> lock(mState->mutex);
+	return (int) mState->jobs.size();
+}
+//------------------------------------------
+void DecodeStrand::wait()
+{
+	std::unique_lock<std::mutex> lock(mState->mutex);
+	mState->idle.wait(lock, [this] { return mState->jobs.empty(); });
+}
+//------------------------------------------
@@ -0,0 +1,118 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _DECODEPOOL_H_
+#define _DECODEPOOL_H_
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+typedef std::function<void()> DecodeJob;
+
+// Work-stealing pool running the decode jobs of every session. Each worker
+// has its own queue; jobs submitted from a worker stay on that worker, the
+// others are spread round-robin, and idle workers steal from the busy ones.
+class DecodePool
+{
+public:
+	// ctor. 0 threads means one per core.
+	DecodePool(int threadCount = 0);
+
+	// dtor. Runs the jobs still queued, then joins the workers.
+	~DecodePool();
+
+	// Pool shared by all the sessions of the process
+	static DecodePool& global();
+
+	int threadCount() const;
+
+	// Urgent jobs go ahead of the queue they're put in, and are the last
+	// ones to be stolen
+	void submit(const DecodeJob& job, bool urgent = false);
+
+	// Number of jobs run by another worker than the one they were queued on
+	unsigned long long stolenJobs() const;
+
+protected:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<DecodeJob> jobs;
+		std::thread thread;
+	};
+
+	void workerLoop(int index);
+	bool popJob(int index, DecodeJob& job);
+
+protected:
+	std::vector<std::unique_ptr<Worker>> mWorkers;
+
+	std::mutex mSleepMutex;
+	std::condition_variable mWakeUp;
+	std::atomic<int> mPending;
+	std::atomic<unsigned int> mNextWorker;
+	std::atomic<unsigned long long> mStolen;
+	bool mRunning;
+};
+
+// Runs jobs one after the other, in order, on a DecodePool. A session uses
+// one strand per decoder, as a decoder can't be fed from two threads.
+class DecodeStrand
+{
+public:
+	// ctor
+	DecodeStrand(DecodePool& pool);
+
+	// dtor. Waits for the queued jobs.
+	~DecodeStrand();
+
+	void post(const DecodeJob& job);
+
+	// Runs the jobs of this strand ahead of the non-urgent ones
+	void setUrgent(bool urgent);
+
+	// Number of jobs queued or running
+	int pending() const;
+
+	// Blocks until every job posted so far has run
+	void wait();
+
+protected:
+	struct State
+	{
+		DecodePool* pool;
+		std::mutex mutex;
+		std::condition_variable idle;
+		std::deque<DecodeJob> jobs;
+		bool scheduled;
+		std::atomic<bool> urgent;
+	};
+
+	static void runNext(const std::shared_ptr<State>& state);
+
+protected:
+	std::shared_ptr<State> mState;
+};
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "DeviceRegistry.h"
+
+#include <QTimerEvent>
+#include <QDebug>
+
+//------------------------------------------
+DeviceRegistry::DeviceRegistry(QObject* parent) :
+	QObject(parent),
+	mTick(0)
+{
+	// A device announced in a slot expires when the wheel comes back to it,
+	// between DEVICE_TIMEOUT_MS and one tick later
+	mWheel.resize(DEVICE_TIMEOUT_MS / DEVICE_EXPIRY_TICK_MS + 1);
+	startTimer(DEVICE_EXPIRY_TICK_MS);
+}
+//------------------------------------------
+DeviceRegistry::~DeviceRegistry()
+{
+	clear();
+}
+//------------------------------------------
+QString DeviceRegistry::key(const QString& name, const QString& address)
+{
+	return address + '/' + name;
+}
+//------------------------------------------
+bool DeviceRegistry::processAnnouncement(const QByteArray& datagram, const QHostAddress& sender)
+{
+	if (datagram.size() < 2)
+		return false;
+
+	const int protocol = (unsigned char) datagram.at(0);
+	const int nameSize = (unsigned char) datagram.at(1);
+	if (datagram.size() < 2 + nameSize)
+		return false;
+
+	const QString name = QString::fromUtf8(datagram.constData() + 2, nameSize);
+	const int capabilities = (datagram.size() > 2 + nameSize) ? (unsigned char) datagram.at(2 + nameSize) : 0;
+
+	// IPv4 addresses, as typed in the connect box
+	bool isIpv4 = false;
+	const quint32 ipv4 = sender.toIPv4Address(&isIpv4);
+	announce(name, isIpv4 ? QHostAddress(ipv4).toString() : sender.toString(), protocol, capabilities);
+	return true;
+}
+//------------------------------------------
+void DeviceRegistry::announce(const QString& name, const QString& address, int protocol, int capabilities)
+{
+	const QString deviceKey = key(name, address);
+	const int bucket = mTick % mWheel.size();
+
+	QHash<QString, Device*>::iterator it = mDevices.find(deviceKey);
+	if (it != mDevices.end())
+	{
+		Device* device = it.value();
+		device->protocol = protocol;
+		device->capabilities = capabilities;
+
+		// Moves to the current slot
+		if (device->bucket != bucket)
+		{
+			if (device->bucket >= 0)
+				mWheel[device->bucket].remove(device);
+			mWheel[bucket].insert(device);
+			device->bucket = bucket;
+		}
+		return;
+	}
+
+	// Its announcements give the real name of a device found by a scan
+	const QString scannedKey = key(SCANNED_DEVICE_NAME, address);
+	Device* scanned = mDevices.take(scannedKey);
+	if (scanned)
+	{
+		delete scanned;
+		emit deviceRemoved(scannedKey);
+	}
+
+	// XXX: Protocol v3 indicates that audio can't be streamed, and v4
+	// indicates that we can stream audio. However, the user can choose
+	// to turn off audio even on v4. Maybe in the future we could indicate
+	// that.
+	Device* device = new Device;
+	device->name = name;
+	device->address = address;
+	device->protocol = protocol;
+	device->capabilities = capabilities;
+	device->bucket = bucket;
+
+	mDevices.insert(deviceKey, device);
+	mWheel[bucket].insert(device);
+	emit deviceAdded(deviceKey);
+}
+//------------------------------------------
+void DeviceRegistry::addScanned(const QString& address)
+{
+	if (findByAddress(address))
+		return;
+
+	Device* device = new Device;
+	device->name = SCANNED_DEVICE_NAME;
+	device->address = address;
+	device->protocol = 0;
+	device->capabilities = 0;
+	device->bucket = -1;
+
+	const QString deviceKey = key(device->name, address);
+	mDevices.insert(deviceKey, device);
+	emit deviceAdded(deviceKey);
+}
+//------------------------------------------
+const Device* DeviceRegistry::find(const QString& deviceKey) const
+{
+	return mDevices.value(deviceKey, nullptr);
+}
+//------------------------------------------
+const Device* DeviceRegistry::find(const QString& name, const QString& address) const
+{
+	return find(key(name, address));
+}
+//------------------------------------------
+const Device* DeviceRegistry::findByAddress(const QString& address) const
+{
+	for (QHash<QString, Device*>::const_iterator it = mDevices.constBegin(); it != mDevices.constEnd(); ++it)
+	{
+		if (it.value()->address == address)
+			return it.value();
+	}
+
+	return nullptr;
+}
+//------------------------------------------
+QList<const Device*> DeviceRegistry::devices() const
+{
+	QList<const Device*> devices;
+	for (QHash<QString, Device*>::const_iterator it = mDevices.constBegin(); it != mDevices.constEnd(); ++it)
+		devices.push_back(it.value());
+
+	return devices;
+}
+//------------------------------------------
+int DeviceRegistry::count() const
+{
+	return mDevices.size();
+}
+//------------------------------------------
+void DeviceRegistry::clear()
+{
+	qDeleteAll(mDevices);
+	mDevices.clear();
+
+	for (int i = 0; i < mWheel.size(); i++)
+		mWheel[i].clear();
+}
+//------------------------------------------
+void DeviceRegistry::timerEvent(QTimerEvent* evt)
+{
+	Q_UNUSED(evt);
+
+	// The slot coming back holds the devices that weren't announced for a
+	// whole turn: all of them go, and it's reused for the new tick
+	mTick++;
+	QSet<Device*>& expired = mWheel[mTick % mWheel.size()];
+	if (expired.isEmpty())
+		return;
+
+	QSet<Device*> devices;
+	devices.swap(expired);
+
+	for (QSet<Device*>::iterator it = devices.begin(); it != devices.end(); ++it)
+	{
+		const QString deviceKey = key((*it)->name, (*it)->address);
+		mDevices.remove(deviceKey);
+		delete *it;
+		emit deviceRemoved(deviceKey);
+	}
+}
+//------------------------------------------
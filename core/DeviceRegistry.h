@@ -0,0 +1,114 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _DEVICEREGISTRY_H_
+#define _DEVICEREGISTRY_H_
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QList>
+#include <QtNetwork/QHostAddress>
+
+// Devices that stopped announcing themselves for this long are forgotten
+#define DEVICE_TIMEOUT_MS 3000
+
+// Granularity of the expiry
+#define DEVICE_EXPIRY_TICK_MS 500
+
+// Name of the devices found by a scan, which never announced themselves
+#define SCANNED_DEVICE_NAME "Scanned"
+
+struct Device
+{
+	QString name;
+	QString address;
+	int protocol;
+
+	// INPUT_CAP_* bits from the announcements
+	int capabilities;
+
+	// Slot of the expiry wheel of the last announcement, -1 if it was
+	// found by a scan and doesn't expire
+	int bucket;
+};
+
+// Devices discovered through their UDP announcements, keyed by name and
+// address. Each announcement is a hash lookup, and the devices expire by
+// slots of a timer wheel: every tick drops all the devices of the slot that
+// wasn't announced again, without looking at the others.
+class DeviceRegistry : public QObject
+{
+	Q_OBJECT;
+
+public:
+	// ctor
+	DeviceRegistry(QObject* parent = 0);
+
+	// dtor
+	~DeviceRegistry();
+
+	// Parses an announcement datagram:
+	// 0 : Protocol version
+	// 1 : Device name size
+	// 2+: Device name
+	// Then, optionally: INPUT_CAP_* bits (1 byte)
+	// Returns false if it's malformed.
+	bool processAnnouncement(const QByteArray& datagram, const QHostAddress& sender);
+
+	// Adds the device, or renews it
+	void announce(const QString& name, const QString& address, int protocol, int capabilities);
+
+	// Adds a device found by a scan, unless it's already known. It doesn't
+	// expire, and is replaced if it announces itself later.
+	void addScanned(const QString& address);
+
+	// nullptr if unknown
+	const Device* find(const QString& key) const;
+	const Device* find(const QString& name, const QString& address) const;
+
+	// First device at this address (a relay shares the address of its host)
+	const Device* findByAddress(const QString& address) const;
+
+	QList<const Device*> devices() const;
+	int count() const;
+
+	// Forgets every device, without signals
+	void clear();
+
+	// Key of a device, for the signals and the views
+	static QString key(const QString& name, const QString& address);
+
+signals:
+	void deviceAdded(const QString& key);
+	void deviceRemoved(const QString& key);
+
+protected:
+	void timerEvent(QTimerEvent* evt);
+
+protected:
+	QHash<QString, Device*> mDevices;
+
+	// Devices by slot of their last announcement, the current one is mTick % size
+	QVector<QSet<Device*> > mWheel;
+	int mTick;
+};
+
+#endif
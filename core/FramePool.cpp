@@ -0,0 +1,123 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "FramePool.h"
+
+struct FramePoolData
+{
+	std::mutex mutex;
+	QVector<uchar*> freeBuffers;
+	int bufferSize;
+	int maxFree;
+	int allocations;
+};
+
+struct FramePoolHandle
+{
+	std::shared_ptr<FramePoolData> pool;
+	uchar* buffer;
+	int size;
+};
+
+//------------------------------------------
+static void releaseBuffer(void* info)
+{
+	FramePoolHandle* handle = (FramePoolHandle*) info;
+
+	{
+		std::lock_guard<std::mutex> lock(handle->pool->mutex);
+		FramePoolData* pool = handle->pool.get();
+
+		// Buffers of an older geometry, or beyond what we keep around, go away
+		if (handle->size == pool->bufferSize && pool->freeBuffers.size() < pool->maxFree)
+		{
+			pool->freeBuffers.push_back(handle->buffer);
+			handle->buffer = nullptr;
+		}
+	}
+
+	delete[] handle->buffer;
+	delete handle;
+}
+//------------------------------------------
+FramePool::FramePool(int maxFree) :
+	mData(new FramePoolData)
+{
+	mData->bufferSize = 0;
+	mData->maxFree = maxFree;
+	mData->allocations = 0;
+}
+//------------------------------------------
+FramePool::~FramePool()
+{
+	std::lock_guard<std::mutex> lock(mData->mutex);
+
+	// Images still alive keep the pool data alive through their handle, but
+	// their buffers won't be recycled anymore.
+	for (auto it = mData->freeBuffers.begin(); it != mData->freeBuffers.end(); ++it)
+		delete[] *it;
+	mData->freeBuffers.clear();
+	mData->maxFree = 0;
+}
+//------------------------------------------
+QImage FramePool::acquire(int width, int height, QImage::Format format)
+{
+	const int depth = (format == QImage::Format_RGB888) ? 24 : 32;
+	const int bytesPerLine = ((width * depth / 8) + 31) & ~31;
+	const int size = bytesPerLine * height;
+
+	uchar* buffer = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mData->mutex);
+
+		if (size != mData->bufferSize)
+		{
+			for (auto it = mData->freeBuffers.begin(); it != mData->freeBuffers.end(); ++it)
+				delete[] *it;
+			mData->freeBuffers.clear();
+			mData->bufferSize = size;
+		}
+
+		if (!mData->freeBuffers.isEmpty())
+		{
+			buffer = mData->freeBuffers.back();
+			mData->freeBuffers.pop_back();
+		}
+		else
+		{
+			mData->allocations++;
+		}
+	}
+
+	if (!buffer)
+		buffer = new uchar[size];
+
+	FramePoolHandle* handle = new FramePoolHandle;
+	handle->pool = mData;
+	handle->buffer = buffer;
+	handle->size = size;
+
+	return QImage(buffer, width, height, bytesPerLine, format, releaseBuffer, handle);
+}
+//------------------------------------------
+int FramePool::allocations() const
+{
+	std::lock_guard<std::mutex> lock(mData->mutex);
+	return mData->allocations;
+}
+//------------------------------------------
@@ -0,0 +1,53 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _FRAMEPOOL_H_
+#define _FRAMEPOOL_H_
+
+#include <QImage>
+#include <QVector>
+
+#include <memory>
+#include <mutex>
+
+struct FramePoolData;
+
+// Recycles the pixel buffers of decoded frames. The QImages handed out by
+// acquire() give their buffer back to the pool when the last copy of them
+// is destroyed, wherever that happens (display, recorder, other thread).
+class FramePool
+{
+public:
+	// ctor
+	FramePool(int maxFree = 4);
+
+	// dtor
+	~FramePool();
+
+	// Returns an image of the given geometry, reusing a free buffer if any.
+	// Rows are 32 bytes aligned. Only 24 and 32 bits formats are supported.
+	QImage acquire(int width, int height, QImage::Format format);
+
+	// Number of buffers allocated since the pool was created
+	int allocations() const;
+
+protected:
+	std::shared_ptr<FramePoolData> mData;
+};
+
+#endif
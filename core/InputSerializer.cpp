@@ -0,0 +1,157 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "InputSerializer.h"
+
+//------------------------------------------
+QByteArray InputSerializer::keyboard(bool down, unsigned int keyCode)
+{
+	QByteArray packet;
+	packet.reserve(INPUT_KEYBOARD_SIZE);
+	appendKeyboard(packet, down, keyCode);
+	return packet;
+}
+//------------------------------------------
+QByteArray InputSerializer::touch(TouchEventType type, unsigned char finger, unsigned short x, unsigned short y)
+{
+	QByteArray packet;
+	packet.reserve(INPUT_TOUCH_SIZE);
+	appendTouch(packet, type, finger, x, y);
+	return packet;
+}
+//------------------------------------------
+void InputSerializer::appendKeyboard(QByteArray& out, bool down, unsigned int keyCode)
+{
+	out.append((char)IET_KEYBOARD);
+	out.append(down ? '\x01' : '\x00');
+	appendNumber(out, keyCode, 4);
+}
+//------------------------------------------
+void InputSerializer::appendTouch(QByteArray& out, TouchEventType type, unsigned char finger, unsigned short x, unsigned short y)
+{
+	out.append((char)IET_TOUCH);
+	out.append((char)type);
+	out.append(finger);
+	appendNumber(out, x, 2);
+	appendNumber(out, y, 2);
+}
+//------------------------------------------
+int InputSerializer::packetSize(const char* data, int available)
+{
+	if (available < 1)
+		return 1;
+
+	switch ((quint8) data[0])
+	{
+	case IET_KEYBOARD:
+		return INPUT_KEYBOARD_SIZE;
+	case IET_TOUCH:
+		return INPUT_TOUCH_SIZE;
+	case IET_TOUCH_BATCH:
+		if (available < INPUT_TOUCH_BATCH_HEADER_SIZE)
+			return INPUT_TOUCH_BATCH_HEADER_SIZE;
+		return qMax(INPUT_TOUCH_BATCH_HEADER_SIZE, ((quint8) data[1] << 8) | (quint8) data[2]);
+	default:
+		return 0;
+	}
+}
+//------------------------------------------
+QByteArray InputSerializer::numberToBytes(unsigned int value, int size)
+{
+	QByteArray output;
+	appendNumber(output, value, size);
+	return output;
+}
+//------------------------------------------
+void InputSerializer::appendNumber(QByteArray& out, unsigned int value, int size)
+{
+	for (int i = 0; i < size; i++)
+	{
+		// value >> 2-1-0
+		out.push_back((value >> ((size - 1 - i) * 8)) & 0xFF);
+	}
+}
+//------------------------------------------
+TouchBatch::TouchBatch() :
+	mCount(0),
+	mLastX(0),
+	mLastY(0)
+{
+	mSamples.reserve(INPUT_TOUCH_BATCH_MAX_SIZE - INPUT_TOUCH_BATCH_HEADER_SIZE);
+}
+//------------------------------------------
+void TouchBatch::add(TouchEventType type, unsigned char finger, unsigned short x, unsigned short y, qint64 dtMs)
+{
+	const int dx = (int) x - mLastX;
+	const int dy = (int) y - mLastY;
+	const bool absolute = mCount == 0 || dx < -128 || dx > 127 || dy < -128 || dy > 127;
+
+	mSamples.append((char) ((type & 0x03) | ((finger & 0x1F) << 2) | (absolute ? 0x80 : 0)));
+	mSamples.append((char) qBound<qint64>(0, dtMs, 255));
+
+	if (absolute)
+	{
+		InputSerializer::appendNumber(mSamples, x, 2);
+		InputSerializer::appendNumber(mSamples, y, 2);
+	}
+	else
+	{
+		mSamples.append((char) (qint8) dx);
+		mSamples.append((char) (qint8) dy);
+	}
+
+	mLastX = x;
+	mLastY = y;
+	mCount++;
+}
+//------------------------------------------
+int TouchBatch::count() const
+{
+	return mCount;
+}
+//------------------------------------------
+bool TouchBatch::isEmpty() const
+{
+	return mCount == 0;
+}
+//------------------------------------------
+bool TouchBatch::isFull() const
+{
+	return mCount >= INPUT_TOUCH_BATCH_MAX_SAMPLES;
+}
+//------------------------------------------
+void TouchBatch::take(QByteArray& out)
+{
+	if (mCount == 0)
+		return;
+
+	out.append((char)IET_TOUCH_BATCH);
+	InputSerializer::appendNumber(out, INPUT_TOUCH_BATCH_HEADER_SIZE + mSamples.size(), 2);
+	out.append((char) mCount);
+	out.append(mSamples);
+
+	clear();
+}
+//------------------------------------------
+void TouchBatch::clear()
+{
+	// Keeps the reserved capacity
+	mSamples.resize(0);
+	mCount = 0;
+}
+//------------------------------------------
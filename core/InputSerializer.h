@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _INPUTSERIALIZER_H_
+#define _INPUTSERIALIZER_H_
+
+#include <QByteArray>
+
+#define INPUT_PROTOCOL_VERSION 1
+
+#define INPUT_KEYBOARD_SIZE 6
+#define INPUT_TOUCH_SIZE 7
+#define INPUT_TOUCH_BATCH_HEADER_SIZE 4
+#define INPUT_TOUCH_BATCH_MAX_SAMPLES 255
+#define INPUT_TOUCH_BATCH_MAX_SIZE (INPUT_TOUCH_BATCH_HEADER_SIZE + INPUT_TOUCH_BATCH_MAX_SAMPLES * 6)
+
+// Fingers tracked at once (the batches have room for 32)
+#define MAX_TOUCH_POINTERS 10
+
+// Capability bits of a device, in the byte following its name in the
+// discovery announcements (devices that don't send it have none)
+#define INPUT_CAP_TOUCH_BATCH 0x01
+
+enum TouchEventType {
+	TET_UP,
+	TET_DOWN,
+	TET_MOVE
+};
+
+// State of one finger in an input frame
+struct TouchPointer
+{
+	TouchEventType type;
+	unsigned char finger;
+	unsigned short x;
+	unsigned short y;
+};
+
+enum InputEventType {
+	IET_KEYBOARD,
+	IET_TOUCH,
+	IET_TOUCH_BATCH
+};
+
+// Builds the input packets sent back to the device, all integers big endian:
+// - Keyboard: [IET_KEYBOARD:1][down:1][keyCode:4]
+// - Touch:    [IET_TOUCH:1][TouchEventType:1][finger:1][x:2][y:2]
+// - Touch batch (INPUT_CAP_TOUCH_BATCH devices only):
+//             [IET_TOUCH_BATCH:1][size:2][count:1] then count samples of
+//             [flags:1][dt:1][x:2][y:2] when absolute, else [flags:1][dt:1][dx:1][dy:1]
+//   flags hold the TouchEventType in bits 0-1, the finger in bits 2-6 and
+//   bit 7 when absolute. dt is the ms since the previous sample (capped to
+//   255), dx/dy are signed and relative to the previous sample of the batch.
+class InputSerializer
+{
+public:
+	static QByteArray keyboard(bool down, unsigned int keyCode);
+	static QByteArray touch(TouchEventType type, unsigned char finger, unsigned short x, unsigned short y);
+
+	// Same, appended to an existing (e.g. preallocated) buffer
+	static void appendKeyboard(QByteArray& out, bool down, unsigned int keyCode);
+	static void appendTouch(QByteArray& out, TouchEventType type, unsigned char finger, unsigned short x, unsigned short y);
+
+	// Full size of the packet starting at data. Batches need their header
+	// for that: with less available, the header size is returned. 0 if the
+	// type is unknown.
+	static int packetSize(const char* data, int available);
+
+	static QByteArray numberToBytes(unsigned int value, int size);
+	static void appendNumber(QByteArray& out, unsigned int value, int size);
+};
+
+// Touch samples being gathered into an IET_TOUCH_BATCH packet
+class TouchBatch
+{
+public:
+	// ctor
+	TouchBatch();
+
+	// dtMs is the time since the previous sample, whichever batch it was in
+	void add(TouchEventType type, unsigned char finger, unsigned short x, unsigned short y, qint64 dtMs);
+
+	int count() const;
+	bool isEmpty() const;
+	bool isFull() const;
+
+	// Appends the packet to out and starts a new batch
+	void take(QByteArray& out);
+	void clear();
+
+protected:
+	QByteArray mSamples;
+	int mCount;
+	int mLastX;
+	int mLastY;
+};
+
+#endif
@@ -0,0 +1,173 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "InputWriter.h"
+#include "InputSerializer.h"
+#include "SocketIo.h"
+
+#include <QDebug>
+
+// How long a send waits for room in a full socket before checking again
+// whether the socket is being detached
+#define INPUT_SEND_POLL_MS 10
+
+//------------------------------------------
+InputWriter::InputWriter() :
+	mRunning(true),
+	mSocket(-1),
+	mDetaching(false),
+	mLatencyCount(0),
+	mLatencySumNs(0),
+	mLatencyMaxNs(0)
+{
+	mPending.reserve(INPUT_WRITER_BUFFER_SIZE);
+	mPendingTimes.reserve(INPUT_WRITER_BUFFER_SIZE / INPUT_KEYBOARD_SIZE);
+	mClock.start();
+
+	mWriterThread = std::thread(&InputWriter::writerThread, this);
+}
+//------------------------------------------
+InputWriter::~InputWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mRunning = false;
+	}
+
+	mDetaching = true;
+	mCondition.notify_one();
+	if (mWriterThread.joinable())
+	{
+		mWriterThread.join();
+	}
+}
+//------------------------------------------
+void InputWriter::setSocket(qintptr descriptor)
+{
+	mDetaching = true;
+	std::lock_guard<std::mutex> socketLock(mSocketMutex);
+	mDetaching = false;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mSocket = descriptor;
+
+	// Whatever was meant for the previous connection is stale
+	mPending.resize(0);
+	mPendingTimes.resize(0);
+}
+//------------------------------------------
+bool InputWriter::write(const char* data, int size)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mSocket == -1 || mPending.size() + size > INPUT_WRITER_BUFFER_SIZE)
+			return false;
+
+		mPending.append(data, size);
+		mPendingTimes.push_back(mClock.nsecsElapsed());
+	}
+
+	mCondition.notify_one();
+	return true;
+}
+//------------------------------------------
+bool InputWriter::write(const QByteArray& packet)
+{
+	return write(packet.constData(), packet.size());
+}
+//------------------------------------------
+void InputWriter::takeLatency(int& packets, double& averageMs, double& maxMs)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	packets = mLatencyCount;
+	averageMs = mLatencyCount ? mLatencySumNs / 1000000.0 / mLatencyCount : 0.0;
+	maxMs = mLatencyMaxNs / 1000000.0;
+
+	mLatencyCount = 0;
+	mLatencySumNs = 0;
+	mLatencyMaxNs = 0;
+}
+//------------------------------------------
+void InputWriter::writerThread()
+{
+	QByteArray chunk;
+	chunk.reserve(INPUT_WRITER_BUFFER_SIZE);
+	QVector<qint64> times;
+	times.reserve(mPendingTimes.capacity());
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this] { return !mRunning || !mPending.isEmpty(); });
+			if (!mRunning)
+				return;
+		}
+
+		// The socket can't change while we're sending, nor the packets
+		// queued for it between the swap and the send
+		std::lock_guard<std::mutex> socketLock(mSocketMutex);
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			chunk.swap(mPending);
+			times.swap(mPendingTimes);
+		}
+
+		if (mSocket != -1 && !chunk.isEmpty() && sendAll(mSocket, chunk.constData(), chunk.size()))
+		{
+			const qint64 now = mClock.nsecsElapsed();
+
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (auto it = times.constBegin(); it != times.constEnd(); ++it)
+			{
+				mLatencySumNs += now - *it;
+				mLatencyMaxNs = qMax(mLatencyMaxNs, now - *it);
+			}
+			mLatencyCount += times.size();
+		}
+
+		// Keeps the capacity for the next swap
+		chunk.resize(0);
+		times.resize(0);
+	}
+}
+//------------------------------------------
+bool InputWriter::sendAll(qintptr descriptor, const char* data, int size)
+{
+	int offset = 0;
+	while (offset < size)
+	{
+		qint64 sent = sendRaw(descriptor, data + offset, size - offset);
+		if (sent < 0)
+		{
+			qDebug() << "Cannot send input to the device";
+			return false;
+		}
+
+		offset += (int) sent;
+		if (sent == 0)
+		{
+			if (mDetaching)
+				return false;
+			waitWritable(descriptor, INPUT_SEND_POLL_MS);
+		}
+	}
+
+	return true;
+}
+//------------------------------------------
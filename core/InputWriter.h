@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _INPUTWRITER_H_
+#define _INPUTWRITER_H_
+
+#include <QByteArray>
+#include <QVector>
+#include <QElapsedTimer>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Room for input packets waiting for the writer thread, allocated once
+#define INPUT_WRITER_BUFFER_SIZE (16 * 1024)
+
+// Sends the input packets to the device from its own thread, straight to
+// the socket descriptor, so they never wait behind the GUI event loop or
+// Nagle's algorithm. The socket stays owned (connected, read and closed)
+// by its QTcpSocket; only input is ever written to it.
+class InputWriter
+{
+public:
+	// ctor
+	InputWriter();
+
+	// dtor
+	~InputWriter();
+
+	// Socket the packets go to, -1 when disconnected: pending packets are
+	// dropped. Once it returns, the previous descriptor isn't used anymore.
+	void setSocket(qintptr descriptor);
+
+	// Queues a packet, timestamped for the latency stats. Returns false if
+	// there's no socket or the buffer is full.
+	bool write(const char* data, int size);
+	bool write(const QByteArray& packet);
+
+	// Time from write() to the packet being handed to the kernel, over the
+	// packets sent since the previous call
+	void takeLatency(int& packets, double& averageMs, double& maxMs);
+
+protected:
+	void writerThread();
+	bool sendAll(qintptr descriptor, const char* data, int size);
+
+protected:
+	std::thread mWriterThread;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mRunning;
+
+	// Held while sending, so setSocket can wait for the descriptor to be released
+	std::mutex mSocketMutex;
+	qintptr mSocket;
+
+	// Set while setSocket waits, makes a send stuck on a full socket give up
+	std::atomic<bool> mDetaching;
+
+	// Packets waiting, and when each of them was queued
+	QByteArray mPending;
+	QVector<qint64> mPendingTimes;
+	QElapsedTimer mClock;
+
+	// Latency since the last takeLatency()
+	int mLatencyCount;
+	qint64 mLatencySumNs;
+	qint64 mLatencyMaxNs;
+};
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "LatencyProbe.h"
+#include "StreamSession.h"
+
+#include <QDebug>
+
+//------------------------------------------
+LatencyProbe::Settings::Settings() :
+	trials(50),
+	intervalMs(500),
+	timeoutMs(2000),
+	region(0, 0, 64, 64),
+	threshold(DEFAULT_REGION_THRESHOLD),
+	touch(32, 32),
+	useKey(false),
+	keyCode(0)
+{
+}
+//------------------------------------------
+LatencyProbe::LatencyProbe(StreamSession* session, QObject* parent) :
+	QObject(parent),
+	mSession(session),
+	mRunning(false),
+	mWaiting(false),
+	mTrial(0),
+	mInjectedAt(0),
+	mMissed(0)
+{
+	mNextTimer.setSingleShot(true);
+	mTimeoutTimer.setSingleShot(true);
+	connect(&mNextTimer, SIGNAL(timeout()), this, SLOT(nextTrial()));
+	connect(&mTimeoutTimer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+	connect(mSession, SIGNAL(frameReady()), this, SLOT(onFrameReady()));
+}
+//------------------------------------------
+LatencyProbe::~LatencyProbe()
+{
+	stop();
+}
+//------------------------------------------
+void LatencyProbe::start(const Settings& settings)
+{
+	stop();
+
+	mSettings = settings;
+	mDecodeLatencies.clear();
+	mPresentLatencies.clear();
+	mMissed = 0;
+	mTrial = 0;
+	mRunning = true;
+
+	mSession->videoDecoder().regionWatch().setRegion(mSettings.region, mSettings.threshold);
+
+	// Gives the watch a picture to compare the first response with
+	mNextTimer.start(mSettings.intervalMs);
+}
+//------------------------------------------
+void LatencyProbe::stop()
+{
+	if (!mRunning)
+		return;
+
+	mRunning = false;
+	mWaiting = false;
+	mNextTimer.stop();
+	mTimeoutTimer.stop();
+	mSession->videoDecoder().regionWatch().setRegion(QRect());
+}
+//------------------------------------------
+bool LatencyProbe::isRunning() const
+{
+	return mRunning;
+}
+//------------------------------------------
+const QVector<qint64>& LatencyProbe::decodeLatencies() const
+{
+	return mDecodeLatencies;
+}
+//------------------------------------------
+const QVector<qint64>& LatencyProbe::presentLatencies() const
+{
+	return mPresentLatencies;
+}
+//------------------------------------------
+int LatencyProbe::missedTrials() const
+{
+	return mMissed;
+}
+//------------------------------------------
+void LatencyProbe::nextTrial()
+{
+	if (!mRunning)
+		return;
+
+	if (mTrial >= mSettings.trials)
+	{
+		stop();
+		emit finished();
+		return;
+	}
+
+	// Armed right before the input, the clock starts when it's queued
+	mSession->videoDecoder().regionWatch().arm();
+	mInjectedAt = RegionWatch::now();
+	mWaiting = true;
+
+	if (mSettings.useKey)
+	{
+		mSession->sendKeyboardInput(true, mSettings.keyCode);
+		mSession->sendKeyboardInput(false, mSettings.keyCode);
+	}
+	else
+	{
+		mSession->sendTouchInput(TET_DOWN, 0, mSettings.touch.x(), mSettings.touch.y());
+		mSession->sendTouchInput(TET_UP, 0, mSettings.touch.x(), mSettings.touch.y());
+	}
+
+	mTimeoutTimer.start(mSettings.timeoutMs);
+}
+//------------------------------------------
+void LatencyProbe::onFrameReady()
+{
+	if (!mWaiting)
+		return;
+
+	const qint64 changedAt = mSession->videoDecoder().regionWatch().changedAt();
+	if (changedAt < 0)
+		return;
+
+	const qint64 presented = RegionWatch::now() - mInjectedAt;
+	mDecodeLatencies.push_back(changedAt - mInjectedAt);
+	mPresentLatencies.push_back(presented);
+
+	emit trialFinished(mTrial, presented / 1000000.0);
+	endTrial();
+}
+//------------------------------------------
+void LatencyProbe::onTimeout()
+{
+	if (!mWaiting)
+		return;
+
+	qDebug() << "No response to latency trial " << mTrial;
+	mMissed++;
+	endTrial();
+}
+//------------------------------------------
+void LatencyProbe::endTrial()
+{
+	mWaiting = false;
+	mTimeoutTimer.stop();
+	mTrial++;
+
+	// Lets the response settle, it's the reference of the next trial
+	mNextTimer.start(mSettings.intervalMs);
+}
+//------------------------------------------
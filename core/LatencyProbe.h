@@ -0,0 +1,108 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _LATENCYPROBE_H_
+#define _LATENCYPROBE_H_
+
+#include <QObject>
+#include <QTimer>
+#include <QRect>
+#include <QPoint>
+#include <QVector>
+
+#include "RegionWatch.h"
+
+class StreamSession;
+
+// Glass to glass latency: injects a touch (or a key) through the session's
+// input path, and times how long it takes for a region of the decoded
+// pictures to respond. bbqserver toggles a marker square in the corner of
+// its synthetic stream on each press; on a device, pick a region that
+// changes when pressed (e.g. a button).
+class LatencyProbe : public QObject
+{
+	Q_OBJECT;
+
+public:
+	struct Settings
+	{
+		int trials;
+		int intervalMs;
+		int timeoutMs;
+
+		// Region watched, in picture pixels, and its threshold
+		QRect region;
+		int threshold;
+
+		// Stimulus: a tap at a point, or a key press when useKey is set
+		QPoint touch;
+		bool useKey;
+		unsigned int keyCode;
+
+		// ctor
+		Settings();
+	};
+
+	// ctor
+	LatencyProbe(StreamSession* session, QObject* parent = 0);
+
+	// dtor
+	~LatencyProbe();
+
+	// The session must be connected and showing frames
+	void start(const Settings& settings);
+	void stop();
+	bool isRunning() const;
+
+	// Input to decoded picture, and to the frame handed to the display, in
+	// nanoseconds, one sample per trial that got a response
+	const QVector<qint64>& decodeLatencies() const;
+	const QVector<qint64>& presentLatencies() const;
+
+	// Trials without a response before the timeout
+	int missedTrials() const;
+
+signals:
+	void trialFinished(int trial, double presentMs);
+	void finished();
+
+protected slots:
+	void nextTrial();
+	void onFrameReady();
+	void onTimeout();
+
+protected:
+	void endTrial();
+
+protected:
+	StreamSession* mSession;
+	Settings mSettings;
+	bool mRunning;
+	bool mWaiting;
+	int mTrial;
+	qint64 mInjectedAt;
+
+	QTimer mNextTimer;
+	QTimer mTimeoutTimer;
+
+	QVector<qint64> mDecodeLatencies;
+	QVector<qint64> mPresentLatencies;
+	int mMissed;
+};
+
+#endif
@@ -0,0 +1,675 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "QStreamDecoder.h"
+
+#include <QtMultimedia/QAudioFormat>
+#include <QtMultimedia/QAudioOutput>
+#include <QtMultimedia/QAudioDeviceInfo>
+#include <QDebug>
+#include <QElapsedTimer>
+
+#define AUDIO_BUFFERING 8
+#define MAX_AUDIO_DATA_PENDING 50000
+#define AVCODEC_MAX_AUDIO_FRAME_SIZE 192000 // it disappeared from avcodec.h
+
+QMutex QStreamDecoder::mInitMutex;
+
+// Audio output device, probed by initialize() and opened by openAudioOutput()
+enum AudioDeviceState {
+	AD_NONE,
+	AD_SUPPORTED,
+	AD_UNSUPPORTED,
+	AD_OPEN,
+	AD_FAILED
+};
+
+static void avlog_cb(void *, int level, const char * szFmt, va_list varg) {
+	/*
+	if (szFmt != NULL) {
+		qDebug(szFmt, varg);
+	}
+	*/
+}
+
+//------------------------------------------
+QStreamDecoder::QStreamDecoder(bool isAudio, bool playback) :
+	mAudioPlaybackRunning(false),
+	mIsAudio(isAudio),
+	mPlayback(playback),
+	mCodec(nullptr),
+	mCodecCtx(nullptr),
+	mPicture(nullptr),
+	mAudioOutput(nullptr),
+	mAudioDevice(AD_NONE),
+	mPrepareStarted(false),
+	mInitMs(-1),
+	mBuffered(0),
+	mPriority(SP_FOCUSED),
+	mAppliedPriority(SP_FOCUSED),
+	mFramesSinceConversion(0),
+	mConvertCtx(nullptr),
+	mChangeDetection(true),
+	mBandConvertCtx(nullptr),
+	mLastBandConvertCtx(nullptr),
+	mUnchangedFrames(0),
+	mPartialFrames(0),
+	mFastConversion(true),
+	mConversionNs(0)
+{
+
+}
+//------------------------------------------
+QStreamDecoder::~QStreamDecoder()
+{
+	if (mPrepareThread.joinable())
+	{
+		mPrepareThread.join();
+	}
+
+	mAudioPlaybackRunning = false;
+	if (mAudioPlaybackThread.joinable())
+	{
+		mAudioPlaybackThread.join();
+	}
+}
+//------------------------------------------
+void QStreamDecoder::decodeFrame(unsigned char* bytes, int size, bool lastRendered)
+{
+	mInput = bytes;
+	mInputSize = size;
+	mLastRendered = lastRendered;
+}
+//------------------------------------------
+void QStreamDecoder::setPriority(SessionPriority priority)
+{
+	mPriority = priority;
+}
+//------------------------------------------
+SessionPriority QStreamDecoder::priority() const
+{
+	return (SessionPriority) mPriority.load();
+}
+//------------------------------------------
+void QStreamDecoder::prepare()
+{
+	if (mPrepareStarted.exchange(true))
+		return;
+
+	mPrepareThread = std::thread(&QStreamDecoder::prepareThread, this);
+}
+//------------------------------------------
+void QStreamDecoder::prepareThread()
+{
+	{
+		QMutexLocker lock(&mDecodeMutex);
+		if (mCodecCtx == nullptr)
+			initialize();
+	}
+
+	// Queued: the output belongs to the thread of the decoder
+	if (mIsAudio)
+		QMetaObject::invokeMethod(this, "openAudioOutput", Qt::QueuedConnection);
+}
+//------------------------------------------
+int QStreamDecoder::initMs() const
+{
+	return mInitMs;
+}
+//------------------------------------------
+void QStreamDecoder::flush()
+{
+	QMutexLocker lock(&mDecodeMutex);
+	if (mCodecCtx == nullptr)
+		return;
+
+	ffmpeg::avcodec_flush_buffers(mCodecCtx);
+
+	// The first picture of the new stream is shown whatever the rate
+	mFramesSinceConversion = 2;
+}
+//------------------------------------------
+void QStreamDecoder::applyPriority()
+{
+	SessionPriority priority = (SessionPriority) mPriority.load();
+	if (priority == mAppliedPriority)
+		return;
+
+	// Non-reference frames can always be skipped safely, and so can their
+	// deblocking. Reference frames are always deblocked: the error would
+	// spread to every later frame, and still show once the tile is focused
+	// again, until the next keyframe.
+	mCodecCtx->skip_frame = (priority == SP_HIDDEN) ? ffmpeg::AVDISCARD_NONREF : ffmpeg::AVDISCARD_DEFAULT;
+	mCodecCtx->skip_loop_filter = (priority == SP_THUMBNAIL) ? ffmpeg::AVDISCARD_NONREF : ffmpeg::AVDISCARD_DEFAULT;
+
+	// Convert the first frame after a change, whatever the new rate
+	mFramesSinceConversion = 2;
+	mAppliedPriority = priority;
+}
+//------------------------------------------
+void QStreamDecoder::initialize()
+{
+	// avcodec_open2 isn't thread safe, the other decoder may be preparing too
+	QMutexLocker lock(&mInitMutex);
+	QElapsedTimer timer;
+	timer.start();
+
+	/* register all the codecs */
+	ffmpeg::avcodec_register_all();
+	ffmpeg::av_register_all();
+
+	ffmpeg::av_init_packet(&mPacket);
+
+	// Allocate decoder
+	mCodec = ffmpeg::avcodec_find_decoder(mIsAudio ? ffmpeg::CODEC_ID_AAC :
+		ffmpeg::CODEC_ID_H264);
+	if (!mCodec)
+	{
+		qDebug() << "Couldn't find " << (mIsAudio ? "H264" : "AAC LATM") << " decoder!";
+		return;
+	}
+
+	mCodecCtx = ffmpeg::avcodec_alloc_context3(mCodec);
+
+	if (mIsAudio)
+	{
+		mAudioFrame = ffmpeg::av_frame_alloc();
+	}
+	else
+	{
+		mPicture = ffmpeg::av_frame_alloc();
+	}
+
+	if (mCodec->capabilities & CODEC_CAP_TRUNCATED)
+		mCodecCtx->flags |= CODEC_FLAG_TRUNCATED;
+
+	// open codec
+	if (ffmpeg::avcodec_open2(mCodecCtx, mCodec, NULL))
+	{
+		qDebug() << "Could not open codec!";
+		return;
+	}
+
+	mInitMs = timer.elapsed();
+
+	if (mIsAudio)
+	{
+		// For audio and audio only, we directly play the decoded stream as we
+		// don't need to do anything else with it.
+		ffmpeg::av_log_set_callback(avlog_cb);
+
+		// AVCodec however decodes audio as float, which we can't use directly
+		// (at least on my hardware).
+		mResampleCtx = ffmpeg::swr_alloc();
+		ffmpeg::av_opt_set_int(mResampleCtx, "in_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+		ffmpeg::av_opt_set_int(mResampleCtx, "out_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+		ffmpeg::av_opt_set_int(mResampleCtx, "in_sample_rate", 48000, 0);
+		ffmpeg::av_opt_set_int(mResampleCtx, "out_sample_rate", 48000, 0);
+		ffmpeg::av_opt_set_sample_fmt(mResampleCtx, "in_sample_fmt", ffmpeg::AV_SAMPLE_FMT_FLTP, 0);
+		ffmpeg::av_opt_set_sample_fmt(mResampleCtx, "out_sample_fmt", ffmpeg::AV_SAMPLE_FMT_S16, 0);
+		if (swr_init(mResampleCtx) < 0) {
+			qDebug() << "SWR_INIT ERROR";
+		}
+
+		int dst_linesize;
+		int dst_nb_samples = 4096;
+		ffmpeg::av_samples_alloc(&mResampleBuffer,
+			&dst_linesize,
+			2,
+			dst_nb_samples,
+			ffmpeg::AV_SAMPLE_FMT_S16,
+			0);
+
+		if (!mPlayback)
+		{
+			mInitMs = timer.elapsed();
+			return;
+		}
+
+		// Probe the output audio device, it's opened by openAudioOutput
+		mAudioFormat.setSampleRate(48000);
+		mAudioFormat.setChannelCount(2);
+		mAudioFormat.setSampleSize(16);
+		mAudioFormat.setSampleType(QAudioFormat::SignedInt);
+		mAudioFormat.setByteOrder(QAudioFormat::LittleEndian);
+		mAudioFormat.setCodec("audio/pcm");
+
+		QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
+		mAudioDevice = info.isFormatSupported(mAudioFormat) ? AD_SUPPORTED : AD_UNSUPPORTED;
+		mInitMs = timer.elapsed();
+	}
+}
+//------------------------------------------
+void QStreamDecoder::openAudioOutput()
+{
+	int state = AD_UNSUPPORTED;
+	if (mAudioDevice.compare_exchange_strong(state, AD_FAILED))
+	{
+		emit audioError("Raw audio format not supported by backend, cannot play audio.");
+		return;
+	}
+
+	state = AD_SUPPORTED;
+	if (!mAudioDevice.compare_exchange_strong(state, AD_OPEN))
+		return;
+
+	mAudioOutput = new QAudioOutput(mAudioFormat);
+	mAudioIO = mAudioOutput->start();
+	mAudioOutput->setVolume(1.0);
+
+	mAudioPlaybackRunning = true;
+	mAudioPlaybackThread = std::thread(&QStreamDecoder::playbackAudioThread, this);
+}
+//------------------------------------------
+void QStreamDecoder::process()
+{
+	bool result = false;
+
+	// Waits for prepare() if it's still setting the codec up
+	mDecodeMutex.lock();
+	if (mCodecCtx == nullptr)
+		initialize();
+
+	// Not prepared ahead (e.g. a replay): the device is opened now
+	if (mIsAudio && mAudioOutput == nullptr && QThread::currentThread() == thread())
+		openAudioOutput();
+
+	if (mIsAudio)
+	{
+		result = decodeAudioFrame(mInput, mInputSize);
+	}
+	else
+	{
+		result = decodeVideoFrame(mInput, mInputSize);
+	}
+
+	mDecodeMutex.unlock();
+
+	delete[] mInput;
+	mInput = NULL;
+
+	emit decodeFinished(result, mIsAudio);
+}
+//------------------------------------------
+void QStreamDecoder::playbackAudioThread()
+{
+	while (mAudioPlaybackRunning)
+	{
+		// Dequeue an audio frame
+		if (mAudioBufferSize.size() > 0 && mBuffered >= AUDIO_BUFFERING
+			&& mAudioOutput->bytesFree() > 0)
+		{
+			mAudioMutex.lock();
+
+			int bufferSize = mAudioBufferSize.front();
+
+			// If we're too slow/accumulating delay, drop audio frames
+			while (mAudioBuffer.size() > MAX_AUDIO_DATA_PENDING)
+			{
+				bufferSize = mAudioBufferSize.front();
+				mAudioBuffer.remove(0, bufferSize);
+				mAudioBufferSize.pop_front();
+			}
+
+			// Write to our audio channel
+			QByteArray frame = mAudioBuffer.left(bufferSize);
+			mAudioIO->write(frame);
+			mAudioBuffer.remove(0, bufferSize);
+
+			mAudioMutex.unlock();
+
+			mAudioBufferSize.pop_front();
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+//------------------------------------------
+bool QStreamDecoder::decodeAudioFrame(unsigned char* bytes, int size)
+{
+	if (size <= 0)
+		return false;
+
+	mPacket.size = size;
+	mPacket.data = bytes;
+
+	int len, out_size;
+	bool hasOutput = false;
+
+	while (mPacket.size > 0)
+	{
+		out_size = AVCODEC_MAX_AUDIO_FRAME_SIZE;
+		len = ffmpeg::avcodec_decode_audio4(mCodecCtx, mAudioFrame, &out_size, &mPacket);
+
+		if (len < 0)
+		{
+			qDebug() << "Error while decoding audio frame";
+			return false;
+		}
+
+		if (out_size > 0)
+		{
+			// Resample from FLOAT PLANAR to S16
+			int samples_output = ffmpeg::swr_convert(mResampleCtx, &mResampleBuffer, 4096, (const uint8_t**)mAudioFrame->extended_data, mAudioFrame->nb_samples);
+
+			if (samples_output > 0)
+			{
+				// A frame has been decoded. Queue it to our buffer, unless
+				// there's no device to play it on.
+				if (mAudioOutput)
+				{
+					mAudioMutex.lock();
+
+					if (mBuffered < AUDIO_BUFFERING) mBuffered++;
+
+					mAudioBuffer.append((const char*)mResampleBuffer, samples_output*4);
+					mAudioBufferSize.push_back(samples_output*4);
+
+					mAudioMutex.unlock();
+				}
+				hasOutput = true;
+			}
+		}
+		else
+		{
+			qDebug() << "Could not get audio data from this frame";
+		}
+
+		
+		mPacket.size -= len;
+		mPacket.data += len;
+	}
+
+	return hasOutput;
+}
+//------------------------------------------
+bool QStreamDecoder::decodeVideoFrame(unsigned char* bytes, int size)
+{
+	if (size <= 0)
+		return false;
+
+	mPacket.size = size;
+	mPacket.data = bytes;
+
+	applyPriority();
+
+	int len, got_picture;
+	bool hasPicture = false;
+	while (mPacket.size > 0)
+	{
+		len = ffmpeg::avcodec_decode_video2(mCodecCtx, mPicture, &got_picture, &mPacket);
+
+		if (len < 0)
+		{
+			qDebug() << "Error while decoding video frame";
+			return false;
+		}
+
+		if (got_picture)
+		{
+			int w = mCodecCtx->width;
+			int h = mCodecCtx->height;
+
+			/*if (w > 1920 || h > 1920)
+				qDebug() << "Unexpected size! " << w << " x " << h;*/
+
+			// Before any conversion, so it doesn't depend on the priority
+			mRegionWatch.update(mPicture->data[0], mPicture->linesize[0], w, h);
+
+			// Lower priorities convert less often, hidden sessions not at all
+			const int interval = (mAppliedPriority == SP_FOCUSED) ? 1 : 2;
+			if (mAppliedPriority != SP_HIDDEN)
+				mFramesSinceConversion++;
+			bool convert = mLastRendered && mAppliedPriority != SP_HIDDEN
+				&& mFramesSinceConversion >= interval;
+
+			if (convert)
+			{
+				// Thumbnails are scaled down during the conversion
+				int outW = w, outH = h;
+				if (mAppliedPriority == SP_THUMBNAIL)
+				{
+					outW = (w / 2) & ~1;
+					outH = (h / 2) & ~1;
+				}
+
+				// Only report the frames that changed what's displayed
+				if (convertPicture(w, h, outW, outH))
+				{
+					mFramesSinceConversion = 0;
+					hasPicture = true;
+				}
+			}
+		}
+		else if (mAppliedPriority != SP_HIDDEN)
+		{
+			qDebug() << "Could not get a full picture from this frame";
+		}
+
+		
+		mPacket.size -= len;
+		mPacket.data += len;
+	}
+
+	return hasPicture;
+}
+//------------------------------------------
+bool QStreamDecoder::convertPicture(int w, int h, int outW, int outH)
+{
+	QImage previous;
+	{
+		QMutexLocker lock(&mFrameMutex);
+		previous = mLastFrame;
+	}
+
+	// Keyframes are always converted whole: they bound how long a change the
+	// luma hash can't see (chroma only) stays on screen.
+	bool full = true;
+	int dirtyTiles = 0;
+	if (mChangeDetection)
+	{
+		dirtyTiles = mTileHash.update(mPicture->data[0], mPicture->linesize[0], w, h);
+		full = mPicture->key_frame || previous.width() != outW || previous.height() != outH
+			|| dirtyTiles == mTileHash.tileCount();
+
+		if (!full && dirtyTiles == 0)
+		{
+			mUnchangedFrames++;
+			return false;
+		}
+	}
+	else
+	{
+		mTileHash.reset();
+	}
+
+	// Bands (rows of tiles, or slices) can only be converted on their own
+	// without scaling, and from planar 4:2:0 where the chroma rows are easy to find
+	const ffmpeg::AVPixelFormat format = mCodecCtx->pix_fmt;
+	const bool banded = outW == w && outH == h
+		&& (format == ffmpeg::PIX_FMT_YUV420P || format == ffmpeg::PIX_FMT_YUVJ420P);
+	if (!banded)
+		full = true;
+
+	// The stream says which matrix and range it was encoded with, swscale
+	// gets the same so both paths show the same colors
+	mYuvConverter.setColorSpace(mCodecCtx->colorspace == ffmpeg::AVCOL_SPC_BT709 ? YUV_BT709 : YUV_BT601,
+		mCodecCtx->color_range == ffmpeg::AVCOL_RANGE_JPEG || format == ffmpeg::PIX_FMT_YUVJ420P);
+	const bool fast = banded && mFastConversion;
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// Convert to RGB, straight into a pooled QImage. The previous
+	// frame's buffer comes back to the pool once it's not displayed anymore.
+	QImage frame = mFramePool.acquire(outW, outH, QImage::Format_RGB32);
+	uint8_t* dstData[4] = { frame.bits(), NULL, NULL, NULL };
+	int dstLinesize[4] = { frame.bytesPerLine(), 0, 0, 0 };
+	QRegion dirty;
+
+	if (full && banded && mSliceConverter.bandCount(w, h) > 1)
+	{
+		// Large frames are converted in parallel slices
+		if (!mSliceConverter.convert(mPicture, format, w, h, frame.bits(), frame.bytesPerLine(),
+			mYuvConverter, !mFastConversion))
+		{
+			mTileHash.reset();
+			return false;
+		}
+
+		dirty = QRegion(0, 0, outW, outH);
+	}
+	else if (full && fast)
+	{
+		mYuvConverter.convert(mPicture, w, 0, h, frame.bits(), frame.bytesPerLine());
+		dirty = QRegion(0, 0, outW, outH);
+	}
+	else if (full)
+	{
+		mConvertCtx = ffmpeg::sws_getCachedContext(mConvertCtx, w, h, format, outW, outH, ffmpeg::PIX_FMT_RGB32,
+			(outW == w) ? SWS_BICUBIC : SWS_FAST_BILINEAR, NULL, NULL, NULL);
+
+		if (mConvertCtx == NULL)
+		{
+			qDebug() << "Cannot initialize the conversion context!";
+			mTileHash.reset();
+			return false;
+		}
+
+		mYuvConverter.configure(mConvertCtx);
+		ffmpeg::sws_scale(mConvertCtx, mPicture->data, mPicture->linesize, 0, h, dstData, dstLinesize);
+		dirty = QRegion(0, 0, outW, outH);
+	}
+	else
+	{
+		for (int row = 0; row < mTileHash.rows(); row++)
+		{
+			const int y = row * CHANGE_TILE_SIZE;
+			const int bandH = qMin(CHANGE_TILE_SIZE, h - y);
+
+			if (!mTileHash.isRowDirty(row))
+			{
+				// Same pixels as the frame on screen
+				for (int i = y; i < y + bandH; i++)
+					memcpy(frame.scanLine(i), previous.constScanLine(i), outW * 4);
+				continue;
+			}
+
+			if (fast)
+			{
+				mYuvConverter.convert(mPicture, w, y, bandH, frame.bits(), frame.bytesPerLine());
+			}
+			else
+			{
+				ffmpeg::SwsContext*& ctx = (bandH == CHANGE_TILE_SIZE) ? mBandConvertCtx : mLastBandConvertCtx;
+				ctx = ffmpeg::sws_getCachedContext(ctx, w, bandH, format, w, bandH, ffmpeg::PIX_FMT_RGB32,
+					SWS_BICUBIC, NULL, NULL, NULL);
+
+				if (ctx == NULL)
+				{
+					qDebug() << "Cannot initialize the band conversion context!";
+					mTileHash.reset();
+					return false;
+				}
+
+				mYuvConverter.configure(ctx);
+
+				const uint8_t* srcBand[4] = {
+					mPicture->data[0] + y * mPicture->linesize[0],
+					mPicture->data[1] + (y / 2) * mPicture->linesize[1],
+					mPicture->data[2] + (y / 2) * mPicture->linesize[2],
+					NULL };
+				uint8_t* dstBand[4] = { frame.scanLine(y), NULL, NULL, NULL };
+
+				ffmpeg::sws_scale(ctx, srcBand, mPicture->linesize, 0, bandH, dstBand, dstLinesize);
+			}
+
+			for (int column = 0; column < mTileHash.columns(); column++)
+			{
+				if (mTileHash.isTileDirty(column, row))
+					dirty += mTileHash.tileRect(column, row);
+			}
+		}
+
+		mPartialFrames++;
+	}
+
+	mConversionNs += timer.nsecsElapsed();
+
+	QMutexLocker lock(&mFrameMutex);
+	mLastFrame = frame;
+	mDirtyRegion += dirty;
+	return true;
+}
+//------------------------------------------
+QRegion QStreamDecoder::takeDirtyRegion()
+{
+	QMutexLocker lock(&mFrameMutex);
+	QRegion dirty = mDirtyRegion;
+	mDirtyRegion = QRegion();
+	return dirty;
+}
+//------------------------------------------
+void QStreamDecoder::setChangeDetection(bool enabled)
+{
+	mChangeDetection = enabled;
+}
+//------------------------------------------
+int QStreamDecoder::unchangedFrames() const
+{
+	return mUnchangedFrames;
+}
+//------------------------------------------
+int QStreamDecoder::partialFrames() const
+{
+	return mPartialFrames;
+}
+//------------------------------------------
+void QStreamDecoder::setConvertThreads(int threads)
+{
+	QMutexLocker lock(&mDecodeMutex);
+	mSliceConverter.setThreadCount(threads);
+}
+//------------------------------------------
+qint64 QStreamDecoder::conversionNs() const
+{
+	return mConversionNs;
+}
+//------------------------------------------
+void QStreamDecoder::setFastConversion(bool enabled)
+{
+	QMutexLocker lock(&mDecodeMutex);
+	mFastConversion = enabled;
+}
+//------------------------------------------
+RegionWatch& QStreamDecoder::regionWatch()
+{
+	return mRegionWatch;
+}
+//------------------------------------------
+YuvConverter::InstructionSet QStreamDecoder::instructionSet() const
+{
+	return mYuvConverter.instructionSet();
+}
+//------------------------------------------
+QImage QStreamDecoder::getLastFrame() const
+{
+	QMutexLocker lock(&mFrameMutex);
+	return mLastFrame;
+}
+//------------------------------------------
@@ -0,0 +1,197 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _QSTREAMDECODER_H_
+#define _QSTREAMDECODER_H_
+
+#include <QIODevice>
+#include <QFile>
+#include <QImage>
+#include <QtMultimedia/QAudioOutput>
+#include <QtMultimedia/QAudioFormat>
+#include <QIODevice>
+#include <QThread>
+#include <QMutex>
+#include <QRegion>
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include <QTFFmpegWrapper/ffmpeg.h>
+
+#include "FramePool.h"
+#include "TileHash.h"
+#include "SliceConverter.h"
+#include "YuvConverter.h"
+#include "RegionWatch.h"
+
+// How much of the CPU a session deserves, from what the operator sees of it
+enum SessionPriority {
+	SP_FOCUSED,		// Every frame decoded and converted
+	SP_VISIBLE,		// Every other frame converted
+	SP_THUMBNAIL,	// Non-reference frames not deblocked, every other frame converted at half size
+	SP_HIDDEN		// Reference frames only, nothing converted
+};
+
+class QStreamDecoder : public QObject
+{
+	Q_OBJECT;
+
+public:
+	// ctor. When playback is disabled, audio is decoded and resampled but
+	// never sent to an output device.
+	QStreamDecoder(bool isAudio, bool playback = true);
+
+	// dtor
+	~QStreamDecoder();
+
+	// Returns the last decoded frame as QImage
+	QImage getLastFrame() const;
+
+	// Area of the frame that changed since the last call, in frame pixels
+	QRegion takeDirtyRegion();
+
+	// Skips the conversion of the tiles that didn't change since the last
+	// converted frame (enabled by default)
+	void setChangeDetection(bool enabled);
+
+	// Frames not converted at all because nothing changed, and frames of
+	// which only the changed tiles were converted
+	int unchangedFrames() const;
+	int partialFrames() const;
+
+	// Bands the color conversion of large frames is split into (0 = from
+	// the core count, 1 = not split). Call before feeding frames.
+	void setConvertThreads(int threads);
+
+	// Time spent converting frames to RGB
+	qint64 conversionNs() const;
+
+	// Unscaled 4:2:0 frames go through the SIMD converter (default), else
+	// through swscale. Call before feeding frames.
+	void setFastConversion(bool enabled);
+	YuvConverter::InstructionSet instructionSet() const;
+
+	// Luma region watched for the latency measurements, see LatencyProbe
+	RegionWatch& regionWatch();
+
+	// Can be changed from any thread, applies from the next packet
+	void setPriority(SessionPriority priority);
+	SessionPriority priority() const;
+
+	// Sets the codec up (and probes the audio device) on a thread of its own,
+	// so it's done by the time the first packet comes; called on connection.
+	// Otherwise it's done by the first process(), which waits for it.
+	void prepare();
+
+	// Time the codec setup took, -1 until it's done
+	int initMs() const;
+
+	// Drops the reference frames and the samples buffered by the codec, for
+	// a new stream (e.g. after a reconnection) starting with a keyframe. The
+	// codec context, the frame pool and the last frame are kept.
+	void flush();
+
+public slots:
+	void decodeFrame(unsigned char* bytes, int size, bool lastRendered = true);
+	void process();
+
+signals:
+	void decodeFinished(bool result, bool isAudio);
+	void audioError(const QString& message);
+
+protected slots:
+	// Starts the audio output, on the thread the decoder belongs to
+	void openAudioOutput();
+
+protected:
+	void initialize();
+	void prepareThread();
+
+	void playbackAudioThread();
+
+	bool decodeVideoFrame(unsigned char* bytes, int size);
+	bool convertPicture(int width, int height, int outWidth, int outHeight);
+	void applyPriority();
+	bool decodeAudioFrame(unsigned char* bytes, int size);
+
+protected:
+	// avcodec_open2 isn't thread safe, decoding itself is per instance
+	static QMutex mInitMutex;
+	QMutex mDecodeMutex;
+	mutable QMutex mFrameMutex;
+
+	std::thread mAudioPlaybackThread;
+	std::mutex mAudioMutex;
+	bool mAudioPlaybackRunning;
+
+	unsigned char* mInput;
+	int mInputSize;
+	bool mLastRendered;
+
+	bool mIsAudio;
+	bool mPlayback;
+	ffmpeg::AVCodec* mCodec;
+	ffmpeg::AVCodecContext* mCodecCtx;
+	ffmpeg::SwrContext* mResampleCtx;
+	ffmpeg::AVPacket mPacket;
+	ffmpeg::AVFrame* mPicture;
+	ffmpeg::AVFrame* mAudioFrame;
+	uint8_t* mResampleBuffer;
+
+	QAudioOutput* mAudioOutput;
+	QIODevice* mAudioIO;
+	QAudioFormat mAudioFormat;
+	std::atomic<int> mAudioDevice;
+
+	// Codec setup ahead of the first packet
+	std::thread mPrepareThread;
+	std::atomic<bool> mPrepareStarted;
+	std::atomic<int> mInitMs;
+	QByteArray mAudioBuffer;
+	QList<int> mAudioBufferSize;
+	int mBuffered;
+
+	std::atomic<int> mPriority;
+	SessionPriority mAppliedPriority;
+	int mFramesSinceConversion;
+
+	FramePool mFramePool;
+	QImage mLastFrame;
+	QRegion mDirtyRegion;
+	ffmpeg::SwsContext* mConvertCtx;
+
+	// Change detection, and the contexts converting one row of tiles at a time
+	std::atomic<bool> mChangeDetection;
+	TileHash mTileHash;
+	ffmpeg::SwsContext* mBandConvertCtx;
+	ffmpeg::SwsContext* mLastBandConvertCtx;
+	std::atomic<int> mUnchangedFrames;
+	std::atomic<int> mPartialFrames;
+
+	SliceConverter mSliceConverter;
+	YuvConverter mYuvConverter;
+	bool mFastConversion;
+	RegionWatch mRegionWatch;
+	std::atomic<qint64> mConversionNs;
+};
+
+
+
+#endif
@@ -0,0 +1,190 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "QStreamFramer.h"
+
+#include <QDebug>
+
+// Consumed bytes are only removed from the front of the buffer once they
+// exceed this amount, to avoid moving the whole buffer after every record.
+#define COMPACT_THRESHOLD (256 * 1024)
+
+//------------------------------------------
+QStreamFramer::QStreamFramer() :
+	mOffset(0),
+	mReceiveTime(0)
+{
+	mClock.start();
+}
+//------------------------------------------
+void QStreamFramer::append(const QByteArray& bytes)
+{
+	if (mOffset > COMPACT_THRESHOLD && mOffset > mBuffer.size() / 2)
+	{
+		mBuffer.remove(0, mOffset);
+		mOffset = 0;
+	}
+
+	mBuffer.append(bytes);
+	mReceiveTime = mClock.nsecsElapsed();
+}
+//------------------------------------------
+bool QStreamFramer::next(StreamRecord& record)
+{
+	const int available = mBuffer.size() - mOffset;
+	if (available < 1)
+		return false;
+
+	const char* data = mBuffer.constData() + mOffset;
+	quint8 protVersion = bytesToUInt8(data);
+	int headerLength = headerSize(protVersion);
+
+	if (headerLength == 0)
+	{
+		// We can't find the next record boundary without a known header,
+		// so drop everything we have and hope the next read is aligned.
+		qWarning() << "WARN: Unknown protVersion " << protVersion;
+		reset();
+		return false;
+	}
+
+	if (available < headerLength)
+		return false;
+
+	quint32 frameSize = bytesToUInt32(data + 2);
+	quint32 audioFrameSize = 0;
+
+	if (protVersion == 4)
+		audioFrameSize = bytesToUInt32(data + 6);
+
+	if ((qint64) headerLength + frameSize + audioFrameSize > available)
+	{
+		// Will revisit later
+		return false;
+	}
+
+	record.protVersion = protVersion;
+	record.orientation = bytesToUInt8(data + 1);
+	record.timestamp = mReceiveTime;
+
+	int payloadOffset = mOffset + headerLength;
+	record.video = (frameSize > 0) ? mBuffer.mid(payloadOffset, frameSize) : QByteArray();
+	record.audio = (audioFrameSize > 0) ? mBuffer.mid(payloadOffset + frameSize, audioFrameSize) : QByteArray();
+
+	mOffset = payloadOffset + frameSize + audioFrameSize;
+
+	if (mOffset == mBuffer.size())
+	{
+		// Everything has been consumed, the buffer can be reused as is
+		mBuffer.resize(0);
+		mOffset = 0;
+	}
+
+	return true;
+}
+//------------------------------------------
+void QStreamFramer::reset()
+{
+	mBuffer.resize(0);
+	mOffset = 0;
+}
+//------------------------------------------
+int QStreamFramer::pendingBytes() const
+{
+	return mBuffer.size() - mOffset;
+}
+//------------------------------------------
+int QStreamFramer::headerSize(quint8 protVersion)
+{
+	if (protVersion == 3) // BBQScreen 2.1.2 - Legacy method, no audio
+		return 6;
+	else if (protVersion == 4) // BBQScreen 2.2.0 - With audio
+		return 10;
+	else
+		return 0;
+}
+//------------------------------------------
+bool QStreamFramer::isKeyFrame(const QByteArray& video)
+{
+	const unsigned char* data = (const unsigned char*) video.constData();
+	const int size = video.size();
+
+	// Look for Annex B start codes and check the NAL unit type that follows
+	for (int i = 0; i + 3 < size; i++)
+	{
+		if (data[i] == 0 && data[i+1] == 0 && data[i+2] == 1)
+		{
+			int nalType = data[i+3] & 0x1F;
+			if (nalType == 5 || nalType == 7)
+				return true;
+
+			i += 2;
+		}
+	}
+
+	return false;
+}
+//------------------------------------------
+bool QStreamFramer::startsWithSps(const QByteArray& video)
+{
+	const unsigned char* data = (const unsigned char*) video.constData();
+	const int size = video.size();
+
+	// 3 or 4 bytes start code, then the NAL header
+	int i = 0;
+	while (i < size && i < 3 && data[i] == 0)
+		i++;
+
+	return i >= 2 && i + 1 < size && data[i] == 1 && (data[i+1] & 0x1F) == 7;
+}
+//------------------------------------------
+QByteArray QStreamFramer::serializeHeader(const StreamRecord& record, quint8 protVersion)
+{
+	QByteArray header;
+	header.reserve(headerSize(4));
+	header.append((char) protVersion);
+	header.append((char) record.orientation);
+
+	quint32 sizes[2] = { (quint32) record.video.size(), (quint32) record.audio.size() };
+	const int count = (protVersion == 4) ? 2 : 1;
+	for (int s = 0; s < count; s++)
+	{
+		for (int i = 3; i >= 0; i--)
+			header.append((char) ((sizes[s] >> (8 * i)) & 0xFF));
+	}
+
+	return header;
+}
+//------------------------------------------
+quint8 QStreamFramer::bytesToUInt8(const char* bytes)
+{
+	return (unsigned char) bytes[0];
+}
+//------------------------------------------
+quint16 QStreamFramer::bytesToUInt16(const char* bytes)
+{
+	const unsigned char* b = (const unsigned char*) bytes;
+	return (quint16) ((b[0] << 8) | b[1]);
+}
+//------------------------------------------
+quint32 QStreamFramer::bytesToUInt32(const char* bytes)
+{
+	const unsigned char* b = (const unsigned char*) bytes;
+	return ((quint32) b[0] << 24) | ((quint32) b[1] << 16) | ((quint32) b[2] << 8) | (quint32) b[3];
+}
+//------------------------------------------
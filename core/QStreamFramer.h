@@ -0,0 +1,84 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _QSTREAMFRAMER_H_
+#define _QSTREAMFRAMER_H_
+
+#include <QByteArray>
+#include <QElapsedTimer>
+
+// One record of the device stream, as sent by the server:
+// - Protocol v3 (BBQScreen 2.1.2): [version:1][orientation:1][videoSize:4] video
+// - Protocol v4 (BBQScreen 2.2.0): [version:1][orientation:1][videoSize:4][audioSize:4] video audio
+// All the header integers are big endian.
+struct StreamRecord
+{
+	quint8 protVersion;
+	quint8 orientation;
+
+	// Monotonic receive time, in nanoseconds
+	qint64 timestamp;
+
+	QByteArray video;
+	QByteArray audio;
+};
+
+class QStreamFramer
+{
+public:
+	// ctor
+	QStreamFramer();
+
+	// Appends bytes received from the socket. Records completed by this
+	// chunk are stamped with the current time.
+	void append(const QByteArray& bytes);
+
+	// Pops the next complete record, returns false if there isn't any yet
+	bool next(StreamRecord& record);
+
+	// Drops any partially received record
+	void reset();
+
+	// Returns the number of buffered bytes not consumed yet
+	int pendingBytes() const;
+
+	// Returns the header size of the given protocol version, or 0 if unknown
+	static int headerSize(quint8 protVersion);
+
+	// Returns true if the H264 payload contains an IDR slice or an SPS
+	static bool isKeyFrame(const QByteArray& video);
+
+	// Returns true if the H264 payload starts with an SPS (codec config)
+	static bool startsWithSps(const QByteArray& video);
+
+	// Returns the wire header of a record for the given protocol version
+	// (v3 can't carry audio, its size is left out)
+	static QByteArray serializeHeader(const StreamRecord& record, quint8 protVersion);
+
+	static quint8 bytesToUInt8(const char* bytes);
+	static quint16 bytesToUInt16(const char* bytes);
+	static quint32 bytesToUInt32(const char* bytes);
+
+protected:
+	QByteArray mBuffer;
+	int mOffset;
+	qint64 mReceiveTime;
+	QElapsedTimer mClock;
+};
+
+#endif
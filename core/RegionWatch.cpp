@@ -0,0 +1,136 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "RegionWatch.h"
+
+#include <string.h>
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define REGIONWATCH_SSE2
+#endif
+
+//------------------------------------------
+RegionWatch::RegionWatch() :
+	mActive(false),
+	mThreshold(DEFAULT_REGION_THRESHOLD),
+	mArmed(false),
+	mChangedAt(-1)
+{
+}
+//------------------------------------------
+void RegionWatch::setRegion(const QRect& region, int threshold)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mRegion = region;
+	mThreshold = qMax(1, threshold);
+	mReferenceRect = QRect();
+	mArmed = false;
+	mChangedAt = -1;
+	mActive = !region.isEmpty();
+}
+//------------------------------------------
+QRect RegionWatch::region() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mRegion;
+}
+//------------------------------------------
+void RegionWatch::arm()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mArmed = true;
+	mChangedAt = -1;
+}
+//------------------------------------------
+qint64 RegionWatch::changedAt() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mChangedAt;
+}
+//------------------------------------------
+void RegionWatch::update(const uint8_t* plane, int linesize, int width, int height)
+{
+	if (!mActive)
+		return;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	const QRect rect = mRegion.intersected(QRect(0, 0, width, height));
+	if (rect.isEmpty())
+		return;
+
+	const uint8_t* origin = plane + rect.y() * linesize + rect.x();
+
+	// Compared with the picture before arming, not the previous one: a
+	// change spread over several pictures is still seen
+	if (mArmed && rect == mReferenceRect)
+	{
+		const uint64_t sad = sumOfDifferences(origin, linesize, &mReference[0], rect.width(),
+			rect.width(), rect.height());
+		if (sad >= (uint64_t) mThreshold * rect.width() * rect.height())
+		{
+			mChangedAt = now();
+			mArmed = false;
+		}
+		return;
+	}
+
+	mReference.resize(rect.width() * rect.height());
+	for (int y = 0; y < rect.height(); y++)
+		memcpy(&mReference[y * rect.width()], origin + y * linesize, rect.width());
+	mReferenceRect = rect;
+}
+//------------------------------------------
+qint64 RegionWatch::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+//------------------------------------------
+uint64_t RegionWatch::sumOfDifferences(const uint8_t* a, int strideA, const uint8_t* b, int strideB, int width, int height)
+{
+	uint64_t sum = 0;
+
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* rowA = a + y * strideA;
+		const uint8_t* rowB = b + y * strideB;
+		int x = 0;
+
+#ifdef REGIONWATCH_SSE2
+		// Two 64 bits partial sums per row, far from overflowing
+		__m128i rowSum = _mm_setzero_si128();
+		for (; x + 16 <= width; x += 16)
+		{
+			rowSum = _mm_add_epi64(rowSum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*) (rowA + x)),
+				_mm_loadu_si128((const __m128i*) (rowB + x))));
+		}
+
+		uint64_t partial[2];
+		_mm_storeu_si128((__m128i*) partial, rowSum);
+		sum += partial[0] + partial[1];
+#endif
+
+		for (; x < width; x++)
+			sum += (rowA[x] > rowB[x]) ? rowA[x] - rowB[x] : rowB[x] - rowA[x];
+	}
+
+	return sum;
+}
+//------------------------------------------
@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _REGIONWATCH_H_
+#define _REGIONWATCH_H_
+
+#include <QRect>
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+// Mean difference per luma pixel that counts as the region having changed
+#define DEFAULT_REGION_THRESHOLD 24
+
+// Watches a rectangle of the luma plane of the decoded pictures, for the
+// latency measurements: once armed, notes when the first picture whose
+// region differs from the last one seen before arming was decoded.
+// update() is called from the decoding thread, the rest from any thread.
+class RegionWatch
+{
+public:
+	// ctor
+	RegionWatch();
+
+	// Rectangle watched, in picture pixels. Empty stops watching.
+	void setRegion(const QRect& region, int threshold = DEFAULT_REGION_THRESHOLD);
+	QRect region() const;
+
+	// Starts looking for a change, and forgets the previous one
+	void arm();
+
+	// When the change was decoded (on the now() clock), -1 if not yet
+	qint64 changedAt() const;
+
+	// Called with each decoded picture
+	void update(const uint8_t* plane, int linesize, int width, int height);
+
+	// Monotonic clock, in nanoseconds
+	static qint64 now();
+
+	// Sum of absolute differences of two blocks of bytes, SSE2 when available
+	static uint64_t sumOfDifferences(const uint8_t* a, int strideA, const uint8_t* b, int strideB, int width, int height);
+
+protected:
+	mutable std::mutex mMutex;
+	std::atomic<bool> mActive;
+	QRect mRegion;
+	int mThreshold;
+
+	// Region of the last picture seen before arming
+	std::vector<uint8_t> mReference;
+	QRect mReferenceRect;
+	bool mArmed;
+	qint64 mChangedAt;
+};
+
+#endif
@@ -0,0 +1,214 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "ReplayRing.h"
+#include "StreamCapture.h"
+#include "StreamRecorder.h"
+
+#include <QDebug>
+
+#include <chrono>
+
+// The writers drop records past their queue limit, which a flush would reach
+// in no time: we wait for them to catch up above this
+#define FLUSH_MAX_PENDING (8 * 1024 * 1024)
+
+//------------------------------------------
+ReplayRing::ReplayRing(QObject* parent) :
+	QObject(parent),
+	mBytes(0),
+	mMaxBytes(0),
+	mMaxDurationNs(0),
+	mWaitingKeyFrame(true),
+	mFlushing(false)
+{
+}
+//------------------------------------------
+ReplayRing::~ReplayRing()
+{
+	if (mFlushThread.joinable())
+		mFlushThread.join();
+}
+//------------------------------------------
+void ReplayRing::setLimits(int seconds, qint64 maxBytes)
+{
+	mMaxDurationNs = (qint64) seconds * 1000000000LL;
+	mMaxBytes = maxBytes;
+
+	if (!isEnabled())
+		clear();
+	else
+		trim();
+}
+//------------------------------------------
+bool ReplayRing::isEnabled() const
+{
+	return mMaxDurationNs > 0 && mMaxBytes > 0;
+}
+//------------------------------------------
+void ReplayRing::clear()
+{
+	mGops.clear();
+	mBytes = 0;
+	mWaitingKeyFrame = true;
+}
+//------------------------------------------
+void ReplayRing::push(const StreamRecord& record)
+{
+	if (!isEnabled())
+		return;
+
+	if (QStreamFramer::startsWithSps(record.video))
+		mCodecConfig = record.video;
+
+	const bool keyFrame = QStreamFramer::isKeyFrame(record.video);
+	if (keyFrame)
+	{
+		mGops.push_back(Gop());
+		mGops.back().bytes = 0;
+		mWaitingKeyFrame = false;
+	}
+	else if (mWaitingKeyFrame)
+	{
+		// Nothing to attach this record to
+		return;
+	}
+
+	// The payloads are shared with the framer, only the record is added
+	const qint64 size = record.video.size() + record.audio.size();
+	mGops.back().records.push_back(record);
+	mGops.back().bytes += size;
+	mBytes += size;
+
+	trim();
+}
+//------------------------------------------
+void ReplayRing::trim()
+{
+	// Drop the oldest GOP while the next one alone still covers the duration
+	while (mGops.size() > 1)
+	{
+		const qint64 newest = mGops.back().records.last().timestamp;
+		const bool overBudget = mBytes > mMaxBytes;
+		const bool coveredWithout = newest - mGops[1].records.first().timestamp >= mMaxDurationNs;
+
+		if (!overBudget && !coveredWithout)
+			break;
+
+		mBytes -= mGops.front().bytes;
+		mGops.pop_front();
+	}
+
+	// A single GOP above the budget can't be kept whole: wait for the next one
+	if (mBytes > mMaxBytes)
+	{
+		qDebug() << "Replay ring: GOP larger than " << mMaxBytes << " bytes, dropped";
+		clear();
+	}
+}
+//------------------------------------------
+qint64 ReplayRing::bytes() const
+{
+	return mBytes;
+}
+//------------------------------------------
+qint64 ReplayRing::durationNs() const
+{
+	if (mGops.empty())
+		return 0;
+
+	return mGops.back().records.last().timestamp - mGops.front().records.first().timestamp;
+}
+//------------------------------------------
+int ReplayRing::gopCount() const
+{
+	return (int) mGops.size();
+}
+//------------------------------------------
+bool ReplayRing::isFlushing() const
+{
+	return mFlushing;
+}
+//------------------------------------------
+bool ReplayRing::flushTo(const QString& path)
+{
+	if (mFlushing || mGops.empty())
+		return false;
+
+	if (mFlushThread.joinable())
+		mFlushThread.join();
+
+	// Only the record list is copied, the payloads stay shared
+	QList<StreamRecord> records;
+	for (auto it = mGops.begin(); it != mGops.end(); ++it)
+		records.append(it->records);
+
+	mFlushing = true;
+	QByteArray codecConfig = mCodecConfig;
+	mFlushThread = std::thread([this, path, records, codecConfig] {
+		bool success = writeRecords(path, records, codecConfig);
+		mFlushing = false;
+		emit flushed(path, success);
+	});
+
+	return true;
+}
+//------------------------------------------
+bool ReplayRing::writeRecords(const QString& path, const QList<StreamRecord>& records, const QByteArray& codecConfig)
+{
+	if (path.endsWith(".bbqcap", Qt::CaseInsensitive))
+	{
+		StreamCaptureWriter writer;
+		if (!writer.open(path))
+			return false;
+
+		// Replays need the SPS/PPS before the first slice
+		if (!QStreamFramer::startsWithSps(records.first().video) && !codecConfig.isEmpty())
+		{
+			StreamRecord config = records.first();
+			config.video = codecConfig;
+			config.audio.clear();
+			writer.write(config);
+		}
+
+		for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+		{
+			while (writer.pendingBytes() > FLUSH_MAX_PENDING)
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			writer.write(*it);
+		}
+
+		writer.close();
+		return writer.droppedRecords() == 0;
+	}
+
+	StreamRecorder recorder;
+	if (!recorder.open(path, codecConfig))
+		return false;
+
+	for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+	{
+		while (recorder.pendingBytes() > FLUSH_MAX_PENDING)
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		recorder.write(*it);
+	}
+
+	recorder.close();
+	return recorder.droppedRecords() == 0;
+}
+//------------------------------------------
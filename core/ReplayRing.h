@@ -0,0 +1,93 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _REPLAYRING_H_
+#define _REPLAYRING_H_
+
+#include <QObject>
+#include <QList>
+
+#include <thread>
+#include <deque>
+#include <atomic>
+
+#include "QStreamFramer.h"
+
+#define DEFAULT_REPLAY_SECONDS 30
+#define DEFAULT_REPLAY_BYTES (48 * 1024 * 1024)
+
+// Keeps the last seconds of a session, compressed, so they can be saved after
+// the fact. Records are held by reference (no copy) and grouped by GOP, so
+// the oldest GOP can be dropped as a whole and what's left always starts on
+// a keyframe. Memory is bounded by the byte budget, whatever the session
+// length; a GOP larger than the whole budget is not kept at all.
+class ReplayRing : public QObject
+{
+	Q_OBJECT;
+
+public:
+	// ctor. Disabled until limits are set.
+	ReplayRing(QObject* parent = 0);
+
+	// dtor. Waits for a flush in progress.
+	~ReplayRing();
+
+	// Keeps at least the given duration, within the byte budget. 0 disables.
+	void setLimits(int seconds, qint64 maxBytes);
+	bool isEnabled() const;
+
+	void push(const StreamRecord& record);
+	void clear();
+
+	qint64 bytes() const;
+	qint64 durationNs() const;
+	int gopCount() const;
+
+	// Writes the current content to a .bbqcap file, or MP4/MKV for any other
+	// extension, on a background thread. Emits flushed() when done.
+	bool flushTo(const QString& path);
+	bool isFlushing() const;
+
+signals:
+	void flushed(const QString& path, bool success);
+
+protected:
+	struct Gop
+	{
+		QList<StreamRecord> records;
+		qint64 bytes;
+	};
+
+	void trim();
+	static bool writeRecords(const QString& path, const QList<StreamRecord>& records, const QByteArray& codecConfig);
+
+protected:
+	std::deque<Gop> mGops;
+	qint64 mBytes;
+	qint64 mMaxBytes;
+	qint64 mMaxDurationNs;
+	bool mWaitingKeyFrame;
+
+	// Last SPS/PPS seen, in case the device doesn't repeat them on keyframes
+	QByteArray mCodecConfig;
+
+	std::thread mFlushThread;
+	std::atomic<bool> mFlushing;
+};
+
+#endif
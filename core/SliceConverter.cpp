@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "SliceConverter.h"
+#include "DecodePool.h"
+#include "YuvConverter.h"
+
+#include <QDebug>
+
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+//------------------------------------------
+SliceConverter::SliceConverter(int threadCount) :
+	mThreadCount(0)
+{
+	setThreadCount(threadCount);
+}
+//------------------------------------------
+SliceConverter::~SliceConverter()
+{
+	for (auto it = mContexts.begin(); it != mContexts.end(); ++it)
+		ffmpeg::sws_freeContext(*it);
+}
+//------------------------------------------
+void SliceConverter::setThreadCount(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = std::min(4, (int) std::max(1u, std::thread::hardware_concurrency()));
+
+	mThreadCount = std::min(threadCount, MAX_CONVERT_THREADS);
+}
+//------------------------------------------
+int SliceConverter::threadCount() const
+{
+	return mThreadCount;
+}
+//------------------------------------------
+DecodePool& SliceConverter::pool()
+{
+	static DecodePool pool(std::min(MAX_CONVERT_THREADS, (int) std::max(1u, std::thread::hardware_concurrency())));
+	return pool;
+}
+//------------------------------------------
+int SliceConverter::bandCount(int width, int height) const
+{
+	if (width * height < MIN_SLICED_CONVERT_PIXELS)
+		return 1;
+
+	// Bands of whole macroblock rows
+	return std::max(1, std::min(mThreadCount, height / 16));
+}
+//------------------------------------------
+bool SliceConverter::convertBand(int band, ffmpeg::AVFrame* picture, ffmpeg::AVPixelFormat format, int width, int y, int bandH,
+	uint8_t* dst, int dstStride, const YuvConverter& yuv, bool swscale)
+{
+	if (!swscale)
+	{
+		yuv.convert(picture, width, y, bandH, dst, dstStride);
+		return true;
+	}
+
+	ffmpeg::SwsContext* ctx = ffmpeg::sws_getCachedContext(mContexts[band], width, bandH, format, width, bandH, ffmpeg::PIX_FMT_RGB32,
+		SWS_BICUBIC, NULL, NULL, NULL);
+	mContexts[band] = ctx;
+
+	if (ctx == NULL)
+		return false;
+
+	yuv.configure(ctx);
+
+	const uint8_t* src[4] = {
+		picture->data[0] + y * picture->linesize[0],
+		picture->data[1] + (y / 2) * picture->linesize[1],
+		picture->data[2] + (y / 2) * picture->linesize[2],
+		NULL };
+	uint8_t* dstBand[4] = { dst + y * dstStride, NULL, NULL, NULL };
+	int dstLinesize[4] = { dstStride, 0, 0, 0 };
+
+	ffmpeg::sws_scale(ctx, src, picture->linesize, 0, bandH, dstBand, dstLinesize);
+	return true;
+}
+//------------------------------------------
+bool SliceConverter::convert(ffmpeg::AVFrame* picture, ffmpeg::AVPixelFormat format, int width, int height,
+	uint8_t* dst, int dstStride, const YuvConverter& yuv, bool swscale)
+{
+	// Rounding the bands to whole macroblock rows can leave fewer of them
+	const int split = bandCount(width, height);
+	const int bandH = ((height + split - 1) / split + 15) & ~15;
+	const int bands = (height + bandH - 1) / bandH;
+
+	if ((int) mContexts.size() < bands)
+	{
+		mContexts.resize(bands, nullptr);
+	}
+
+	struct Completion
+	{
+		std::mutex mutex;
+		std::condition_variable done;
+		int remaining;
+		bool success;
+	} completion;
+	completion.remaining = bands - 1;
+	completion.success = true;
+
+	// Every band but the first goes to the pool
+	for (int band = 1; band < bands; band++)
+	{
+		const int y = band * bandH;
+		const int h = std::min(bandH, height - y);
+		pool().submit([this, band, picture, format, width, y, h, dst, dstStride, &yuv, swscale, &completion] {
+			bool result = convertBand(band, picture, format, width, y, h, dst, dstStride, yuv, swscale);
+
+			std::lock_guard<std::mutex> lock(completion.mutex);
+			completion.success = completion.success && result;
+			if (--completion.remaining == 0)
+				completion.done.notify_one();
+		});
+	}
+
+	bool success = convertBand(0, picture, format, width, 0, std::min(bandH, height), dst, dstStride, yuv, swscale);
+
+	// The frame is only handed over once all the bands are there
+	std::unique_lock<std::mutex> lock(completion.mutex);
+	completion.done.wait(lock, [&completion] { return completion.remaining == 0; });
+
+	if (!(success && completion.success))
+	{
+		qDebug() << "Cannot initialize the band conversion contexts!";
+		return false;
+	}
+
+	return true;
+}
+//------------------------------------------
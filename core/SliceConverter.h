@@ -0,0 +1,71 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _SLICECONVERTER_H_
+#define _SLICECONVERTER_H_
+
+#include <vector>
+
+#include <QTFFmpegWrapper/ffmpeg.h>
+
+class DecodePool;
+class YuvConverter;
+
+// Most bands a picture is split into
+#define MAX_CONVERT_THREADS 8
+
+// Below this many pixels, splitting the conversion costs more than it saves
+#define MIN_SLICED_CONVERT_PIXELS (1280 * 720)
+
+// Converts planar 4:2:0 pictures to RGB32 without scaling, in horizontal
+// bands run in parallel, with the YuvConverter kernels or swscale. With
+// swscale each band has its own SwsContext, as a context can't be used from
+// two threads. The calling thread converts the first band itself, convert()
+// returns once all of them are done.
+class SliceConverter
+{
+public:
+	// ctor. 0 threads picks from the core count.
+	SliceConverter(int threadCount = 0);
+
+	// dtor
+	~SliceConverter();
+
+	void setThreadCount(int threadCount);
+	int threadCount() const;
+
+	// Number of bands the given picture would be split into
+	int bandCount(int width, int height) const;
+
+	// Pool shared by the converters of every session
+	static DecodePool& pool();
+
+	// With swscale set, the bands go through swscale set up with the same
+	// matrix and range as yuv instead of its kernels
+	bool convert(ffmpeg::AVFrame* picture, ffmpeg::AVPixelFormat format, int width, int height,
+		uint8_t* dst, int dstStride, const YuvConverter& yuv, bool swscale);
+
+protected:
+	bool convertBand(int band, ffmpeg::AVFrame* picture, ffmpeg::AVPixelFormat format, int width, int y, int bandH,
+		uint8_t* dst, int dstStride, const YuvConverter& yuv, bool swscale);
+
+protected:
+	int mThreadCount;
+	std::vector<ffmpeg::SwsContext*> mContexts;
+};
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "SocketIo.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <winsock2.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <errno.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // Darwin, Qt already sets SO_NOSIGPIPE on its sockets
+#endif
+#endif
+
+//------------------------------------------
+qint64 sendRaw(qintptr fd, const char* data, qint64 size)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	int sent = ::send((SOCKET) fd, data, (int) size, 0);
+	if (sent == SOCKET_ERROR)
+		return (WSAGetLastError() == WSAEWOULDBLOCK) ? 0 : -1;
+	return sent;
+#else
+	ssize_t sent;
+	do
+	{
+		sent = ::send((int) fd, data, (size_t) size, MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+
+	if (sent < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+	return sent;
+#endif
+}
+//------------------------------------------
+void waitWritable(qintptr fd, int timeoutMs)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	fd_set writeSet;
+	FD_ZERO(&writeSet);
+	FD_SET((SOCKET) fd, &writeSet);
+	timeval timeout = { 0, timeoutMs * 1000 };
+	::select(0, NULL, &writeSet, NULL, &timeout);
+#else
+	pollfd pfd;
+	pfd.fd = (int) fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	::poll(&pfd, 1, timeoutMs);
+#endif
+}
+//------------------------------------------
@@ -0,0 +1,35 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _SOCKETIO_H_
+#define _SOCKETIO_H_
+
+#include <QtGlobal>
+
+// Non-blocking sends straight from our buffers to the kernel, on the native
+// descriptor of a socket (QAbstractSocket::socketDescriptor), bypassing the
+// QTcpSocket write buffer. Never raises SIGPIPE.
+
+// Returns the number of bytes sent, 0 if the socket is full, -1 if the peer
+// is gone
+qint64 sendRaw(qintptr fd, const char* data, qint64 size);
+
+// Waits until there's room to send, or the timeout
+void waitWritable(qintptr fd, int timeoutMs);
+
+#endif
@@ -0,0 +1,473 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "StreamCapture.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <cstring>
+
+// The writer thread only touches the disk once this much data is pending,
+// or when it hasn't written anything for WRITE_INTERVAL_MS.
+#define WRITE_CHUNK_SIZE (1024 * 1024)
+#define WRITE_INTERVAL_MS 500
+
+// If the disk can't keep up, records are dropped rather than growing the
+// pending buffer forever.
+#define MAX_PENDING_SIZE (64 * 1024 * 1024)
+
+//------------------------------------------
+StreamCaptureWriter::StreamCaptureWriter() :
+	mRunning(false),
+	mNextOffset(0),
+	mFirstTimestamp(-1),
+	mDropped(0),
+	mWaitingKeyFrame(false)
+{
+
+}
+//------------------------------------------
+StreamCaptureWriter::~StreamCaptureWriter()
+{
+	close();
+}
+//------------------------------------------
+bool StreamCaptureWriter::open(const QString& path)
+{
+	close();
+
+	mFile.setFileName(path);
+	if (!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		qWarning() << "Cannot open capture file " << path << ": " << mFile.errorString();
+		return false;
+	}
+
+	QByteArray header;
+	header.append(CAPTURE_MAGIC, 6);
+	appendUInt16(header, CAPTURE_FORMAT_VERSION);
+	appendUInt64(header, QDateTime::currentMSecsSinceEpoch());
+
+	mPending = header;
+	mIndex.clear();
+	mNextOffset = header.size();
+	mFirstTimestamp = -1;
+	mDropped = 0;
+	mWaitingKeyFrame = false;
+
+	mRunning = true;
+	mWriterThread = std::thread(&StreamCaptureWriter::writerThread, this);
+
+	return true;
+}
+//------------------------------------------
+void StreamCaptureWriter::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning)
+			return;
+
+		mRunning = false;
+	}
+
+	mCondition.notify_one();
+	if (mWriterThread.joinable())
+	{
+		mWriterThread.join();
+	}
+
+	// The writer thread has flushed everything, the index goes right after
+	QByteArray index;
+	index.reserve(mIndex.size() * CAPTURE_INDEX_ENTRY_SIZE + CAPTURE_FOOTER_SIZE);
+	for (auto it = mIndex.constBegin(); it != mIndex.constEnd(); ++it)
+	{
+		appendUInt64(index, it->timestamp);
+		appendUInt64(index, it->offset);
+		appendUInt32(index, it->flags);
+		appendUInt32(index, 0);
+	}
+
+	appendUInt64(index, mNextOffset);
+	appendUInt32(index, mIndex.size());
+	appendUInt32(index, 0);
+	index.append(CAPTURE_INDEX_MAGIC, 8);
+
+	mFile.write(index);
+	mFile.close();
+
+	if (mDropped > 0)
+	{
+		qWarning() << "Capture " << mFile.fileName() << " dropped " << mDropped << " records";
+	}
+
+	mIndex.clear();
+}
+//------------------------------------------
+bool StreamCaptureWriter::isOpen() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mRunning;
+}
+//------------------------------------------
+QString StreamCaptureWriter::fileName() const
+{
+	return mFile.fileName();
+}
+//------------------------------------------
+int StreamCaptureWriter::droppedRecords() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mDropped;
+}
+//------------------------------------------
+qint64 StreamCaptureWriter::pendingBytes() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mPending.size();
+}
+//------------------------------------------
+void StreamCaptureWriter::write(const StreamRecord& record)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mRunning)
+		return;
+
+	const int recordSize = CAPTURE_RECORD_HEADER_SIZE + record.video.size() + record.audio.size();
+	const bool keyFrame = QStreamFramer::isKeyFrame(record.video);
+
+	// Behind on disk: whatever we keep must start on a keyframe to be decodable
+	if (mPending.size() + recordSize > MAX_PENDING_SIZE)
+		mWaitingKeyFrame = true;
+
+	if (mWaitingKeyFrame)
+	{
+		if (!keyFrame || mPending.size() + recordSize > MAX_PENDING_SIZE)
+		{
+			mDropped++;
+			return;
+		}
+		mWaitingKeyFrame = false;
+	}
+
+	if (mFirstTimestamp < 0)
+		mFirstTimestamp = record.timestamp;
+
+	CaptureIndexEntry entry;
+	entry.timestamp = record.timestamp - mFirstTimestamp;
+	entry.offset = mNextOffset;
+	entry.flags = keyFrame ? CRF_KEYFRAME : 0;
+
+	mPending.append((char) record.protVersion);
+	mPending.append((char) record.orientation);
+	appendUInt16(mPending, entry.flags);
+	appendUInt32(mPending, record.video.size());
+	appendUInt32(mPending, record.audio.size());
+	appendUInt64(mPending, entry.timestamp);
+	mPending.append(record.video);
+	mPending.append(record.audio);
+
+	mIndex.push_back(entry);
+	mNextOffset += recordSize;
+
+	if (mPending.size() >= WRITE_CHUNK_SIZE)
+		mCondition.notify_one();
+}
+//------------------------------------------
+void StreamCaptureWriter::writerThread()
+{
+	QByteArray chunk;
+	bool running = true;
+
+	while (running)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait_for(lock, std::chrono::milliseconds(WRITE_INTERVAL_MS), [this] {
+				return !mRunning || mPending.size() >= WRITE_CHUNK_SIZE;
+			});
+
+			running = mRunning;
+
+			// Take everything pending in one go, the producer keeps filling
+			// the (now empty) buffer while we're on the disk.
+			chunk.swap(mPending);
+			mPending.resize(0);
+		}
+
+		if (!chunk.isEmpty())
+		{
+			if (mFile.write(chunk) != chunk.size())
+			{
+				qWarning() << "Error while writing capture: " << mFile.errorString();
+			}
+			chunk.resize(0);
+		}
+	}
+
+	mFile.flush();
+}
+//------------------------------------------
+void StreamCaptureWriter::appendUInt16(QByteArray& out, quint16 value)
+{
+	for (int i = 0; i < 2; i++)
+		out.append((char) ((value >> (8 * i)) & 0xFF));
+}
+//------------------------------------------
+void StreamCaptureWriter::appendUInt32(QByteArray& out, quint32 value)
+{
+	for (int i = 0; i < 4; i++)
+		out.append((char) ((value >> (8 * i)) & 0xFF));
+}
+//------------------------------------------
+void StreamCaptureWriter::appendUInt64(QByteArray& out, quint64 value)
+{
+	for (int i = 0; i < 8; i++)
+		out.append((char) ((value >> (8 * i)) & 0xFF));
+}
+//------------------------------------------
+StreamCaptureReader::StreamCaptureReader() :
+	mData(nullptr),
+	mSize(0)
+{
+
+}
+//------------------------------------------
+StreamCaptureReader::~StreamCaptureReader()
+{
+	close();
+}
+//------------------------------------------
+bool StreamCaptureReader::open(const QString& path)
+{
+	close();
+
+	mFile.setFileName(path);
+	if (!mFile.open(QIODevice::ReadOnly))
+	{
+		qWarning() << "Cannot open capture file " << path << ": " << mFile.errorString();
+		return false;
+	}
+
+	mSize = mFile.size();
+	if (mSize < CAPTURE_FILE_HEADER_SIZE)
+	{
+		qWarning() << "Capture file " << path << " is truncated";
+		close();
+		return false;
+	}
+
+	mData = mFile.map(0, mSize);
+	if (!mData)
+	{
+		qWarning() << "Cannot map capture file " << path << ": " << mFile.errorString();
+		close();
+		return false;
+	}
+
+	if (memcmp(mData, CAPTURE_MAGIC, 6) != 0 || readUInt16(mData + 6) > CAPTURE_FORMAT_VERSION)
+	{
+		qWarning() << path << " is not a supported capture file";
+		close();
+		return false;
+	}
+
+	if (!loadIndex())
+	{
+		// No (valid) index, the capture probably wasn't closed properly
+		qDebug() << "Capture " << path << " has no index, scanning records";
+		scanRecords();
+	}
+
+	return true;
+}
+//------------------------------------------
+void StreamCaptureReader::close()
+{
+	if (mData)
+	{
+		mFile.unmap(mData);
+		mData = nullptr;
+	}
+
+	mFile.close();
+	mSize = 0;
+	mIndex.clear();
+}
+//------------------------------------------
+bool StreamCaptureReader::isOpen() const
+{
+	return mData != nullptr;
+}
+//------------------------------------------
+int StreamCaptureReader::recordCount() const
+{
+	return mIndex.size();
+}
+//------------------------------------------
+qint64 StreamCaptureReader::duration() const
+{
+	return mIndex.isEmpty() ? 0 : mIndex.last().timestamp;
+}
+//------------------------------------------
+const QVector<CaptureIndexEntry>& StreamCaptureReader::index() const
+{
+	return mIndex;
+}
+//------------------------------------------
+bool StreamCaptureReader::record(int index, StreamRecord& out) const
+{
+	if (index < 0 || index >= mIndex.size())
+		return false;
+
+	const uchar* header = mData + mIndex.at(index).offset;
+	quint32 videoSize = readUInt32(header + 4);
+	quint32 audioSize = readUInt32(header + 8);
+
+	out.protVersion = header[0];
+	out.orientation = header[1];
+	out.timestamp = readUInt64(header + 12);
+
+	const char* payload = (const char*) header + CAPTURE_RECORD_HEADER_SIZE;
+	out.video = QByteArray::fromRawData(payload, videoSize);
+	out.audio = QByteArray::fromRawData(payload + videoSize, audioSize);
+
+	return true;
+}
+//------------------------------------------
+int StreamCaptureReader::findKeyFrame(qint64 timestamp) const
+{
+	// Binary search the last record at or before the timestamp...
+	int low = 0, high = mIndex.size() - 1, found = 0;
+	while (low <= high)
+	{
+		int mid = (low + high) / 2;
+		if (mIndex.at(mid).timestamp <= timestamp)
+		{
+			found = mid;
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid - 1;
+		}
+	}
+
+	// ...then walk back to the keyframe it depends on
+	while (found > 0 && !(mIndex.at(found).flags & CRF_KEYFRAME))
+		found--;
+
+	return found;
+}
+//------------------------------------------
+bool StreamCaptureReader::loadIndex()
+{
+	if (mSize < CAPTURE_FILE_HEADER_SIZE + CAPTURE_FOOTER_SIZE)
+		return false;
+
+	const uchar* footer = mData + mSize - CAPTURE_FOOTER_SIZE;
+	if (memcmp(footer + 16, CAPTURE_INDEX_MAGIC, 8) != 0)
+		return false;
+
+	qint64 indexOffset = readUInt64(footer);
+	quint32 count = readUInt32(footer + 8);
+
+	if (indexOffset < CAPTURE_FILE_HEADER_SIZE || indexOffset > mSize
+		|| indexOffset + (qint64) count * CAPTURE_INDEX_ENTRY_SIZE + CAPTURE_FOOTER_SIZE != mSize)
+		return false;
+
+	mIndex.resize(count);
+	const uchar* entry = mData + indexOffset;
+	for (quint32 i = 0; i < count; i++, entry += CAPTURE_INDEX_ENTRY_SIZE)
+	{
+		CaptureIndexEntry& e = mIndex[i];
+		e.timestamp = readUInt64(entry);
+		e.offset = readUInt64(entry + 8);
+		e.flags = readUInt32(entry + 16);
+
+		// The whole record must be before the index: record() trusts its sizes.
+		// A corrupt entry makes the caller rebuild the index with scanRecords.
+		if (e.offset < CAPTURE_FILE_HEADER_SIZE || e.offset > indexOffset - CAPTURE_RECORD_HEADER_SIZE)
+		{
+			mIndex.clear();
+			return false;
+		}
+
+		const uchar* header = mData + e.offset;
+		const qint64 recordSize = CAPTURE_RECORD_HEADER_SIZE
+			+ (qint64) readUInt32(header + 4) + readUInt32(header + 8);
+		if (e.offset + recordSize > indexOffset)
+		{
+			mIndex.clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+//------------------------------------------
+bool StreamCaptureReader::scanRecords()
+{
+	qint64 offset = CAPTURE_FILE_HEADER_SIZE;
+	mIndex.clear();
+
+	while (offset + CAPTURE_RECORD_HEADER_SIZE <= mSize)
+	{
+		const uchar* header = mData + offset;
+		qint64 recordSize = CAPTURE_RECORD_HEADER_SIZE
+			+ (qint64) readUInt32(header + 4) + readUInt32(header + 8);
+
+		if (offset + recordSize > mSize)
+		{
+			// Last record was cut while writing
+			break;
+		}
+
+		CaptureIndexEntry e;
+		e.timestamp = readUInt64(header + 12);
+		e.offset = offset;
+		e.flags = readUInt16(header + 2);
+		mIndex.push_back(e);
+
+		offset += recordSize;
+	}
+
+	return !mIndex.isEmpty();
+}
+//------------------------------------------
+quint16 StreamCaptureReader::readUInt16(const uchar* bytes)
+{
+	return (quint16) (bytes[0] | (bytes[1] << 8));
+}
+//------------------------------------------
+quint32 StreamCaptureReader::readUInt32(const uchar* bytes)
+{
+	quint32 value = 0;
+	for (int i = 3; i >= 0; i--)
+		value = (value << 8) | bytes[i];
+	return value;
+}
+//------------------------------------------
+quint64 StreamCaptureReader::readUInt64(const uchar* bytes)
+{
+	quint64 value = 0;
+	for (int i = 7; i >= 0; i--)
+		value = (value << 8) | bytes[i];
+	return value;
+}
+//------------------------------------------
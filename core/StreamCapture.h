@@ -0,0 +1,163 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _STREAMCAPTURE_H_
+#define _STREAMCAPTURE_H_
+
+#include <QFile>
+#include <QByteArray>
+#include <QVector>
+#include <QString>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "QStreamFramer.h"
+
+// Layout of a .bbqcap file. All integers are little endian.
+//
+// File header (16 bytes):
+//   magic "BBQCAP" (6) | format version (2) | capture start, ms since epoch (8)
+//
+// Records, back to back:
+//   protVersion (1) | orientation (1) | flags (2) | videoSize (4) | audioSize (4)
+//   | timestamp, ns since the first record (8) | video payload | audio payload
+//
+// Trailing index, written when the capture is closed:
+//   entries: timestamp (8) | record offset (8) | flags (4) | reserved (4)
+//   footer:  index offset (8) | entry count (4) | reserved (4) | magic "BBQIDX\0\0" (8)
+//
+// A file without the footer (e.g. the client crashed while recording) is
+// still readable by scanning the records from the start.
+
+#define CAPTURE_MAGIC "BBQCAP"
+#define CAPTURE_INDEX_MAGIC "BBQIDX\0\0"
+#define CAPTURE_FORMAT_VERSION 1
+#define CAPTURE_FILE_HEADER_SIZE 16
+#define CAPTURE_RECORD_HEADER_SIZE 20
+#define CAPTURE_INDEX_ENTRY_SIZE 24
+#define CAPTURE_FOOTER_SIZE 24
+
+enum CaptureRecordFlags {
+	CRF_KEYFRAME = 0x1
+};
+
+struct CaptureIndexEntry
+{
+	qint64 timestamp;
+	qint64 offset;
+	quint32 flags;
+};
+
+class StreamCaptureWriter
+{
+public:
+	// ctor
+	StreamCaptureWriter();
+
+	// dtor
+	~StreamCaptureWriter();
+
+	// Creates the file and starts the writer thread
+	bool open(const QString& path);
+
+	// Flushes pending records, writes the index and closes the file
+	void close();
+
+	bool isOpen() const;
+	QString fileName() const;
+
+	// Queues a record for writing. Never blocks on disk I/O.
+	void write(const StreamRecord& record);
+
+	// Number of records dropped because the disk couldn't keep up
+	int droppedRecords() const;
+
+	// Bytes queued and not written yet
+	qint64 pendingBytes() const;
+
+protected:
+	void writerThread();
+
+	static void appendUInt16(QByteArray& out, quint16 value);
+	static void appendUInt32(QByteArray& out, quint32 value);
+	static void appendUInt64(QByteArray& out, quint64 value);
+
+protected:
+	QFile mFile;
+	std::thread mWriterThread;
+	mutable std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mRunning;
+
+	// Serialized records waiting for the writer thread
+	QByteArray mPending;
+	QVector<CaptureIndexEntry> mIndex;
+	qint64 mNextOffset;
+	qint64 mFirstTimestamp;
+	int mDropped;
+
+	// A record was dropped: the P-frames after it are useless until a keyframe
+	bool mWaitingKeyFrame;
+};
+
+class StreamCaptureReader
+{
+public:
+	// ctor
+	StreamCaptureReader();
+
+	// dtor
+	~StreamCaptureReader();
+
+	// Maps the whole file in memory and loads (or rebuilds) its index
+	bool open(const QString& path);
+	void close();
+
+	bool isOpen() const;
+	int recordCount() const;
+
+	// Timestamp of the last record, in nanoseconds
+	qint64 duration() const;
+
+	// Returns the record at the given position. The payloads point directly
+	// into the mapped file, so they are only valid while the reader is open.
+	bool record(int index, StreamRecord& out) const;
+
+	// Returns the position of the last keyframe at or before the timestamp
+	int findKeyFrame(qint64 timestamp) const;
+
+	const QVector<CaptureIndexEntry>& index() const;
+
+protected:
+	bool loadIndex();
+	bool scanRecords();
+
+	static quint16 readUInt16(const uchar* bytes);
+	static quint32 readUInt32(const uchar* bytes);
+	static quint64 readUInt64(const uchar* bytes);
+
+protected:
+	QFile mFile;
+	uchar* mData;
+	qint64 mSize;
+	QVector<CaptureIndexEntry> mIndex;
+};
+
+#endif
@@ -0,0 +1,627 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "StreamRecorder.h"
+
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+// Timestamps handed to writePacket are in microseconds
+static const ffmpeg::AVRational MICROSECONDS = { 1, 1000000 };
+
+// Audio resyncs on the record timestamps when it drifts more than this
+#define AUDIO_RESYNC_US 100000
+
+#define NAL_SLICE 1
+#define NAL_IDR 5
+#define NAL_SPS 7
+#define NAL_PPS 8
+
+//------------------------------------------
+// Reads an H264 RBSP, emulation prevention bytes already removed
+class BitReader
+{
+public:
+	BitReader(const QByteArray& data) : mData(data), mPos(0) {}
+
+	bool atEnd() const { return mPos >= mData.size() * 8; }
+
+	unsigned int bit()
+	{
+		if (atEnd())
+			return 0;
+		unsigned int value = ((quint8) mData.at(mPos / 8) >> (7 - (mPos % 8))) & 1;
+		mPos++;
+		return value;
+	}
+
+	unsigned int bits(int count)
+	{
+		unsigned int value = 0;
+		while (count-- > 0)
+			value = (value << 1) | bit();
+		return value;
+	}
+
+	// Exp-Golomb, unsigned then signed
+	unsigned int ue()
+	{
+		int zeros = 0;
+		while (bit() == 0 && !atEnd() && zeros < 32)
+			zeros++;
+
+		// Not a 32 bits value: malformed, reads as the end of the data
+		if (zeros >= 32)
+		{
+			mPos = mData.size() * 8;
+			return 0;
+		}
+
+		return ((1u << zeros) - 1) + bits(zeros);
+	}
+
+	int se()
+	{
+		unsigned int value = ue();
+		return (value & 1) ? (int) ((value + 1) / 2) : -(int) (value / 2);
+	}
+
+protected:
+	QByteArray mData;
+	int mPos;
+};
+//------------------------------------------
+// Splits an Annex-B payload in NAL units, start codes removed
+static QList<QByteArray> splitNalUnits(const QByteArray& payload)
+{
+	QList<QByteArray> units;
+	const quint8* data = (const quint8*) payload.constData();
+	const int size = payload.size();
+
+	int start = -1;
+	for (int i = 0; i + 2 < size; i++)
+	{
+		if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+		{
+			if (start >= 0)
+			{
+				// The zero of a 4 bytes start code belongs to the next one
+				int end = i;
+				while (end > start && data[end - 1] == 0)
+					end--;
+				units.push_back(payload.mid(start, end - start));
+			}
+			start = i + 3;
+			i += 2;
+		}
+	}
+
+	if (start >= 0 && start < size)
+		units.push_back(payload.mid(start));
+
+	return units;
+}
+//------------------------------------------
+StreamRecorder::StreamRecorder() :
+	mRunning(false),
+	mPendingBytes(0),
+	mWaitingKeyFrame(false),
+	mDropped(0),
+	mFormatCtx(nullptr),
+	mVideoStream(nullptr),
+	mAudioStream(nullptr),
+	mSegment(0),
+	mOrientation(0),
+	mWidth(0),
+	mHeight(0),
+	mFirstTimestamp(-1),
+	mLastVideoDts(-1),
+	mLastAudioDts(-1),
+	mAudioSamples(0)
+{
+}
+//------------------------------------------
+StreamRecorder::~StreamRecorder()
+{
+	close();
+}
+//------------------------------------------
+bool StreamRecorder::open(const QString& path, const QByteArray& codecConfig)
+{
+	close();
+
+	ffmpeg::av_register_all();
+
+	if (!ffmpeg::av_guess_format(NULL, path.toUtf8().constData(), NULL))
+	{
+		qDebug() << "No muxer for " << path;
+		return false;
+	}
+
+	if (!QFileInfo(QFileInfo(path).absolutePath()).isWritable())
+	{
+		qDebug() << "Cannot write to " << QFileInfo(path).absolutePath();
+		return false;
+	}
+
+	mPath = path;
+	mPending.clear();
+	mPendingBytes = 0;
+	mWaitingKeyFrame = false;
+	mDropped = 0;
+	mSegment = 0;
+	mSps.clear();
+	mPps.clear();
+
+	bool hasIdr, hasSlice;
+	scanVideo(codecConfig, hasIdr, hasSlice);
+
+	mRunning = true;
+	mMuxerThread = std::thread(&StreamRecorder::muxerThread, this);
+	return true;
+}
+//------------------------------------------
+void StreamRecorder::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning)
+			return;
+		mRunning = false;
+	}
+
+	mCondition.notify_one();
+	mMuxerThread.join();
+}
+//------------------------------------------
+bool StreamRecorder::isOpen() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mRunning;
+}
+//------------------------------------------
+QString StreamRecorder::fileName() const
+{
+	return mPath;
+}
+//------------------------------------------
+int StreamRecorder::droppedRecords() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mDropped;
+}
+//------------------------------------------
+qint64 StreamRecorder::pendingBytes() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mPendingBytes;
+}
+//------------------------------------------
+void StreamRecorder::write(const StreamRecord& record)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning)
+			return;
+
+		// Behind on disk: whatever we keep must start on a keyframe to be playable
+		if (mPendingBytes > MAX_RECORDER_PENDING)
+			mWaitingKeyFrame = true;
+
+		if (mWaitingKeyFrame)
+		{
+			if (!QStreamFramer::isKeyFrame(record.video) || mPendingBytes > MAX_RECORDER_PENDING)
+			{
+				mDropped++;
+				return;
+			}
+			mWaitingKeyFrame = false;
+		}
+
+		// The payloads are shared with the caller, not copied
+		mPending.push_back(record);
+		mPendingBytes += record.video.size() + record.audio.size();
+	}
+
+	mCondition.notify_one();
+}
+//------------------------------------------
+void StreamRecorder::muxerThread()
+{
+	while (true)
+	{
+		QList<StreamRecord> records;
+		bool running;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this] { return !mPending.isEmpty() || !mRunning; });
+
+			records.swap(mPending);
+			mPendingBytes = 0;
+			running = mRunning;
+		}
+
+		for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+			muxRecord(*it);
+
+		if (!running)
+			break;
+	}
+
+	finishSegment();
+}
+//------------------------------------------
+bool StreamRecorder::scanVideo(const QByteArray& video, bool& hasIdr, bool& hasSlice)
+{
+	hasIdr = false;
+	hasSlice = false;
+	bool newConfig = false;
+
+	QList<QByteArray> units = splitNalUnits(video);
+	for (auto it = units.constBegin(); it != units.constEnd(); ++it)
+	{
+		if (it->isEmpty())
+			continue;
+
+		switch (it->at(0) & 0x1F)
+		{
+		case NAL_IDR:
+			hasIdr = true;
+			hasSlice = true;
+			break;
+		case NAL_SLICE:
+			hasSlice = true;
+			break;
+		case NAL_SPS:
+			newConfig |= (*it != mSps);
+			mSps = *it;
+			break;
+		case NAL_PPS:
+			newConfig |= (*it != mPps);
+			mPps = *it;
+			break;
+		}
+	}
+
+	return newConfig;
+}
+//------------------------------------------
+void StreamRecorder::muxRecord(const StreamRecord& record)
+{
+	bool hasIdr = false, hasSlice = false;
+	bool newConfig = scanVideo(record.video, hasIdr, hasSlice);
+
+	// A new segment is needed when the track metadata changes, and can only
+	// start on a keyframe
+	if (hasIdr && !mSps.isEmpty() && !mPps.isEmpty())
+	{
+		int width = 0, height = 0;
+		parseSpsSize(mSps, width, height);
+
+		if (!mFormatCtx || newConfig || record.orientation != mOrientation
+			|| width != mWidth || height != mHeight)
+		{
+			finishSegment();
+			if (!startSegment(record))
+				return;
+		}
+	}
+
+	if (!mFormatCtx)
+		return;
+
+	if (hasSlice)
+		writeVideo(record, hasIdr);
+
+	if (record.audio.size() > 0 && mAudioStream)
+		writeAudio(record);
+}
+//------------------------------------------
+QString StreamRecorder::segmentPath(int index) const
+{
+	if (index <= 1)
+		return mPath;
+
+	QFileInfo info(mPath);
+	return info.dir().filePath(QString("%1-%2.%3").arg(info.completeBaseName()).arg(index).arg(info.suffix()));
+}
+//------------------------------------------
+bool StreamRecorder::startSegment(const StreamRecord& keyFrame)
+{
+	mSegment++;
+	QByteArray path = segmentPath(mSegment).toUtf8();
+
+	if (ffmpeg::avformat_alloc_output_context2(&mFormatCtx, NULL, NULL, path.constData()) < 0 || !mFormatCtx)
+	{
+		qDebug() << "Unable to create the muxer for " << path;
+		mFormatCtx = nullptr;
+		return false;
+	}
+
+	parseSpsSize(mSps, mWidth, mHeight);
+	mOrientation = keyFrame.orientation;
+
+	// Video track, Annex-B extradata: the muxer converts to avcC itself
+	mVideoStream = ffmpeg::avformat_new_stream(mFormatCtx, NULL);
+	ffmpeg::AVCodecContext* video = mVideoStream->codec;
+	video->codec_type = ffmpeg::AVMEDIA_TYPE_VIDEO;
+	video->codec_id = ffmpeg::CODEC_ID_H264;
+	video->width = mWidth;
+	video->height = mHeight;
+	video->time_base.num = 1;
+	video->time_base.den = 90000;
+	mVideoStream->time_base = video->time_base;
+
+	QByteArray extradata;
+	extradata.append(QByteArray("\x00\x00\x00\x01", 4)).append(mSps);
+	extradata.append(QByteArray("\x00\x00\x00\x01", 4)).append(mPps);
+	video->extradata = (uint8_t*) ffmpeg::av_mallocz(extradata.size() + FF_INPUT_BUFFER_PADDING_SIZE);
+	memcpy(video->extradata, extradata.constData(), extradata.size());
+	video->extradata_size = extradata.size();
+
+	// The client shows the picture rotated by orientation * -90 degrees,
+	// the rotate tag is clockwise
+	int rotation = (360 - mOrientation * 90) % 360;
+	if (rotation != 0)
+		ffmpeg::av_dict_set(&mVideoStream->metadata, "rotate", QByteArray::number(rotation).constData(), 0);
+
+	// Audio track, when the device sends some (protocol v4)
+	mAudioStream = nullptr;
+	if (keyFrame.protVersion >= 4 && keyFrame.audio.size() >= 7)
+	{
+		const quint8* adts = (const quint8*) keyFrame.audio.constData();
+		if (adts[0] == 0xFF && (adts[1] & 0xF0) == 0xF0)
+		{
+			static const int sampleRates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+			int objectType = ((adts[2] >> 6) & 0x3) + 1;
+			int rateIndex = (adts[2] >> 2) & 0xF;
+			int channels = ((adts[2] & 0x1) << 2) | ((adts[3] >> 6) & 0x3);
+
+			mAudioStream = ffmpeg::avformat_new_stream(mFormatCtx, NULL);
+			ffmpeg::AVCodecContext* audio = mAudioStream->codec;
+			audio->codec_type = ffmpeg::AVMEDIA_TYPE_AUDIO;
+			audio->codec_id = ffmpeg::CODEC_ID_AAC;
+			audio->sample_rate = sampleRates[qMin(rateIndex, 12)];
+			audio->channels = channels;
+			audio->channel_layout = ffmpeg::av_get_default_channel_layout(channels);
+			audio->frame_size = 1024;
+			audio->time_base.num = 1;
+			audio->time_base.den = audio->sample_rate;
+			mAudioStream->time_base = audio->time_base;
+
+			// AudioSpecificConfig, the ADTS headers are stripped from the packets
+			audio->extradata = (uint8_t*) ffmpeg::av_mallocz(2 + FF_INPUT_BUFFER_PADDING_SIZE);
+			audio->extradata[0] = (objectType << 3) | (rateIndex >> 1);
+			audio->extradata[1] = ((rateIndex & 0x1) << 7) | (channels << 3);
+			audio->extradata_size = 2;
+		}
+	}
+
+	if (mFormatCtx->oformat->flags & AVFMT_GLOBALHEADER)
+	{
+		video->flags |= CODEC_FLAG_GLOBAL_HEADER;
+		if (mAudioStream)
+			mAudioStream->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+	}
+
+	if (ffmpeg::avio_open(&mFormatCtx->pb, path.constData(), AVIO_FLAG_WRITE) < 0
+		|| ffmpeg::avformat_write_header(mFormatCtx, NULL) < 0)
+	{
+		qDebug() << "Unable to start recording to " << path;
+		if (mFormatCtx->pb)
+			ffmpeg::avio_close(mFormatCtx->pb);
+		ffmpeg::avformat_free_context(mFormatCtx);
+		mFormatCtx = nullptr;
+		return false;
+	}
+
+	mFirstTimestamp = keyFrame.timestamp;
+	mLastVideoDts = -1;
+	mLastAudioDts = -1;
+	mAudioSamples = 0;
+
+	qDebug() << "Recording " << mWidth << "x" << mHeight << " rotated " << rotation << " to " << path;
+	return true;
+}
+//------------------------------------------
+void StreamRecorder::finishSegment()
+{
+	if (!mFormatCtx)
+		return;
+
+	ffmpeg::av_write_trailer(mFormatCtx);
+	ffmpeg::avio_close(mFormatCtx->pb);
+	ffmpeg::avformat_free_context(mFormatCtx);
+
+	mFormatCtx = nullptr;
+	mVideoStream = nullptr;
+	mAudioStream = nullptr;
+}
+//------------------------------------------
+void StreamRecorder::writeVideo(const StreamRecord& record, bool keyFrame)
+{
+	const qint64 timestampUs = (record.timestamp - mFirstTimestamp) / 1000;
+
+	// av_write_frame doesn't keep the data, no need to copy the payload
+	writePacket(mVideoStream, (uint8_t*) record.video.constData(), record.video.size(),
+		timestampUs, keyFrame, mLastVideoDts);
+}
+//------------------------------------------
+void StreamRecorder::writeAudio(const StreamRecord& record)
+{
+	const int sampleRate = mAudioStream->codec->sample_rate;
+	const qint64 timestampUs = (record.timestamp - mFirstTimestamp) / 1000;
+
+	// Audio is timed by its sample count, as long as it stays close to the
+	// arrival time of the records
+	qint64 expected = timestampUs * sampleRate / 1000000;
+	if (qAbs(expected - mAudioSamples) > (qint64) AUDIO_RESYNC_US * sampleRate / 1000000)
+		mAudioSamples = expected;
+
+	const quint8* data = (const quint8*) record.audio.constData();
+	int offset = 0;
+
+	while (offset + 7 <= record.audio.size())
+	{
+		const quint8* adts = data + offset;
+		if (adts[0] != 0xFF || (adts[1] & 0xF0) != 0xF0)
+			break;
+
+		int headerSize = (adts[1] & 0x1) ? 7 : 9;
+		int frameSize = ((adts[3] & 0x3) << 11) | (adts[4] << 3) | (adts[5] >> 5);
+		if (frameSize <= headerSize || offset + frameSize > record.audio.size())
+			break;
+
+		qint64 ptsUs = mAudioSamples * 1000000 / sampleRate;
+		writePacket(mAudioStream, (uint8_t*) adts + headerSize, frameSize - headerSize,
+			ptsUs, true, mLastAudioDts);
+
+		mAudioSamples += 1024;
+		offset += frameSize;
+	}
+}
+//------------------------------------------
+void StreamRecorder::writePacket(ffmpeg::AVStream* stream, uint8_t* data, int size, qint64 timestampUs, bool keyFrame, qint64& lastDts)
+{
+	ffmpeg::AVPacket packet;
+	ffmpeg::av_init_packet(&packet);
+
+	// No B-frames from the device: pts = dts, and they must grow strictly
+	qint64 ts = ffmpeg::av_rescale_q(qMax((qint64) 0, timestampUs), MICROSECONDS, stream->time_base);
+	if (ts <= lastDts)
+		ts = lastDts + 1;
+	lastDts = ts;
+
+	packet.data = data;
+	packet.size = size;
+	packet.pts = ts;
+	packet.dts = ts;
+	packet.stream_index = stream->index;
+	if (keyFrame)
+		packet.flags |= AV_PKT_FLAG_KEY;
+
+	if (ffmpeg::av_write_frame(mFormatCtx, &packet) < 0)
+		qDebug() << "Unable to write a packet to " << segmentPath(mSegment);
+}
+//------------------------------------------
+bool StreamRecorder::parseSpsSize(const QByteArray& sps, int& width, int& height)
+{
+	if (sps.size() < 4 || (sps.at(0) & 0x1F) != NAL_SPS)
+		return false;
+
+	// Remove the emulation prevention bytes (00 00 03)
+	QByteArray rbsp;
+	rbsp.reserve(sps.size());
+	int zeros = 0;
+	for (int i = 1; i < sps.size(); i++)
+	{
+		char c = sps.at(i);
+		if (zeros >= 2 && c == 3)
+		{
+			zeros = 0;
+			continue;
+		}
+		zeros = (c == 0) ? zeros + 1 : 0;
+		rbsp.append(c);
+	}
+
+	BitReader reader(rbsp);
+	unsigned int profile = reader.bits(8);
+	reader.bits(16); // constraints, level
+	reader.ue(); // sps id
+
+	unsigned int chromaFormat = 1;
+	bool separateColourPlanes = false;
+	if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44
+		|| profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138
+		|| profile == 139 || profile == 134 || profile == 135)
+	{
+		chromaFormat = reader.ue();
+		if (chromaFormat == 3)
+			separateColourPlanes = reader.bit();
+		reader.ue(); // luma bit depth
+		reader.ue(); // chroma bit depth
+		reader.bit(); // qpprime y zero transform bypass
+
+		if (reader.bit()) // scaling matrices
+		{
+			const int lists = (chromaFormat != 3) ? 8 : 12;
+			for (int i = 0; i < lists; i++)
+			{
+				if (!reader.bit())
+					continue;
+
+				int last = 8, next = 8;
+				for (int j = 0; j < (i < 6 ? 16 : 64); j++)
+				{
+					if (next != 0)
+						next = (last + reader.se() + 256) % 256;
+					last = (next == 0) ? last : next;
+				}
+			}
+		}
+	}
+
+	reader.ue(); // log2 max frame num
+	unsigned int pocType = reader.ue();
+	if (pocType == 0)
+	{
+		reader.ue();
+	}
+	else if (pocType == 1)
+	{
+		reader.bit();
+		reader.se();
+		reader.se();
+		unsigned int cycle = reader.ue();
+		for (unsigned int i = 0; i < cycle && !reader.atEnd(); i++)
+			reader.se();
+	}
+
+	reader.ue(); // max ref frames
+	reader.bit(); // gaps allowed
+	unsigned int widthMbs = reader.ue() + 1;
+	unsigned int heightMapUnits = reader.ue() + 1;
+	unsigned int frameMbsOnly = reader.bit();
+	if (!frameMbsOnly)
+		reader.bit(); // mb adaptive frame field
+	reader.bit(); // direct 8x8 inference
+
+	width = widthMbs * 16;
+	height = (2 - frameMbsOnly) * heightMapUnits * 16;
+
+	if (reader.bit()) // frame cropping
+	{
+		unsigned int left = reader.ue(), right = reader.ue();
+		unsigned int top = reader.ue(), bottom = reader.ue();
+
+		int cropX = 1, cropY = 2 - frameMbsOnly;
+		if (chromaFormat != 0 && !separateColourPlanes)
+		{
+			cropX = (chromaFormat == 3) ? 1 : 2;
+			cropY *= (chromaFormat == 1) ? 2 : 1;
+		}
+
+		width -= (left + right) * cropX;
+		height -= (top + bottom) * cropY;
+	}
+
+	return !reader.atEnd() && width > 0 && height > 0;
+}
+//------------------------------------------
@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _STREAMRECORDER_H_
+#define _STREAMRECORDER_H_
+
+#include <QString>
+#include <QList>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <QTFFmpegWrapper/ffmpeg.h>
+
+#include "QStreamFramer.h"
+
+// Payload bytes queued for the muxer before we drop up to the next keyframe
+#define MAX_RECORDER_PENDING (32 * 1024 * 1024)
+
+// Records the H264 and AAC payloads as they come from the device into an
+// MP4 or MKV file (from the extension), without decoding or re-encoding.
+// Muxing runs on its own thread. The device orientation is written as the
+// rotation metadata of the track; when it changes, a new segment file
+// (name-2.mp4, name-3.mp4...) is started on the next keyframe.
+class StreamRecorder
+{
+public:
+	// ctor
+	StreamRecorder();
+
+	// dtor
+	~StreamRecorder();
+
+	// Starts the muxer thread. The file is created on the first keyframe.
+	// The device may only send its SPS/PPS once at the start of the stream,
+	// codecConfig gives the last ones seen to a recording started later.
+	bool open(const QString& path, const QByteArray& codecConfig = QByteArray());
+
+	// Flushes pending records and finalizes the current segment
+	void close();
+
+	bool isOpen() const;
+	QString fileName() const;
+
+	// Queues a record for muxing. Never blocks on disk I/O.
+	void write(const StreamRecord& record);
+
+	// Number of records dropped because the muxer couldn't keep up
+	int droppedRecords() const;
+
+	// Payload bytes queued and not muxed yet
+	qint64 pendingBytes() const;
+
+	// Width and height of an H264 picture from its SPS NAL unit (with header)
+	static bool parseSpsSize(const QByteArray& sps, int& width, int& height);
+
+protected:
+	void muxerThread();
+	void muxRecord(const StreamRecord& record);
+	bool startSegment(const StreamRecord& keyFrame);
+	void finishSegment();
+	void writeVideo(const StreamRecord& record, bool keyFrame);
+	void writeAudio(const StreamRecord& record);
+	void writePacket(ffmpeg::AVStream* stream, uint8_t* data, int size, qint64 timestampUs, bool keyFrame, qint64& lastDts);
+	QString segmentPath(int index) const;
+	bool scanVideo(const QByteArray& video, bool& hasIdr, bool& hasSlice);
+
+protected:
+	QString mPath;
+	std::thread mMuxerThread;
+	mutable std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mRunning;
+
+	// Records waiting for the muxer thread
+	QList<StreamRecord> mPending;
+	qint64 mPendingBytes;
+	bool mWaitingKeyFrame;
+	int mDropped;
+
+	// Muxer thread state
+	ffmpeg::AVFormatContext* mFormatCtx;
+	ffmpeg::AVStream* mVideoStream;
+	ffmpeg::AVStream* mAudioStream;
+	QByteArray mSps;
+	QByteArray mPps;
+	int mSegment;
+	int mOrientation;
+	int mWidth;
+	int mHeight;
+	qint64 mFirstTimestamp;
+	qint64 mLastVideoDts;
+	qint64 mLastAudioDts;
+	qint64 mAudioSamples;
+};
+
+#endif
@@ -0,0 +1,333 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "StreamRelay.h"
+#include "StreamSession.h"
+#include "InputSerializer.h"
+#include "SocketIo.h"
+
+#include <QDebug>
+#include <QtNetwork/QHostAddress>
+
+// Number of ports tried after the requested one when it's taken
+#define RELAY_PORT_ATTEMPTS 10
+
+//------------------------------------------
+StreamRelay::StreamRelay(QObject* parent) :
+	QObject(parent),
+	mProtVersion(4)
+{
+	connect(&mServer, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+	connect(&mAnnounceTimer, SIGNAL(timeout()), this, SLOT(onAnnounceTimer()));
+}
+//------------------------------------------
+StreamRelay::~StreamRelay()
+{
+	close();
+}
+//------------------------------------------
+bool StreamRelay::listen(quint16 port, const QString& announceName)
+{
+	close();
+
+	for (int i = 0; i < RELAY_PORT_ATTEMPTS; i++)
+	{
+		if (mServer.listen(QHostAddress::Any, port + i))
+			break;
+	}
+
+	if (!mServer.isListening())
+	{
+		qDebug() << "Relay unable to listen: " << mServer.errorString();
+		return false;
+	}
+
+	qDebug() << "Relaying the session on port " << mServer.serverPort();
+
+	// Other clients always connect to the default port
+	mAnnounceName = announceName;
+	if (!mAnnounceName.isEmpty() && mServer.serverPort() == DEFAULT_STREAM_PORT)
+	{
+		mAnnounceTimer.start(1000);
+		onAnnounceTimer();
+	}
+
+	return true;
+}
+//------------------------------------------
+void StreamRelay::close()
+{
+	mAnnounceTimer.stop();
+
+	while (!mViewers.isEmpty())
+		removeViewer(mViewers.first());
+
+	mServer.close();
+	mGop.clear();
+	mCodecConfig.clear();
+}
+//------------------------------------------
+bool StreamRelay::isListening() const
+{
+	return mServer.isListening();
+}
+//------------------------------------------
+quint16 StreamRelay::port() const
+{
+	return mServer.serverPort();
+}
+//------------------------------------------
+int StreamRelay::viewerCount() const
+{
+	return mViewers.size();
+}
+//------------------------------------------
+void StreamRelay::publish(const StreamRecord& record)
+{
+	if (!mServer.isListening())
+		return;
+
+	mProtVersion = record.protVersion;
+
+	// Serialized once, the viewers' queues all share this buffer
+	QByteArray data = QStreamFramer::serializeHeader(record, record.protVersion);
+	data.reserve(data.size() + record.video.size() + record.audio.size());
+	data.append(record.video);
+	data.append(record.audio);
+
+	if (QStreamFramer::startsWithSps(record.video))
+		mCodecConfig = data;
+
+	const bool keyFrame = QStreamFramer::isKeyFrame(record.video);
+	if (keyFrame || mGop.size() >= MAX_RELAY_GOP_RECORDS)
+		mGop.clear();
+	if (keyFrame || !mGop.isEmpty())
+		mGop.push_back(data);
+
+	QList<Viewer*> gone;
+	for (auto it = mViewers.begin(); it != mViewers.end(); ++it)
+	{
+		queueRecord(*it, data, keyFrame);
+		if (!flushViewer(*it))
+			gone.push_back(*it);
+	}
+
+	for (auto it = gone.begin(); it != gone.end(); ++it)
+		removeViewer(*it);
+}
+//------------------------------------------
+void StreamRelay::queueRecord(Viewer* viewer, const QByteArray& data, bool keyFrame)
+{
+	if (viewer->waitingKeyFrame)
+	{
+		if (!keyFrame)
+		{
+			viewer->dropped++;
+			return;
+		}
+		viewer->waitingKeyFrame = false;
+		queueCodecConfig(viewer, data);
+	}
+
+	if (viewer->queue.size() - viewer->backlog >= MAX_RELAY_QUEUED_RECORDS)
+	{
+		// Too slow: drop everything not started yet and resume on a keyframe
+		const int keep = (viewer->written > 0) ? 1 : 0;
+		while (viewer->queue.size() > keep)
+		{
+			viewer->queue.removeLast();
+			viewer->dropped++;
+		}
+		viewer->backlog = qMin(viewer->backlog, viewer->queue.size());
+
+		if (!keyFrame)
+		{
+			viewer->waitingKeyFrame = true;
+			viewer->dropped++;
+			return;
+		}
+
+		queueCodecConfig(viewer, data);
+	}
+
+	viewer->queue.push_back(data);
+}
+//------------------------------------------
+void StreamRelay::queueCodecConfig(Viewer* viewer, const QByteArray& keyFrame)
+{
+	// Not when the keyframe is the config record itself (the queues share
+	// the buffers, so comparing them is enough)
+	if (!mCodecConfig.isEmpty() && keyFrame.constData() != mCodecConfig.constData())
+		viewer->queue.push_back(mCodecConfig);
+}
+//------------------------------------------
+bool StreamRelay::flushViewer(Viewer* viewer)
+{
+	const qintptr fd = viewer->socket->socketDescriptor();
+
+	while (!viewer->queue.isEmpty())
+	{
+		const QByteArray& data = viewer->queue.first();
+
+		qint64 sent = sendRaw(fd, data.constData() + viewer->written, data.size() - viewer->written);
+		if (sent < 0)
+			return false;
+
+		if (sent == 0)
+		{
+			// Socket full, carry on when it's writable again
+			viewer->notifier->setEnabled(true);
+			return true;
+		}
+
+		viewer->written += sent;
+		if (viewer->written < data.size())
+			continue;
+
+		viewer->queue.removeFirst();
+		viewer->written = 0;
+		if (viewer->backlog > 0)
+			viewer->backlog--;
+	}
+
+	viewer->notifier->setEnabled(false);
+	return true;
+}
+//------------------------------------------
+StreamRelay::Viewer* StreamRelay::viewerOf(QObject* object)
+{
+	for (auto it = mViewers.begin(); it != mViewers.end(); ++it)
+	{
+		if ((*it)->socket == object || (*it)->notifier == object)
+			return *it;
+	}
+
+	return nullptr;
+}
+//------------------------------------------
+void StreamRelay::onNewConnection()
+{
+	while (mServer.hasPendingConnections())
+	{
+		Viewer* viewer = new Viewer;
+		viewer->socket = mServer.nextPendingConnection();
+		viewer->socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+		viewer->notifier = new QSocketNotifier(viewer->socket->socketDescriptor(), QSocketNotifier::Write, this);
+		viewer->notifier->setEnabled(false);
+		viewer->written = 0;
+		viewer->dropped = 0;
+
+		// Start on the current GOP rather than waiting for the next keyframe
+		viewer->waitingKeyFrame = mGop.isEmpty();
+		if (!mGop.isEmpty())
+			queueCodecConfig(viewer, mGop.first());
+		viewer->queue.append(mGop);
+
+		// A whole GOP can be more than the kernel takes at once: it's not a
+		// sign of a slow viewer
+		viewer->backlog = viewer->queue.size();
+
+		connect(viewer->socket, SIGNAL(readyRead()), this, SLOT(onViewerReadyRead()));
+		connect(viewer->socket, SIGNAL(disconnected()), this, SLOT(onViewerDisconnected()));
+		connect(viewer->notifier, SIGNAL(activated(int)), this, SLOT(onViewerWritable()));
+		mViewers.push_back(viewer);
+
+		qDebug() << "Relay viewer connected from " << viewer->socket->peerAddress().toString();
+
+		if (!flushViewer(viewer))
+		{
+			removeViewer(viewer);
+			continue;
+		}
+
+		emit viewersChanged(mViewers.size());
+	}
+}
+//------------------------------------------
+void StreamRelay::onViewerWritable()
+{
+	Viewer* viewer = viewerOf(sender());
+	if (viewer && !flushViewer(viewer))
+		removeViewer(viewer);
+}
+//------------------------------------------
+void StreamRelay::onViewerReadyRead()
+{
+	Viewer* viewer = viewerOf(sender());
+	if (!viewer)
+		return;
+
+	viewer->input.append(viewer->socket->readAll());
+
+	// Forward whole input packets only
+	int offset = 0;
+	while (offset < viewer->input.size())
+	{
+		int size = InputSerializer::packetSize(viewer->input.constData() + offset, viewer->input.size() - offset);
+		if (size == 0)
+		{
+			// Out of sync, drop what we have
+			offset = viewer->input.size();
+			break;
+		}
+
+		if (viewer->input.size() - offset < size)
+			break;
+
+		emit inputReceived(viewer->input.mid(offset, size));
+		offset += size;
+	}
+
+	viewer->input.remove(0, offset);
+}
+//------------------------------------------
+void StreamRelay::onViewerDisconnected()
+{
+	Viewer* viewer = viewerOf(sender());
+	if (viewer)
+		removeViewer(viewer);
+}
+//------------------------------------------
+void StreamRelay::removeViewer(Viewer* viewer)
+{
+	if (!mViewers.removeOne(viewer))
+		return;
+
+	qDebug() << "Relay viewer gone, " << viewer->dropped << " records dropped";
+
+	delete viewer->notifier;
+	viewer->socket->disconnect(this);
+	viewer->socket->abort();
+	viewer->socket->deleteLater();
+	delete viewer;
+
+	emit viewersChanged(mViewers.size());
+}
+//------------------------------------------
+void StreamRelay::onAnnounceTimer()
+{
+	// Same format as the device announcements, see DeviceRegistry::processAnnouncement
+	QByteArray name = mAnnounceName.toUtf8().left(255);
+	QByteArray datagram;
+	datagram.append((char) mProtVersion);
+	datagram.append((char) name.size());
+	datagram.append(name);
+
+	mAnnouncer.writeDatagram(datagram, QHostAddress::Broadcast, DEFAULT_STREAM_PORT);
+}
+//------------------------------------------
@@ -0,0 +1,116 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _STREAMRELAY_H_
+#define _STREAMRELAY_H_
+
+#include <QObject>
+#include <QList>
+#include <QTimer>
+#include <QSocketNotifier>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtNetwork/QUdpSocket>
+
+#include "QStreamFramer.h"
+
+// Records queued for one viewer before it's considered too slow
+#define MAX_RELAY_QUEUED_RECORDS 60
+
+// Records kept since the last keyframe, so newcomers start right away
+#define MAX_RELAY_GOP_RECORDS 600
+
+// Re-serves a session to local viewers, with the same v3/v4 framing as the
+// device. Each record is serialized once and the same buffer is queued for
+// every viewer, then sent straight from it to the socket. A viewer that
+// can't keep up drops records up to the next keyframe on its own, without
+// slowing down the others.
+class StreamRelay : public QObject
+{
+	Q_OBJECT;
+
+public:
+	// ctor
+	StreamRelay(QObject* parent = 0);
+
+	// dtor
+	~StreamRelay();
+
+	// Listens on the first free port from the given one. An announce name
+	// makes the relay show up in the device list of the other clients,
+	// which only works on the default port.
+	bool listen(quint16 port, const QString& announceName = QString());
+	void close();
+
+	bool isListening() const;
+	quint16 port() const;
+	int viewerCount() const;
+
+	void publish(const StreamRecord& record);
+
+signals:
+	void viewersChanged(int count);
+
+	// A complete input packet sent by a viewer, to forward to the device
+	void inputReceived(const QByteArray& packet);
+
+protected slots:
+	void onNewConnection();
+	void onViewerReadyRead();
+	void onViewerDisconnected();
+	void onViewerWritable();
+	void onAnnounceTimer();
+
+protected:
+	struct Viewer
+	{
+		QTcpSocket* socket;
+		QSocketNotifier* notifier;
+		QList<QByteArray> queue;
+
+		// Records at the head of the queue from the GOP it joined on, which
+		// don't count against MAX_RELAY_QUEUED_RECORDS
+		int backlog;
+		int written;
+		bool waitingKeyFrame;
+		int dropped;
+		QByteArray input;
+	};
+
+	void queueRecord(Viewer* viewer, const QByteArray& data, bool keyFrame);
+	void queueCodecConfig(Viewer* viewer, const QByteArray& keyFrame);
+	bool flushViewer(Viewer* viewer);
+	void removeViewer(Viewer* viewer);
+	Viewer* viewerOf(QObject* object);
+
+protected:
+	QTcpServer mServer;
+	QList<Viewer*> mViewers;
+	QList<QByteArray> mGop;
+
+	// Last record starting with an SPS: devices may only send it at the
+	// start of the stream, and a viewer can't decode any keyframe without it
+	QByteArray mCodecConfig;
+	quint8 mProtVersion;
+
+	QUdpSocket mAnnouncer;
+	QTimer mAnnounceTimer;
+	QString mAnnounceName;
+};
+
+#endif
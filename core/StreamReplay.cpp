@@ -0,0 +1,132 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "StreamReplay.h"
+
+// When running as fast as possible, yield to the event loop after this
+// long so the display and input still get a chance to run.
+#define MAX_BURST_MS 10
+
+//------------------------------------------
+StreamReplay::StreamReplay(QObject* parent) :
+	QObject(parent),
+	mSpeed(1.0),
+	mNextRecord(0),
+	mRunning(false)
+{
+	mTimer.setSingleShot(true);
+	mTimer.setTimerType(Qt::PreciseTimer);
+	connect(&mTimer, SIGNAL(timeout()), this, SLOT(onTimer()));
+}
+//------------------------------------------
+StreamReplay::~StreamReplay()
+{
+	stop();
+}
+//------------------------------------------
+bool StreamReplay::open(const QString& path)
+{
+	stop();
+	mNextRecord = 0;
+	return mReader.open(path);
+}
+//------------------------------------------
+void StreamReplay::setSpeed(double speed)
+{
+	mSpeed = speed;
+}
+//------------------------------------------
+double StreamReplay::speed() const
+{
+	return mSpeed;
+}
+//------------------------------------------
+bool StreamReplay::isRunning() const
+{
+	return mRunning;
+}
+//------------------------------------------
+const StreamCaptureReader& StreamReplay::reader() const
+{
+	return mReader;
+}
+//------------------------------------------
+void StreamReplay::start()
+{
+	if (!mReader.isOpen() || mRunning)
+		return;
+
+	mRunning = true;
+	mNextRecord = 0;
+	mClock.start();
+	mTimer.start(0);
+}
+//------------------------------------------
+void StreamReplay::stop()
+{
+	mRunning = false;
+	mTimer.stop();
+}
+//------------------------------------------
+void StreamReplay::onTimer()
+{
+	QElapsedTimer burst;
+	burst.start();
+
+	StreamRecord record;
+	while (mRunning && mReader.record(mNextRecord, record))
+	{
+		// In real time mode, only emit the records that are due
+		if (mSpeed > 0 && record.timestamp / mSpeed > mClock.nsecsElapsed())
+			break;
+
+		// Restamp with our own clock, as if it had just been received
+		record.timestamp = mClock.nsecsElapsed();
+		mNextRecord++;
+		emit recordReady(record);
+
+		if (mSpeed <= 0 && burst.elapsed() >= MAX_BURST_MS)
+			break;
+	}
+
+	if (mNextRecord >= mReader.recordCount())
+	{
+		mRunning = false;
+		emit finished();
+		return;
+	}
+
+	scheduleNext();
+}
+//------------------------------------------
+void StreamReplay::scheduleNext()
+{
+	if (!mRunning)
+		return;
+
+	if (mSpeed <= 0)
+	{
+		mTimer.start(0);
+		return;
+	}
+
+	qint64 due = mReader.index().at(mNextRecord).timestamp / mSpeed;
+	qint64 delayMs = (due - mClock.nsecsElapsed()) / 1000000;
+	mTimer.start(delayMs > 0 ? (int) delayMs : 0);
+}
+//------------------------------------------
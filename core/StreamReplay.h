@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _STREAMREPLAY_H_
+#define _STREAMREPLAY_H_
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "StreamCapture.h"
+
+// Plays back a .bbqcap file as if its records were coming from a device
+class StreamReplay : public QObject
+{
+	Q_OBJECT;
+
+public:
+	// ctor
+	StreamReplay(QObject* parent = 0);
+
+	// dtor
+	~StreamReplay();
+
+	bool open(const QString& path);
+
+	// Speed multiplier applied to the recorded timestamps: 1.0 is real time,
+	// 0 (or below) pushes the records as fast as they can be consumed.
+	void setSpeed(double speed);
+	double speed() const;
+
+	bool isRunning() const;
+	const StreamCaptureReader& reader() const;
+
+public slots:
+	void start();
+	void stop();
+
+signals:
+	// Payloads are only valid during the signal emission
+	void recordReady(const StreamRecord& record);
+	void finished();
+
+protected slots:
+	void onTimer();
+
+protected:
+	void scheduleNext();
+
+protected:
+	StreamCaptureReader mReader;
+	QTimer mTimer;
+	QElapsedTimer mClock;
+	double mSpeed;
+	int mNextRecord;
+	bool mRunning;
+};
+
+#endif
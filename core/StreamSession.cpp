@@ -0,0 +1,680 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "StreamSession.h"
+
+#include <QTimerEvent>
+#include <QSignalBlocker>
+#include <QDebug>
+#include <QtNetwork/QHostAddress>
+
+//------------------------------------------
+StreamSession::StartupTimes::StartupTimes() :
+	connectedMs(-1),
+	firstRecordMs(-1),
+	firstFrameMs(-1),
+	videoInitMs(-1),
+	audioInitMs(-1)
+{
+}
+//------------------------------------------
+StreamSession::StreamSession(bool audioPlayback, QObject* parent) :
+	QObject(parent),
+	mDecoder(false),
+	mAudioDecoder(true, audioPlayback),
+	mWaitingKeyFrame(false),
+	mDroppedRecords(0),
+	mState(SS_IDLE),
+	mPort(DEFAULT_STREAM_PORT),
+	mStopped(false),
+	mConnectionAttempts(0),
+	mConnectionTimerId(-1),
+	mReconnecting(false),
+	mRetryDelayMs(RECONNECT_MIN_DELAY_MS),
+	mReconnectConnectMs(0),
+	mAwaitingFirstFrame(false),
+	mReconnections(0),
+	mLastReconnectMs(-1),
+	mRemoteOrientation(0),
+	mTextInjector(&mInputWriter),
+	mPendingMoveMask(0),
+	mTouchBatching(false),
+	mTouchIntervalMs(TOUCH_EVENT_INTERVAL_MS),
+	mLastTouchSampleMs(0)
+{
+	connect(&mDecoder, SIGNAL(decodeFinished(bool, bool)), this, SLOT(onDecodeFinished(bool, bool)));
+	connect(&mAudioDecoder, SIGNAL(decodeFinished(bool, bool)), this, SLOT(onDecodeFinished(bool, bool)));
+	connect(&mAudioDecoder, SIGNAL(audioError(const QString&)), this, SIGNAL(audioError(const QString&)));
+
+	connect(&mRelay, SIGNAL(inputReceived(const QByteArray&)), this, SLOT(sendRawInput(const QByteArray&)));
+
+	connect(&mTcpSocket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+	connect(&mTcpSocket, SIGNAL(stateChanged(QAbstractSocket::SocketState)), this, SLOT(onSocketStateChanged()));
+
+	mTouchTimer.setSingleShot(true);
+	mTouchTimer.setTimerType(Qt::PreciseTimer);
+	connect(&mTouchTimer, SIGNAL(timeout()), this, SLOT(flushTouchInput()));
+
+	mInputPacket.reserve(INPUT_TOUCH_BATCH_MAX_SIZE);
+	mTouchEventPacket.reserve(INPUT_TOUCH_BATCH_MAX_SIZE);
+
+	mTimeSinceLastTouchEvent.start();
+	mTouchClock.start();
+}
+//------------------------------------------
+StreamSession::~StreamSession()
+{
+	stop();
+}
+//------------------------------------------
+void StreamSession::connectTo(const QString& host, quint16 port)
+{
+	mHost = host;
+	mPort = port;
+
+	qDebug() << "Connecting to " << host;
+
+	// Nothing depends on the stream to set the codecs up and probe the audio
+	// device: done while connecting instead of on the first packets. Audio
+	// isn't decoded on the pool.
+	mStartupClock.start();
+	mStartupTimes = StartupTimes();
+	mDecoder.prepare();
+	if (!mVideoStrand)
+		mAudioDecoder.prepare();
+
+	mReconnecting = false;
+	mAwaitingFirstFrame = false;
+	mConnectionAttempts = 0;
+	mRetryDelayMs = RECONNECT_MIN_DELAY_MS;
+	attemptConnection();
+}
+//------------------------------------------
+void StreamSession::setDecodePool(DecodePool* pool)
+{
+	if (pool)
+	{
+		mVideoStrand.reset(new DecodeStrand(*pool));
+		mVideoStrand->setUrgent(mDecoder.priority() == SP_FOCUSED);
+	}
+	else
+	{
+		mVideoStrand.reset();
+	}
+}
+//------------------------------------------
+void StreamSession::setPriority(SessionPriority priority)
+{
+	mDecoder.setPriority(priority);
+
+	if (mVideoStrand)
+		mVideoStrand->setUrgent(priority == SP_FOCUSED);
+}
+//------------------------------------------
+SessionPriority StreamSession::priority() const
+{
+	return mDecoder.priority();
+}
+//------------------------------------------
+void StreamSession::attemptConnection()
+{
+	if (mTcpSocket.state() != QAbstractSocket::UnconnectedState)
+	{
+		// Dropped right away, without telling onSocketStateChanged it failed
+		mInputWriter.setSocket(-1);
+		QSignalBlocker blocker(&mTcpSocket);
+		mTcpSocket.abort();
+	}
+
+	// Whatever was left of the previous connection can't be resumed
+	mFramer.reset();
+
+	mConnectionAttempts++;
+	setState(mReconnecting ? SS_RECONNECTING : SS_CONNECTING);
+
+	// Given up on in timerEvent if it takes too long
+	scheduleConnection(CONNECT_TIMEOUT_MS);
+	mTcpSocket.connectToHost(QHostAddress(mHost), mPort);
+}
+//------------------------------------------
+void StreamSession::scheduleConnection(int delayMs)
+{
+	if (mConnectionTimerId != -1)
+		killTimer(mConnectionTimerId);
+
+	mConnectionTimerId = startTimer(delayMs);
+}
+//------------------------------------------
+void StreamSession::flushDecoders()
+{
+	// Queued behind the packets of the old stream when decoding on the pool
+	QStreamDecoder* decoder = &mDecoder;
+	if (mVideoStrand)
+		mVideoStrand->post([decoder] { decoder->flush(); });
+	else
+		mDecoder.flush();
+
+	mAudioDecoder.flush();
+
+	// The new stream can't be decoded before its first keyframe
+	mWaitingKeyFrame = true;
+}
+//------------------------------------------
+void StreamSession::stop()
+{
+	if (mStopped)
+		return;
+
+	mStopped = true;
+	mTouchTimer.stop();
+
+	if (mConnectionTimerId != -1)
+	{
+		killTimer(mConnectionTimerId);
+		mConnectionTimerId = -1;
+	}
+
+	mCaptureWriter.close();
+	mRecorder.close();
+	mRelay.close();
+	mTextInjector.stop();
+	mInputWriter.setSocket(-1);
+	mTcpSocket.abort();
+
+	if (mVideoStrand)
+		mVideoStrand->wait();
+
+	setState(SS_IDLE);
+}
+//------------------------------------------
+StreamSession::State StreamSession::state() const
+{
+	return mState;
+}
+//------------------------------------------
+void StreamSession::setState(State state)
+{
+	mState = state;
+	emit stateChanged(state);
+}
+//------------------------------------------
+QString StreamSession::host() const
+{
+	return mHost;
+}
+//------------------------------------------
+QString StreamSession::errorString() const
+{
+	return mTcpSocket.errorString();
+}
+//------------------------------------------
+int StreamSession::connectionAttempts() const
+{
+	return mConnectionAttempts;
+}
+//------------------------------------------
+const StreamSession::StartupTimes& StreamSession::startupTimes() const
+{
+	return mStartupTimes;
+}
+//------------------------------------------
+int StreamSession::elapsedSinceConnectMs() const
+{
+	return mStartupClock.isValid() ? mStartupClock.elapsed() : -1;
+}
+//------------------------------------------
+int StreamSession::reconnections() const
+{
+	return mReconnections;
+}
+//------------------------------------------
+int StreamSession::lastReconnectMs() const
+{
+	return mLastReconnectMs;
+}
+//------------------------------------------
+QImage StreamSession::lastFrame() const
+{
+	return mDecoder.getLastFrame();
+}
+//------------------------------------------
+QRegion StreamSession::takeDirtyRegion()
+{
+	return mDecoder.takeDirtyRegion();
+}
+//------------------------------------------
+QStreamDecoder& StreamSession::videoDecoder()
+{
+	return mDecoder;
+}
+//------------------------------------------
+int StreamSession::remoteOrientation() const
+{
+	return mRemoteOrientation;
+}
+//------------------------------------------
+int StreamSession::droppedRecords() const
+{
+	return mDroppedRecords;
+}
+//------------------------------------------
+StreamCaptureWriter& StreamSession::captureWriter()
+{
+	return mCaptureWriter;
+}
+//------------------------------------------
+StreamRelay& StreamSession::relay()
+{
+	return mRelay;
+}
+//------------------------------------------
+bool StreamSession::startRecording(const QString& path)
+{
+	return mRecorder.open(path, mCodecConfig);
+}
+//------------------------------------------
+StreamRecorder& StreamSession::recorder()
+{
+	return mRecorder;
+}
+//------------------------------------------
+ReplayRing& StreamSession::replayRing()
+{
+	return mReplayRing;
+}
+//------------------------------------------
+void StreamSession::onReadyRead()
+{
+	while (!mStopped && mTcpSocket.bytesAvailable() > 0)
+	{
+		// Read the pending bytes and split them into records
+		mFramer.append(mTcpSocket.readAll());
+
+		StreamRecord record;
+		while (!mStopped && mFramer.next(record))
+		{
+			processRecord(record);
+		}
+	}
+}
+//------------------------------------------
+void StreamSession::processRecord(const StreamRecord& record)
+{
+	if (mStopped)
+		return;
+
+	if (mCaptureWriter.isOpen())
+		mCaptureWriter.write(record);
+
+	if (mRelay.isListening())
+		mRelay.publish(record);
+
+	if (QStreamFramer::startsWithSps(record.video))
+		mCodecConfig = record.video;
+
+	if (mRecorder.isOpen())
+		mRecorder.write(record);
+
+	if (mReplayRing.isEnabled())
+		mReplayRing.push(record);
+
+	mRemoteOrientation = record.orientation;
+
+	if (mStartupTimes.firstRecordMs < 0 && record.video.size() > 0 && mStartupClock.isValid())
+		mStartupTimes.firstRecordMs = mStartupClock.elapsed();
+
+	if (mVideoStrand)
+	{
+		processRecordOnPool(record);
+		return;
+	}
+
+	// Decode the video frame (if any), from a keyframe after a reconnection
+	if (record.video.size() > 0 && mWaitingKeyFrame && !QStreamFramer::isKeyFrame(record.video))
+	{
+		mDroppedRecords++;
+	}
+	else if (record.video.size() > 0)
+	{
+		mWaitingKeyFrame = false;
+		unsigned char* buff = new unsigned char[record.video.size()];
+		memcpy(buff, record.video.constData(), record.video.size());
+		mDecoder.decodeFrame(buff, record.video.size());
+		mDecoder.process();
+	}
+
+	// If protocol version 4, decode the audio frame (if any)
+	if (record.audio.size() > 0)
+	{
+		unsigned char* buff = new unsigned char[record.audio.size()];
+		memcpy(buff, record.audio.constData(), record.audio.size());
+		mAudioDecoder.decodeFrame(buff, record.audio.size());
+		mAudioDecoder.process();
+	}
+}
+//------------------------------------------
+void StreamSession::processRecordOnPool(const StreamRecord& record)
+{
+	if (record.video.size() == 0)
+		return;
+
+	// When the pool is behind, drop whole GOPs rather than queuing latency
+	if (mVideoStrand->pending() >= MAX_PENDING_DECODES)
+		mWaitingKeyFrame = true;
+
+	if (mWaitingKeyFrame)
+	{
+		if (!QStreamFramer::isKeyFrame(record.video))
+		{
+			mDroppedRecords++;
+			return;
+		}
+		mWaitingKeyFrame = false;
+	}
+
+	int size = record.video.size();
+	unsigned char* buff = new unsigned char[size];
+	memcpy(buff, record.video.constData(), size);
+
+	QStreamDecoder* decoder = &mDecoder;
+	mVideoStrand->post([decoder, buff, size] {
+		decoder->decodeFrame(buff, size);
+		decoder->process();
+	});
+}
+//------------------------------------------
+void StreamSession::onDecodeFinished(bool result, bool isAudio)
+{
+	if (isAudio || !result || mStopped)
+		return;
+
+	if (mStartupTimes.firstFrameMs < 0 && mStartupClock.isValid())
+	{
+		mStartupTimes.firstFrameMs = mStartupClock.elapsed();
+		mStartupTimes.videoInitMs = mDecoder.initMs();
+		mStartupTimes.audioInitMs = mAudioDecoder.initMs();
+		qDebug() << "First frame from " << mHost << " after " << mStartupTimes.firstFrameMs << " ms: connected at "
+			<< mStartupTimes.connectedMs << " ms, first record at " << mStartupTimes.firstRecordMs
+			<< " ms; video codec set up in " << mStartupTimes.videoInitMs << " ms, audio in "
+			<< mStartupTimes.audioInitMs << " ms";
+	}
+
+	if (mAwaitingFirstFrame)
+	{
+		mAwaitingFirstFrame = false;
+		mReconnections++;
+		mLastReconnectMs = mOutageClock.elapsed();
+		qDebug() << "Reconnected to " << mHost << " in " << mReconnectConnectMs << " ms, first frame after "
+			<< mLastReconnectMs << " ms";
+		emit reconnected(mReconnectConnectMs, mLastReconnectMs);
+	}
+
+	emit frameReady();
+}
+//------------------------------------------
+void StreamSession::onSocketStateChanged()
+{
+	// Input is written straight to the descriptor, which is only valid while
+	// connected. Qt emits ClosingState before closing it.
+	if (mTcpSocket.state() == QAbstractSocket::ConnectedState)
+	{
+		mTcpSocket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+		mInputWriter.setSocket(mTcpSocket.socketDescriptor());
+	}
+	else
+	{
+		// The rest of a text would be typed somewhere else after reconnecting
+		mTextInjector.stop();
+		mInputWriter.setSocket(-1);
+	}
+
+	if (mStopped)
+	{
+		// Don't do anything if we stopped or closed the window
+		return;
+	}
+
+	if (mTcpSocket.state() == QAbstractSocket::ConnectedState)
+	{
+		// Samples of a gesture started before the reconnection are stale
+		mTouchEventPacket.resize(0);
+		mPendingMoveMask = 0;
+		mTouchBatch.clear();
+		mTimeSinceLastTouchEvent.restart();
+
+		if (mConnectionTimerId != -1)
+		{
+			killTimer(mConnectionTimerId);
+			mConnectionTimerId = -1;
+		}
+
+		if (mStartupTimes.connectedMs < 0 && mStartupClock.isValid())
+			mStartupTimes.connectedMs = mStartupClock.elapsed();
+
+		if (mReconnecting)
+		{
+			mReconnectConnectMs = mOutageClock.elapsed();
+			mAwaitingFirstFrame = true;
+			mReconnecting = false;
+		}
+
+		mConnectionAttempts = 0;
+		mRetryDelayMs = RECONNECT_MIN_DELAY_MS;
+		setState(SS_CONNECTED);
+	}
+	else if (mTcpSocket.state() == QAbstractSocket::UnconnectedState && mState == SS_CONNECTED)
+	{
+		// Lost: the decoders keep their contexts and the last frame, but not
+		// the references of a stream that won't continue
+		qDebug() << "Lost connection with " << mHost << ": " << mTcpSocket.errorString();
+		mOutageClock.start();
+		mReconnecting = true;
+		mAwaitingFirstFrame = false;
+		mConnectionAttempts = 0;
+		mRetryDelayMs = RECONNECT_MIN_DELAY_MS;
+		flushDecoders();
+
+		setState(SS_RECONNECTING);
+		scheduleConnection(0);
+	}
+	else if (mTcpSocket.state() == QAbstractSocket::UnconnectedState
+		&& (mState == SS_CONNECTING || mState == SS_RECONNECTING))
+	{
+		// This attempt failed (refused, unreachable or timed out)
+		const int maxAttempts = mReconnecting ? MAX_RECONNECTION_ATTEMPTS : MAX_CONNECTION_ATTEMPTS;
+		if (mConnectionAttempts >= maxAttempts)
+		{
+			if (mConnectionTimerId != -1)
+			{
+				killTimer(mConnectionTimerId);
+				mConnectionTimerId = -1;
+			}
+			setState(SS_FAILED);
+			return;
+		}
+
+		scheduleConnection(mRetryDelayMs);
+		mRetryDelayMs = qMin(mRetryDelayMs * 2, RECONNECT_MAX_DELAY_MS);
+	}
+}
+//------------------------------------------
+void StreamSession::timerEvent(QTimerEvent* evt)
+{
+	if (mStopped || evt->timerId() != mConnectionTimerId)
+		return;
+
+	// Single shot: either the retry delay or the attempt timeout is over
+	killTimer(mConnectionTimerId);
+	mConnectionTimerId = -1;
+
+	if (mTcpSocket.state() == QAbstractSocket::UnconnectedState)
+	{
+		attemptConnection();
+	}
+	else if (mTcpSocket.state() != QAbstractSocket::ConnectedState)
+	{
+		// Unable to connect in time: onSocketStateChanged schedules the next attempt
+		qDebug() << "Connection attempt " << mConnectionAttempts << " to " << mHost << " timed out";
+		mTcpSocket.abort();
+	}
+}
+//------------------------------------------
+void StreamSession::sendKeyboardInput(bool down, unsigned int keyCode)
+{
+	if (mTcpSocket.state() != QAbstractSocket::ConnectedState) return;
+
+	qDebug() << "Keyboard pressed: " << keyCode;
+
+	mInputPacket.resize(0);
+	InputSerializer::appendKeyboard(mInputPacket, down, keyCode);
+	mInputWriter.write(mInputPacket);
+}
+//------------------------------------------
+void StreamSession::sendTouchInput(TouchEventType type, unsigned char finger, unsigned short x, unsigned short y)
+{
+	TouchPointer pointer = { type, finger, x, y };
+	sendTouchFrame(&pointer, 1);
+}
+//------------------------------------------
+void StreamSession::sendTouchFrame(const TouchPointer* pointers, int count)
+{
+	if (mTcpSocket.state() != QAbstractSocket::ConnectedState || count <= 0) return;
+
+	if (mTouchBatching)
+	{
+		// Pointers of one frame share its timestamp
+		const qint64 now = mTouchClock.elapsed();
+		bool urgent = false;
+		for (int i = 0; i < count; i++)
+		{
+			const TouchPointer& pointer = pointers[i];
+			mTouchBatch.add(pointer.type, pointer.finger, pointer.x, pointer.y, (i == 0) ? now - mLastTouchSampleMs : 0);
+			urgent = urgent || pointer.type != TET_MOVE;
+
+			if (mTouchBatch.isFull())
+				flushTouchInput();
+		}
+		mLastTouchSampleMs = now;
+
+		// Presses and releases go out right away, with the moves before them
+		if (urgent)
+		{
+			flushTouchInput();
+			return;
+		}
+	}
+	else
+	{
+		for (int i = 0; i < count; i++)
+		{
+			const TouchPointer& pointer = pointers[i];
+			if (pointer.type == TET_MOVE)
+			{
+				const int slot = pointer.finger % MAX_TOUCH_POINTERS;
+				mPendingMoves[slot] = pointer;
+				mPendingMoveMask |= 1u << slot;
+				continue;
+			}
+
+			// Only moves can be coalesced: the pending ones go first
+			flushTouchInput();
+
+			mInputPacket.resize(0);
+			InputSerializer::appendTouch(mInputPacket, pointer.type, pointer.finger, pointer.x, pointer.y);
+			mInputWriter.write(mInputPacket);
+			mTimeSinceLastTouchEvent.restart();
+		}
+
+		if (mPendingMoveMask == 0)
+			return;
+	}
+
+	// Moves are sent at most every mTouchIntervalMs
+	if (!mTouchTimer.isActive())
+	{
+		int wait = mTouchIntervalMs - mTimeSinceLastTouchEvent.elapsed();
+		mTouchTimer.start(qMax(0, wait));
+	}
+}
+//------------------------------------------
+void StreamSession::setTouchBatching(bool enabled, int moveIntervalMs)
+{
+	if (enabled != mTouchBatching)
+	{
+		flushTouchInput();
+		mPendingMoveMask = 0;
+		mTouchBatch.clear();
+	}
+
+	mTouchBatching = enabled;
+	mTouchIntervalMs = qMax(0, moveIntervalMs);
+}
+//------------------------------------------
+bool StreamSession::touchBatching() const
+{
+	return mTouchBatching;
+}
+//------------------------------------------
+InputWriter& StreamSession::inputWriter()
+{
+	return mInputWriter;
+}
+//------------------------------------------
+TextInjector& StreamSession::textInjector()
+{
+	return mTextInjector;
+}
+//------------------------------------------
+void StreamSession::sendRawInput(const QByteArray& packet)
+{
+	if (mTcpSocket.state() != QAbstractSocket::ConnectedState) return;
+
+	mInputWriter.write(packet);
+}
+//------------------------------------------
+void StreamSession::flushTouchInput()
+{
+	mTouchTimer.stop();
+
+	// The pending packets: the batch, or the last move of each finger
+	if (mTouchBatching)
+	{
+		mTouchBatch.take(mTouchEventPacket);
+	}
+	else
+	{
+		for (int slot = 0; slot < MAX_TOUCH_POINTERS; slot++)
+		{
+			if (mPendingMoveMask & (1u << slot))
+			{
+				const TouchPointer& pointer = mPendingMoves[slot];
+				InputSerializer::appendTouch(mTouchEventPacket, pointer.type, pointer.finger, pointer.x, pointer.y);
+			}
+		}
+		mPendingMoveMask = 0;
+	}
+
+	if (mTouchEventPacket.size() > 0 && mTcpSocket.state() == QAbstractSocket::ConnectedState)
+	{
+		mInputWriter.write(mTouchEventPacket);
+		mTimeSinceLastTouchEvent.restart();
+	}
+
+	mTouchEventPacket.resize(0);
+}
+//------------------------------------------
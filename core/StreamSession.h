@@ -0,0 +1,263 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _STREAMSESSION_H_
+#define _STREAMSESSION_H_
+
+#include <QObject>
+#include <QTimer>
+#include <QTime>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QtNetwork/QTcpSocket>
+
+#include <memory>
+
+#include "QStreamFramer.h"
+#include "QStreamDecoder.h"
+#include "StreamCapture.h"
+#include "InputSerializer.h"
+#include "InputWriter.h"
+#include "TextInjector.h"
+#include "DecodePool.h"
+#include "StreamRelay.h"
+#include "StreamRecorder.h"
+#include "ReplayRing.h"
+
+#define DEFAULT_STREAM_PORT 9876
+#define MAX_CONNECTION_ATTEMPTS 3
+#define MAX_RECONNECTION_ATTEMPTS 8
+
+// Time given to each connection attempt, and the delay before the next one,
+// doubled after each failure
+#define CONNECT_TIMEOUT_MS 3000
+#define RECONNECT_MIN_DELAY_MS 250
+#define RECONNECT_MAX_DELAY_MS 4000
+
+// Video records queued on the decode pool before we drop up to the next keyframe
+#define MAX_PENDING_DECODES 8
+
+// Minimum interval between two touch packets carrying moves. Legacy
+// packets only keep the last move, batches keep all of them.
+#define TOUCH_EVENT_INTERVAL_MS 16
+
+// One connection to a device: socket, framing, decoding and input. Has no
+// UI, the owner displays lastFrame() when frameReady() is emitted.
+class StreamSession : public QObject
+{
+	Q_OBJECT;
+
+public:
+	enum State {
+		SS_IDLE,
+		SS_CONNECTING,
+		SS_CONNECTED,
+		SS_RECONNECTING,
+		SS_FAILED
+	};
+
+	// Phases of the wait for the first frame, in ms from connectTo(), -1
+	// until reached. The codecs are set up in parallel with the connection,
+	// their setup time is a duration.
+	struct StartupTimes
+	{
+		int connectedMs;
+		int firstRecordMs;
+		int firstFrameMs;
+		int videoInitMs;
+		int audioInitMs;
+
+		// ctor
+		StartupTimes();
+	};
+
+	// ctor
+	StreamSession(bool audioPlayback = true, QObject* parent = 0);
+
+	// dtor
+	~StreamSession();
+
+	// Connects without blocking, while the decoders are set up. A lost
+	// connection is retried with backoff; the decoders are kept, flushed,
+	// and resume at the next keyframe.
+	void connectTo(const QString& host, quint16 port = DEFAULT_STREAM_PORT);
+
+	// Decodes video on the given pool instead of the calling thread. Audio
+	// isn't decoded at all in that mode. Must be called before connecting.
+	void setDecodePool(DecodePool* pool);
+
+	// Focused sessions also jump ahead of the others on the decode pool
+	void setPriority(SessionPriority priority);
+	SessionPriority priority() const;
+
+	// Stops the session for good: no more reconnection, decoding or capture
+	void stop();
+
+	State state() const;
+	QString host() const;
+	QString errorString() const;
+	int connectionAttempts() const;
+
+	// Connections lost and reestablished, and for the last one, time from
+	// the loss to the first frame after it (-1 if none yet)
+	int reconnections() const;
+	int lastReconnectMs() const;
+
+	// Time to first frame of the last connectTo(), and the time since it
+	const StartupTimes& startupTimes() const;
+	int elapsedSinceConnectMs() const;
+
+	// Feeds a record that didn't come from the socket (e.g. a replay)
+	void processRecord(const StreamRecord& record);
+
+	QImage lastFrame() const;
+	int remoteOrientation() const;
+
+	// Part of lastFrame() that changed since the previous call
+	QRegion takeDirtyRegion();
+
+	QStreamDecoder& videoDecoder();
+
+	// Video records dropped because the decode pool couldn't keep up
+	int droppedRecords() const;
+
+	StreamCaptureWriter& captureWriter();
+
+	// Re-serves the records received to local viewers, see StreamRelay
+	StreamRelay& relay();
+
+	// Starts remuxing the session to an MP4/MKV file, see StreamRecorder
+	bool startRecording(const QString& path);
+	StreamRecorder& recorder();
+
+	// Last seconds of the session, kept compressed for instant replay
+	ReplayRing& replayRing();
+
+	void sendKeyboardInput(bool down, unsigned int keyCode);
+	void sendTouchInput(TouchEventType type, unsigned char finger, unsigned short x, unsigned short y);
+
+	// Every pointer of one input frame (e.g. a QTouchEvent), stationary ones
+	// as moves. Batched devices get them with the same timestamp; the others
+	// one packet per finger, keeping only the last move of each.
+	void sendTouchFrame(const TouchPointer* pointers, int count);
+
+	// Sends every touch sample in IET_TOUCH_BATCH packets, for devices
+	// announcing INPUT_CAP_TOUCH_BATCH. Presses and releases are sent right
+	// away, moves at most every moveIntervalMs.
+	void setTouchBatching(bool enabled, int moveIntervalMs = TOUCH_EVENT_INTERVAL_MS);
+	bool touchBatching() const;
+
+	// Sends the input packets, and measures how long they wait to be sent
+	InputWriter& inputWriter();
+
+	// Types text (e.g. a paste) on the device, paced; stopped on disconnection
+	TextInjector& textInjector();
+
+public slots:
+	// Sends an already serialized input packet (e.g. from a relay viewer)
+	void sendRawInput(const QByteArray& packet);
+
+signals:
+	void stateChanged(StreamSession::State state);
+	void frameReady();
+	void audioError(const QString& message);
+
+	// First frame after a reconnection: time from the loss to the connection,
+	// and to that frame
+	void reconnected(int connectMs, int firstFrameMs);
+
+protected:
+	void timerEvent(QTimerEvent* evt);
+	void attemptConnection();
+	void scheduleConnection(int delayMs);
+	void flushDecoders();
+	void setState(State state);
+	void processRecordOnPool(const StreamRecord& record);
+
+protected slots:
+	void onReadyRead();
+	void onSocketStateChanged();
+	void onDecodeFinished(bool result, bool isAudio);
+	void flushTouchInput();
+
+protected:
+	QTcpSocket mTcpSocket;
+	QStreamFramer mFramer;
+	StreamCaptureWriter mCaptureWriter;
+	StreamRelay mRelay;
+	StreamRecorder mRecorder;
+	ReplayRing mReplayRing;
+
+	// Last SPS/PPS received, for recordings started mid-stream
+	QByteArray mCodecConfig;
+
+	// Decoders
+	QStreamDecoder mDecoder;
+	QStreamDecoder mAudioDecoder;
+
+	// Pool decoding (declared after the decoders, so it's drained first)
+	std::unique_ptr<DecodeStrand> mVideoStrand;
+	bool mWaitingKeyFrame;
+	int mDroppedRecords;
+
+	// Connection
+	State mState;
+	QString mHost;
+	quint16 mPort;
+	bool mStopped;
+	int mConnectionAttempts;
+	int mConnectionTimerId;
+
+	// Reconnection after a loss, and its time to first frame
+	bool mReconnecting;
+	int mRetryDelayMs;
+	QElapsedTimer mOutageClock;
+	int mReconnectConnectMs;
+	bool mAwaitingFirstFrame;
+	int mReconnections;
+	int mLastReconnectMs;
+
+	// Time to first frame
+	QElapsedTimer mStartupClock;
+	StartupTimes mStartupTimes;
+
+	// Remote frame info
+	int mRemoteOrientation;
+
+	// Local input info (the writer is declared after the socket, so it's
+	// done with its descriptor first)
+	InputWriter mInputWriter;
+	QByteArray mInputPacket;
+	TextInjector mTextInjector;
+	QTimer mTouchTimer;
+	QTime mTimeSinceLastTouchEvent;
+	QByteArray mTouchEventPacket;
+
+	// Last move of each finger not sent yet (legacy packets)
+	TouchPointer mPendingMoves[MAX_TOUCH_POINTERS];
+	quint32 mPendingMoveMask;
+
+	// Touch batching
+	bool mTouchBatching;
+	int mTouchIntervalMs;
+	TouchBatch mTouchBatch;
+	QElapsedTimer mTouchClock;
+	qint64 mLastTouchSampleMs;
+};
+
+#endif
@@ -0,0 +1,300 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "SubnetScanner.h"
+
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QNetworkInterface>
+#include <QDebug>
+
+// Timeouts are checked this often
+#define SCAN_TICK_MS 10
+
+//------------------------------------------
+SubnetScanner::SubnetScanner(QObject* parent) :
+	QObject(parent),
+	mNextHost(0),
+	mPort(0),
+	mBusyProbes(0),
+	mConcurrency(SCAN_CONCURRENCY),
+	mTimeoutMs(SCAN_TIMEOUT_MS),
+	mFillPending(false),
+	mProbed(0),
+	mFound(0),
+	mRunning(false),
+	mElapsedMs(0)
+{
+	mTickTimer.setTimerType(Qt::PreciseTimer);
+	connect(&mTickTimer, SIGNAL(timeout()), this, SLOT(onTick()));
+}
+//------------------------------------------
+SubnetScanner::~SubnetScanner()
+{
+	stop();
+
+	for (QVector<Probe>::iterator it = mProbes.begin(); it != mProbes.end(); ++it)
+		delete it->socket;
+}
+//------------------------------------------
+bool SubnetScanner::start(const QStringList& ranges, quint16 port)
+{
+	stop();
+
+	const QStringList scanned = ranges.isEmpty() ? localSubnets() : ranges;
+	mHosts.clear();
+	for (QStringList::const_iterator it = scanned.begin(); it != scanned.end(); ++it)
+	{
+		if (!parseRange(it->trimmed(), mHosts))
+			qDebug() << "Not a valid IPv4 range to scan: " << *it;
+	}
+
+	if (mHosts.size() > SCAN_MAX_HOSTS)
+	{
+		qDebug() << "Scanning the first " << SCAN_MAX_HOSTS << " of " << mHosts.size() << " hosts";
+		mHosts.resize(SCAN_MAX_HOSTS);
+	}
+
+	if (mHosts.isEmpty())
+		return false;
+
+	qDebug() << "Scanning " << mHosts.size() << " hosts of " << scanned.join(", ") << " on port " << port;
+
+	// The sockets are kept from one probe (and one scan) to the next
+	while (mProbes.size() < mConcurrency)
+	{
+		Probe probe;
+		probe.socket = new QTcpSocket(this);
+		probe.address = 0;
+		probe.deadline = 0;
+		probe.busy = false;
+
+		connect(probe.socket, SIGNAL(connected()), this, SLOT(onProbeConnected()));
+		connect(probe.socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(onProbeError()));
+		mProbeIndex.insert(probe.socket, mProbes.size());
+		mProbes.push_back(probe);
+	}
+
+	mPort = port;
+	mNextHost = 0;
+	mProbed = 0;
+	mFound = 0;
+	mElapsedMs = 0;
+	mRunning = true;
+	mClock.start();
+	mTickTimer.start(SCAN_TICK_MS);
+
+	fillWindow();
+	return true;
+}
+//------------------------------------------
+void SubnetScanner::stop()
+{
+	if (!mRunning)
+		return;
+
+	mRunning = false;
+	mTickTimer.stop();
+	mElapsedMs = mClock.elapsed();
+
+	for (QVector<Probe>::iterator it = mProbes.begin(); it != mProbes.end(); ++it)
+	{
+		if (it->busy)
+		{
+			it->busy = false;
+			it->socket->abort();
+		}
+	}
+	mBusyProbes = 0;
+}
+//------------------------------------------
+bool SubnetScanner::isRunning() const
+{
+	return mRunning;
+}
+//------------------------------------------
+void SubnetScanner::setConcurrency(int connections)
+{
+	mConcurrency = qMax(1, connections);
+}
+//------------------------------------------
+void SubnetScanner::setTimeout(int ms)
+{
+	mTimeoutMs = qMax(1, ms);
+}
+//------------------------------------------
+int SubnetScanner::hostCount() const
+{
+	return mHosts.size();
+}
+//------------------------------------------
+int SubnetScanner::probedCount() const
+{
+	return mProbed;
+}
+//------------------------------------------
+int SubnetScanner::foundCount() const
+{
+	return mFound;
+}
+//------------------------------------------
+qint64 SubnetScanner::elapsedMs() const
+{
+	return mRunning ? mClock.elapsed() : mElapsedMs;
+}
+//------------------------------------------
+QStringList SubnetScanner::localSubnets()
+{
+	QStringList subnets;
+
+	QList<QNetworkInterface> interfaces = QNetworkInterface::allInterfaces();
+	for (QList<QNetworkInterface>::const_iterator it = interfaces.begin(); it != interfaces.end(); ++it)
+	{
+		const QNetworkInterface::InterfaceFlags flags = it->flags();
+		if (!(flags & QNetworkInterface::IsUp) || !(flags & QNetworkInterface::IsRunning)
+			|| (flags & QNetworkInterface::IsLoopBack))
+			continue;
+
+		QList<QNetworkAddressEntry> entries = it->addressEntries();
+		for (QList<QNetworkAddressEntry>::const_iterator entry = entries.begin(); entry != entries.end(); ++entry)
+		{
+			if (entry->ip().protocol() != QAbstractSocket::IPv4Protocol)
+				continue;
+
+			// Larger networks are scanned around our own address only
+			const int prefix = qMax(24, entry->prefixLength());
+			const quint32 mask = 0xFFFFFFFFu << (32 - prefix);
+			const QString subnet = QString("%1/%2").arg(QHostAddress(entry->ip().toIPv4Address() & mask).toString()).arg(prefix);
+
+			if (!subnets.contains(subnet))
+				subnets.push_back(subnet);
+		}
+	}
+
+	return subnets;
+}
+//------------------------------------------
+bool SubnetScanner::parseRange(const QString& range, QVector<quint32>& hosts)
+{
+	// A single address is a /32
+	QPair<QHostAddress, int> subnet = QHostAddress::parseSubnet(range.contains('/') ? range : range + "/32");
+	if (subnet.first.protocol() != QAbstractSocket::IPv4Protocol || subnet.second < 0)
+		return false;
+
+	const int prefix = subnet.second;
+	const quint32 mask = (prefix == 0) ? 0 : 0xFFFFFFFFu << (32 - prefix);
+	const quint32 network = subnet.first.toIPv4Address() & mask;
+	const quint32 last = network | ~mask;
+
+	if (prefix >= 31)
+	{
+		// No network nor broadcast address
+		for (quint64 address = network; address <= last; address++)
+			hosts.push_back((quint32) address);
+		return true;
+	}
+
+	for (quint64 address = network + 1; address < last && hosts.size() <= SCAN_MAX_HOSTS; address++)
+		hosts.push_back((quint32) address);
+
+	return true;
+}
+//------------------------------------------
+void SubnetScanner::fillWindow()
+{
+	mFillPending = false;
+	if (!mRunning)
+		return;
+
+	// The sockets of an earlier, wider scan are kept, but not used past the window
+	for (QVector<Probe>::iterator it = mProbes.begin();
+		it != mProbes.end() && mNextHost < mHosts.size() && mBusyProbes < mConcurrency; ++it)
+	{
+		if (it->busy || it->socket->state() != QAbstractSocket::UnconnectedState)
+			continue;
+
+		it->busy = true;
+		it->address = mHosts[mNextHost++];
+		it->deadline = mClock.elapsed() + mTimeoutMs;
+		mBusyProbes++;
+		it->socket->connectToHost(QHostAddress(it->address), mPort);
+	}
+
+	if (mNextHost >= mHosts.size() && mBusyProbes == 0)
+	{
+		stop();
+		qDebug() << "Scanned " << mProbed << " hosts in " << mElapsedMs << " ms, found " << mFound;
+		emit finished();
+	}
+}
+//------------------------------------------
+void SubnetScanner::scheduleFill()
+{
+	// Not from the handlers of the sockets, which may be reused right away
+	if (mFillPending)
+		return;
+
+	mFillPending = true;
+	QMetaObject::invokeMethod(this, "fillWindow", Qt::QueuedConnection);
+}
+//------------------------------------------
+void SubnetScanner::endProbe(Probe& probe, bool found)
+{
+	if (!probe.busy)
+		return;
+
+	probe.busy = false;
+	mBusyProbes--;
+	mProbed++;
+
+	// Only the answer matters, the device doesn't get to stream
+	probe.socket->abort();
+
+	if (found)
+	{
+		mFound++;
+		emit deviceFound(QHostAddress(probe.address).toString());
+	}
+
+	scheduleFill();
+}
+//------------------------------------------
+void SubnetScanner::onProbeConnected()
+{
+	const int index = mProbeIndex.value(QObject::sender(), -1);
+	if (index >= 0)
+		endProbe(mProbes[index], true);
+}
+//------------------------------------------
+void SubnetScanner::onProbeError()
+{
+	// Refused, unreachable...
+	const int index = mProbeIndex.value(QObject::sender(), -1);
+	if (index >= 0)
+		endProbe(mProbes[index], false);
+}
+//------------------------------------------
+void SubnetScanner::onTick()
+{
+	const qint64 now = mClock.elapsed();
+	for (QVector<Probe>::iterator it = mProbes.begin(); it != mProbes.end(); ++it)
+	{
+		if (it->busy && now >= it->deadline)
+			endProbe(*it, false);
+	}
+}
+//------------------------------------------
@@ -0,0 +1,115 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _SUBNETSCANNER_H_
+#define _SUBNETSCANNER_H_
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QtNetwork/QTcpSocket>
+
+// Connections in flight at once, and how long each host gets to accept
+#define SCAN_CONCURRENCY 128
+#define SCAN_TIMEOUT_MS 250
+
+// Largest range scanned (a /20)
+#define SCAN_MAX_HOSTS 4096
+
+// Finds the devices that can't be discovered through their announcements
+// (UDP broadcasts are often blocked): tries a TCP connection to the stream
+// port of every host of a range, a window of them at a time, and reports
+// the hosts that accept as soon as they do.
+class SubnetScanner : public QObject
+{
+	Q_OBJECT;
+
+public:
+	// ctor
+	SubnetScanner(QObject* parent = 0);
+
+	// dtor
+	~SubnetScanner();
+
+	// Ranges in CIDR notation ("192.168.1.0/24"), the local /24s if empty.
+	// Returns false if there's no valid range.
+	bool start(const QStringList& ranges, quint16 port);
+	void stop();
+	bool isRunning() const;
+
+	// Call before start()
+	void setConcurrency(int connections);
+	void setTimeout(int ms);
+
+	int hostCount() const;
+	int probedCount() const;
+	int foundCount() const;
+	qint64 elapsedMs() const;
+
+	// The /24 (or smaller) IPv4 networks of the interfaces that are up
+	static QStringList localSubnets();
+
+	// Host addresses of a CIDR range, false if it's not a valid IPv4 range
+	static bool parseRange(const QString& range, QVector<quint32>& hosts);
+
+signals:
+	void deviceFound(const QString& address);
+	void finished();
+
+protected slots:
+	void onProbeConnected();
+	void onProbeError();
+	void onTick();
+	void fillWindow();
+
+protected:
+	struct Probe
+	{
+		QTcpSocket* socket;
+		quint32 address;
+		qint64 deadline;
+		bool busy;
+	};
+
+	void endProbe(Probe& probe, bool found);
+	void scheduleFill();
+
+protected:
+	QVector<quint32> mHosts;
+	int mNextHost;
+	quint16 mPort;
+
+	QVector<Probe> mProbes;
+	QHash<QObject*, int> mProbeIndex;
+	int mBusyProbes;
+	int mConcurrency;
+	int mTimeoutMs;
+	bool mFillPending;
+
+	int mProbed;
+	int mFound;
+	bool mRunning;
+	QTimer mTickTimer;
+	QElapsedTimer mClock;
+	qint64 mElapsedMs;
+};
+
+#endif
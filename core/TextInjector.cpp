@@ -0,0 +1,296 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "TextInjector.h"
+#include "InputWriter.h"
+#include "InputSerializer.h"
+
+#include <QDebug>
+
+// Rows of a US keyboard, with the Linux (evdev) code of their first key.
+// Those are also the PC scan codes Windows reports; X11 adds 8 to them.
+struct KeyRow
+{
+	unsigned int firstCode;
+	const char* keys;
+	const char* shifted;
+};
+
+static const KeyRow KEY_ROWS[] = {
+	{ 2, "1234567890-=", "!@#$%^&*()_+" },
+	{ 16, "qwertyuiop[]", "QWERTYUIOP{}" },
+	{ 30, "asdfghjkl;'`", "ASDFGHJKL:\"~" },
+	{ 43, "\\zxcvbnm,./", "|ZXCVBNM<>?" },
+};
+
+#define KEY_CODE_TAB 15
+#define KEY_CODE_ENTER 28
+#define KEY_CODE_SHIFT 42
+#define KEY_CODE_SPACE 57
+
+//------------------------------------------
+// Key code sent by the screen window for a key: the Qt key on macOS, the
+// native scan code elsewhere
+static unsigned int platformKeyCode(unsigned int code, char key)
+{
+#if defined(Q_OS_MAC)
+	switch (code)
+	{
+	case KEY_CODE_TAB: return Qt::Key_Tab;
+	case KEY_CODE_ENTER: return Qt::Key_Return;
+	case KEY_CODE_SHIFT: return Qt::Key_Shift;
+	default: return (unsigned char) key;
+	}
+#elif defined(Q_OS_WIN)
+	Q_UNUSED(key);
+	return code;
+#else
+	Q_UNUSED(key);
+	return code + 8;
+#endif
+}
+//------------------------------------------
+TextInjector::TextInjector(InputWriter* writer, QObject* parent) :
+	QObject(parent),
+	mWriter(writer),
+	mTyped(0),
+	mSkipped(0),
+	mRate(TEXT_INJECT_DEFAULT_RATE),
+	mElapsedMs(0)
+{
+	connect(&mTickTimer, SIGNAL(timeout()), this, SLOT(onTick()));
+}
+//------------------------------------------
+TextInjector::~TextInjector()
+{
+	stop();
+}
+//------------------------------------------
+int TextInjector::start(const QString& text, int charsPerSecond)
+{
+	stop();
+
+	mPackets.resize(0);
+	mCharEnds.resize(0);
+	mTyped = 0;
+	mSkipped = 0;
+	mRate = qMax(0, charsPerSecond);
+	mElapsedMs = 0;
+
+	// Mapped once: down and up of each key, shift pressed around runs of
+	// shifted characters
+	bool shiftDown = false;
+	for (int i = 0; i < text.size(); i++)
+	{
+		// "\r\n" is one line break
+		if (text[i] == '\r' && i + 1 < text.size() && text[i + 1] == '\n')
+			continue;
+
+		KeyStroke stroke;
+		if (!keyStrokeFor(text[i], stroke))
+		{
+			mSkipped++;
+			continue;
+		}
+
+		if (stroke.shift != shiftDown)
+		{
+			InputSerializer::appendKeyboard(mPackets, stroke.shift, shiftKeyCode());
+			shiftDown = stroke.shift;
+		}
+
+		InputSerializer::appendKeyboard(mPackets, true, stroke.keyCode);
+		InputSerializer::appendKeyboard(mPackets, false, stroke.keyCode);
+		mCharEnds.push_back(mPackets.size());
+	}
+
+	if (shiftDown)
+	{
+		InputSerializer::appendKeyboard(mPackets, false, shiftKeyCode());
+		mCharEnds.back() = mPackets.size();
+	}
+
+	if (mSkipped > 0)
+		qDebug() << mSkipped << " characters have no key and won't be typed";
+
+	if (mCharEnds.isEmpty())
+		return 0;
+
+	mClock.start();
+	mTickTimer.start(mRate > 0 ? TEXT_INJECT_TICK_MS : 0);
+	onTick();
+
+	return mCharEnds.size();
+}
+//------------------------------------------
+void TextInjector::stop()
+{
+	if (!mTickTimer.isActive())
+		return;
+
+	mTickTimer.stop();
+	mElapsedMs = mClock.elapsed();
+
+	// Stopped in a run of shifted characters, shift would stay down
+	if (mTyped < mCharEnds.size())
+	{
+		QByteArray release;
+		InputSerializer::appendKeyboard(release, false, shiftKeyCode());
+		mWriter->write(release);
+	}
+}
+//------------------------------------------
+bool TextInjector::isRunning() const
+{
+	return mTickTimer.isActive();
+}
+//------------------------------------------
+int TextInjector::typedCount() const
+{
+	return mTyped;
+}
+//------------------------------------------
+int TextInjector::totalCount() const
+{
+	return mCharEnds.size();
+}
+//------------------------------------------
+int TextInjector::skippedCount() const
+{
+	return mSkipped;
+}
+//------------------------------------------
+qint64 TextInjector::elapsedMs() const
+{
+	return isRunning() ? mClock.elapsed() : mElapsedMs;
+}
+//------------------------------------------
+void TextInjector::onTick()
+{
+	if (!mTickTimer.isActive())
+		return;
+
+	// Characters due since the start, at most a chunk at once
+	int due = mCharEnds.size();
+	if (mRate > 0)
+		due = qMin(due, (int) ((mClock.elapsed() * mRate) / 1000) + 1);
+	due = qMin(due, mTyped + TEXT_INJECT_MAX_CHUNK);
+
+	if (due > mTyped)
+	{
+		const int from = (mTyped > 0) ? mCharEnds[mTyped - 1] : 0;
+		const int to = mCharEnds[due - 1];
+
+		// The writer is full (or disconnected): the same chunk goes next tick
+		if (!mWriter->write(mPackets.constData() + from, to - from))
+			return;
+
+		mTyped = due;
+	}
+
+	if (mTyped >= mCharEnds.size())
+	{
+		mTickTimer.stop();
+		mElapsedMs = mClock.elapsed();
+		emit finished();
+	}
+}
+//------------------------------------------
+bool TextInjector::keyStrokeFor(QChar c, KeyStroke& stroke)
+{
+	const ushort u = c.unicode();
+	stroke.shift = false;
+
+	switch (u)
+	{
+	case '\t':
+		stroke.keyCode = platformKeyCode(KEY_CODE_TAB, '\t');
+		return true;
+
+	case '\n':
+	case '\r':
+		stroke.keyCode = platformKeyCode(KEY_CODE_ENTER, '\n');
+		return true;
+
+	case ' ':
+		stroke.keyCode = platformKeyCode(KEY_CODE_SPACE, ' ');
+		return true;
+	}
+
+	if (u < 0x21 || u > 0x7E)
+		return false;
+
+	for (size_t row = 0; row < sizeof(KEY_ROWS) / sizeof(KEY_ROWS[0]); row++)
+	{
+		for (int key = 0; KEY_ROWS[row].keys[key]; key++)
+		{
+			if (KEY_ROWS[row].keys[key] != u && KEY_ROWS[row].shifted[key] != u)
+				continue;
+
+			stroke.shift = (KEY_ROWS[row].shifted[key] == u);
+#if defined(Q_OS_MAC)
+			// Qt reports the character typed (e.g. Key_Exclam for shift+1),
+			// letters as capitals
+			stroke.keyCode = (u >= 'a' && u <= 'z') ? u - 'a' + Qt::Key_A : u;
+#else
+			stroke.keyCode = platformKeyCode(KEY_ROWS[row].firstCode + key, KEY_ROWS[row].keys[key]);
+#endif
+			return true;
+		}
+	}
+
+	return false;
+}
+//------------------------------------------
+QChar TextInjector::charFor(unsigned int keyCode, bool shift)
+{
+	static const char SPECIAL_KEYS[] = { '\t', '\n', ' ' };
+	static const unsigned int SPECIAL_CODES[] = { KEY_CODE_TAB, KEY_CODE_ENTER, KEY_CODE_SPACE };
+
+	for (size_t i = 0; i < sizeof(SPECIAL_CODES) / sizeof(SPECIAL_CODES[0]); i++)
+	{
+		if (keyCode == platformKeyCode(SPECIAL_CODES[i], SPECIAL_KEYS[i]))
+			return QChar(SPECIAL_KEYS[i]);
+	}
+
+	for (size_t row = 0; row < sizeof(KEY_ROWS) / sizeof(KEY_ROWS[0]); row++)
+	{
+		for (int key = 0; KEY_ROWS[row].keys[key]; key++)
+		{
+			KeyStroke stroke;
+			keyStrokeFor(QChar(KEY_ROWS[row].keys[key]), stroke);
+			if (stroke.keyCode == keyCode)
+				return QChar(shift ? KEY_ROWS[row].shifted[key] : KEY_ROWS[row].keys[key]);
+
+#if defined(Q_OS_MAC)
+			// The shifted characters have their own key
+			keyStrokeFor(QChar(KEY_ROWS[row].shifted[key]), stroke);
+			if (stroke.keyCode == keyCode)
+				return QChar(KEY_ROWS[row].shifted[key]);
+#endif
+		}
+	}
+
+	return QChar();
+}
+//------------------------------------------
+unsigned int TextInjector::shiftKeyCode()
+{
+	return platformKeyCode(KEY_CODE_SHIFT, 0);
+}
+//------------------------------------------
@@ -0,0 +1,101 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _TEXTINJECTOR_H_
+#define _TEXTINJECTOR_H_
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+class InputWriter;
+
+// Characters per second typed by default, that the device keeps up with
+#define TEXT_INJECT_DEFAULT_RATE 100
+
+// Characters handed to the writer at most per tick, and the tick period
+#define TEXT_INJECT_MAX_CHUNK 256
+#define TEXT_INJECT_TICK_MS 10
+
+// Types a text on the device: each character is mapped once to the key
+// presses of a US keyboard, in the key codes the screen window sends for
+// the same keys, and the packets are handed to the input writer by chunks,
+// paced to a number of characters per second.
+class TextInjector : public QObject
+{
+	Q_OBJECT;
+
+public:
+	struct KeyStroke
+	{
+		unsigned int keyCode;
+		bool shift;
+	};
+
+	// ctor
+	TextInjector(InputWriter* writer, QObject* parent = 0);
+
+	// dtor
+	~TextInjector();
+
+	// Starts typing text, replacing any text still being typed. A rate of 0
+	// sends as fast as the writer takes the packets. Returns the number of
+	// characters that will be typed (the others have no key).
+	int start(const QString& text, int charsPerSecond = TEXT_INJECT_DEFAULT_RATE);
+	void stop();
+	bool isRunning() const;
+
+	// Progress of the current (or last) text
+	int typedCount() const;
+	int totalCount() const;
+	int skippedCount() const;
+	qint64 elapsedMs() const;
+
+	// Keys of a character on a US keyboard; false if it has none
+	static bool keyStrokeFor(QChar c, KeyStroke& stroke);
+
+	// Character typed by a key, the reverse of keyStrokeFor; null if none
+	static QChar charFor(unsigned int keyCode, bool shift);
+
+	static unsigned int shiftKeyCode();
+
+signals:
+	void finished();
+
+protected slots:
+	void onTick();
+
+protected:
+	InputWriter* mWriter;
+	QTimer mTickTimer;
+	QElapsedTimer mClock;
+
+	// Key packets of the whole text, and where each character ends in them
+	QByteArray mPackets;
+	QVector<int> mCharEnds;
+
+	int mTyped;
+	int mSkipped;
+	int mRate;
+	qint64 mElapsedMs;
+};
+
+#endif
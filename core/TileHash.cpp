@@ -0,0 +1,181 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TileHash.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TILEHASH_SSE2
+#endif
+
+//------------------------------------------
+// Two running sums per 32 bits lane, Fletcher style: the first one catches
+// any single byte change, the second one makes the hash depend on where
+// the bytes are. The scalar version gives the same result as the SSE2 one.
+//------------------------------------------
+#ifdef TILEHASH_SSE2
+static void hashRow(const uint8_t* row, int width, __m128i& a, __m128i& b)
+{
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		a = _mm_add_epi32(a, _mm_loadu_si128((const __m128i*) (row + x)));
+		b = _mm_add_epi32(b, a);
+	}
+
+	if (x < width)
+	{
+		uint8_t tail[16] = { 0 };
+		memcpy(tail, row + x, width - x);
+		a = _mm_add_epi32(a, _mm_loadu_si128((const __m128i*) tail));
+		b = _mm_add_epi32(b, a);
+	}
+}
+#else
+static void hashRow(const uint8_t* row, int width, uint32_t* a, uint32_t* b)
+{
+	for (int x = 0; x < width; x += 16)
+	{
+		uint8_t block[16] = { 0 };
+		memcpy(block, row + x, qMin(16, width - x));
+
+		uint32_t lanes[4];
+		memcpy(lanes, block, 16);
+		for (int i = 0; i < 4; i++)
+		{
+			a[i] += lanes[i];
+			b[i] += a[i];
+		}
+	}
+}
+#endif
+//------------------------------------------
+uint64_t TileHash::hashBlock(const uint8_t* data, int linesize, int width, int height)
+{
+	uint32_t sums[8];
+
+#ifdef TILEHASH_SSE2
+	__m128i a = _mm_setzero_si128(), b = _mm_setzero_si128();
+	for (int y = 0; y < height; y++)
+		hashRow(data + y * linesize, width, a, b);
+
+	_mm_storeu_si128((__m128i*) sums, a);
+	_mm_storeu_si128((__m128i*) (sums + 4), b);
+#else
+	memset(sums, 0, sizeof(sums));
+	for (int y = 0; y < height; y++)
+		hashRow(data + y * linesize, width, sums, sums + 4);
+#endif
+
+	// FNV-1a over the lanes
+	uint64_t hash = 14695981039346656037ULL;
+	for (int i = 0; i < 8; i++)
+		hash = (hash ^ sums[i]) * 1099511628211ULL;
+
+	return hash;
+}
+//------------------------------------------
+TileHash::TileHash() :
+	mWidth(0),
+	mHeight(0),
+	mColumns(0),
+	mRows(0)
+{
+}
+//------------------------------------------
+void TileHash::reset()
+{
+	mWidth = mHeight = 0;
+	mColumns = mRows = 0;
+	mHashes.clear();
+	mDirty.clear();
+}
+//------------------------------------------
+int TileHash::update(const uint8_t* plane, int linesize, int width, int height)
+{
+	const bool resized = (width != mWidth || height != mHeight);
+	if (resized)
+	{
+		mWidth = width;
+		mHeight = height;
+		mColumns = (width + CHANGE_TILE_SIZE - 1) / CHANGE_TILE_SIZE;
+		mRows = (height + CHANGE_TILE_SIZE - 1) / CHANGE_TILE_SIZE;
+		mHashes.fill(0, mColumns * mRows);
+		mDirty.fill(1, mColumns * mRows);
+	}
+
+	int dirty = 0;
+	for (int row = 0; row < mRows; row++)
+	{
+		for (int column = 0; column < mColumns; column++)
+		{
+			const QRect rect = tileRect(column, row);
+			const uint64_t hash = hashBlock(plane + rect.y() * linesize + rect.x(), linesize, rect.width(), rect.height());
+
+			const int index = row * mColumns + column;
+			const bool changed = resized || hash != mHashes[index];
+			mHashes[index] = hash;
+			mDirty[index] = changed;
+
+			if (changed)
+				dirty++;
+		}
+	}
+
+	return dirty;
+}
+//------------------------------------------
+int TileHash::columns() const
+{
+	return mColumns;
+}
+//------------------------------------------
+int TileHash::rows() const
+{
+	return mRows;
+}
+//------------------------------------------
+int TileHash::tileCount() const
+{
+	return mColumns * mRows;
+}
+//------------------------------------------
+bool TileHash::isTileDirty(int column, int row) const
+{
+	return mDirty[row * mColumns + column] != 0;
+}
+//------------------------------------------
+bool TileHash::isRowDirty(int row) const
+{
+	for (int column = 0; column < mColumns; column++)
+	{
+		if (mDirty[row * mColumns + column])
+			return true;
+	}
+
+	return false;
+}
+//------------------------------------------
+QRect TileHash::tileRect(int column, int row) const
+{
+	const int x = column * CHANGE_TILE_SIZE;
+	const int y = row * CHANGE_TILE_SIZE;
+	return QRect(x, y, qMin(CHANGE_TILE_SIZE, mWidth - x), qMin(CHANGE_TILE_SIZE, mHeight - y));
+}
+//------------------------------------------
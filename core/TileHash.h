@@ -0,0 +1,67 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TILEHASH_H_
+#define _TILEHASH_H_
+
+#include <QVector>
+#include <QRect>
+
+#include <stdint.h>
+
+// Side of the square tiles, in luma pixels (a multiple of the 16x16 macroblocks)
+#define CHANGE_TILE_SIZE 64
+
+// Finds what changed between two decoded pictures. Macroblocks the encoder
+// skipped are copied from the reference frame, so an unchanged area of the
+// screen gives byte-identical planes: a hash per tile of the luma plane is
+// enough to tell which tiles need converting and presenting again.
+class TileHash
+{
+public:
+	// ctor
+	TileHash();
+
+	// Hashes the plane and compares it with the previous call. Returns the
+	// number of tiles that changed; all of them after a reset or a size change.
+	int update(const uint8_t* plane, int linesize, int width, int height);
+
+	// Forgets the previous picture, the next update reports every tile
+	void reset();
+
+	int columns() const;
+	int rows() const;
+	int tileCount() const;
+
+	bool isTileDirty(int column, int row) const;
+	bool isRowDirty(int row) const;
+	QRect tileRect(int column, int row) const;
+
+	// Position dependent hash of a block of bytes, SSE2 when available
+	static uint64_t hashBlock(const uint8_t* data, int linesize, int width, int height);
+
+protected:
+	int mWidth;
+	int mHeight;
+	int mColumns;
+	int mRows;
+
+	QVector<uint64_t> mHashes;
+	QVector<char> mDirty;
+};
+
+#endif
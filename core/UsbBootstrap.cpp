@@ -0,0 +1,181 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "UsbBootstrap.h"
+
+#include <QDebug>
+
+//------------------------------------------
+UsbBootstrap::UsbBootstrap(QObject* parent) :
+	QObject(parent),
+	mPrepared(false),
+	mCheckStep(-1),
+	mCopyStep(-1),
+	mChmodStep(-1)
+{
+	connect(&mRunner, SIGNAL(stepFinished(int)), this, SLOT(onStepFinished(int)));
+	connect(&mRunner, SIGNAL(finished(bool)), this, SLOT(onFinished(bool)));
+}
+//------------------------------------------
+void UsbBootstrap::setAdbPath(const QString& path)
+{
+	mRunner.setProgram(path);
+}
+//------------------------------------------
+bool UsbBootstrap::start()
+{
+	if (mRunner.isRunning())
+		return false;
+
+	mRunner.clear();
+
+	// The check may fail (no copy yet, or no cmp before Android 6): it only
+	// decides whether the other steps are needed. The shell of older devices
+	// always exits with 0, so the result is printed.
+	QStringList args;
+	args << "shell" << QString("cmp -s %1 %2 && [ -x %2 ] && echo %3")
+		.arg(BBQSCREEN_APP_BINARY, BBQSCREEN_EXEC_BINARY, BBQSCREEN_READY_MARKER);
+	mCheckStep = mRunner.addStep("check", args, QList<int>(), ADB_STEP_TIMEOUT_MS, true);
+
+	args.clear();
+	args << "shell" << "cp" << BBQSCREEN_APP_BINARY << BBQSCREEN_EXEC_BINARY;
+	mCopyStep = mRunner.addStep("copy", args, QList<int>() << mCheckStep);
+
+	args.clear();
+	args << "shell" << "chmod" << "755" << BBQSCREEN_EXEC_BINARY;
+	mChmodStep = mRunner.addStep("chmod", args, QList<int>() << mCopyStep);
+
+	return mRunner.start();
+}
+//------------------------------------------
+void UsbBootstrap::cancel()
+{
+	mRunner.cancel();
+}
+//------------------------------------------
+bool UsbBootstrap::isRunning() const
+{
+	return mRunner.isRunning();
+}
+//------------------------------------------
+bool UsbBootstrap::isPrepared() const
+{
+	return mPrepared;
+}
+//------------------------------------------
+void UsbBootstrap::invalidate()
+{
+	mPrepared = false;
+}
+//------------------------------------------
+QString UsbBootstrap::failedStep() const
+{
+	const AdbStep* step = mRunner.step(mRunner.failedStep());
+	return step ? step->name : QString();
+}
+//------------------------------------------
+qint64 UsbBootstrap::elapsedMs() const
+{
+	return mRunner.elapsedMs();
+}
+//------------------------------------------
+int UsbBootstrap::stepsRun() const
+{
+	return mRunner.stepCount(AS_DONE) + mRunner.stepCount(AS_FAILED);
+}
+//------------------------------------------
+int UsbBootstrap::stepsSkipped() const
+{
+	return mRunner.stepCount(AS_SKIPPED);
+}
+//------------------------------------------
+AdbJobRunner& UsbBootstrap::runner()
+{
+	return mRunner;
+}
+//------------------------------------------
+QStringList UsbBootstrap::serviceArguments(int qualityIndex, int bitrate)
+{
+	QStringList args;
+	args << "shell";
+	args << BBQSCREEN_EXEC_BINARY;
+	args << "-s";
+	args << "50";
+	switch (qualityIndex)
+	{
+	case 0:
+		args << "-1080";
+		break;
+	case 1:
+		args << "-720";
+		break;
+	case 2:
+		args << "-540";
+		break;
+	case 3:
+		args << "-360";
+		break;
+	}
+	args << "-q";
+	args << QString::number(bitrate);
+	args << "-i";
+
+	return args;
+}
+//------------------------------------------
+bool UsbBootstrap::isInstalled(const QString& output)
+{
+	const QStringList lines = output.split('\n', QString::SkipEmptyParts);
+	for (QStringList::const_iterator it = lines.begin(); it != lines.end(); ++it)
+	{
+		if (it->trimmed() == BBQSCREEN_READY_MARKER)
+			return true;
+	}
+
+	return false;
+}
+//------------------------------------------
+void UsbBootstrap::onStepFinished(int id)
+{
+	if (id != mCheckStep)
+		return;
+
+	const AdbStep* step = mRunner.step(id);
+	if (isInstalled(step->output))
+	{
+		qDebug() << "USB service already in place, skipping the copy";
+		mRunner.skip(mCopyStep);
+		mRunner.skip(mChmodStep);
+	}
+}
+//------------------------------------------
+void UsbBootstrap::onFinished(bool ok)
+{
+	if (ok)
+	{
+		mPrepared = true;
+		qDebug() << "USB service prepared in " << mRunner.elapsedMs() << " ms (" << stepsRun() << " adb calls, "
+			<< stepsSkipped() << " skipped)";
+		emit prepared();
+		return;
+	}
+
+	const AdbStep* step = mRunner.step(mRunner.failedStep());
+	emit failed(step ? step->error : ADB_CANCELED);
+}
+//------------------------------------------
@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _USBBOOTSTRAP_H_
+#define _USBBOOTSTRAP_H_
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include "AdbJobRunner.h"
+
+// Service binary as installed by the app, and where it can be executed from
+// (works around the security restrictions of Lollipop and Knox)
+#define BBQSCREEN_APP_BINARY "/data/data/org.bbqdroid.bbqscreen/files/bbqscreen"
+#define BBQSCREEN_EXEC_BINARY "/data/local/tmp/bbqscreen"
+
+// Printed by the check when the executable copy is the same as the app's
+#define BBQSCREEN_READY_MARKER "BBQ_READY"
+
+// Puts the streaming service in place through adb before it's started over
+// USB: checks the binary, then copies it and makes it executable only when
+// it's missing or differs from the app's one. Once done, the service can be
+// restarted (quality change, crash) without going through it again.
+class UsbBootstrap : public QObject
+{
+	Q_OBJECT;
+
+public:
+	// ctor
+	UsbBootstrap(QObject* parent = 0);
+
+	void setAdbPath(const QString& path);
+
+	// Returns false if it's already running
+	bool start();
+	void cancel();
+	bool isRunning() const;
+
+	// The binary was put in place, invalidate() if it's not there anymore
+	bool isPrepared() const;
+	void invalidate();
+
+	// Name of the step that failed
+	QString failedStep() const;
+
+	qint64 elapsedMs() const;
+	int stepsRun() const;
+	int stepsSkipped() const;
+
+	AdbJobRunner& runner();
+
+	// adb arguments that start the service
+	static QStringList serviceArguments(int qualityIndex, int bitrate);
+
+	// Whether the output of the check reports an executable copy with the
+	// same content as the app's binary
+	static bool isInstalled(const QString& output);
+
+signals:
+	void prepared();
+	void failed(AdbError error);
+
+protected slots:
+	void onStepFinished(int id);
+	void onFinished(bool ok);
+
+protected:
+	AdbJobRunner mRunner;
+	bool mPrepared;
+	int mCheckStep;
+	int mCopyStep;
+	int mChmodStep;
+};
+
+#endif
@@ -0,0 +1,415 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "YuvConverter.h"
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define YUV_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define YUV_TARGET(isa)
+#else
+// Only these functions are built for the extended sets, the CPU is checked
+// before they're picked
+#define YUV_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define YUV_NEON
+#include <arm_neon.h>
+#endif
+
+#define FIX_BITS 13
+#define FIX_ROUND (1 << (FIX_BITS - 1))
+
+typedef YuvConverter::Coefficients Coefficients;
+
+//------------------------------------------
+static inline uint32_t clampToByte(int value)
+{
+	return (uint32_t) (value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+//------------------------------------------
+// Reference version, also used for the pixels left over by the SIMD ones
+//------------------------------------------
+static void convertRowC(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint32_t* dst, int width,
+	const Coefficients& c)
+{
+	for (int x = 0; x < width; x++)
+	{
+		const int luma = (y[x] - c.yOffset) * c.y + FIX_ROUND;
+		const int cb = u[x / 2] - 128;
+		const int cr = v[x / 2] - 128;
+
+		const int r = (luma + c.rv * cr) >> FIX_BITS;
+		const int g = (luma - c.gu * cb - c.gv * cr) >> FIX_BITS;
+		const int b = (luma + c.bu * cb) >> FIX_BITS;
+
+		dst[x] = 0xFF000000u | (clampToByte(r) << 16) | (clampToByte(g) << 8) | clampToByte(b);
+	}
+}
+
+#ifdef YUV_X86
+//------------------------------------------
+// Two 16 bits coefficients, multiplied with the even and odd 16 bits lanes
+// by madd. Everything is computed in 32 bits so all versions round the same.
+//------------------------------------------
+static inline int coefficientPair(int even, int odd)
+{
+	return (int) ((uint32_t) (uint16_t) even | ((uint32_t) (uint16_t) odd << 16));
+}
+//------------------------------------------
+YUV_TARGET("sse2")
+static inline __m128i channelSse2(__m128i yLo, __m128i yHi, __m128i uvLo, __m128i uvHi, __m128i coef)
+{
+	__m128i lo = _mm_srai_epi32(_mm_add_epi32(yLo, _mm_madd_epi16(uvLo, coef)), FIX_BITS);
+	__m128i hi = _mm_srai_epi32(_mm_add_epi32(yHi, _mm_madd_epi16(uvHi, coef)), FIX_BITS);
+	__m128i words = _mm_packs_epi32(lo, hi);
+	return _mm_packus_epi16(words, words);
+}
+//------------------------------------------
+YUV_TARGET("sse2")
+static void convertRowSse2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint32_t* dst, int width,
+	const Coefficients& c)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i alpha = _mm_set1_epi8((char) 0xFF);
+	const __m128i yOffset = _mm_set1_epi16((short) c.yOffset);
+	const __m128i chromaOffset = _mm_set1_epi16(128);
+	const __m128i yCoef = _mm_set1_epi32(coefficientPair(c.y, FIX_ROUND));
+	const __m128i rCoef = _mm_set1_epi32(coefficientPair(0, c.rv));
+	const __m128i gCoef = _mm_set1_epi32(coefficientPair(-c.gu, -c.gv));
+	const __m128i bCoef = _mm_set1_epi32(coefficientPair(c.bu, 0));
+
+	int x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		int u4, v4;
+		memcpy(&u4, u + x / 2, 4);
+		memcpy(&v4, v + x / 2, 4);
+
+		// Each chroma sample covers two pixels
+		__m128i u8 = _mm_cvtsi32_si128(u4);
+		__m128i v8 = _mm_cvtsi32_si128(v4);
+		u8 = _mm_unpacklo_epi8(u8, u8);
+		v8 = _mm_unpacklo_epi8(v8, v8);
+
+		__m128i luma = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (y + x)), zero), yOffset);
+		__m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(u8, zero), chromaOffset);
+		__m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(v8, zero), chromaOffset);
+
+		__m128i yLo = _mm_madd_epi16(_mm_unpacklo_epi16(luma, ones), yCoef);
+		__m128i yHi = _mm_madd_epi16(_mm_unpackhi_epi16(luma, ones), yCoef);
+		__m128i uvLo = _mm_unpacklo_epi16(cb, cr);
+		__m128i uvHi = _mm_unpackhi_epi16(cb, cr);
+
+		__m128i r = channelSse2(yLo, yHi, uvLo, uvHi, rCoef);
+		__m128i g = channelSse2(yLo, yHi, uvLo, uvHi, gCoef);
+		__m128i b = channelSse2(yLo, yHi, uvLo, uvHi, bCoef);
+
+		// B G R A in memory, which is 0xAARRGGBB as little endian words
+		__m128i bg = _mm_unpacklo_epi8(b, g);
+		__m128i ra = _mm_unpacklo_epi8(r, alpha);
+		_mm_storeu_si128((__m128i*) (dst + x), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i*) (dst + x + 4), _mm_unpackhi_epi16(bg, ra));
+	}
+
+	convertRowC(y + x, u + x / 2, v + x / 2, dst + x, width - x, c);
+}
+//------------------------------------------
+YUV_TARGET("avx2")
+static inline __m256i channelAvx2(__m256i yLo, __m256i yHi, __m256i uvLo, __m256i uvHi, __m256i coef)
+{
+	__m256i lo = _mm256_srai_epi32(_mm256_add_epi32(yLo, _mm256_madd_epi16(uvLo, coef)), FIX_BITS);
+	__m256i hi = _mm256_srai_epi32(_mm256_add_epi32(yHi, _mm256_madd_epi16(uvHi, coef)), FIX_BITS);
+	__m256i words = _mm256_packs_epi32(lo, hi);
+	return _mm256_packus_epi16(words, words);
+}
+//------------------------------------------
+YUV_TARGET("avx2")
+static void convertRowAvx2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint32_t* dst, int width,
+	const Coefficients& c)
+{
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i alpha = _mm256_set1_epi8((char) 0xFF);
+	const __m256i yOffset = _mm256_set1_epi16((short) c.yOffset);
+	const __m256i chromaOffset = _mm256_set1_epi16(128);
+	const __m256i yCoef = _mm256_set1_epi32(coefficientPair(c.y, FIX_ROUND));
+	const __m256i rCoef = _mm256_set1_epi32(coefficientPair(0, c.rv));
+	const __m256i gCoef = _mm256_set1_epi32(coefficientPair(-c.gu, -c.gv));
+	const __m256i bCoef = _mm256_set1_epi32(coefficientPair(c.bu, 0));
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i u8 = _mm_loadl_epi64((const __m128i*) (u + x / 2));
+		__m128i v8 = _mm_loadl_epi64((const __m128i*) (v + x / 2));
+		u8 = _mm_unpacklo_epi8(u8, u8);
+		v8 = _mm_unpacklo_epi8(v8, v8);
+
+		__m256i luma = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (y + x))), yOffset);
+		__m256i cb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(u8), chromaOffset);
+		__m256i cr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(v8), chromaOffset);
+
+		// unpack and pack both work within 128 bits lanes, so the pixels come
+		// back in order after the pack
+		__m256i yLo = _mm256_madd_epi16(_mm256_unpacklo_epi16(luma, ones), yCoef);
+		__m256i yHi = _mm256_madd_epi16(_mm256_unpackhi_epi16(luma, ones), yCoef);
+		__m256i uvLo = _mm256_unpacklo_epi16(cb, cr);
+		__m256i uvHi = _mm256_unpackhi_epi16(cb, cr);
+
+		__m256i r = channelAvx2(yLo, yHi, uvLo, uvHi, rCoef);
+		__m256i g = channelAvx2(yLo, yHi, uvLo, uvHi, gCoef);
+		__m256i b = channelAvx2(yLo, yHi, uvLo, uvHi, bCoef);
+
+		// Pixels 0-3 and 8-11 in lo, 4-7 and 12-15 in hi
+		__m256i bg = _mm256_unpacklo_epi8(b, g);
+		__m256i ra = _mm256_unpacklo_epi8(r, alpha);
+		__m256i lo = _mm256_unpacklo_epi16(bg, ra);
+		__m256i hi = _mm256_unpackhi_epi16(bg, ra);
+		_mm256_storeu_si256((__m256i*) (dst + x), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*) (dst + x + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	convertRowC(y + x, u + x / 2, v + x / 2, dst + x, width - x, c);
+}
+#endif
+
+#ifdef YUV_NEON
+//------------------------------------------
+static inline uint8x8_t narrowNeon(int32x4_t lo, int32x4_t hi)
+{
+	return vqmovun_s16(vcombine_s16(vshrn_n_s32(lo, FIX_BITS), vshrn_n_s32(hi, FIX_BITS)));
+}
+//------------------------------------------
+static void convertRowNeon(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint32_t* dst, int width,
+	const Coefficients& c)
+{
+	const uint8x8_t yOffset = vdup_n_u8((uint8_t) c.yOffset);
+	const uint8x8_t chromaOffset = vdup_n_u8(128);
+	const int32x4_t round = vdupq_n_s32(FIX_ROUND);
+
+	int x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		uint32_t u4, v4;
+		memcpy(&u4, u + x / 2, 4);
+		memcpy(&v4, v + x / 2, 4);
+
+		// Each chroma sample covers two pixels
+		uint8x8_t u8 = vreinterpret_u8_u32(vdup_n_u32(u4));
+		uint8x8_t v8 = vreinterpret_u8_u32(vdup_n_u32(v4));
+		u8 = vzip_u8(u8, u8).val[0];
+		v8 = vzip_u8(v8, v8).val[0];
+
+		int16x8_t luma = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(y + x), yOffset));
+		int16x8_t cb = vreinterpretq_s16_u16(vsubl_u8(u8, chromaOffset));
+		int16x8_t cr = vreinterpretq_s16_u16(vsubl_u8(v8, chromaOffset));
+
+		int32x4_t yLo = vmlal_n_s16(round, vget_low_s16(luma), (int16_t) c.y);
+		int32x4_t yHi = vmlal_n_s16(round, vget_high_s16(luma), (int16_t) c.y);
+
+		uint8x8x4_t pixels;
+		pixels.val[0] = narrowNeon(vmlal_n_s16(yLo, vget_low_s16(cb), (int16_t) c.bu),
+			vmlal_n_s16(yHi, vget_high_s16(cb), (int16_t) c.bu));
+		pixels.val[1] = narrowNeon(
+			vmlsl_n_s16(vmlsl_n_s16(yLo, vget_low_s16(cb), (int16_t) c.gu), vget_low_s16(cr), (int16_t) c.gv),
+			vmlsl_n_s16(vmlsl_n_s16(yHi, vget_high_s16(cb), (int16_t) c.gu), vget_high_s16(cr), (int16_t) c.gv));
+		pixels.val[2] = narrowNeon(vmlal_n_s16(yLo, vget_low_s16(cr), (int16_t) c.rv),
+			vmlal_n_s16(yHi, vget_high_s16(cr), (int16_t) c.rv));
+		pixels.val[3] = vdup_n_u8(0xFF);
+
+		// B G R A in memory, which is 0xAARRGGBB as little endian words
+		vst4_u8((uint8_t*) (dst + x), pixels);
+	}
+
+	convertRowC(y + x, u + x / 2, v + x / 2, dst + x, width - x, c);
+}
+#endif
+
+//------------------------------------------
+YuvConverter::YuvConverter() :
+	mMatrix(YUV_BT709),
+	mFullRange(true),
+	mInstructionSet(IS_C),
+	mRowFunction(convertRowC)
+{
+	setColorSpace(YUV_BT601, false);
+	setInstructionSet(IS_AUTO);
+}
+//------------------------------------------
+void YuvConverter::setColorSpace(YuvMatrix matrix, bool fullRange)
+{
+	if (matrix == mMatrix && fullRange == mFullRange)
+		return;
+
+	mMatrix = matrix;
+	mFullRange = fullRange;
+
+	const double kr = (matrix == YUV_BT709) ? 0.2126 : 0.299;
+	const double kb = (matrix == YUV_BT709) ? 0.0722 : 0.114;
+	const double kg = 1.0 - kr - kb;
+
+	// Limited range stretches 16..235 and 16..240 (around 128) to 0..255
+	const double yScale = fullRange ? 1.0 : 255.0 / 219.0;
+	const double cScale = fullRange ? 1.0 : 255.0 / 224.0;
+	const double one = 1 << FIX_BITS;
+
+	mCoefficients.yOffset = fullRange ? 0 : 16;
+	mCoefficients.y = (int) floor(yScale * one + 0.5);
+	mCoefficients.rv = (int) floor(2.0 * (1.0 - kr) * cScale * one + 0.5);
+	mCoefficients.bu = (int) floor(2.0 * (1.0 - kb) * cScale * one + 0.5);
+	mCoefficients.gu = (int) floor(2.0 * (1.0 - kb) * kb / kg * cScale * one + 0.5);
+	mCoefficients.gv = (int) floor(2.0 * (1.0 - kr) * kr / kg * cScale * one + 0.5);
+}
+//------------------------------------------
+YuvMatrix YuvConverter::matrix() const
+{
+	return mMatrix;
+}
+//------------------------------------------
+bool YuvConverter::fullRange() const
+{
+	return mFullRange;
+}
+//------------------------------------------
+bool YuvConverter::isSupported(InstructionSet set)
+{
+	const int flags = ffmpeg::av_get_cpu_flags();
+	Q_UNUSED(flags);
+
+	switch (set)
+	{
+	case IS_C:
+		return true;
+
+#ifdef YUV_X86
+	case IS_SSE2:
+#if defined(__x86_64__) || defined(_M_X64)
+		return true;
+#else
+		return (flags & AV_CPU_FLAG_SSE2) != 0;
+#endif
+
+	case IS_AVX2:
+		return (flags & AV_CPU_FLAG_AVX2) != 0;
+#endif
+
+#ifdef YUV_NEON
+	case IS_NEON:
+#if defined(__aarch64__)
+		return true;
+#else
+		return (flags & AV_CPU_FLAG_NEON) != 0;
+#endif
+#endif
+
+	default:
+		return false;
+	}
+}
+//------------------------------------------
+bool YuvConverter::setInstructionSet(InstructionSet set)
+{
+	const bool available = (set == IS_AUTO) || isSupported(set);
+	if (set == IS_AUTO || !available)
+	{
+		const InstructionSet preferred[] = { IS_AVX2, IS_SSE2, IS_NEON, IS_C };
+		for (int i = 0; i < 4; i++)
+		{
+			if (isSupported(preferred[i]))
+			{
+				set = preferred[i];
+				break;
+			}
+		}
+	}
+
+	switch (set)
+	{
+#ifdef YUV_X86
+	case IS_SSE2:
+		mRowFunction = convertRowSse2;
+		break;
+
+	case IS_AVX2:
+		mRowFunction = convertRowAvx2;
+		break;
+#endif
+
+#ifdef YUV_NEON
+	case IS_NEON:
+		mRowFunction = convertRowNeon;
+		break;
+#endif
+
+	default:
+		set = IS_C;
+		mRowFunction = convertRowC;
+		break;
+	}
+
+	mInstructionSet = set;
+	return available;
+}
+//------------------------------------------
+YuvConverter::InstructionSet YuvConverter::instructionSet() const
+{
+	return mInstructionSet;
+}
+//------------------------------------------
+QString YuvConverter::name(InstructionSet set)
+{
+	static const char* names[] = { "auto", "c", "sse2", "avx2", "neon" };
+	return names[set];
+}
+//------------------------------------------
+void YuvConverter::convert(const ffmpeg::AVFrame* picture, int width, int y, int rows, uint8_t* dst, int dstStride) const
+{
+	for (int row = y; row < y + rows; row++)
+	{
+		mRowFunction(picture->data[0] + row * picture->linesize[0],
+			picture->data[1] + (row / 2) * picture->linesize[1],
+			picture->data[2] + (row / 2) * picture->linesize[2],
+			(uint32_t*) (dst + row * dstStride), width, mCoefficients);
+	}
+}
+//------------------------------------------
+void YuvConverter::configure(ffmpeg::SwsContext* ctx) const
+{
+	if (ctx == NULL)
+		return;
+
+	// Only when it differs: setting the details rebuilds the context's tables
+	const int* coefficients = ffmpeg::sws_getCoefficients(mMatrix == YUV_BT709 ? SWS_CS_ITU709 : SWS_CS_ITU601);
+	int* invTable;
+	int* table;
+	int srcRange, dstRange, brightness, contrast, saturation;
+	if (ffmpeg::sws_getColorspaceDetails(ctx, &invTable, &srcRange, &table, &dstRange,
+			&brightness, &contrast, &saturation) >= 0
+		&& srcRange == (mFullRange ? 1 : 0) && dstRange == 1 && memcmp(invTable, coefficients, 4 * sizeof(int)) == 0)
+		return;
+
+	ffmpeg::sws_setColorspaceDetails(ctx, coefficients, mFullRange ? 1 : 0,
+		ffmpeg::sws_getCoefficients(SWS_CS_DEFAULT), 1, 0, 1 << 16, 1 << 16);
+}
+//------------------------------------------
@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _YUVCONVERTER_H_
+#define _YUVCONVERTER_H_
+
+#include <QString>
+
+#include <QTFFmpegWrapper/ffmpeg.h>
+
+enum YuvMatrix {
+	YUV_BT601,
+	YUV_BT709
+};
+
+// Converts planar 4:2:0 pictures to 32 bits RGB (QImage::Format_RGB32)
+// without scaling, the one conversion every displayed frame goes through.
+// The kernel is picked at runtime from the CPU features: AVX2, SSE2, NEON or
+// plain C. All of them use the same fixed point math and give the same
+// result, within 1 of swscale.
+class YuvConverter
+{
+public:
+	enum InstructionSet {
+		IS_AUTO,
+		IS_C,
+		IS_SSE2,
+		IS_AVX2,
+		IS_NEON
+	};
+
+	// ctor. BT.601 limited range, best instruction set available.
+	YuvConverter();
+
+	void setColorSpace(YuvMatrix matrix, bool fullRange);
+	YuvMatrix matrix() const;
+	bool fullRange() const;
+
+	// Falls back to the best available set when the requested one isn't
+	bool setInstructionSet(InstructionSet set);
+	InstructionSet instructionSet() const;
+	static bool isSupported(InstructionSet set);
+	static QString name(InstructionSet set);
+
+	// Converts the rows [y, y + rows) of the picture, written at the same
+	// rows of dst. y must be even. Can be called from several threads at once.
+	void convert(const ffmpeg::AVFrame* picture, int width, int y, int rows, uint8_t* dst, int dstStride) const;
+
+	// Makes a swscale context convert with the same matrix and range
+	void configure(ffmpeg::SwsContext* ctx) const;
+
+	// Coefficients, in 13 bits fixed point
+	struct Coefficients
+	{
+		int yOffset;
+		int y;
+		int rv;
+		int gu;
+		int gv;
+		int bu;
+	};
+
+protected:
+	typedef void (*RowFunction)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint32_t* dst, int width,
+		const Coefficients& c);
+
+protected:
+	YuvMatrix mMatrix;
+	bool mFullRange;
+	Coefficients mCoefficients;
+
+	InstructionSet mInstructionSet;
+	RowFunction mRowFunction;
+};
+
+#endif
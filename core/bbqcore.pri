@@ -0,0 +1,21 @@
+# ----------------------------------------------------
+# Include this file to link against bbqcore. The library
+# is (re)built before the including target.
+# ----------------------------------------------------
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+LIBS += -L$$PWD/lib -lbbqcore
+
+win32:BBQCORE_LIB = $$PWD/lib/bbqcore.lib
+else:BBQCORE_LIB = $$PWD/lib/libbbqcore.a
+
+bbqcore.target = $$BBQCORE_LIB
+bbqcore.commands = cd $$PWD && $$QMAKE_QMAKE bbqcore.pro && $(MAKE)
+bbqcore.depends = FORCE
+QMAKE_EXTRA_TARGETS += bbqcore
+PRE_TARGETDEPS += $$BBQCORE_LIB
+
+# ::send in SocketIo
+win32:LIBS += -lws2_32
@@ -0,0 +1,81 @@
+# ----------------------------------------------------
+# bbqcore - streaming core shared by the client and the tools
+# Framing, decoding, capture/replay, input serialization and the
+# device session. Must not depend on QtWidgets.
+# Build with: qmake bbqcore.pro && make
+# (the client and tools build it automatically through bbqcore.pri)
+# The Visual Studio project builds one copy per configuration with
+# BBQCORE_SUBDIR=<Platform>/<Configuration> (lib/, obj/ and
+# GeneratedFiles/ get that subdirectory)
+# ----------------------------------------------------
+
+!isEmpty(BBQCORE_SUBDIR): BBQCORE_SUBDIR = /$$BBQCORE_SUBDIR
+
+TEMPLATE = lib
+TARGET = bbqcore
+CONFIG += staticlib c++11
+DESTDIR = $$PWD/lib$$BBQCORE_SUBDIR
+
+QT += core gui network multimedia
+QT -= widgets
+
+INCLUDEPATH += . \
+    .. \
+    ../QTFFmpegWrapper \
+    $(QTDIR)/../qtmultimedia/include/QtMultimedia \
+    $(QTDIR)/../qtmultimedia/include
+DEPENDPATH += .
+MOC_DIR += ./GeneratedFiles$$BBQCORE_SUBDIR
+OBJECTS_DIR += ./obj$$BBQCORE_SUBDIR
+
+HEADERS += ./QStreamFramer.h \
+    ./QStreamDecoder.h \
+    ./FramePool.h \
+    ./StreamCapture.h \
+    ./StreamReplay.h \
+    ./InputSerializer.h \
+    ./InputWriter.h \
+    ./SocketIo.h \
+    ./LatencyProbe.h \
+    ./RegionWatch.h \
+    ./StreamSession.h \
+    ./TextInjector.h \
+    ./DecodePool.h \
+    ./CpuUsage.h \
+    ./DeviceRegistry.h \
+    ./SubnetScanner.h \
+    ./AdbJobRunner.h \
+    ./UsbBootstrap.h \
+    ./StreamRelay.h \
+    ./StreamRecorder.h \
+    ./ReplayRing.h \
+    ./TileHash.h \
+    ./SliceConverter.h \
+    ./YuvConverter.h
+SOURCES += ./QStreamFramer.cpp \
+    ./QStreamDecoder.cpp \
+    ./FramePool.cpp \
+    ./StreamCapture.cpp \
+    ./StreamReplay.cpp \
+    ./InputSerializer.cpp \
+    ./InputWriter.cpp \
+    ./SocketIo.cpp \
+    ./LatencyProbe.cpp \
+    ./RegionWatch.cpp \
+    ./StreamSession.cpp \
+    ./TextInjector.cpp \
+    ./DecodePool.cpp \
+    ./CpuUsage.cpp \
+    ./DeviceRegistry.cpp \
+    ./SubnetScanner.cpp \
+    ./AdbJobRunner.cpp \
+    ./UsbBootstrap.cpp \
+    ./StreamRelay.cpp \
+    ./StreamRecorder.cpp \
+    ./ReplayRing.cpp \
+    ./TileHash.cpp \
+    ./SliceConverter.cpp \
+    ./YuvConverter.cpp
+
+# Requied for some C99 defines
+DEFINES += __STDC_CONSTANT_MACROS
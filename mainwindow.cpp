@@ -20,8 +20,11 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "screenform.h"
+#include "wallform.h"
 #include <QDesktopServices>
 #include <QUrl>
+#include <QStandardPaths>
+#include <QInputDialog>
 #include <QtNetwork/QUdpSocket>
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkReply>
@@ -50,8 +53,18 @@ MainWindow::MainWindow(QWidget *parent) :
 
 	// Setup UDP discovery socket
 	mAnnouncer = new QUdpSocket(this);
-	mAnnouncer->bind(QHostAddress::Any, 9876);
+	mAnnouncer->bind(QHostAddress::Any, 9876, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint);
 	connect(mAnnouncer, SIGNAL(readyRead()), this, SLOT(onDiscoveryReadyRead()));
+	connect(&mDevices, SIGNAL(deviceAdded(const QString&)), this, SLOT(onDeviceAdded(const QString&)));
+	connect(&mDevices, SIGNAL(deviceRemoved(const QString&)), this, SLOT(onDeviceRemoved(const QString&)));
+	connect(&mScanner, SIGNAL(deviceFound(const QString&)), this, SLOT(onScanDeviceFound(const QString&)));
+	connect(&mScanner, SIGNAL(finished()), this, SLOT(onScanFinished()));
+
+	// USB service bootstrap
+	mBootstrap.setAdbPath(adbPath());
+	connect(&mBootstrap, SIGNAL(prepared()), this, SLOT(onUsbServicePrepared()));
+	connect(&mBootstrap, SIGNAL(failed(AdbError)), this, SLOT(onUsbServiceFailed(AdbError)));
+	connect(&mBootstrap.runner(), SIGNAL(output(const QString&, bool)), this, SLOT(onADBStepOutput(const QString&, bool)));
 
 	// Connect UI slots
 	connect(ui->listDevices, SIGNAL(itemClicked(QListWidgetItem*)), this, SLOT(onSelectDevice(QListWidgetItem*)));
@@ -61,6 +74,9 @@ MainWindow::MainWindow(QWidget *parent) :
 	connect(ui->btnConnect, SIGNAL(clicked()), this, SLOT(onClickConnect()));
 	connect(ui->btnWebsite, SIGNAL(clicked()), this, SLOT(onClickWebsite()));
 	connect(ui->btnDebugLog, SIGNAL(clicked()), this, SLOT(onClickShowDebugLog()));
+	connect(ui->btnReplay, SIGNAL(clicked()), this, SLOT(onClickReplay()));
+	connect(ui->btnWall, SIGNAL(clicked()), this, SLOT(onClickWall()));
+	connect(ui->btnScan, SIGNAL(clicked()), this, SLOT(onClickScan()));
 	connect(ui->cbQuality, SIGNAL(currentIndexChanged(int)), this, SLOT(onQualityChanged(int)));
 	connect(ui->spinBitrate, SIGNAL(valueChanged(int)), this, SLOT(onBitrateChanged(int)));
 
@@ -72,9 +88,6 @@ MainWindow::MainWindow(QWidget *parent) :
 	connect(reply, SIGNAL(finished()), this, SLOT(onUpdateChecked()));
 
 	ui->lblClientVersion->setText("Client version " CLIENT_VERSION);
-
-	// Start timeout timer
-	startTimer(500);
 }
 //----------------------------------------------------
 MainWindow::~MainWindow()
@@ -85,6 +98,9 @@ MainWindow::~MainWindow()
 void MainWindow::closeEvent(QCloseEvent* evt)
 {
 	Q_UNUSED(evt);
+	mServiceShouldRun = false;
+	mBootstrap.cancel();
+
 	if (mADBProcess)
 	{
 		disconnect(mADBProcess, SIGNAL(finished(int, QProcess::ExitStatus)), this, SLOT(onADBProcessFinishes()));
@@ -93,23 +109,6 @@ void MainWindow::closeEvent(QCloseEvent* evt)
 	}
 }
 //----------------------------------------------------
-void MainWindow::timerEvent(QTimerEvent* evt)
-{
-	Q_UNUSED(evt);
-
-	// See if we have devices that disappeared. We make them timeout after 3 seconds.
-	for (auto it = mDevices.begin(); it != mDevices.end(); ++it)
-	{
-		if ((*it)->lastPing.elapsed() > 3000)
-		{
-			ui->listDevices->takeItem(mDevices.indexOf(*it));
-			delete (*it);
-			it = mDevices.erase(it);
-			break;
-		}
-	}
-}
-//----------------------------------------------------
 void MainWindow::onQualityChanged(int index)
 {
 	if (mADBProcess)
@@ -143,11 +142,16 @@ void MainWindow::onClickConnect()
 		return;
 	}
 
+	// Input the device announced it understands, if it was discovered
+	const Device* device = mDevices.findByAddress(ip);
+	const int capabilities = device ? device->capabilities : 0;
+
 	// The IP is valid, connect to there
 	ScreenForm* screen = new ScreenForm(this);
 	screen->setAttribute(Qt::WA_DeleteOnClose);
 	screen->setQuality(ui->cbHighQuality->isChecked());
 	screen->setShowFps(ui->cbShowFps->isChecked());
+	screen->setTouchBatching((capabilities & INPUT_CAP_TOUCH_BATCH) != 0);
 	screen->show();
 	screen->connectTo(ui->ebIP->text());
 
@@ -155,14 +159,124 @@ void MainWindow::onClickConnect()
 	hide();
 }
 //----------------------------------------------------
+void MainWindow::onClickReplay()
+{
+	QString path = QFileDialog::getOpenFileName(this, "Open capture",
+		QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation),
+		"BBQScreen captures (*.bbqcap)");
+	if (path.isEmpty())
+		return;
+
+	bool ok = false;
+	double speed = QInputDialog::getDouble(this, "Replay speed",
+		"Speed multiplier (0 = as fast as possible):", 1.0, 0.0, 64.0, 2, &ok);
+	if (!ok)
+		return;
+
+	ScreenForm* screen = new ScreenForm(this);
+	screen->setAttribute(Qt::WA_DeleteOnClose);
+	screen->setQuality(ui->cbHighQuality->isChecked());
+	screen->setShowFps(ui->cbShowFps->isChecked());
+	screen->show();
+
+	if (!screen->replayFrom(path, speed))
+	{
+		screen->close();
+		return;
+	}
+
+	// Hide this dialog
+	hide();
+}
+//----------------------------------------------------
+void MainWindow::onClickWall()
+{
+	// Selected devices, or every discovered one if there's no multiple selection
+	QList<const Device*> devices;
+	QList<QListWidgetItem*> selected = ui->listDevices->selectedItems();
+	for (auto it = selected.begin(); it != selected.end(); ++it)
+	{
+		const Device* device = mDevices.find((*it)->data(Qt::UserRole).toString());
+		if (device)
+			devices.push_back(device);
+	}
+
+	if (devices.size() < 2)
+	{
+		// In the order of the list
+		devices.clear();
+		for (int i = 0; i < ui->listDevices->count(); ++i)
+		{
+			const Device* device = mDevices.find(ui->listDevices->item(i)->data(Qt::UserRole).toString());
+			if (device)
+				devices.push_back(device);
+		}
+	}
+
+	if (devices.isEmpty())
+	{
+		QMessageBox::critical(this, "No devices", "No device has been discovered on the network yet");
+		return;
+	}
+
+	WallForm* wall = new WallForm(this);
+	wall->setAttribute(Qt::WA_DeleteOnClose);
+	wall->setQuality(ui->cbHighQuality->isChecked());
+	wall->setShowFps(ui->cbShowFps->isChecked());
+
+	for (auto it = devices.begin(); it != devices.end(); ++it)
+		wall->addDevice((*it)->address, (*it)->name);
+
+	wall->show();
+
+	// Hide this dialog
+	hide();
+}
+//----------------------------------------------------
+void MainWindow::onClickScan()
+{
+	if (mScanner.isRunning())
+	{
+		mScanner.stop();
+		onScanFinished();
+		return;
+	}
+
+	bool ok = false;
+	const QString ranges = QInputDialog::getText(this, "Scan the network",
+		"Networks to scan for devices (for instance 192.168.1.0/24), separated by commas:",
+		QLineEdit::Normal, SubnetScanner::localSubnets().join(", "), &ok);
+	if (!ok)
+		return;
+
+	if (!mScanner.start(ranges.split(',', QString::SkipEmptyParts), DEFAULT_STREAM_PORT))
+	{
+		QMessageBox::critical(this, "Nothing to scan", "Enter IPv4 networks such as 192.168.1.0/24");
+		return;
+	}
+
+	ui->btnScan->setText(QString("Stop scanning (%1 hosts)").arg(mScanner.hostCount()));
+}
+//----------------------------------------------------
+void MainWindow::onScanDeviceFound(const QString& address)
+{
+	mDevices.addScanned(address);
+}
+//----------------------------------------------------
+void MainWindow::onScanFinished()
+{
+	ui->btnScan->setText(QString("Scan the network for devices (%1 found)").arg(mScanner.foundCount()));
+}
+//----------------------------------------------------
 void MainWindow::onSelectDevice(QListWidgetItem* item)
 {
 	Q_UNUSED(item);
 	
-	int index = ui->listDevices->currentRow();
-	if (index >= 0)
+	QListWidgetItem* current = ui->listDevices->currentItem();
+	const Device* device = current ? mDevices.find(current->data(Qt::UserRole).toString()) : nullptr;
+	if (device)
 	{
-		ui->ebIP->setText(mDevices.at(index)->address);
+		ui->ebIP->setText(device->address);
 	}
 }
 //----------------------------------------------------
@@ -187,46 +301,29 @@ void MainWindow::onDiscoveryReadyRead()
 		mAnnouncer->readDatagram(datagram.data(), datagram.size(),
 			&sender, &senderPort);
 
-		// Format of announcer packet:
-		// 0 : Protocol version
-		// 1 : Device name size
-		// 2+: Device name
-
-		unsigned char protocolVersion = datagram.at(0),
-			deviceNameSize = datagram.at(1);
-
-		QString deviceName = QByteArray(datagram.data()+2, deviceNameSize);
-		QString remoteIp = sender.toString();
-
-		// Make sure we don't already know this device
-		bool exists = false;
-		for (auto it = mDevices.begin(); it != mDevices.end(); ++it)
-		{
-			if ((*it)->name == deviceName && (*it)->address == remoteIp)
-			{
-				(*it)->lastPing.restart();
-				exists = true;
-				break;
-			}
-		}
-
-		if (!exists)
-		{
-			// XXX: Protocol v3 indicates that audio can't be streamed, and v4
-			// indicates that we can stream audio. However, the user can choose
-			// to turn off audio even on v4. Maybe in the future we could indicate
-			// that.
-			Device* device = new Device;
-			device->name = deviceName;
-			device->address = remoteIp;
-			device->lastPing.start();
-			
-			ui->listDevices->addItem(QString("%1 - (%2)").arg(deviceName, remoteIp));
-			mDevices.push_back(device);
-		}
+		// Adds the device or renews it, the list follows the registry signals
+		mDevices.processAnnouncement(datagram, sender);
 	}
 }
 //----------------------------------------------------
+void MainWindow::onDeviceAdded(const QString& key)
+{
+	const Device* device = mDevices.find(key);
+	if (!device)
+		return;
+
+	QListWidgetItem* item = new QListWidgetItem(QString("%1 - (%2)").arg(device->name, device->address));
+	item->setData(Qt::UserRole, key);
+	ui->listDevices->addItem(item);
+	mDeviceItems.insert(key, item);
+}
+//----------------------------------------------------
+void MainWindow::onDeviceRemoved(const QString& key)
+{
+	// Deleting an item takes it out of its list
+	delete mDeviceItems.take(key);
+}
+//----------------------------------------------------
 void MainWindow::onClickWebsite()
 {
 	QDesktopServices::openUrl(QUrl("http://screen.bbqdroid.org/"));
@@ -256,11 +353,7 @@ QProcess* MainWindow::runAdb(const QStringList& params)
 	connect(process, SIGNAL(readyReadStandardOutput()), this, SLOT(onADBProcessReadyRead()));
 	connect(process, SIGNAL(readyReadStandardError()), this, SLOT(onADBErrorReadyRead()));
 
-#ifndef PLAT_APPLE
-	process->start(ADB_PATH, params);
-#else
-	process->start(QDir(QCoreApplication::applicationDirPath()).absolutePath() + "/" + ADB_PATH, params);
-#endif	
+	process->start(adbPath(), params);
 
 	return process;
 }
@@ -276,7 +369,11 @@ void MainWindow::onClickBootstrapUSB()
 	else
 	{
 		mServiceShouldRun = false;
-		if (mADBProcess) 
+		if (mBootstrap.isRunning())
+		{
+			mBootstrap.cancel();
+		}
+		else if (mADBProcess) 
 		{
 			mADBProcess->terminate();
 			mADBProcess->kill();
@@ -327,15 +424,10 @@ void MainWindow::onADBProcessReadyRead()
 	QByteArray stdOut = process->readAllStandardOutput();
 	QString stdOutLine = QString(stdOut).trimmed();
 	
-	if (stdOutLine.contains("/data/data") &&  stdOutLine.contains("No such file or directory"))
-	{
-		mServiceShouldRun = false;
-		mServiceStartError = true;
-	}
-	else if (stdOutLine.contains("Unable to chmod"))
+	// The binary is gone (the app was reinstalled...), the next start puts it back
+	if (stdOutLine.contains(BBQSCREEN_EXEC_BINARY) && AdbJobRunner::parseError(stdOutLine) == ADB_NO_SUCH_FILE)
 	{
-		mServiceShouldRun = false;
-		mServiceStartError = true;
+		mBootstrap.invalidate();
 	}
 
 	if (!stdOutLine.isEmpty())
@@ -385,6 +477,19 @@ void MainWindow::onADBErrorReadyRead()
 	}
 }
 //----------------------------------------------------
+void MainWindow::onADBStepOutput(const QString& line, bool error)
+{
+	(error ? mADBErrorLog : mADBLog).push_back(line);
+
+	if (mDebugWidget != nullptr)
+	{
+		QListWidgetItem* item = new QListWidgetItem(line);
+		if (error)
+			item->setTextColor(QColor(255, 0, 0));
+		mDebugWidget->addItem(item);
+	}
+}
+//----------------------------------------------------
 void MainWindow::onUpdateChecked()
 {
 	QNetworkReply* reply = (QNetworkReply*) QObject::sender();
@@ -400,14 +505,34 @@ void MainWindow::onUpdateChecked()
 	}
 }
 //----------------------------------------------------
+QString MainWindow::adbPath()
+{
+#ifndef PLAT_APPLE
+	return ADB_PATH;
+#else
+	return QDir(QCoreApplication::applicationDirPath()).absolutePath() + "/" + ADB_PATH;
+#endif
+}
+//----------------------------------------------------
 void MainWindow::startUsbService()
 {
-	mServiceStartError = false;
-
 	ui->btnBootstrapUSB->setEnabled(false);
 	ui->btnBootstrapUSB->setText("Starting...");
-	qApp->processEvents();
 
+	// After a crash or a settings change, the binary is still in place
+	if (mBootstrap.isPrepared())
+	{
+		launchUsbService();
+		return;
+	}
+
+	// Copies the binary to an executable zone (Lollipop and Knox security
+	// restrictions) if it's not there yet, then onUsbServicePrepared runs it
+	mBootstrap.start();
+}
+//----------------------------------------------------
+void MainWindow::launchUsbService()
+{
 	if (!mADBProcess)
 	{
 		mADBProcess = new QProcess(this);
@@ -416,72 +541,57 @@ void MainWindow::startUsbService()
 		connect(mADBProcess, SIGNAL(readyReadStandardError()), this, SLOT(onADBErrorReadyRead()));
 	}
 
-	// Copy binary to workaround some security restrictions on Lollipop and Knox
-	QStringList args;
-	args << "shell";
-	args << "cp";
-	args << "/data/data/org.bbqdroid.bbqscreen/files/bbqscreen";
-	args << "/data/local/tmp/bbqscreen";
-	QProcess* copyProc = runAdb(args);
-	copyProc->waitForFinished();
-
-	if (mServiceStartError) 
-	{
-		QMessageBox::critical(this, "Unable to prepare the USB service", "Unable to copy the BBQScreen service to an executable zone on your device, as it hasn't been found. Please make sure the BBQScreen app is installed, and that you opened it once, and pressed 'USB' if prompted or turned it on once.");
-		delete copyProc;
-		return;
-	}
-
-	args.clear();
-	args << "shell";
-	args << "chmod";
-	args << "755";
-	args << "/data/local/tmp/bbqscreen";
-	QProcess* chmodProc = runAdb(args);
-	chmodProc->waitForFinished();
+	mADBProcess->start(adbPath(), UsbBootstrap::serviceArguments(ui->cbQuality->currentIndex(), ui->spinBitrate->value()));
 
-	if (mServiceStartError) 
-	{
-		QMessageBox::critical(this, "Unable to prepare the USB service", "Unable to set the permissions of the BBQScreen service to executable. Please contact support.");
-		delete chmodProc;
-		return;
-	}
+	ui->btnConnectUSB->setEnabled(true);
+	ui->btnBootstrapUSB->setEnabled(true);
+	ui->btnBootstrapUSB->setText("Stop USB service");
+}
+//----------------------------------------------------
+void MainWindow::stopUsbService()
+{
+	mServiceShouldRun = false;
+	ui->btnBootstrapUSB->setEnabled(true);
+	ui->btnBootstrapUSB->setText("Start USB service");
+	ui->btnConnectUSB->setEnabled(false);
+}
+//----------------------------------------------------
+void MainWindow::onUsbServicePrepared()
+{
+	if (mServiceShouldRun)
+		launchUsbService();
+}
+//----------------------------------------------------
+void MainWindow::onUsbServiceFailed(AdbError error)
+{
+	stopUsbService();
 
-	args.clear();
-	args << "shell";
-	args << "/data/local/tmp/bbqscreen";
-	args << "-s";
-	args << "50";
-	switch (ui->cbQuality->currentIndex())
+	switch (error)
 	{
-	case 0:
-		args << "-1080";
+	case ADB_CANCELED:
+		// Stopped by the user
+		break;
+	case ADB_DEVICE_NOT_FOUND:
+		QMessageBox::critical(this, "Device not found or unplugged", "Cannot find an Android device connected via ADB. Make sure USB Debugging is enabled on your device, and that the ADB drivers are installed. Follow the guide on our website for more information.");
+		break;
+	case ADB_DEVICE_OFFLINE:
+		QMessageBox::critical(this, "Device offline", "An Android device is connected but reports as offline. Check your device for any additional information, or try to unplug and replug your device");
+		break;
+	case ADB_UNAUTHORIZED:
+		QMessageBox::critical(this, "Device unauthorized", "An Android device is connected but reports as unauthorized. Please check the confirmation dialog on your device.");
 		break;
-	case 1:
-		args << "-720";
+	case ADB_FAILED_TO_START:
+		QMessageBox::critical(this, "Unable to prepare the USB service", "Unable to run ADB (" + adbPath() + "). Please reinstall the client.");
 		break;
-	case 2:
-		args << "-540";
+	case ADB_TIMEOUT:
+		QMessageBox::critical(this, "Unable to prepare the USB service", "ADB didn't answer in time. Try to unplug and replug your device.");
 		break;
-	case 3:
-		args << "-360";
+	default:
+		if (mBootstrap.failedStep() == "copy")
+			QMessageBox::critical(this, "Unable to prepare the USB service", "Unable to copy the BBQScreen service to an executable zone on your device, as it hasn't been found. Please make sure the BBQScreen app is installed, and that you opened it once, and pressed 'USB' if prompted or turned it on once.");
+		else
+			QMessageBox::critical(this, "Unable to prepare the USB service", "Unable to set the permissions of the BBQScreen service to executable. Please contact support.");
 		break;
 	}
-	args << "-q";
-	args << QString::number(ui->spinBitrate->value());
-	args << "-i";
-
-#ifndef PLAT_APPLE
-	mADBProcess->start(ADB_PATH, args);
-#else
-	mADBProcess->start(QDir(QCoreApplication::applicationDirPath()).absolutePath() + "/" + ADB_PATH, args);
-#endif
-
-	ui->btnConnectUSB->setEnabled(true);
-	ui->btnBootstrapUSB->setEnabled(true);
-	ui->btnBootstrapUSB->setText("Stop USB service");
-
-	delete chmodProc;
-	delete copyProc;
 }
 //----------------------------------------------------
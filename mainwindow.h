@@ -24,6 +24,10 @@
 #include <QTime>
 #include <QListWidgetItem>
 #include <QProcess>
+#include <QHash>
+#include "DeviceRegistry.h"
+#include "SubnetScanner.h"
+#include "UsbBootstrap.h"
 
 
 namespace Ui {
@@ -32,13 +36,6 @@ namespace Ui {
 
 class ScreenForm;
 
-struct Device
-{
-	QString name;
-	QString address;
-	QTime lastPing;
-};
-
 class MainWindow : public QDialog
 {
 	Q_OBJECT
@@ -48,23 +45,36 @@ public:
 	~MainWindow();
 
 	void closeEvent(QCloseEvent* evt);
-	void timerEvent(QTimerEvent* evt);
 
 	QProcess* runAdb(const QStringList& params);
 
 	void startUsbService();
+	void launchUsbService();
+	void stopUsbService();
+
+	static QString adbPath();
 
 private slots:
 	void onClickConnect();
 	void onClickWebsite();
 	void onClickShowDebugLog();
+	void onClickReplay();
+	void onClickWall();
+	void onClickScan();
+	void onScanDeviceFound(const QString& address);
+	void onScanFinished();
 	void onDiscoveryReadyRead();
+	void onDeviceAdded(const QString& key);
+	void onDeviceRemoved(const QString& key);
 	void onSelectDevice(QListWidgetItem* item);
 	void onClickBootstrapUSB();
 	void onClickConnectUSB();
 	void onADBProcessFinishes();
 	void onADBProcessReadyRead();
 	void onADBErrorReadyRead();
+	void onADBStepOutput(const QString& line, bool error);
+	void onUsbServicePrepared();
+	void onUsbServiceFailed(AdbError error);
 	void onDoubleClickDevice(QListWidgetItem* item);
 	void onUpdateChecked();
 	void onQualityChanged(int index);
@@ -75,16 +85,21 @@ private:
 	QUdpSocket* mAnnouncer;
 	ScreenForm* mFormToDelete;
 
-	// Pair device name, device ip / List order is listWidget of devices
-	QList<Device*> mDevices;
+	// Discovered devices, and their item in listDevices (which holds the key)
+	DeviceRegistry mDevices;
+	QHash<QString, QListWidgetItem*> mDeviceItems;
+
+	// Finds the devices whose announcements don't reach us
+	SubnetScanner mScanner;
 
+	// Puts the service binary in place, then mADBProcess runs it
+	UsbBootstrap mBootstrap;
 	QProcess* mADBProcess;
 	QStringList mADBLog;
 	QStringList mADBErrorLog;
 	QListWidget* mDebugWidget;
 	bool mServiceShouldRun;
 	int mCrashCount;
-	bool mServiceStartError;
 
 };
 
@@ -24,61 +24,60 @@
 #include <QPainter>
 #include <QMessageBox>
 #include <QCloseEvent>
+#include <QTouchEvent>
+#include <QTouchDevice>
+#include <QGuiApplication>
+#include <QClipboard>
 #include <QFile>
-#include <QtNetwork/QHostAddress>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QStandardPaths>
 #include <QtGui/QPixmap>
 
 #ifdef PLAT_APPLE
  #include <Carbon/Carbon.h>
 #endif
 
-#define INPUT_PROTOCOL_VERSION 1
-
 //#define PROFILING
 
 //----------------------------------------------------
 ScreenForm::ScreenForm(MainWindow* win, QWidget *parent) :
 	QWidget(parent),
 	ui(new Ui::ScreenForm),
-	mTotalFrameReceived(0),
-	mRotationAngle(0),
 	mParentWindow(win),
-	mOrientationOffset(0),
+	mReplay(nullptr),
 	mShowFps(false),
 	mStopped(false),
-	mCtrlDown(false),
+	mRotationAngle(0),
+	mTotalFrameReceived(0),
+	mOrientationOffset(0),
+	mFirstFrameShown(false),
 	mIsMouseDown(false),
-	mDecoder(false),
-	mAudioDecoder(true)
+	mCtrlDown(false),
+	mForwardingTouch(false)
 {
 	ui->setupUi(this);
 
-	// Run decoder in separate threads
-	mDecoder.moveToThread(&mVideoDecoderThread);
-	mAudioDecoder.moveToThread(&mAudioDecoderThread);
-	connect(&mVideoDecoderThread, SIGNAL(started()), &mDecoder, SLOT(process()));
-	connect(&mAudioDecoderThread, SIGNAL(started()), &mDecoder, SLOT(process()));
-
-	connect(&mDecoder, SIGNAL(decodeFinished(bool, bool)), this, SLOT(onDecodeFinished(bool, bool)));
-	connect(&mAudioDecoder, SIGNAL(decodeFinished(bool, bool)), this, SLOT(onDecodeFinished(bool, bool)));
+	// Touchscreens and trackpads: every finger is sent to the device
+	setAttribute(Qt::WA_AcceptTouchEvents);
+	mTouchFrame.reserve(MAX_TOUCH_POINTERS);
 
-	// Start TCP client
-	connect(&mTcpSocket, SIGNAL(readyRead()),
-		this, SLOT(processPendingDatagrams()));
+	connect(&mSession, SIGNAL(stateChanged(StreamSession::State)), this, SLOT(onSessionStateChanged(StreamSession::State)));
+	connect(&mSession, SIGNAL(frameReady()), this, SLOT(onFrameReady()));
+	connect(&mSession, SIGNAL(audioError(const QString&)), this, SLOT(onAudioError(const QString&)));
+	connect(&mSession.relay(), SIGNAL(viewersChanged(int)), this, SLOT(updateWindowTitle()));
+	connect(&mSession.replayRing(), SIGNAL(flushed(const QString&, bool)), this, SLOT(onReplaySaved(const QString&, bool)));
 
-	connect(&mTcpSocket, SIGNAL(stateChanged(QAbstractSocket::SocketState)), this, SLOT(onSocketStateChanged()));
+	// Ctrl+S saves what just happened
+	mSession.replayRing().setLimits(DEFAULT_REPLAY_SECONDS, DEFAULT_REPLAY_BYTES);
 
 	mFrameTimer.start();
-
-	// On protocol v3, the client runs at a refresh rate of 35 fps whereas
-	// the server is locked at 25 fps. On protocol v4, the stream is at 60fps
-	// This is to ensure both smoothness and responsiveness
-	startTimer(1, Qt::PreciseTimer);
 }
 //----------------------------------------------------
 ScreenForm::~ScreenForm()
 {
-	//mTcpSocket.close();
+	mSession.stop();
 
 	if (ui)
 		delete ui;
@@ -89,30 +88,63 @@ ScreenForm::~ScreenForm()
 void ScreenForm::connectTo(const QString &host)
 {
 	mHost = host;
-	this->setWindowTitle("BBQScreen - " + host);
-
-	qDebug() << "Connecting to " << host;
-	mIsConnecting = true;
+	mTitle = "BBQScreen - " + host;
+	updateWindowTitle();
 
-	QTime connectionTimeout;
-	connectionTimeout.start();
-	mConnectionAttempts = 0;
-	mConnectionTimerId = startTimer(1000);
-	attemptConnection();
+	mSession.connectTo(host);
 }
 //----------------------------------------------------
-void ScreenForm::attemptConnection()
+bool ScreenForm::replayFrom(const QString& path, double speed)
 {
-	mIsConnecting = true;
-	if (mTcpSocket.state() != QAbstractSocket::UnconnectedState)
+	mHost = QFileInfo(path).fileName();
+	mTitle = "BBQScreen - Replay of " + mHost;
+	updateWindowTitle();
+
+	mReplay = new StreamReplay(this);
+	if (!mReplay->open(path))
+	{
+		QMessageBox::critical(this, "Replay error", "Unable to read the capture file " + path);
+		return false;
+	}
+
+	connect(mReplay, SIGNAL(recordReady(const StreamRecord&)), this, SLOT(onReplayRecord(const StreamRecord&)));
+	connect(mReplay, SIGNAL(finished()), this, SLOT(onReplayFinished()));
+
+	qDebug() << "Replaying " << mReplay->reader().recordCount() << " records from " << path << " at speed " << speed;
+
+	mFrameTimer.start();
+	if (!mShowFps)
 	{
-		mTcpSocket.disconnectFromHost();
-		mTcpSocket.waitForDisconnected(1000);
+		ui->lblFps->setText("");
+		ui->lblFps->setVisible(false);
 	}
 
-	mConnectionAttempts++;
-	mTcpSocket.connectToHost(QHostAddress(mHost), 9876);
-	ui->lblFps->setText("Connecting to '" + mHost + "'... (Attempt " + QString::number(mConnectionAttempts) + "/3)");
+	mReplay->setSpeed(speed);
+	mReplay->start();
+	return true;
+}
+//----------------------------------------------------
+void ScreenForm::onReplayRecord(const StreamRecord& record)
+{
+	// Keep feeding while hidden, the decoder needs the reference frames
+	if (!ui || mStopped)
+		return;
+
+	// The payloads point into the mapped capture, and are only valid during
+	// the signal: the session keeps them (codec config, replay ring,
+	// recorder), so it gets its own copy, as for a live stream
+	StreamRecord copy = record;
+	copy.video = QByteArray(record.video.constData(), record.video.size());
+	copy.audio = QByteArray(record.audio.constData(), record.audio.size());
+
+	mSession.processRecord(copy);
+}
+//----------------------------------------------------
+void ScreenForm::onReplayFinished()
+{
+	qDebug() << "Replay of " << mHost << " finished";
+	mTitle = "BBQScreen - Replay of " + mHost + " (finished)";
+	updateWindowTitle();
 }
 //----------------------------------------------------
 void ScreenForm::setQuality(bool high)
@@ -126,228 +158,233 @@ void ScreenForm::setShowFps(bool show)
 	mShowFps = show;
 }
 //----------------------------------------------------
-void ScreenForm::processPendingDatagrams()
+void ScreenForm::setTouchBatching(bool enabled)
 {
-	if (!isVisible() || !ui || mStopped)
-		return;
-	
-	int currentSocket = 0;
-	const int headerSize = 6;
+	mSession.setTouchBatching(enabled);
+}
+//----------------------------------------------------
+void ScreenForm::toggleCapture()
+{
+	StreamCaptureWriter& writer = mSession.captureWriter();
 
-	while (mTcpSocket.bytesAvailable() > 0)
+	if (writer.isOpen())
 	{
-		if (!isVisible() || !ui || mStopped)
-			return;
-
-#ifdef PROFILING
-		int timeSinceLastFrame = mFrameTimer.elapsed();
-		qDebug() << "Got datagram after " << timeSinceLastFrame << " ms";
-		mFrameTimer.restart();
-#endif
-
-		//qDebug() << "Has packet of " << mTcpSocket.bytesAvailable() << " bytes";
-
-		// Read the first pending packet
-		mGlobalBytesBuffer.append(mTcpSocket.readAll());
+		writer.close();
+		qDebug() << "Capture saved to " << writer.fileName();
+		updateWindowTitle();
+		return;
+	}
 
-		int remainSize = mGlobalBytesBuffer.size();
-		while (mGlobalBytesBuffer.size() > 10)
-		{
-			// Read header
-			quint8 headerSize, protVersion;
-			quint32 frameSize, audioFrameSize = 0;
+	QString dir = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation);
+	QString fileName = QString("bbqscreen-%1-%2.bbqcap")
+		.arg(QString(mHost).replace(':', '_'), QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+	QString path = QDir(dir).filePath(fileName);
 
-			protVersion = bytesToUInt8(mGlobalBytesBuffer, 0);
+	if (writer.open(path))
+	{
+		qDebug() << "Capturing stream to " << path;
+		updateWindowTitle();
+	}
+	else
+	{
+		QMessageBox::critical(this, "Capture error", "Unable to create the capture file " + path);
+	}
+}
+//----------------------------------------------------
+void ScreenForm::toggleRecording()
+{
+	StreamRecorder& recorder = mSession.recorder();
 
-			if (protVersion == 3) // BBQScreen 2.1.2 - Legacy method, no audio
-				headerSize = 6;
-			else if (protVersion == 4) // BBQScreen 2.2.0 - With audio
-				headerSize = 10;
-			else
-				qWarning() << "WARN: Unknown protVersion " << protVersion;
+	if (recorder.isOpen())
+	{
+		recorder.close();
+		qDebug() << "Recording saved to " << recorder.fileName();
+		updateWindowTitle();
+		return;
+	}
 
-			mRemoteOrientation = (int) bytesToUInt8(mGlobalBytesBuffer, 1);
-			frameSize = bytesToUInt32(mGlobalBytesBuffer, 2);
+	QString dir = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation);
+	QString fileName = QString("bbqscreen-%1-%2.mp4")
+		.arg(QString(mHost).replace(':', '_'), QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+	QString path = QDir(dir).filePath(fileName);
 
-			if (protVersion == 4)
-			{
-				audioFrameSize = bytesToUInt32(mGlobalBytesBuffer, 6);
-				//qDebug() << "Protocol V4, video size=" << frameSize << " audio size=" << audioFrameSize;
-			}
+	if (mSession.startRecording(path))
+	{
+		qDebug() << "Recording stream to " << path;
+		updateWindowTitle();
+	}
+	else
+	{
+		QMessageBox::critical(this, "Recording error", "Unable to record to " + path);
+	}
+}
+//----------------------------------------------------
+void ScreenForm::saveReplay()
+{
+	ReplayRing& ring = mSession.replayRing();
 
-			mVideoFrameSize = frameSize;
-			mAudioFrameSize = audioFrameSize;
-			if (frameSize+audioFrameSize+headerSize > mGlobalBytesBuffer.size())
-			{
-				//qDebug() << "-- Will revisit later (" << (mGlobalBytesBuffer.size()-headerSize) << "/" << (frameSize+audioFrameSize) << ")";
-				break;
-			}
+	if (ring.isFlushing())
+		return;
 
-			mGlobalBytesBuffer = mGlobalBytesBuffer.remove(0, headerSize);
+	QString dir = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation);
+	QString fileName = QString("bbqscreen-%1-%2-replay.mp4")
+		.arg(QString(mHost).replace(':', '_'), QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+	QString path = QDir(dir).filePath(fileName);
 
-			// Decode the video frame (if any)
-			if (frameSize > 0)
-			{
-				unsigned char* buff = new unsigned char[frameSize];
-				memcpy(buff, mGlobalBytesBuffer.data(), frameSize);
-				mDecoder.decodeFrame(buff, frameSize, mLastImageDisplayed);
-				mDecoder.process();
-				//mVideoDecoderThread.start();
-				mGlobalBytesBuffer = mGlobalBytesBuffer.remove(0, frameSize);
-			}
-			
-			// If protocol version 4, decode the audio frame (if any)
-			if (audioFrameSize > 0)
-			{
-				unsigned char* buff = new unsigned char[audioFrameSize];
-				memcpy(buff, mGlobalBytesBuffer.data(), audioFrameSize);
-				mAudioDecoder.decodeFrame(buff, audioFrameSize);
-				mAudioDecoder.process();
-				//mAudioDecoderThread.start();
-				mGlobalBytesBuffer = mGlobalBytesBuffer.remove(0, audioFrameSize);
-			}
-		}
-	}
+	if (ring.flushTo(path))
+		qDebug() << "Saving the last " << ring.durationNs() / 1000000 << " ms (" << ring.bytes() << " bytes) to " << path;
+	else
+		qDebug() << "Nothing to save yet, waiting for a keyframe";
 }
 //----------------------------------------------------
-void ScreenForm::onDecodeFinished(bool result, bool isAudio)
+void ScreenForm::pasteClipboard()
 {
-	if (!isAudio && result)
+	TextInjector& injector = mSession.textInjector();
+
+	// Pasting again while typing cancels
+	if (injector.isRunning())
 	{
-		if (mLastImageDisplayed)
-		{
-			QImage img = mDecoder.getLastFrame();
-			mRotationAngle = mRemoteOrientation * (-90) + mOrientationOffset;
+		injector.stop();
+		qDebug() << "Paste cancelled after " << injector.typedCount() << " of " << injector.totalCount() << " characters";
+		return;
+	}
 
-			mOriginalSize.setX(img.width());
-			mOriginalSize.setY(img.height());
+	const int count = injector.start(QGuiApplication::clipboard()->text());
+	qDebug() << "Pasting " << count << " characters (" << injector.skippedCount() << " without a key)";
+}
+//----------------------------------------------------
+void ScreenForm::onReplaySaved(const QString& path, bool success)
+{
+	if (success)
+		qDebug() << "Replay saved to " << path;
+	else
+		QMessageBox::critical(this, "Replay error", "Unable to save the replay to " + path);
+}
+//----------------------------------------------------
+void ScreenForm::toggleRelay()
+{
+	StreamRelay& relay = mSession.relay();
 
-			if (mRotationAngle != 0)
-			{
-				QTransform t;
-				t.rotate(mRotationAngle);
-				img = img.transformed(t, mHighQuality ? Qt::SmoothTransformation : Qt::FastTransformation);
-			}
+	if (relay.isListening())
+	{
+		relay.close();
+	}
+	else if (!relay.listen(DEFAULT_STREAM_PORT, mHost + " (relay)"))
+	{
+		QMessageBox::critical(this, "Relay error", "Unable to listen for viewers on a local port");
+	}
 
-			mLastImage = img;
-			mLastImageDisplayed = false;
-			ui->lblDisplay->setImage(mLastImage);
+	updateWindowTitle();
+}
+//----------------------------------------------------
+void ScreenForm::updateWindowTitle()
+{
+	QString title = mTitle;
 
-			mTotalFrameReceived++;
-			
-#ifdef PROFILING
-			timeSinceLastFrame = mFrameTimer.elapsed();
-			qDebug() << "Decoded in " << timeSinceLastFrame << " ms";
-#endif
-			if (!isVisible() || !ui || mStopped)
-				return;
+	if (mSession.captureWriter().isOpen())
+		title += " [REC]";
 
-			if (mShowFps)
-			{
-				ui->lblFps->setText(QString::number((double)(mTotalFrameReceived/(mFrameTimer.elapsed()/1000.0))) + " fps");
+	if (mSession.recorder().isOpen())
+		title += " [MP4]";
 
-				if (mFrameTimer.elapsed() > 2000) {
-					mFrameTimer.restart();
-					mTotalFrameReceived = 0;
-				}
-			}
-			else
-			{
-				ui->lblFps->setText("");
-			}
-		}
-	}
+	const StreamRelay& relay = mSession.relay();
+	if (relay.isListening())
+		title += QString(" [RELAY :%1, %2 viewers]").arg(relay.port()).arg(relay.viewerCount());
 
-	if (isAudio)
-		mAudioDecoderThread.quit();
-	else
-		mVideoDecoderThread.quit();
+	setWindowTitle(title);
 }
 //----------------------------------------------------
-void ScreenForm::onSocketStateChanged()
+void ScreenForm::onFrameReady()
 {
-	if (mStopped || !ui)
-	{
-		// Don't do anything if we stopped or closed the window
+	if (!isVisible() || !ui || mStopped)
 		return;
+
+	QImage img = mSession.lastFrame();
+	QRegion dirty = mSession.takeDirtyRegion();
+	mRotationAngle = mSession.remoteOrientation() * (-90) + mOrientationOffset;
+
+	mOriginalSize.setX(img.width());
+	mOriginalSize.setY(img.height());
+
+	// Only the tiles that changed are uploaded, the rotation is done by the view
+	ui->lblDisplay->setRotation(mRotationAngle);
+	ui->lblDisplay->updateImage(img, dirty);
+
+	if (!mFirstFrameShown && mSession.elapsedSinceConnectMs() >= 0)
+	{
+		mFirstFrameShown = true;
+		qDebug() << "First frame displayed " << mSession.elapsedSinceConnectMs() << " ms after connecting";
 	}
 
-	if (mTcpSocket.state() == QAbstractSocket::ConnectedState)
+	mTotalFrameReceived++;
+
+#ifdef PROFILING
+	qDebug() << "Frame displayed after " << mFrameTimer.elapsed() << " ms";
+#endif
+
+	if (mShowFps)
 	{
-		ui->lblFps->setText("Connected, loading first frame...");
-		mIsConnecting = false;
-		qApp->processEvents();
+		ui->lblFps->setText(QString::number((double)(mTotalFrameReceived/(mFrameTimer.elapsed()/1000.0))) + " fps" + mInputLatency);
+
+		if (mFrameTimer.elapsed() > 2000) {
+			mFrameTimer.restart();
+			mTotalFrameReceived = 0;
+
+			// Input to wire latency over the same period, if there was input
+			int packets;
+			double averageMs, maxMs;
+			mSession.inputWriter().takeLatency(packets, averageMs, maxMs);
+			mInputLatency = (packets > 0)
+				? QString(" - input %1 ms (max %2)").arg(averageMs, 0, 'f', 2).arg(maxMs, 0, 'f', 2)
+				: QString();
+		}
 	}
-	else if (mTcpSocket.state() == QAbstractSocket::UnconnectedState)
+	else if (ui->lblFps->isVisible())
 	{
-		ui->lblFps->setText("Lost connection with host device. Reconnecting...");
-		ui->lblFps->setVisible(true);
-		mIsConnecting = true;
-
-		connectTo(mHost);
+		// First frame is there, no need for the connection status anymore
+		ui->lblFps->setText("");
+		ui->lblFps->setVisible(false);
 	}
 }
 //----------------------------------------------------
-void ScreenForm::timerEvent(QTimerEvent *evt)
+void ScreenForm::onAudioError(const QString& message)
+{
+	QMessageBox::critical(this, "Audio playback error", message);
+}
+//----------------------------------------------------
+void ScreenForm::onSessionStateChanged(StreamSession::State state)
 {
-	if (mStopped)
+	if (mStopped || !ui)
+	{
+		// Don't do anything if we stopped or closed the window
 		return;
+	}
 
-	if (evt->timerId() == mConnectionTimerId)
+	switch (state)
 	{
-		if (mTcpSocket.state() != QAbstractSocket::ConnectedState
-			&& mTcpSocket.state() != QAbstractSocket::ConnectingState)
-		{
-			if (mConnectionAttempts < 3)
-			{
-				// Unable to connect, try again
-				attemptConnection();
-			}
-			else
-			{
-				// Tried too much times, abort
-				QMessageBox::critical(this, "Could not connect", "Unable to connect to " + mHost + " after 3 attempts. Please check the device IP, and make sure your screen is unlocked.\nError message: " + mTcpSocket.errorString());
-				killTimer(mConnectionTimerId);
-				mConnectionTimerId = -1;
-				close();
-				return;
-			}
-		}
-		else if (mTcpSocket.state() == QAbstractSocket::ConnectedState)
-		{
-			// Connected
-			mIsConnecting = false;
-			mFrameTimer.start();
+	case StreamSession::SS_CONNECTING:
+		ui->lblFps->setText("Connecting to '" + mHost + "'... (Attempt " + QString::number(mSession.connectionAttempts()) + "/" + QString::number(MAX_CONNECTION_ATTEMPTS) + ")");
+		break;
 
-			if (!mShowFps)
-			{
-				ui->lblFps->setText("");
-				ui->lblFps->setVisible(false);
-			}
+	case StreamSession::SS_CONNECTED:
+		ui->lblFps->setText("Connected, loading first frame...");
+		mFrameTimer.start();
+		mTotalFrameReceived = 0;
+		break;
 
-			mTimeSinceLastTouchEvent.restart();
-			killTimer(mConnectionTimerId);
-			mConnectionTimerId = -1;
-		}
-	}
-	else
-	{
-		// Frame updater timer
-		if (!mLastImageDisplayed)
-		{
-			// Display next frame
-			ui->lblDisplay->setImage(mLastImage);
-			mLastImageDisplayed = true;
-		}
+	case StreamSession::SS_RECONNECTING:
+		ui->lblFps->setText("Lost connection with host device. Reconnecting... (Attempt " + QString::number(mSession.connectionAttempts()) + "/" + QString::number(MAX_RECONNECTION_ATTEMPTS) + ")");
+		ui->lblFps->setVisible(true);
+		break;
 
-		if (mTimeSinceLastTouchEvent.elapsed() > 16 && mTouchEventPacket.size() > 0)
-		{
-			mTcpSocket.write(mTouchEventPacket);
-			mTcpSocket.flush();
-			mTouchEventPacket.clear();
+	case StreamSession::SS_FAILED:
+		// Tried too much times, abort
+		QMessageBox::critical(this, "Could not connect", "Unable to connect to " + mHost + " after " + QString::number(mSession.connectionAttempts()) + " attempts. Please check the device IP, and make sure your screen is unlocked.\nError message: " + mSession.errorString());
+		close();
+		break;
 
-			mTimeSinceLastTouchEvent.restart();
-		}
+	default:
+		break;
 	}
 }
 //----------------------------------------------------
@@ -392,9 +429,9 @@ void ScreenForm::keyReleaseEvent(QKeyEvent *evt)
 		{
 			// Route the key to the server
 #if defined(PLAT_WINDOWS) || defined(PLAT_LINUX)
-			sendKeyboardInput(false, evt->nativeScanCode());
+			mSession.sendKeyboardInput(false, evt->nativeScanCode());
 #elif defined(PLAT_APPLE)
-			sendKeyboardInput(false, evt->key());
+			mSession.sendKeyboardInput(false, evt->key());
 #else
 #error "Unsupported keyboard platform"
 #endif
@@ -418,11 +455,11 @@ void ScreenForm::keyPressEvent(QKeyEvent *evt)
 		{
 			// Route the key to the server
 #if defined(PLAT_WINDOWS) || defined(PLAT_LINUX)
-			sendKeyboardInput(true, evt->nativeScanCode());
+			mSession.sendKeyboardInput(true, evt->nativeScanCode());
 #elif defined(PLAT_APPLE)
 			char inputChar = evt->text().at(0).toLatin1();
 			qDebug() << "Input char is " << inputChar;
-			sendKeyboardInput(true, evt->key());
+			mSession.sendKeyboardInput(true, evt->key());
 #endif
 		}
 		break;
@@ -451,6 +488,26 @@ void ScreenForm::keyPressEvent(QKeyEvent *evt)
 			if (mOrientationOffset == 360)
 				mOrientationOffset = 0;
 			break;
+
+		case Qt::Key_R:
+			toggleCapture();
+			break;
+
+		case Qt::Key_L:
+			toggleRelay();
+			break;
+
+		case Qt::Key_M:
+			toggleRecording();
+			break;
+
+		case Qt::Key_S:
+			saveReplay();
+			break;
+
+		case Qt::Key_V:
+			pasteClipboard();
+			break;
 		}
 	}
 
@@ -475,9 +532,9 @@ void ScreenForm::mousePressEvent(QMouseEvent *evt)
 		if (pos.y() < 0) pos.setY(0);
 
 		if (evt->button() == Qt::LeftButton) {
-			sendTouchInput(TET_DOWN, 0, pos.x(), pos.y());
+			mSession.sendTouchInput(TET_DOWN, 0, pos.x(), pos.y());
 		} else {
-			sendTouchInput(TET_DOWN, 1, pos.x() + 30, pos.y() + 30);
+			mSession.sendTouchInput(TET_DOWN, 1, pos.x() + 30, pos.y() + 30);
 		}
 
 		evt->accept();
@@ -499,9 +556,9 @@ void ScreenForm::mouseReleaseEvent(QMouseEvent *evt)
 		QPoint pos = getScreenSpacePoint(posX, posY);
 
 		if (evt->button() == Qt::LeftButton) {
-			sendTouchInput(TET_UP, 0, pos.x(), pos.y());
+			mSession.sendTouchInput(TET_UP, 0, pos.x(), pos.y());
 		} else {
-			sendTouchInput(TET_UP, 1, pos.x(), pos.y());
+			mSession.sendTouchInput(TET_UP, 1, pos.x(), pos.y());
 		}
 
 		evt->accept();
@@ -520,84 +577,179 @@ void ScreenForm::mouseMoveEvent(QMouseEvent *evt)
 		posX = posX * ((float) width() / (float) imgSz.width());
 
 		QPoint pos = getScreenSpacePoint(posX, posY);
-		sendTouchInput(TET_MOVE, 0, pos.x(), pos.y());
+		mSession.sendTouchInput(TET_MOVE, 0, pos.x(), pos.y());
 
 		evt->accept();
 	}
 }
 //----------------------------------------------------
-quint8 ScreenForm::bytesToUInt8(const QByteArray& bytes, int offset)
+bool ScreenForm::event(QEvent *evt)
 {
-	return ((unsigned char) (bytes.at(offset)));
+	switch (evt->type())
+	{
+	case QEvent::TouchBegin:
+	case QEvent::TouchUpdate:
+	case QEvent::TouchEnd:
+	case QEvent::TouchCancel:
+		touchEvent(static_cast<QTouchEvent*>(evt));
+		return true;
+
+	default:
+		return QWidget::event(evt);
+	}
 }
 //----------------------------------------------------
-quint16 ScreenForm::bytesToUInt16(const QByteArray& bytes, int offset)
+void ScreenForm::touchEvent(QTouchEvent *evt)
 {
-	quint16 value = 0;
-	for (int i = 0; i < 2; i++) {
-		value += ((unsigned char) bytes.at(offset + i)) << (8 * (1-i));
+	const QList<QTouchEvent::TouchPoint>& points = evt->touchPoints();
+	const bool touchPad = evt->device() && evt->device()->type() == QTouchDevice::TouchPad;
+	mTouchFrame.resize(0);
+
+	if (evt->type() == QEvent::TouchCancel)
+	{
+		// Lift every finger where it was
+		for (QMap<int, TouchPointer>::iterator it = mTouchPointers.begin(); it != mTouchPointers.end(); ++it)
+		{
+			it.value().type = TET_UP;
+			mTouchFrame.append(it.value());
+		}
 	}
-	return value;
+	else
+	{
+		// One finger on a trackpad moves the cursor: only gestures are sent,
+		// until every finger is lifted
+		if (touchPad && !mForwardingTouch && points.size() < 2)
+		{
+			evt->accept();
+			return;
+		}
+		mForwardingTouch = true;
+
+		for (QList<QTouchEvent::TouchPoint>::const_iterator it = points.begin(); it != points.end(); ++it)
+		{
+			QPoint pos;
+			if (touchPad)
+			{
+				// Trackpads are mapped on the whole screen
+				QPointF norm = it->normalizedPos();
+				pos = QPoint(qBound(0, (int) (norm.x() * mOriginalSize.x()), qMax(0, mOriginalSize.x() - 1)),
+					qBound(0, (int) (norm.y() * mOriginalSize.y()), qMax(0, mOriginalSize.y() - 1)));
+			}
+			else
+			{
+				pos = getTouchPoint(it->pos());
+			}
+
+			QMap<int, TouchPointer>::iterator known = mTouchPointers.find(it->id());
+			if (known == mTouchPointers.end())
+			{
+				if (it->state() == Qt::TouchPointReleased || mTouchPointers.size() >= MAX_TOUCH_POINTERS)
+					continue;
+
+				// New finger: the lowest one free on the device
+				unsigned char finger = 0;
+				for (QMap<int, TouchPointer>::const_iterator used = mTouchPointers.constBegin(); used != mTouchPointers.constEnd(); )
+				{
+					if (used.value().finger == finger)
+					{
+						finger++;
+						used = mTouchPointers.constBegin();
+					}
+					else
+					{
+						++used;
+					}
+				}
+
+				TouchPointer pointer = { TET_DOWN, finger, (unsigned short) pos.x(), (unsigned short) pos.y() };
+				known = mTouchPointers.insert(it->id(), pointer);
+			}
+			else
+			{
+				known.value().type = (it->state() == Qt::TouchPointReleased) ? TET_UP : TET_MOVE;
+				known.value().x = pos.x();
+				known.value().y = pos.y();
+			}
+
+			mTouchFrame.append(known.value());
+		}
+	}
+
+	// The released fingers are free again
+	for (QMap<int, TouchPointer>::iterator it = mTouchPointers.begin(); it != mTouchPointers.end(); )
+	{
+		if (it.value().type == TET_UP)
+			it = mTouchPointers.erase(it);
+		else
+			++it;
+	}
+
+	if (evt->type() == QEvent::TouchEnd || evt->type() == QEvent::TouchCancel)
+	{
+		mTouchPointers.clear();
+		mForwardingTouch = false;
+	}
+
+	if (!mTouchFrame.isEmpty())
+		mSession.sendTouchFrame(mTouchFrame.constData(), mTouchFrame.size());
+
+	evt->accept();
 }
 //----------------------------------------------------
-quint32 ScreenForm::bytesToUInt32(const QByteArray& bytes, int offset)
+void ScreenForm::changeEvent(QEvent *evt)
 {
-	quint32 value = 0;
-	for (int i = 0; i < 4; i++) {
-		value += ((unsigned char) bytes.at(offset + i)) << ((3 - i) * 8);
-	}
-	return value;
+	QWidget::changeEvent(evt);
+
+	if (evt->type() == QEvent::ActivationChange || evt->type() == QEvent::WindowStateChange)
+		updatePriority();
 }
 //----------------------------------------------------
-void ScreenForm::closeEvent(QCloseEvent *evt)
+void ScreenForm::showEvent(QShowEvent *evt)
 {
-	mParentWindow->show();
-	QWidget::closeEvent(evt);
-	mStopped = true;
+	QWidget::showEvent(evt);
+	updatePriority();
 }
 //----------------------------------------------------
-void ScreenForm::sendKeyboardInput(bool down, unsigned int keyCode)
+void ScreenForm::hideEvent(QHideEvent *evt)
 {
-	if (mTcpSocket.state() != QAbstractSocket::ConnectedState) return;
-
-	QByteArray packet;
-	packet.append((char)IET_KEYBOARD);
-	packet.append(down ? '\x01' : '\x00');
-	packet.append(numberToBytes(keyCode, 4));
-
-	qDebug() << "Keyboard pressed: " << keyCode;
-
-	mTcpSocket.write(packet);
-	mTcpSocket.flush();
-	qApp->processEvents();
+	QWidget::hideEvent(evt);
+	updatePriority();
 }
 //----------------------------------------------------
-void ScreenForm::sendTouchInput(TouchEventType type, unsigned char finger, unsigned short x, unsigned short y)
+void ScreenForm::updatePriority()
 {
-	if (mTcpSocket.state() != QAbstractSocket::ConnectedState) return;
+	if (!isVisible() || isMinimized())
+	{
+		// Nobody sees us: keep reading the socket so the device doesn't stall,
+		// but only decode the reference frames and don't convert anything.
+		if (!mHiddenCpu.isStarted())
+			mHiddenCpu.start();
 
-	QByteArray packet;
-	packet.append((char)IET_TOUCH);
-	packet.append((char)type);
-	packet.append(finger);
-	packet.append(numberToBytes(x, 2));
-	packet.append(numberToBytes(y, 2));
+		mSession.setPriority(SP_HIDDEN);
+		return;
+	}
+
+	if (mHiddenCpu.isStarted())
+	{
+		qDebug() << "Was hidden for " << mHiddenCpu.elapsedMs() << " ms, CPU usage "
+			<< QString::number(mHiddenCpu.utilization() * 100.0, 'f', 1) << "% of a core";
+		mHiddenCpu = CpuUsageMeter();
+	}
 
-	mTouchEventPacket = packet;
-	// Will be sent in timerEvent
+	// The next frame decoded is converted whatever the rate, so the display is
+	// fresh right away. Another window has the focus: the frame rate can go down.
+	mSession.setPriority(isActiveWindow() ? SP_FOCUSED : SP_VISIBLE);
 }
 //----------------------------------------------------
-QByteArray ScreenForm::numberToBytes(unsigned int value, int size)
+void ScreenForm::closeEvent(QCloseEvent *evt)
 {
-	QByteArray output;
-
-	for (int i = 0; i < size; i++)
-	{
-		// value >> 2-1-0
-		output.push_back((value >> ((size - 1 - i) * 8)) & 0xFF);
-	}
+	if (mReplay)
+		mReplay->stop();
 
-	return output;
+	mSession.stop();
+	mParentWindow->show();
+	QWidget::closeEvent(evt);
+	mStopped = true;
 }
 //----------------------------------------------------
 QPoint ScreenForm::getScreenSpacePoint(int x, int y)
@@ -609,3 +761,16 @@ QPoint ScreenForm::getScreenSpacePoint(int x, int y)
 	return output;
 }
 //----------------------------------------------------
+QPoint ScreenForm::getTouchPoint(const QPointF& pos)
+{
+	QSizeF imgSz = ui->lblDisplay->getRenderSize();
+	float posX = pos.x() - (width() / 2.0f - imgSz.width() / 2.0f);
+	posX = posX * ((float) width() / (float) imgSz.width());
+
+	QPoint output = getScreenSpacePoint(posX, pos.y());
+	output.setX(qBound(0, output.x(), qMax(0, mOriginalSize.x() - 1)));
+	output.setY(qBound(0, output.y(), qMax(0, mOriginalSize.y() - 1)));
+
+	return output;
+}
+//----------------------------------------------------
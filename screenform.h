@@ -21,13 +21,14 @@
 #define SCREENFORM_H
 
 #include <QtWidgets/QWidget>
-#include <QtNetwork/QTcpSocket>
 #include <QTime>
 #include <QPainter>
-#include <QBuffer>
 #include <QLabel>
-#include <QtMultimedia/QMediaPlayer>
-#include "QStreamDecoder.h"
+#include <QMap>
+#include <QVector>
+#include "StreamSession.h"
+#include "StreamReplay.h"
+#include "CpuUsage.h"
 
 #define FPS_AVERAGE_SAMPLES 50
 
@@ -42,17 +43,6 @@
 #warning "Unsupported keyboard platform"
 #endif
 
-enum TouchEventType {
-	TET_UP,
-	TET_DOWN,
-	TET_MOVE
-};
-
-enum InputEventType {
-	IET_KEYBOARD,
-	IET_TOUCH
-};
-
 namespace Ui {
 	class ScreenForm;
 }
@@ -68,81 +58,88 @@ public:
 	~ScreenForm();
 
 	void connectTo(const QString& host);
+	bool replayFrom(const QString& path, double speed);
 
-	void timerEvent(QTimerEvent *evt);
 	void closeEvent(QCloseEvent *evt);
+	void changeEvent(QEvent *evt);
+	void showEvent(QShowEvent *evt);
+	void hideEvent(QHideEvent *evt);
 	void keyPressEvent(QKeyEvent *evt);
 	void keyReleaseEvent(QKeyEvent *evt);
 	void mousePressEvent(QMouseEvent *evt);
 	void mouseReleaseEvent(QMouseEvent *evt);
 	void mouseMoveEvent(QMouseEvent *evt);
-
-	quint8 bytesToUInt8(const QByteArray& bytes, int offset);
-	quint16 bytesToUInt16(const QByteArray& bytes, int offset);
-	quint32 bytesToUInt32(const QByteArray& bytes, int offset);
-	QByteArray numberToBytes(unsigned int value, int size);
+	bool event(QEvent *evt);
 
 	void setQuality(bool high);
 	void setShowFps(bool show);
 
-	void sendKeyboardInput(bool down, unsigned int keyCode);
-	void sendTouchInput(TouchEventType type, unsigned char finger, unsigned short x, unsigned short y);
+	// For devices announcing INPUT_CAP_TOUCH_BATCH, see StreamSession::setTouchBatching
+	void setTouchBatching(bool enabled);
 
 	QPoint getScreenSpacePoint(int x, int y);
 
+	// Device point under a position of the widget, clamped to the screen
+	QPoint getTouchPoint(const QPointF& pos);
+
 #ifdef __APPLE__
 	bool nativeEvent(const QByteArray& eventType, void* message, long* result);
 #endif
 
 protected:
-	void attemptConnection();
+	void toggleCapture();
+	void toggleRelay();
+	void toggleRecording();
+	void saveReplay();
+	void pasteClipboard();
+	void updatePriority();
+	void touchEvent(QTouchEvent *evt);
 
 private slots:
-	void processPendingDatagrams();
-	void onSocketStateChanged();
-	void onDecodeFinished(bool result, bool isAudio);
+	void updateWindowTitle();
+	void onSessionStateChanged(StreamSession::State state);
+	void onFrameReady();
+	void onReplayRecord(const StreamRecord& record);
+	void onReplayFinished();
+	void onAudioError(const QString& message);
+	void onReplaySaved(const QString& path, bool success);
 
 private:
 	Ui::ScreenForm *ui;
 	MainWindow* mParentWindow;
 
-	QTcpSocket mTcpSocket;
-
-	// Decoders
-	QStreamDecoder mDecoder;
-	QStreamDecoder mAudioDecoder;
-	QThread mAudioDecoderThread;
-	QThread mVideoDecoderThread;
+	// Connection, decoding and input
+	StreamSession mSession;
+	StreamReplay* mReplay;
 
 	// Session settings
 	bool mHighQuality;
-	bool mIsConnecting;
 	bool mShowFps;
 	bool mStopped;
 	int mRotationAngle;
 	QString mHost;
-
-	// Session data
-	QByteArray mGlobalBytesBuffer;
-	int mVideoFrameSize;
-	int mAudioFrameSize;
-	int mConnectionAttempts;
-	int mConnectionTimerId;
+	QString mTitle;
 
 	// Remote frame info
 	int mTotalFrameReceived;
-	int mRemoteOrientation;
 	int mOrientationOffset;
 	QPoint mOriginalSize;
 	QTime mFrameTimer;
-	QImage mLastImage;
-	bool mLastImageDisplayed;
+	bool mFirstFrameShown;
+
+	// Measures the CPU used while the window is minimized or hidden
+	CpuUsageMeter mHiddenCpu;
 
 	// Local input info
+	QString mInputLatency;
 	bool mIsMouseDown;
 	bool mCtrlDown;
-	QTime mTimeSinceLastTouchEvent;
-	QByteArray mTouchEventPacket;
+
+	// Touch points being forwarded, by QTouchEvent::TouchPoint id, with the
+	// finger they were given on the device
+	QMap<int, TouchPointer> mTouchPointers;
+	QVector<TouchPointer> mTouchFrame;
+	bool mForwardingTouch;
 };
 
 #endif // SCREENFORM_H
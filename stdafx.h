@@ -17,4 +17,10 @@
  */
 
 
+#ifdef QT_WIDGETS_LIB
 #include <QtWidgets/QtWidgets>
+#else
+// Headless targets (benchmarks, tools) only get the non-GUI modules
+#include <QtCore/QtCore>
+#include <QtGui/QImage>
+#endif
@@ -0,0 +1,40 @@
+# ----------------------------------------------------
+# bbqbench - headless benchmark of the stream pipeline
+# Build with: qmake bbqbench.pro && make
+# ----------------------------------------------------
+
+TEMPLATE = app
+TARGET = bbqbench
+DESTDIR = .
+
+QT += core gui network multimedia
+QT -= widgets
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../.. \
+    ../../QTFFmpegWrapper \
+    ../common
+DEPENDPATH += .
+MOC_DIR += ./GeneratedFiles
+OBJECTS_DIR += ./obj
+
+HEADERS += ../../stdafx.h \
+    ../common/SyntheticStream.h
+SOURCES += main.cpp \
+    ../common/SyntheticStream.cpp
+
+include(../../core/bbqcore.pri)
+
+unix:LIBS += -L/usr/local/lib
+win32:LIBS += -L../../ffmpeg_lib_win64
+
+# Set list of required FFmpeg libraries
+LIBS += -lavutil \
+    -lavcodec \
+    -lavformat \
+    -lswscale \
+    -lswresample
+
+# Requied for some C99 defines
+DEFINES += __STDC_CONSTANT_MACROS
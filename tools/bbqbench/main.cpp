@@ -0,0 +1,1181 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// bbqbench - headless benchmark of the client stream pipeline.
+//
+// Runs the framer, the decoders and the color conversion over a .bbqcap
+// capture or a synthetic H264+AAC stream, and prints the results as JSON
+// so they can be compared across commits.
+//
+// With --connect, measures instead how the frame rate scales with the number
+// of sessions decoding on the shared DecodePool, against a bbqserver.
+//
+// With --latency, measures the glass to glass latency of a bbqserver or a
+// device: time from an injected input to its visible response.
+//
+// With --reconnect, measures the time to first frame after each connection
+// drop of a bbqserver started with --drop-every.
+//
+// With --startup, measures the time to first frame of new sessions, phase
+// by phase.
+//
+// With --discovery, listens to the device announcements (e.g. of a bbqserver
+// with --announce-count 500) and measures the discovery registry.
+//
+// With --scan, probes the stream port of every host of a range (e.g. the
+// 127.0.1.0/24 of a bbqserver with --farm 50) and measures the subnet scan.
+//
+// With --adb-bootstrap, times the USB service bootstrap against an adb (the
+// tools/common/fake-adb.sh stand-in), with and without the binary in place,
+// and the blocking cp and chmod it replaced.
+//
+// With --type, measures how fast text is typed into a bbqserver: the
+// server logs the characters it received and their rate on disconnection.
+//
+// With --yuv-bench, checks the YUV to RGB kernels of every instruction set
+// the CPU has against swscale, and times them, at the usual device sizes.
+
+#include "stdafx.h"
+#include "QStreamFramer.h"
+#include "QStreamDecoder.h"
+#include "StreamCapture.h"
+#include "StreamSession.h"
+#include "DecodePool.h"
+#include "CpuUsage.h"
+#include "SyntheticStream.h"
+#include "YuvConverter.h"
+#include "LatencyProbe.h"
+#include "DeviceRegistry.h"
+#include "SubnetScanner.h"
+#include "UsbBootstrap.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QFile>
+#include <QVector>
+#include <QTextStream>
+#include <QEventLoop>
+#include <QDir>
+#include <QFileInfo>
+#include <QProcess>
+#include <QTimer>
+#include <QtNetwork/QUdpSocket>
+
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+
+// Size of the chunks fed to the framer, roughly what a socket read returns
+#define READ_CHUNK_SIZE (64 * 1024)
+
+// Conversions timed per kernel and size with --yuv-bench
+#define YUV_BENCH_ITERATIONS 50
+
+//------------------------------------------
+// Allocation accounting. Only covers C++ allocations (Qt containers, our own
+// buffers), FFmpeg allocates through av_malloc and isn't counted here.
+static std::atomic<qint64> sAllocCount(0);
+static std::atomic<qint64> sAllocBytes(0);
+
+void* operator new(size_t size)
+{
+	sAllocCount++;
+	sAllocBytes += size;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+//------------------------------------------
+static QJsonObject latencyStats(QVector<qint64> samples)
+{
+	QJsonObject stats;
+	if (samples.isEmpty())
+		return stats;
+
+	std::sort(samples.begin(), samples.end());
+
+	qint64 total = 0;
+	for (auto it = samples.constBegin(); it != samples.constEnd(); ++it)
+		total += *it;
+
+	auto percentile = [&samples](double p) {
+		int index = qMin(samples.size() - 1, (int) (p * samples.size()));
+		return samples.at(index) / 1000000.0;
+	};
+
+	stats["mean"] = total / 1000000.0 / samples.size();
+	stats["p50"] = percentile(0.50);
+	stats["p90"] = percentile(0.90);
+	stats["p99"] = percentile(0.99);
+	stats["max"] = samples.last() / 1000000.0;
+	return stats;
+}
+//------------------------------------------
+static QByteArray serializeRecord(const StreamRecord& record)
+{
+	QByteArray out = QStreamFramer::serializeHeader(record, 4);
+	out.append(record.video);
+	out.append(record.audio);
+	return out;
+}
+//------------------------------------------
+static bool loadRecords(const QCommandLineParser& args, StreamCaptureReader& reader,
+	QVector<StreamRecord>& records, QJsonObject& source)
+{
+	if (args.isSet("capture"))
+	{
+		QString path = args.value("capture");
+		if (!reader.open(path))
+			return false;
+
+		for (int i = 0; i < reader.recordCount(); i++)
+		{
+			StreamRecord record;
+			reader.record(i, record);
+			records.push_back(record);
+		}
+
+		source["type"] = QString("capture");
+		source["path"] = path;
+		source["records"] = records.size();
+		return true;
+	}
+
+	int width = args.value("width").toInt();
+	int height = args.value("height").toInt();
+	int fps = args.value("fps").toInt();
+	int frames = args.value("frames").toInt();
+	int bitrate = args.value("bitrate").toInt();
+	bool audio = !args.isSet("no-audio");
+	SyntheticStream::Pattern pattern;
+	if (!SyntheticStream::parsePattern(args.value("pattern"), pattern))
+	{
+		qCritical() << "Unknown pattern " << args.value("pattern");
+		return false;
+	}
+
+	SyntheticStream stream;
+	if (!stream.open(width, height, fps, bitrate, audio))
+		return false;
+	stream.setPattern(pattern);
+
+	// Everything is encoded upfront so the encoder isn't part of the measure
+	for (int i = 0; i < frames; i++)
+	{
+		StreamRecord record;
+		record.protVersion = 4;
+		record.orientation = 0;
+		record.timestamp = (qint64) i * 1000000000LL / fps;
+		if (!stream.nextFrame(record.video, record.audio))
+			return false;
+		records.push_back(record);
+	}
+
+	source["type"] = QString("synthetic");
+	source["width"] = width;
+	source["height"] = height;
+	source["fps"] = fps;
+	source["bitrate_kbps"] = bitrate;
+	source["audio"] = audio;
+	source["pattern"] = args.value("pattern");
+	source["records"] = records.size();
+	return true;
+}
+//------------------------------------------
+static bool parsePriority(const QString& name, SessionPriority& priority)
+{
+	static const char* names[] = { "focused", "visible", "thumbnail", "hidden" };
+	for (int i = 0; i < 4; i++)
+	{
+		if (name == names[i])
+		{
+			priority = (SessionPriority) i;
+			return true;
+		}
+	}
+
+	return false;
+}
+//------------------------------------------
+static QJsonObject runDecodeBench(const QVector<StreamRecord>& records, SessionPriority priority, bool changeDetection,
+	int convertThreads, bool fastConversion)
+{
+	QByteArray wire;
+	for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+		wire.append(serializeRecord(*it));
+
+	QStreamFramer framer;
+	QStreamDecoder videoDecoder(false, false);
+	QStreamDecoder audioDecoder(true, false);
+	videoDecoder.setPriority(priority);
+	videoDecoder.setChangeDetection(changeDetection);
+	videoDecoder.setConvertThreads(convertThreads);
+	videoDecoder.setFastConversion(fastConversion);
+
+	QVector<qint64> latencies;
+	latencies.reserve(records.size());
+	int videoFrames = 0, decodedFrames = 0, convertedFrames = 0;
+	qint64 uploadBytes = 0, fullUploadBytes = 0;
+
+	QObject::connect(&videoDecoder, &QStreamDecoder::decodeFinished, [&convertedFrames](bool result, bool) {
+		if (result)
+			convertedFrames++;
+	});
+
+	QElapsedTimer wall, frameTimer;
+	const qint64 cpuStart = processCpuTimeNs();
+	const qint64 allocStart = sAllocCount, allocBytesStart = sAllocBytes;
+	wall.start();
+
+	for (int offset = 0; offset < wire.size(); offset += READ_CHUNK_SIZE)
+	{
+		framer.append(QByteArray::fromRawData(wire.constData() + offset, qMin(READ_CHUNK_SIZE, wire.size() - offset)));
+
+		StreamRecord record;
+		while (framer.next(record))
+		{
+			frameTimer.start();
+
+			if (record.video.size() > 0)
+			{
+				// Same hand-off as ScreenForm::processRecord
+				unsigned char* buff = new unsigned char[record.video.size()];
+				memcpy(buff, record.video.constData(), record.video.size());
+				videoDecoder.decodeFrame(buff, record.video.size(), true);
+				videoDecoder.process();
+				videoFrames++;
+			}
+
+			if (record.audio.size() > 0)
+			{
+				unsigned char* buff = new unsigned char[record.audio.size()];
+				memcpy(buff, record.audio.constData(), record.audio.size());
+				audioDecoder.decodeFrame(buff, record.audio.size());
+				audioDecoder.process();
+			}
+
+			if (record.video.size() > 0)
+			{
+				latencies.push_back(frameTimer.nsecsElapsed());
+				QImage frame = videoDecoder.getLastFrame();
+				if (!frame.isNull())
+					decodedFrames++;
+
+				// What the display uploads: the dirty tiles, against the
+				// whole frame each time it changed before
+				QRegion dirty = videoDecoder.takeDirtyRegion();
+				if (!dirty.isEmpty())
+				{
+					QVector<QRect> rects = dirty.rects();
+					for (auto it = rects.constBegin(); it != rects.constEnd(); ++it)
+						uploadBytes += (qint64) it->width() * it->height() * (frame.depth() / 8);
+					fullUploadBytes += (qint64) frame.width() * frame.height() * (frame.depth() / 8);
+				}
+			}
+		}
+	}
+
+	const qint64 wallNs = wall.nsecsElapsed();
+	const qint64 cpuNs = processCpuTimeNs() - cpuStart;
+	const qint64 allocs = sAllocCount - allocStart;
+	const qint64 allocBytes = sAllocBytes - allocBytesStart;
+	const int frames = qMax(1, videoFrames);
+
+	QImage last = videoDecoder.getLastFrame();
+
+	QJsonObject result;
+	result["frames"] = videoFrames;
+	result["decoded_frames"] = decodedFrames;
+	result["converted_frames"] = convertedFrames;
+	result["unchanged_frames"] = videoDecoder.unchangedFrames();
+	result["partial_frames"] = videoDecoder.partialFrames();
+	result["upload_bytes_per_frame"] = (double) uploadBytes / frames;
+	result["full_upload_bytes_per_frame"] = (double) fullUploadBytes / frames;
+	result["output_width"] = last.width();
+	result["output_height"] = last.height();
+	result["wall_ms"] = wallNs / 1000000.0;
+	result["fps"] = videoFrames / (wallNs / 1000000000.0);
+	result["frame_latency_ms"] = latencyStats(latencies);
+	result["convert_threads"] = convertThreads;
+	result["convert_path"] = fastConversion ? YuvConverter::name(videoDecoder.instructionSet()) : QString("swscale");
+	result["convert_ms_per_frame"] = videoDecoder.conversionNs() / 1000000.0 / frames;
+	result["cpu_ms"] = cpuNs / 1000000.0;
+	result["cpu_ms_per_frame"] = cpuNs / 1000000.0 / frames;
+	result["cpu_utilization"] = (double) cpuNs / wallNs;
+	result["allocs_per_frame"] = (double) allocs / frames;
+	result["alloc_bytes_per_frame"] = (double) allocBytes / frames;
+	return result;
+}
+//------------------------------------------
+// Fills a 4:2:0 picture with gradients and noise, reaching past the limited
+// range on both ends so the clamping is exercised too
+static void fillYuvPicture(ffmpeg::AVFrame* picture)
+{
+	quint32 seed = 12345;
+	for (int plane = 0; plane < 3; plane++)
+	{
+		const int w = plane ? (picture->width + 1) / 2 : picture->width;
+		const int h = plane ? (picture->height + 1) / 2 : picture->height;
+		for (int y = 0; y < h; y++)
+		{
+			uint8_t* row = picture->data[plane] + y * picture->linesize[plane];
+			for (int x = 0; x < w; x++)
+			{
+				seed = seed * 1664525 + 1013904223;
+				row[x] = (uint8_t) (((x * 255) / w + (y * 255) / h + (seed >> 28)) & 0xFF);
+			}
+		}
+	}
+}
+//------------------------------------------
+static int maxChannelDiff(const QImage& a, const QImage& b)
+{
+	int diff = 0;
+	for (int y = 0; y < a.height(); y++)
+	{
+		const uint8_t* rowA = a.constScanLine(y);
+		const uint8_t* rowB = b.constScanLine(y);
+		for (int x = 0; x < a.width() * 4; x++)
+			diff = std::max(diff, std::abs(rowA[x] - rowB[x]));
+	}
+	return diff;
+}
+//------------------------------------------
+static QJsonArray runYuvBench()
+{
+	static const QSize sizes[] = { QSize(720, 1280), QSize(1080, 1920), QSize(1440, 2560) };
+	static const YuvConverter::InstructionSet sets[] = {
+		YuvConverter::IS_C, YuvConverter::IS_SSE2, YuvConverter::IS_AVX2, YuvConverter::IS_NEON };
+
+	QJsonArray results;
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		const int w = sizes[s].width(), h = sizes[s].height();
+
+		ffmpeg::AVFrame* picture = ffmpeg::av_frame_alloc();
+		picture->format = ffmpeg::PIX_FMT_YUV420P;
+		picture->width = w;
+		picture->height = h;
+		if (ffmpeg::av_frame_get_buffer(picture, 32) < 0)
+		{
+			qCritical() << "Cannot allocate a " << w << "x" << h << " picture";
+			ffmpeg::av_frame_free(&picture);
+			continue;
+		}
+		fillYuvPicture(picture);
+
+		ffmpeg::SwsContext* ctx = ffmpeg::sws_getContext(w, h, ffmpeg::PIX_FMT_YUV420P, w, h, ffmpeg::PIX_FMT_RGB32,
+			SWS_BICUBIC, NULL, NULL, NULL);
+		QImage reference(w, h, QImage::Format_RGB32);
+		QImage converted(w, h, QImage::Format_RGB32);
+
+		for (int variant = 0; variant < 4; variant++)
+		{
+			YuvConverter converter;
+			converter.setColorSpace((variant & 2) ? YUV_BT709 : YUV_BT601, (variant & 1) != 0);
+
+			QJsonObject result;
+			result["width"] = w;
+			result["height"] = h;
+			result["matrix"] = QString((variant & 2) ? "bt709" : "bt601");
+			result["range"] = QString((variant & 1) ? "full" : "limited");
+
+			if (ctx != NULL)
+			{
+				converter.configure(ctx);
+				uint8_t* dstData[4] = { reference.bits(), NULL, NULL, NULL };
+				int dstLinesize[4] = { reference.bytesPerLine(), 0, 0, 0 };
+
+				QElapsedTimer timer;
+				timer.start();
+				for (int i = 0; i < YUV_BENCH_ITERATIONS; i++)
+					ffmpeg::sws_scale(ctx, picture->data, picture->linesize, 0, h, dstData, dstLinesize);
+				result["swscale_ms"] = timer.nsecsElapsed() / 1000000.0 / YUV_BENCH_ITERATIONS;
+			}
+
+			for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++)
+			{
+				if (!converter.setInstructionSet(sets[i]))
+					continue;
+
+				QElapsedTimer timer;
+				timer.start();
+				for (int n = 0; n < YUV_BENCH_ITERATIONS; n++)
+					converter.convert(picture, w, 0, h, converted.bits(), converted.bytesPerLine());
+
+				QJsonObject kernel;
+				kernel["ms"] = timer.nsecsElapsed() / 1000000.0 / YUV_BENCH_ITERATIONS;
+				if (ctx != NULL)
+					kernel["max_diff"] = maxChannelDiff(reference, converted);
+				result[YuvConverter::name(sets[i])] = kernel;
+			}
+
+			results.append(result);
+		}
+
+		ffmpeg::sws_freeContext(ctx);
+		ffmpeg::av_frame_free(&picture);
+	}
+
+	return results;
+}
+//------------------------------------------
+static void runEventLoopFor(int ms)
+{
+	QEventLoop loop;
+	QTimer::singleShot(ms, &loop, SLOT(quit()));
+	loop.exec();
+}
+//------------------------------------------
+static QJsonObject runSessionsStep(const QString& host, quint16 port, int sessionCount, int durationMs)
+{
+	QVector<StreamSession*> sessions;
+	QVector<int> frames(sessionCount, 0);
+
+	for (int i = 0; i < sessionCount; i++)
+	{
+		StreamSession* session = new StreamSession(false);
+		session->setDecodePool(&DecodePool::global());
+		QObject::connect(session, &StreamSession::frameReady, [&frames, i] { frames[i]++; });
+		session->connectTo(host, port);
+		sessions.push_back(session);
+	}
+
+	// Let every session connect and get its first keyframe before measuring
+	runEventLoopFor(1000);
+	frames.fill(0);
+
+	QElapsedTimer wall;
+	const qint64 cpuStart = processCpuTimeNs();
+	const unsigned long long stolenStart = DecodePool::global().stolenJobs();
+	wall.start();
+
+	runEventLoopFor(durationMs);
+
+	const qint64 wallNs = wall.nsecsElapsed();
+	const qint64 cpuNs = processCpuTimeNs() - cpuStart;
+
+	int connected = 0, dropped = 0, totalFrames = 0;
+	double minFps = -1;
+	for (int i = 0; i < sessionCount; i++)
+	{
+		if (sessions[i]->state() == StreamSession::SS_CONNECTED)
+			connected++;
+		dropped += sessions[i]->droppedRecords();
+		totalFrames += frames[i];
+
+		double fps = frames[i] / (wallNs / 1000000000.0);
+		if (minFps < 0 || fps < minFps)
+			minFps = fps;
+
+		sessions[i]->stop();
+		delete sessions[i];
+	}
+
+	QJsonObject result;
+	result["sessions"] = sessionCount;
+	result["connected"] = connected;
+	result["total_fps"] = totalFrames / (wallNs / 1000000000.0);
+	result["mean_session_fps"] = totalFrames / (wallNs / 1000000000.0) / sessionCount;
+	result["min_session_fps"] = minFps;
+	result["dropped_records"] = dropped;
+	result["stolen_jobs"] = (double) (DecodePool::global().stolenJobs() - stolenStart);
+	result["cpu_utilization"] = (double) cpuNs / wallNs;
+	return result;
+}
+//------------------------------------------
+static void parseHost(const QString& value, QString& host, quint16& port)
+{
+	host = value;
+	port = DEFAULT_STREAM_PORT;
+	if (host.contains(':'))
+	{
+		port = host.section(':', 1).toUShort();
+		host = host.section(':', 0, 0);
+	}
+}
+//------------------------------------------
+static QJsonObject runSessionsBench(const QCommandLineParser& args)
+{
+	QString host;
+	quint16 port;
+	parseHost(args.value("connect"), host, port);
+
+	const int maxSessions = qMax(1, args.value("sessions").toInt());
+	const int durationMs = args.value("duration").toInt() * 1000;
+
+	// 1, 2, 4, ... up to the requested count
+	QJsonArray steps;
+	for (int count = 1; ; count = qMin(count * 2, maxSessions))
+	{
+		steps.append(runSessionsStep(host, port, count, durationMs));
+		if (count == maxSessions)
+			break;
+	}
+
+	QJsonObject result;
+	result["host"] = host;
+	result["port"] = port;
+	result["pool_threads"] = DecodePool::global().threadCount();
+	result["duration_s"] = durationMs / 1000;
+	result["steps"] = steps;
+	return result;
+}
+//------------------------------------------
+static bool runLatencyBench(const QCommandLineParser& args, QJsonObject& result)
+{
+	QString host;
+	quint16 port;
+	parseHost(args.value("latency"), host, port);
+
+	LatencyProbe::Settings settings;
+	settings.trials = qMax(1, args.value("trials").toInt());
+	settings.intervalMs = qMax(50, args.value("probe-interval").toInt());
+
+	if (args.isSet("probe-region"))
+	{
+		QStringList parts = args.value("probe-region").split(',');
+		if (parts.size() != 4)
+		{
+			qCritical() << "The probe region is x,y,width,height";
+			return false;
+		}
+		settings.region = QRect(parts[0].toInt(), parts[1].toInt(), parts[2].toInt(), parts[3].toInt());
+	}
+	else
+	{
+		settings.region = QRect(0, 0, LATENCY_MARKER_SIZE, LATENCY_MARKER_SIZE);
+	}
+
+	settings.touch = settings.region.center();
+	if (args.isSet("probe-touch"))
+	{
+		QStringList parts = args.value("probe-touch").split(',');
+		if (parts.size() != 2)
+		{
+			qCritical() << "The probe touch point is x,y";
+			return false;
+		}
+		settings.touch = QPoint(parts[0].toInt(), parts[1].toInt());
+	}
+
+	settings.useKey = args.isSet("probe-key");
+	settings.keyCode = args.value("probe-key").toUInt();
+
+	StreamSession session(false);
+	session.connectTo(host, port);
+
+	// The watch needs pictures to compare with
+	{
+		QEventLoop loop;
+		QObject::connect(&session, &StreamSession::frameReady, &loop, &QEventLoop::quit);
+		QTimer::singleShot(5000, &loop, SLOT(quit()));
+		loop.exec();
+	}
+
+	if (session.lastFrame().isNull())
+	{
+		qCritical() << "No frame received from " << host;
+		return false;
+	}
+
+	LatencyProbe probe(&session);
+	{
+		QEventLoop loop;
+		QObject::connect(&probe, &LatencyProbe::finished, &loop, &QEventLoop::quit);
+		probe.start(settings);
+		loop.exec();
+	}
+
+	session.stop();
+
+	QJsonArray region;
+	region.append(settings.region.x());
+	region.append(settings.region.y());
+	region.append(settings.region.width());
+	region.append(settings.region.height());
+
+	result["host"] = host;
+	result["port"] = port;
+	result["trials"] = settings.trials;
+	result["responses"] = probe.presentLatencies().size();
+	result["missed"] = probe.missedTrials();
+	result["region"] = region;
+	result["stimulus"] = settings.useKey ? QString("key %1").arg(settings.keyCode)
+		: QString("touch %1,%2").arg(settings.touch.x()).arg(settings.touch.y());
+	result["decode_latency_ms"] = latencyStats(probe.decodeLatencies());
+	result["present_latency_ms"] = latencyStats(probe.presentLatencies());
+	return true;
+}
+//------------------------------------------
+static bool runReconnectBench(const QCommandLineParser& args, QJsonObject& result)
+{
+	QString host;
+	quint16 port;
+	parseHost(args.value("reconnect"), host, port);
+
+	const int drops = qMax(1, args.value("drops").toInt());
+	QVector<qint64> connectNs, firstFrameNs;
+
+	StreamSession session(false);
+	QEventLoop loop;
+	QObject::connect(&session, &StreamSession::reconnected, &loop, [&](int connectMs, int firstFrameMs) {
+		connectNs.push_back(connectMs * 1000000LL);
+		firstFrameNs.push_back(firstFrameMs * 1000000LL);
+		loop.quit();
+	});
+	QObject::connect(&session, &StreamSession::stateChanged, &loop, [&loop](StreamSession::State state) {
+		if (state == StreamSession::SS_FAILED)
+			loop.quit();
+	});
+	session.connectTo(host, port);
+
+	// Each drop has a minute to happen and recover
+	for (int i = 0; i < drops && session.state() != StreamSession::SS_FAILED; i++)
+	{
+		QTimer timeout;
+		timeout.setSingleShot(true);
+		QObject::connect(&timeout, &QTimer::timeout, &loop, &QEventLoop::quit);
+		timeout.start(60000);
+		loop.exec();
+
+		if (!timeout.isActive())
+		{
+			qCritical() << "No reconnection within a minute, is bbqserver running with --drop-every?";
+			break;
+		}
+	}
+
+	const int dropped = session.droppedRecords();
+	session.stop();
+
+	if (firstFrameNs.isEmpty())
+		return false;
+
+	result["host"] = host;
+	result["port"] = port;
+	result["reconnections"] = firstFrameNs.size();
+	result["records_skipped"] = dropped;
+	result["connect_ms"] = latencyStats(connectNs);
+	result["first_frame_ms"] = latencyStats(firstFrameNs);
+	return true;
+}
+//------------------------------------------
+static bool runStartupBench(const QCommandLineParser& args, QJsonObject& result)
+{
+	QString host;
+	quint16 port;
+	parseHost(args.value("startup"), host, port);
+
+	const int trials = qMax(1, args.value("trials").toInt());
+	QVector<qint64> connected, firstRecord, firstFrame, videoInit, audioInit;
+	int missed = 0;
+
+	// A new session each time, so the codecs are set up again
+	for (int i = 0; i < trials; i++)
+	{
+		StreamSession session(false);
+		{
+			QEventLoop loop;
+			QObject::connect(&session, &StreamSession::frameReady, &loop, &QEventLoop::quit);
+			QTimer::singleShot(5000, &loop, SLOT(quit()));
+			session.connectTo(host, port);
+			loop.exec();
+		}
+
+		const StreamSession::StartupTimes times = session.startupTimes();
+		session.stop();
+
+		if (times.firstFrameMs < 0)
+		{
+			missed++;
+			continue;
+		}
+
+		connected.push_back(times.connectedMs * 1000000LL);
+		firstRecord.push_back(times.firstRecordMs * 1000000LL);
+		firstFrame.push_back(times.firstFrameMs * 1000000LL);
+		videoInit.push_back(times.videoInitMs * 1000000LL);
+		if (times.audioInitMs >= 0)
+			audioInit.push_back(times.audioInitMs * 1000000LL);
+	}
+
+	if (firstFrame.isEmpty())
+	{
+		qCritical() << "No frame received from " << host;
+		return false;
+	}
+
+	result["host"] = host;
+	result["port"] = port;
+	result["trials"] = trials;
+	result["missed"] = missed;
+	result["connected_ms"] = latencyStats(connected);
+	result["first_record_ms"] = latencyStats(firstRecord);
+	result["first_frame_ms"] = latencyStats(firstFrame);
+	result["video_init_ms"] = latencyStats(videoInit);
+	result["audio_init_ms"] = latencyStats(audioInit);
+	return true;
+}
+//------------------------------------------
+static bool runDiscoveryBench(const QCommandLineParser& args, QJsonObject& result)
+{
+	const int seconds = qMax(1, args.value("discovery").toInt());
+	const quint16 port = DEFAULT_STREAM_PORT;
+
+	// Shared, so the client can keep listening too
+	QUdpSocket socket;
+	if (!socket.bind(QHostAddress::Any, port, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint))
+	{
+		qCritical() << "Cannot listen to the announcements on port " << port << ": " << socket.errorString();
+		return false;
+	}
+
+	DeviceRegistry registry;
+	int added = 0, removed = 0, peak = 0, datagrams = 0, malformed = 0;
+	qint64 processNs = 0;
+	QObject::connect(&registry, &DeviceRegistry::deviceAdded, [&](const QString&) { added++; peak = qMax(peak, registry.count()); });
+	QObject::connect(&registry, &DeviceRegistry::deviceRemoved, [&](const QString&) { removed++; });
+
+	QByteArray datagram;
+	QHostAddress sender;
+	QElapsedTimer timer;
+	QObject::connect(&socket, &QUdpSocket::readyRead, [&]() {
+		while (socket.hasPendingDatagrams())
+		{
+			datagram.resize(socket.pendingDatagramSize());
+			socket.readDatagram(datagram.data(), datagram.size(), &sender);
+
+			timer.start();
+			if (!registry.processAnnouncement(datagram, sender))
+				malformed++;
+			processNs += timer.nsecsElapsed();
+			datagrams++;
+		}
+	});
+
+	QElapsedTimer clock;
+	clock.start();
+	{
+		QEventLoop loop;
+		QTimer::singleShot(seconds * 1000, &loop, SLOT(quit()));
+		loop.exec();
+	}
+	const double elapsed = clock.elapsed() / 1000.0;
+
+	result["seconds"] = elapsed;
+	result["datagrams"] = datagrams;
+	result["malformed"] = malformed;
+	result["datagrams_per_second"] = datagrams / elapsed;
+	result["ns_per_datagram"] = datagrams ? (double) processNs / datagrams : 0.0;
+	result["devices"] = registry.count();
+	result["peak_devices"] = peak;
+	result["added"] = added;
+	result["removed"] = removed;
+	return true;
+}
+//------------------------------------------
+static bool runTypeBench(const QCommandLineParser& args, QJsonObject& result)
+{
+	QString host;
+	quint16 port;
+	parseHost(args.value("type"), host, port);
+
+	// Letters of both cases, digits, punctuation and line breaks
+	static const char* const SAMPLE = "The quick brown fox jumps over the lazy dog 0123456789, "
+		"THEN ASKS: \"Why?\" (again) & waits [1-2 s] {ok} #tag @me 50% ~/x_y+z=w|v;\n";
+
+	const int chars = qMax(1, args.value("text-chars").toInt());
+	QString text;
+	while (text.size() < chars)
+		text += QString::fromLatin1(SAMPLE);
+	text.truncate(chars);
+
+	StreamSession session(false);
+	session.connectTo(host, port);
+	{
+		QEventLoop loop;
+		QObject::connect(&session, &StreamSession::stateChanged, &loop, [&loop](StreamSession::State state) {
+			if (state == StreamSession::SS_CONNECTED)
+				loop.quit();
+		});
+		QTimer::singleShot(5000, &loop, SLOT(quit()));
+		loop.exec();
+	}
+
+	if (session.state() != StreamSession::SS_CONNECTED)
+	{
+		qCritical() << "Unable to connect to " << host;
+		return false;
+	}
+
+	int packets;
+	double averageMs, maxMs;
+	session.inputWriter().takeLatency(packets, averageMs, maxMs);
+
+	TextInjector& injector = session.textInjector();
+	const int rate = qMax(0, args.value("text-rate").toInt());
+	{
+		QEventLoop loop;
+		QObject::connect(&injector, &TextInjector::finished, &loop, &QEventLoop::quit);
+		if (injector.start(text, rate) > 0)
+			loop.exec();
+	}
+	const qint64 elapsedMs = injector.elapsedMs();
+
+	// Lets the writer hand the last chunk to the kernel
+	{
+		QEventLoop loop;
+		QTimer::singleShot(200, &loop, SLOT(quit()));
+		loop.exec();
+	}
+	session.inputWriter().takeLatency(packets, averageMs, maxMs);
+	session.stop();
+
+	result["host"] = host;
+	result["port"] = port;
+	result["characters"] = injector.typedCount();
+	result["skipped"] = injector.skippedCount();
+	result["rate_limit"] = rate;
+	result["elapsed_ms"] = (double) elapsedMs;
+	result["chars_per_second"] = elapsedMs > 0 ? injector.typedCount() * 1000.0 / elapsedMs : 0.0;
+	result["writes"] = packets;
+	result["write_latency_ms"] = averageMs;
+	result["write_latency_max_ms"] = maxMs;
+	return true;
+}
+//------------------------------------------
+static bool runScanBench(const QCommandLineParser& args, QJsonObject& result)
+{
+	const QStringList ranges = args.value("scan").split(',', QString::SkipEmptyParts);
+	const quint16 port = DEFAULT_STREAM_PORT;
+
+	SubnetScanner scanner;
+	scanner.setConcurrency(args.value("scan-concurrency").toInt());
+	scanner.setTimeout(args.value("scan-timeout").toInt());
+
+	QJsonArray found;
+	qint64 firstFoundMs = -1;
+	QObject::connect(&scanner, &SubnetScanner::deviceFound, [&](const QString& address) {
+		if (firstFoundMs < 0)
+			firstFoundMs = scanner.elapsedMs();
+		found.append(address);
+	});
+
+	if (!scanner.start(ranges, port))
+	{
+		qCritical() << "Nothing to scan in " << args.value("scan");
+		return false;
+	}
+
+	if (scanner.isRunning())
+	{
+		QEventLoop loop;
+		QObject::connect(&scanner, SIGNAL(finished()), &loop, SLOT(quit()));
+		loop.exec();
+	}
+
+	result["ranges"] = QJsonArray::fromStringList(ranges);
+	result["port"] = port;
+	result["concurrency"] = args.value("scan-concurrency").toInt();
+	result["timeout_ms"] = args.value("scan-timeout").toInt();
+	result["hosts"] = scanner.hostCount();
+	result["probed"] = scanner.probedCount();
+	result["found"] = scanner.foundCount();
+	result["found_addresses"] = found;
+	result["first_found_ms"] = firstFoundMs;
+	result["elapsed_ms"] = scanner.elapsedMs();
+	return true;
+}
+//------------------------------------------
+static bool runAdbBootstrapBench(const QCommandLineParser& args, QJsonObject& result)
+{
+	const QString adb = args.value("adb-bootstrap");
+	const int trials = qMax(1, args.value("trials").toInt());
+
+	// Device files of the fake adb, with the app's binary installed
+	const QString root = QDir::temp().absoluteFilePath(QString("bbqbench-adb-%1").arg(QCoreApplication::applicationPid()));
+	qputenv("FAKE_ADB_DIR", root.toUtf8());
+	QDir().mkpath(root + QFileInfo(BBQSCREEN_APP_BINARY).path());
+	QFile app(root + BBQSCREEN_APP_BINARY);
+	if (!app.open(QIODevice::WriteOnly))
+	{
+		qCritical() << "Cannot create " << app.fileName();
+		return false;
+	}
+	app.write(QByteArray(512 * 1024, 'b'));
+	app.close();
+
+	UsbBootstrap bootstrap;
+	bootstrap.setAdbPath(adb);
+
+	QVector<qint64> cold, warm, legacy;
+	int coldCalls = 0, warmCalls = 0;
+	bool ok = true;
+	for (int i = 0; i < trials && ok; i++)
+	{
+		for (int warmRun = 0; warmRun < 2 && ok; warmRun++)
+		{
+			// A cold run starts without the copy
+			if (!warmRun)
+				QFile::remove(root + BBQSCREEN_EXEC_BINARY);
+
+			QEventLoop loop;
+			QObject::connect(&bootstrap, SIGNAL(prepared()), &loop, SLOT(quit()));
+			QObject::connect(&bootstrap, &UsbBootstrap::failed, &loop, [&](AdbError error) {
+				qCritical() << "Bootstrap failed at " << bootstrap.failedStep() << ": " << AdbJobRunner::errorString(error);
+				ok = false;
+				loop.quit();
+			});
+
+			if (!bootstrap.start())
+				return false;
+			loop.exec();
+
+			(warmRun ? warm : cold).push_back(bootstrap.elapsedMs() * 1000000);
+			(warmRun ? warmCalls : coldCalls) = bootstrap.stepsRun();
+		}
+
+		// What the client did before: cp then chmod, each waited for
+		QElapsedTimer clock;
+		clock.start();
+		QProcess copy, chmod;
+		copy.start(adb, QStringList() << "shell" << "cp" << BBQSCREEN_APP_BINARY << BBQSCREEN_EXEC_BINARY);
+		copy.waitForFinished();
+		chmod.start(adb, QStringList() << "shell" << "chmod" << "755" << BBQSCREEN_EXEC_BINARY);
+		chmod.waitForFinished();
+		legacy.push_back(clock.nsecsElapsed());
+	}
+
+	QDir(root).removeRecursively();
+	if (!ok)
+		return false;
+
+	result["adb"] = adb;
+	result["trials"] = trials;
+	result["cold_ms"] = latencyStats(cold);
+	result["cold_adb_calls"] = coldCalls;
+	result["warm_ms"] = latencyStats(warm);
+	result["warm_adb_calls"] = warmCalls;
+	result["blocking_cp_chmod_ms"] = latencyStats(legacy);
+	return true;
+}
+//------------------------------------------
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("bbqbench");
+
+	QCommandLineParser args;
+	args.setApplicationDescription("Headless benchmark of the BBQScreen client stream pipeline");
+	args.addHelpOption();
+	args.addOptions({
+		{ "capture", "Run over a .bbqcap capture instead of a synthetic stream.", "file" },
+		{ "width", "Synthetic stream width.", "pixels", "720" },
+		{ "height", "Synthetic stream height.", "pixels", "1280" },
+		{ "fps", "Synthetic stream frame rate.", "fps", "60" },
+		{ "frames", "Synthetic stream length.", "frames", "600" },
+		{ "bitrate", "Synthetic stream bitrate.", "kbps", "4500" },
+		{ "no-audio", "Synthetic stream without AAC audio." },
+		{ "pattern", "Synthetic stream content: moving, static (blinking cursor) or scroll (list flings).", "pattern", "moving" },
+		{ "no-change-detection", "Convert every frame whole, even when nothing changed." },
+		{ "convert-threads", "Bands the color conversion is split into (0 = from the core count).", "count", "0" },
+		{ "convert-scaling", "Also run the decode with 1 to N conversion threads and report each.", "count" },
+		{ "swscale", "Convert with swscale instead of the SIMD YUV converter." },
+		{ "yuv-bench", "Check and time the YUV converter kernels against swscale instead." },
+		{ "priority", "Session priority: focused, visible, thumbnail or hidden.", "priority", "focused" },
+		{ "connect", "Measure sessions scaling against a bbqserver instead.", "host[:port]" },
+		{ "sessions", "Highest number of concurrent sessions (with --connect).", "count", "16" },
+		{ "duration", "Measure length of each sessions step (with --connect).", "seconds", "10" },
+		{ "latency", "Measure the input to display latency of a bbqserver or device instead.", "host[:port]" },
+		{ "trials", "Inputs injected (with --latency), sessions started (with --startup), or bootstraps (with --adb-bootstrap).", "count", "50" },
+		{ "probe-interval", "Time between two inputs (with --latency).", "ms", "500" },
+		{ "probe-region", "Area that responds to the input (default: the bbqserver marker).", "x,y,w,h" },
+		{ "probe-touch", "Where to tap (default: the middle of the region).", "x,y" },
+		{ "probe-key", "Press this key code instead of tapping.", "code" },
+		{ "discovery", "Measure the discovery of the devices announced on the network for N seconds instead.", "seconds" },
+		{ "startup", "Measure the time to first frame of new sessions to a bbqserver or device instead.", "host[:port]" },
+		{ "reconnect", "Measure the time to first frame after connection drops of a bbqserver instead.", "host[:port]" },
+		{ "drops", "Reconnections measured (with --reconnect).", "count", "10" },
+		{ "scan", "Measure the scan of these networks for devices instead (e.g. 127.0.1.0/24, comma separated).", "ranges" },
+		{ "scan-concurrency", "Connections in flight at once (with --scan).", "count", "128" },
+		{ "scan-timeout", "Time each host gets to accept (with --scan).", "ms", "250" },
+		{ "adb-bootstrap", "Time the USB service bootstrap against this adb (e.g. tools/common/fake-adb.sh) instead.", "adb" },
+		{ "type", "Measure the text typing throughput into a bbqserver instead.", "host[:port]" },
+		{ "text-chars", "Characters typed (with --type).", "count", "5000" },
+		{ "text-rate", "Characters per second, 0 for as fast as possible (with --type).", "cps", "0" },
+		{ "label", "Free-form label stored in the report (e.g. a commit hash).", "label" },
+		{ "output", "Write the JSON report to a file instead of stdout.", "file" },
+	});
+	args.process(app);
+
+	QJsonObject report;
+	report["label"] = args.value("label");
+	report["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+
+	if (args.isSet("connect"))
+	{
+		report["bench"] = QString("sessions");
+		report["sessions"] = runSessionsBench(args);
+	}
+	else if (args.isSet("latency"))
+	{
+		QJsonObject latency;
+		if (!runLatencyBench(args, latency))
+			return 1;
+
+		report["bench"] = QString("latency");
+		report["latency"] = latency;
+	}
+	else if (args.isSet("discovery"))
+	{
+		QJsonObject discovery;
+		if (!runDiscoveryBench(args, discovery))
+			return 1;
+
+		report["bench"] = QString("discovery");
+		report["discovery"] = discovery;
+	}
+	else if (args.isSet("scan"))
+	{
+		QJsonObject scan;
+		if (!runScanBench(args, scan))
+			return 1;
+
+		report["bench"] = QString("scan");
+		report["scan"] = scan;
+	}
+	else if (args.isSet("adb-bootstrap"))
+	{
+		QJsonObject bootstrap;
+		if (!runAdbBootstrapBench(args, bootstrap))
+			return 1;
+
+		report["bench"] = QString("adb-bootstrap");
+		report["adb_bootstrap"] = bootstrap;
+	}
+	else if (args.isSet("startup"))
+	{
+		QJsonObject startup;
+		if (!runStartupBench(args, startup))
+			return 1;
+
+		report["bench"] = QString("startup");
+		report["startup"] = startup;
+	}
+	else if (args.isSet("reconnect"))
+	{
+		QJsonObject reconnect;
+		if (!runReconnectBench(args, reconnect))
+			return 1;
+
+		report["bench"] = QString("reconnect");
+		report["reconnect"] = reconnect;
+	}
+	else if (args.isSet("type"))
+	{
+		QJsonObject type;
+		if (!runTypeBench(args, type))
+			return 1;
+
+		report["bench"] = QString("type");
+		report["type"] = type;
+	}
+	else if (args.isSet("yuv-bench"))
+	{
+		report["bench"] = QString("yuv");
+		report["instruction_set"] = YuvConverter::name(YuvConverter().instructionSet());
+		report["yuv"] = runYuvBench();
+	}
+	else
+	{
+		StreamCaptureReader reader;
+		QVector<StreamRecord> records;
+		QJsonObject source;
+		if (!loadRecords(args, reader, records, source))
+		{
+			qCritical() << "Unable to load the input stream";
+			return 1;
+		}
+
+		SessionPriority priority;
+		if (!parsePriority(args.value("priority"), priority))
+		{
+			qCritical() << "Unknown priority " << args.value("priority");
+			return 1;
+		}
+
+		report["bench"] = QString("decode");
+		report["priority"] = args.value("priority");
+		report["source"] = source;
+		const bool changeDetection = !args.isSet("no-change-detection");
+		report["change_detection"] = changeDetection;
+		const bool fastConversion = !args.isSet("swscale");
+		report["decode"] = runDecodeBench(records, priority, changeDetection, args.value("convert-threads").toInt(),
+			fastConversion);
+
+		if (args.isSet("convert-scaling"))
+		{
+			QJsonArray steps;
+			const int maxThreads = qBound(1, args.value("convert-scaling").toInt(), MAX_CONVERT_THREADS);
+			for (int threads = 1; threads <= maxThreads; threads++)
+				steps.append(runDecodeBench(records, priority, changeDetection, threads, fastConversion));
+			report["convert_scaling"] = steps;
+		}
+	}
+
+	QByteArray json = QJsonDocument(report).toJson();
+	if (args.isSet("output"))
+	{
+		QFile out(args.value("output"));
+		if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		{
+			qCritical() << "Cannot write " << args.value("output");
+			return 1;
+		}
+		out.write(json);
+	}
+	else
+	{
+		QTextStream(stdout) << json;
+	}
+
+	return 0;
+}
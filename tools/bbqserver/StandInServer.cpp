@@ -0,0 +1,587 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "stdafx.h"
+#include "StandInServer.h"
+#include "TextInjector.h"
+
+#include <QTextStream>
+#include <QDebug>
+
+// How often pending records are pushed to the sockets
+#define SEND_INTERVAL_MS 2
+
+// Viewers that fall this far behind get their unsent records dropped
+#define MAX_QUEUED_RECORDS 120
+
+// Stop handing data to a socket whose kernel buffer is that far behind, so
+// the backlog stays in our queue where it can be dropped
+#define MAX_SOCKET_BACKLOG (256 * 1024)
+
+// The token bucket of the bandwidth cap can hold this much time worth of data
+#define BANDWIDTH_BURST_MS 50
+
+// Input packet types and sizes, see ScreenForm::sendKeyboardInput/sendTouchInput
+#define INPUT_KEYBOARD 0
+#define INPUT_TOUCH 1
+#define INPUT_TOUCH_BATCH 2
+#define INPUT_KEYBOARD_SIZE 6
+#define INPUT_TOUCH_SIZE 7
+#define INPUT_TOUCH_BATCH_HEADER_SIZE 4
+
+// Announced after the device name when batches are supported
+#define INPUT_CAP_TOUCH_BATCH 0x01
+
+#define TOUCH_UP 0
+#define TOUCH_DOWN 1
+#define TOUCH_MOVE 2
+
+//------------------------------------------
+StandInServer::StandInServer(const Settings& settings, QObject* parent) :
+	QObject(parent),
+	mSettings(settings),
+	mLastSend(0),
+	mCaptureRecord(0),
+	mCaptureLoopStart(0),
+	mFrameNumber(0),
+	mOrientation(0)
+{
+	connect(&mServer, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+	connect(&mFrameTimer, SIGNAL(timeout()), this, SLOT(onFrameTimer()));
+	connect(&mSendTimer, SIGNAL(timeout()), this, SLOT(onSendTimer()));
+	connect(&mAnnounceTimer, SIGNAL(timeout()), this, SLOT(onAnnounceTimer()));
+	connect(&mDropTimer, SIGNAL(timeout()), this, SLOT(onDropTimer()));
+}
+//------------------------------------------
+StandInServer::~StandInServer()
+{
+	qDeleteAll(mClients);
+	qDeleteAll(mFarm);
+}
+//------------------------------------------
+bool StandInServer::start()
+{
+	mClock.start();
+
+	if (!mSettings.logPath.isEmpty())
+	{
+		mLogFile.setFileName(mSettings.logPath);
+		if (!mLogFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+			qWarning() << "Cannot open log file " << mSettings.logPath;
+	}
+
+	if (!mSettings.source.isEmpty())
+	{
+		if (!mCapture.open(mSettings.source))
+			return false;
+
+		// Loop from the first keyframe, the decoder can't start anywhere else
+		const QVector<CaptureIndexEntry>& index = mCapture.index();
+		for (int i = 0; i < index.size(); i++)
+		{
+			if (index.at(i).flags & CRF_KEYFRAME)
+			{
+				mCaptureLoopStart = i;
+				break;
+			}
+		}
+		mCaptureRecord = mCaptureLoopStart;
+	}
+	else if (!mSynthetic.open(mSettings.width, mSettings.height, mSettings.fps, mSettings.bitrateKbps,
+		mSettings.audio && mSettings.protocol == 4))
+	{
+		return false;
+	}
+
+	mSynthetic.setPattern(mSettings.pattern);
+
+	for (int i = 0; i < mSettings.farmCount; i++)
+	{
+		QTcpServer* server = new QTcpServer(this);
+		connect(server, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+		mFarm.push_back(server);
+	}
+
+	if (!listenAll())
+		return false;
+
+	mFrameTimer.setTimerType(Qt::PreciseTimer);
+	mFrameTimer.start(1000 / mSettings.fps);
+	mSendTimer.setTimerType(Qt::PreciseTimer);
+	mSendTimer.start(SEND_INTERVAL_MS);
+
+	if (!mSettings.announceName.isEmpty())
+	{
+		mAnnounceTimer.start(qMax(1, mSettings.announceIntervalMs));
+	}
+
+	if (mSettings.dropEvery > 0)
+	{
+		mDropTimer.start(mSettings.dropEvery * 1000);
+	}
+
+	log(QString("Serving protocol v%1 on port %2 (%3)").arg(mSettings.protocol).arg(mSettings.port)
+		.arg(mSettings.source.isEmpty()
+			? QString("synthetic %1x%2 @ %3 fps, %4 kbps").arg(mSettings.width).arg(mSettings.height).arg(mSettings.fps).arg(mSettings.bitrateKbps)
+			: mSettings.source));
+	if (!mFarm.isEmpty())
+		log(QString("Serving as %1 devices on 127.0.1.1 to 127.0.1.%1").arg(mFarm.size()));
+	return true;
+}
+//------------------------------------------
+bool StandInServer::listenAll()
+{
+	// Listening on any address would take the port of the farm addresses
+	if (!mServer.listen(mFarm.isEmpty() ? QHostAddress::Any : QHostAddress::LocalHost, mSettings.port))
+	{
+		qCritical() << "Cannot listen on port " << mSettings.port << ": " << mServer.errorString();
+		return false;
+	}
+
+	quint32 address = QHostAddress("127.0.1.1").toIPv4Address();
+	for (QList<QTcpServer*>::iterator it = mFarm.begin(); it != mFarm.end(); ++it, ++address)
+	{
+		if (!(*it)->listen(QHostAddress(address), mSettings.port))
+		{
+			qCritical() << "Cannot listen on " << QHostAddress(address).toString() << ": " << (*it)->errorString();
+			return false;
+		}
+	}
+
+	return true;
+}
+//------------------------------------------
+void StandInServer::closeAll()
+{
+	mServer.close();
+	for (QList<QTcpServer*>::iterator it = mFarm.begin(); it != mFarm.end(); ++it)
+		(*it)->close();
+}
+//------------------------------------------
+void StandInServer::onNewConnection()
+{
+	// The main listener or one of the farm
+	QTcpServer* server = (QTcpServer*) QObject::sender();
+
+	while (server->hasPendingConnections())
+	{
+		Client* client = new Client;
+		client->socket = server->nextPendingConnection();
+		client->name = QString("%1:%2").arg(client->socket->peerAddress().toString()).arg(client->socket->peerPort());
+		client->lastDue = 0;
+		client->tokens = 0;
+		client->waitingKeyFrame = true;
+		client->dropped = 0;
+		client->fingersDown = 0;
+		client->touchPackets = 0;
+		client->touchSamples = 0;
+		client->touchErrors = 0;
+		client->shiftDown = false;
+		client->typedChars = 0;
+		client->firstTypedAt = 0;
+		client->lastTypedAt = 0;
+
+		connect(client->socket, SIGNAL(readyRead()), this, SLOT(onClientReadyRead()));
+		connect(client->socket, SIGNAL(disconnected()), this, SLOT(onClientDisconnected()));
+		mClients.insert(client->socket, client);
+
+		// Start the newcomer on a fresh IDR rather than the end of the GOP
+		mSynthetic.requestKeyFrame();
+
+		log(QString("%1 connected (%2 viewers)").arg(client->name).arg(mClients.size()));
+	}
+}
+//------------------------------------------
+void StandInServer::onDropTimer()
+{
+	log(QString("Dropping %1 viewers, refusing connections for %2 ms").arg(mClients.size()).arg(mSettings.outageMs));
+
+	// Aborting removes the client from mClients
+	QList<QTcpSocket*> sockets = mClients.keys();
+	for (QList<QTcpSocket*>::iterator it = sockets.begin(); it != sockets.end(); ++it)
+		(*it)->abort();
+
+	if (mSettings.outageMs > 0)
+	{
+		closeAll();
+		QTimer::singleShot(mSettings.outageMs, this, SLOT(onOutageOver()));
+	}
+}
+//------------------------------------------
+void StandInServer::onOutageOver()
+{
+	if (!listenAll())
+		log(QString("Cannot listen on port %1 again").arg(mSettings.port));
+}
+//------------------------------------------
+void StandInServer::onClientDisconnected()
+{
+	QTcpSocket* socket = (QTcpSocket*) QObject::sender();
+	Client* client = mClients.take(socket);
+	if (!client)
+		return;
+
+	log(QString("%1 disconnected, %2 records dropped (%3 viewers)").arg(client->name).arg(client->dropped).arg(mClients.size()));
+	log(QString("%1 touch: %2 samples in %3 packets, %4 out of sequence").arg(client->name)
+		.arg(client->touchSamples).arg(client->touchPackets).arg(client->touchErrors));
+	if (client->typedChars > 0)
+	{
+		const qint64 ms = (client->lastTypedAt - client->firstTypedAt) / 1000000;
+		log(QString("%1 text: %2 characters in %3 ms (%4 chars/s): %5").arg(client->name).arg(client->typedChars).arg(ms)
+			.arg(ms > 0 ? QString::number(client->typedChars * 1000.0 / ms, 'f', 0) : QString("-"))
+			.arg(client->typed.left(40)));
+	}
+	socket->deleteLater();
+	delete client;
+}
+//------------------------------------------
+bool StandInServer::nextRecord(StreamRecord& record)
+{
+	record.protVersion = mSettings.protocol;
+	record.timestamp = mClock.nsecsElapsed();
+
+	if (mSettings.rotateEvery > 0)
+		mOrientation = (mFrameNumber / (mSettings.rotateEvery * mSettings.fps)) % 4;
+
+	if (mCapture.isOpen())
+	{
+		if (mCaptureRecord >= mCapture.recordCount())
+			mCaptureRecord = mCaptureLoopStart;
+
+		StreamRecord recorded;
+		if (!mCapture.record(mCaptureRecord++, recorded))
+			return false;
+
+		record.video = recorded.video;
+		record.audio = (mSettings.protocol == 4) ? recorded.audio : QByteArray();
+		record.orientation = (mSettings.rotateEvery > 0) ? mOrientation : recorded.orientation;
+	}
+	else
+	{
+		if (!mSynthetic.nextFrame(record.video, record.audio))
+			return false;
+		record.orientation = mOrientation;
+	}
+
+	mFrameNumber++;
+	return true;
+}
+//------------------------------------------
+void StandInServer::onFrameTimer()
+{
+	// Nobody watching, don't spend time encoding
+	if (mClients.isEmpty())
+		return;
+
+	StreamRecord record;
+	if (!nextRecord(record))
+	{
+		qCritical() << "Unable to produce the next record";
+		mFrameTimer.stop();
+		return;
+	}
+
+	// Serialized once, shared by every viewer
+	QByteArray data = QStreamFramer::serializeHeader(record, mSettings.protocol);
+	data.append(record.video);
+	data.append(record.audio);
+
+	const bool keyFrame = QStreamFramer::isKeyFrame(record.video);
+	for (auto it = mClients.begin(); it != mClients.end(); ++it)
+		queueRecord(it.value(), data, keyFrame);
+}
+//------------------------------------------
+void StandInServer::queueRecord(Client* client, const QByteArray& data, bool keyFrame)
+{
+	if (client->waitingKeyFrame)
+	{
+		if (!keyFrame)
+			return;
+		client->waitingKeyFrame = false;
+	}
+
+	if (client->queue.size() >= MAX_QUEUED_RECORDS)
+	{
+		// The viewer can't keep up: drop everything that wasn't started and
+		// resume on the next keyframe, like a congested phone would.
+		while (client->queue.size() > 0 && client->queue.last().written == 0)
+		{
+			client->queue.removeLast();
+			client->dropped++;
+		}
+		client->waitingKeyFrame = !keyFrame;
+		if (!keyFrame)
+			return;
+	}
+
+	PendingRecord pending;
+	pending.data = data;
+	pending.written = 0;
+	pending.due = mClock.nsecsElapsed();
+
+	if (mSettings.jitterMs > 0)
+		pending.due += (qint64) (qrand() % (mSettings.jitterMs + 1)) * 1000000LL;
+
+	// Jitter delays records but never reorders them
+	pending.due = qMax(pending.due, client->lastDue);
+	client->lastDue = pending.due;
+
+	client->queue.push_back(pending);
+}
+//------------------------------------------
+void StandInServer::onSendTimer()
+{
+	const qint64 now = mClock.nsecsElapsed();
+	double newTokens = 0;
+
+	if (mSettings.bandwidthKbps > 0)
+		newTokens = (now - mLastSend) / 1000000000.0 * mSettings.bandwidthKbps * 1000.0 / 8.0;
+
+	mLastSend = now;
+
+	for (auto it = mClients.begin(); it != mClients.end(); ++it)
+		flushClient(it.value(), now, newTokens);
+}
+//------------------------------------------
+void StandInServer::flushClient(Client* client, qint64 now, double newTokens)
+{
+	if (mSettings.bandwidthKbps > 0)
+	{
+		const double burst = mSettings.bandwidthKbps * 1000.0 / 8.0 * BANDWIDTH_BURST_MS / 1000.0;
+		client->tokens = qMin(burst, client->tokens + newTokens);
+	}
+
+	while (!client->queue.isEmpty())
+	{
+		PendingRecord& pending = client->queue.first();
+		if (pending.due > now || client->socket->bytesToWrite() > MAX_SOCKET_BACKLOG)
+			break;
+
+		int remaining = pending.data.size() - pending.written;
+		int length = remaining;
+		if (mSettings.bandwidthKbps > 0)
+			length = qMin(remaining, (int) client->tokens);
+
+		if (length <= 0)
+			break;
+
+		qint64 written = client->socket->write(pending.data.constData() + pending.written, length);
+		if (written <= 0)
+			break;
+
+		pending.written += written;
+		if (mSettings.bandwidthKbps > 0)
+			client->tokens -= written;
+
+		if (pending.written < pending.data.size())
+			break;
+
+		client->queue.removeFirst();
+	}
+}
+//------------------------------------------
+void StandInServer::onClientReadyRead()
+{
+	QTcpSocket* socket = (QTcpSocket*) QObject::sender();
+	Client* client = mClients.value(socket);
+	if (!client)
+		return;
+
+	client->input.append(socket->readAll());
+	parseInput(client);
+}
+//------------------------------------------
+void StandInServer::parseInput(Client* client)
+{
+	QByteArray& input = client->input;
+	int offset = 0;
+
+	while (offset < input.size())
+	{
+		const char* packet = input.constData() + offset;
+		const int available = input.size() - offset;
+		const quint8 type = QStreamFramer::bytesToUInt8(packet);
+
+		if (type == INPUT_KEYBOARD)
+		{
+			if (available < INPUT_KEYBOARD_SIZE)
+				break;
+
+			const bool down = packet[1] != 0;
+			const unsigned int keyCode = QStreamFramer::bytesToUInt32(packet + 2);
+
+			// Characters typed on a US keyboard, to check and time text injection
+			QChar typed;
+			if (keyCode == TextInjector::shiftKeyCode())
+				client->shiftDown = down;
+			else if (down)
+				typed = TextInjector::charFor(keyCode, client->shiftDown);
+
+			if (!typed.isNull())
+			{
+				const qint64 now = mClock.nsecsElapsed();
+				if (client->typedChars == 0)
+					client->firstTypedAt = now;
+				client->lastTypedAt = now;
+				client->typedChars++;
+				if (client->typed.size() < 40)
+					client->typed.append(typed);
+			}
+
+			log(QString("%1 KEY %2 code=%3%4").arg(client->name)
+				.arg(down ? "DOWN" : "UP").arg(keyCode)
+				.arg(typed.isNull() ? QString() : QString(" '%1'").arg(typed)));
+			if (down)
+				mSynthetic.toggleMarker();
+			offset += INPUT_KEYBOARD_SIZE;
+		}
+		else if (type == INPUT_TOUCH)
+		{
+			if (available < INPUT_TOUCH_SIZE)
+				break;
+
+			client->touchPackets++;
+			logTouch(client, QStreamFramer::bytesToUInt8(packet + 1), QStreamFramer::bytesToUInt8(packet + 2),
+				QStreamFramer::bytesToUInt16(packet + 3), QStreamFramer::bytesToUInt16(packet + 5), QString());
+			offset += INPUT_TOUCH_SIZE;
+		}
+		else if (type == INPUT_TOUCH_BATCH)
+		{
+			if (available < INPUT_TOUCH_BATCH_HEADER_SIZE)
+				break;
+
+			const int size = QStreamFramer::bytesToUInt16(packet + 1);
+			const int count = QStreamFramer::bytesToUInt8(packet + 3);
+			if (size < INPUT_TOUCH_BATCH_HEADER_SIZE)
+			{
+				log(QString("%1 touch batch of %2 bytes, dropping %3 bytes").arg(client->name).arg(size).arg(available));
+				offset = input.size();
+				break;
+			}
+			if (available < size)
+				break;
+
+			client->touchPackets++;
+
+			// Samples are absolute or relative to the previous one of the batch
+			int pos = INPUT_TOUCH_BATCH_HEADER_SIZE;
+			int x = 0, y = 0, elapsed = 0;
+			for (int i = 0; i < count; i++)
+			{
+				if (pos + 4 > size)
+					break;
+
+				const quint8 flags = QStreamFramer::bytesToUInt8(packet + pos);
+				elapsed += QStreamFramer::bytesToUInt8(packet + pos + 1);
+				if (flags & 0x80)
+				{
+					if (pos + 6 > size)
+						break;
+					x = QStreamFramer::bytesToUInt16(packet + pos + 2);
+					y = QStreamFramer::bytesToUInt16(packet + pos + 4);
+					pos += 6;
+				}
+				else
+				{
+					x += (qint8) packet[pos + 2];
+					y += (qint8) packet[pos + 3];
+					pos += 4;
+				}
+
+				logTouch(client, flags & 0x03, (flags >> 2) & 0x1F, x, y,
+					QString(" +%1ms (%2/%3)").arg(elapsed).arg(i + 1).arg(count));
+			}
+
+			if (pos != size)
+			{
+				log(QString("%1 touch batch of %2 samples doesn't match its %3 bytes").arg(client->name).arg(count).arg(size));
+				client->touchErrors++;
+			}
+
+			offset += size;
+		}
+		else
+		{
+			// Without knowing the size, there's no way to find the next packet
+			log(QString("%1 unknown input packet type %2, dropping %3 bytes").arg(client->name).arg(type).arg(available));
+			offset = input.size();
+		}
+	}
+
+	input.remove(0, offset);
+}
+//------------------------------------------
+void StandInServer::logTouch(Client* client, quint8 type, quint8 finger, int x, int y, const QString& suffix)
+{
+	static const char* touchTypes[] = { "UP", "DOWN", "MOVE" };
+
+	// A finger moves or goes up only after going down, and goes down once
+	const quint32 bit = 1u << (finger & 0x1F);
+	const bool down = (client->fingersDown & bit) != 0;
+	const bool valid = (type == TOUCH_DOWN) ? !down : (type < 3 && down);
+	if (type == TOUCH_DOWN)
+		client->fingersDown |= bit;
+	else if (type == TOUCH_UP)
+		client->fingersDown &= ~bit;
+
+	client->touchSamples++;
+	if (!valid)
+		client->touchErrors++;
+
+	// Visible response for the latency measurements
+	if (type == TOUCH_DOWN)
+		mSynthetic.toggleMarker();
+
+	log(QString("%1 TOUCH %2 finger=%3 x=%4 y=%5%6%7").arg(client->name)
+		.arg(type < 3 ? touchTypes[type] : "?")
+		.arg(finger).arg(x).arg(y).arg(suffix)
+		.arg(valid ? "" : " OUT OF SEQUENCE"));
+}
+//------------------------------------------
+void StandInServer::onAnnounceTimer()
+{
+	// Same format as the device announcements, see DeviceRegistry::processAnnouncement
+	QByteArray datagram;
+	for (int i = 0; i < mSettings.announceCount; i++)
+	{
+		QString announced = (mSettings.announceCount > 1) ? QString("%1 #%2").arg(mSettings.announceName).arg(i + 1)
+			: mSettings.announceName;
+		QByteArray name = announced.toUtf8().left(255);
+
+		datagram.resize(0);
+		datagram.append((char) mSettings.protocol);
+		datagram.append((char) name.size());
+		datagram.append(name);
+		if (mSettings.touchBatching)
+			datagram.append((char) INPUT_CAP_TOUCH_BATCH);
+
+		mAnnouncer.writeDatagram(datagram, QHostAddress::Broadcast, mSettings.port);
+	}
+}
+//------------------------------------------
+void StandInServer::log(const QString& line)
+{
+	QString stamped = QString("[%1 ms] %2").arg(mClock.nsecsElapsed() / 1000000.0, 0, 'f', 3).arg(line);
+	QTextStream(stdout) << stamped << endl;
+
+	if (mLogFile.isOpen())
+	{
+		QTextStream(&mLogFile) << stamped << endl;
+	}
+}
+//------------------------------------------
@@ -0,0 +1,173 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _STANDINSERVER_H_
+#define _STANDINSERVER_H_
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QFile>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtNetwork/QUdpSocket>
+
+#include "QStreamFramer.h"
+#include "StreamCapture.h"
+#include "SyntheticStream.h"
+
+// Stand-in for the bbqscreen service running on the phone: serves a
+// synthetic or pre-recorded stream with protocol v3/v4 framing, and logs
+// the input packets sent back by the client, checking that each finger goes
+// down, moves and goes up in order, and timing the text typed.
+class StandInServer : public QObject
+{
+	Q_OBJECT;
+
+public:
+	struct Settings
+	{
+		quint16 port;
+		int protocol;
+
+		int width;
+		int height;
+		int fps;
+		int bitrateKbps;
+		bool audio;
+		SyntheticStream::Pattern pattern;
+
+		// Pre-recorded .bbqcap to serve instead of the synthetic stream
+		QString source;
+
+		// Rotate the reported orientation every N seconds (0 = never)
+		int rotateEvery;
+
+		// Per viewer link emulation (0 = unlimited / none)
+		int bandwidthKbps;
+		int jitterMs;
+
+		// Drop every connection every N seconds (0 = never), and refuse
+		// the new ones for some time after that, like a Wi-Fi blip
+		int dropEvery;
+		int outageMs;
+
+		// Name sent in the UDP discovery announcements (empty = no announce),
+		// as that many devices ("<name> #<n>") and how often
+		QString announceName;
+		int announceCount;
+		int announceIntervalMs;
+
+		// Also serve on 127.0.1.1 to 127.0.1.N (the main listener is then
+		// on 127.0.0.1 only), as that many devices for subnet scans
+		int farmCount;
+
+		// Announce batched touch input support
+		bool touchBatching;
+
+		QString logPath;
+	};
+
+	// ctor
+	StandInServer(const Settings& settings, QObject* parent = 0);
+
+	// dtor
+	~StandInServer();
+
+	bool start();
+
+protected slots:
+	void onNewConnection();
+	void onClientReadyRead();
+	void onClientDisconnected();
+	void onFrameTimer();
+	void onSendTimer();
+	void onAnnounceTimer();
+	void onDropTimer();
+	void onOutageOver();
+
+protected:
+	struct PendingRecord
+	{
+		QByteArray data;
+		qint64 due;
+		int written;
+	};
+
+	struct Client
+	{
+		QTcpSocket* socket;
+		QString name;
+		QByteArray input;
+		QList<PendingRecord> queue;
+		qint64 lastDue;
+		double tokens;
+		bool waitingKeyFrame;
+		int dropped;
+
+		// Touch input checks
+		quint32 fingersDown;
+		int touchPackets;
+		int touchSamples;
+		int touchErrors;
+
+		// Keyboard input, as typed text
+		bool shiftDown;
+		int typedChars;
+		QString typed;
+		qint64 firstTypedAt;
+		qint64 lastTypedAt;
+	};
+
+	bool nextRecord(StreamRecord& record);
+	void queueRecord(Client* client, const QByteArray& data, bool keyFrame);
+	void flushClient(Client* client, qint64 now, double newTokens);
+	void parseInput(Client* client);
+	void logTouch(Client* client, quint8 type, quint8 finger, int x, int y, const QString& suffix);
+	void log(const QString& line);
+	bool listenAll();
+	void closeAll();
+
+protected:
+	Settings mSettings;
+	QTcpServer mServer;
+	QList<QTcpServer*> mFarm;
+	QUdpSocket mAnnouncer;
+	QHash<QTcpSocket*, Client*> mClients;
+
+	QTimer mFrameTimer;
+	QTimer mSendTimer;
+	QTimer mAnnounceTimer;
+	QTimer mDropTimer;
+	QElapsedTimer mClock;
+	qint64 mLastSend;
+
+	SyntheticStream mSynthetic;
+	StreamCaptureReader mCapture;
+	int mCaptureRecord;
+	int mCaptureLoopStart;
+
+	int mFrameNumber;
+	quint8 mOrientation;
+
+	QFile mLogFile;
+};
+
+#endif
@@ -0,0 +1,42 @@
+# ----------------------------------------------------
+# bbqserver - local stand-in for the device service
+# Build with: qmake bbqserver.pro && make
+# ----------------------------------------------------
+
+TEMPLATE = app
+TARGET = bbqserver
+DESTDIR = .
+
+QT += core gui network
+QT -= widgets
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../.. \
+    ../../QTFFmpegWrapper \
+    ../common
+DEPENDPATH += .
+MOC_DIR += ./GeneratedFiles
+OBJECTS_DIR += ./obj
+
+HEADERS += ../../stdafx.h \
+    ../common/SyntheticStream.h \
+    StandInServer.h
+SOURCES += main.cpp \
+    StandInServer.cpp \
+    ../common/SyntheticStream.cpp
+
+include(../../core/bbqcore.pri)
+
+unix:LIBS += -L/usr/local/lib
+win32:LIBS += -L../../ffmpeg_lib_win64
+
+# Set list of required FFmpeg libraries
+LIBS += -lavutil \
+    -lavcodec \
+    -lavformat \
+    -lswscale \
+    -lswresample
+
+# Requied for some C99 defines
+DEFINES += __STDC_CONSTANT_MACROS
@@ -0,0 +1,103 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// bbqserver - local stand-in for the bbqscreen service running on a phone.
+//
+// Serves an encoded stream with the same framing as the device on port
+// 9876, so the client can be load tested and profiled without a phone.
+
+#include "stdafx.h"
+#include "StandInServer.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("bbqserver");
+
+	QCommandLineParser args;
+	args.setApplicationDescription("Local stand-in for the BBQScreen device service");
+	args.addHelpOption();
+	args.addOptions({
+		{ "port", "TCP port to listen on.", "port", "9876" },
+		{ "protocol", "Stream protocol version (3 = video only, 4 = video and audio).", "version", "4" },
+		{ "width", "Synthetic stream width.", "pixels", "720" },
+		{ "height", "Synthetic stream height.", "pixels", "1280" },
+		{ "fps", "Frame rate.", "fps", "60" },
+		{ "bitrate", "Synthetic stream bitrate.", "kbps", "4500" },
+		{ "no-audio", "Don't encode audio (protocol v4 records carry no audio)." },
+		{ "pattern", "Synthetic stream content: moving, static (blinking cursor) or scroll (list flings).", "pattern", "moving" },
+		{ "source", "Serve a .bbqcap capture (looped) instead of the synthetic stream.", "file" },
+		{ "rotate-every", "Cycle the reported orientation every N seconds.", "seconds", "0" },
+		{ "bandwidth", "Cap the bandwidth of each viewer.", "kbps", "0" },
+		{ "jitter", "Delay each record by a random 0..N ms.", "ms", "0" },
+		{ "drop-every", "Drop every viewer's connection every N seconds.", "seconds", "0" },
+		{ "outage", "Refuse connections for this long after each drop.", "ms", "0" },
+		{ "announce", "Send UDP discovery announcements with this device name.", "name" },
+		{ "announce-count", "Announce this many devices (\"<name> #<n>\"), for discovery tests.", "count", "1" },
+		{ "announce-interval", "Time between two announcements of each device.", "ms", "1000" },
+		{ "farm", "Also serve on 127.0.1.1 to 127.0.1.N, as that many devices for subnet scans.", "count", "0" },
+		{ "legacy-touch", "Don't announce batched touch input, as older devices." },
+		{ "log", "Also append the log (including input packets) to a file.", "file" },
+	});
+	args.process(app);
+
+	StandInServer::Settings settings;
+	settings.port = args.value("port").toUShort();
+	settings.protocol = args.value("protocol").toInt();
+	settings.width = args.value("width").toInt();
+	settings.height = args.value("height").toInt();
+	settings.fps = qMax(1, args.value("fps").toInt());
+	settings.bitrateKbps = args.value("bitrate").toInt();
+	settings.audio = !args.isSet("no-audio");
+	settings.source = args.value("source");
+	settings.rotateEvery = args.value("rotate-every").toInt();
+	settings.bandwidthKbps = args.value("bandwidth").toInt();
+	settings.jitterMs = args.value("jitter").toInt();
+	settings.dropEvery = args.value("drop-every").toInt();
+	settings.outageMs = args.value("outage").toInt();
+	settings.announceName = args.value("announce");
+	settings.announceCount = qMax(1, args.value("announce-count").toInt());
+	settings.announceIntervalMs = args.value("announce-interval").toInt();
+	settings.farmCount = qBound(0, args.value("farm").toInt(), 254);
+	settings.touchBatching = !args.isSet("legacy-touch");
+	settings.logPath = args.value("log");
+
+	if (!SyntheticStream::parsePattern(args.value("pattern"), settings.pattern))
+	{
+		qCritical() << "Unknown pattern " << args.value("pattern");
+		return 1;
+	}
+
+	if (settings.protocol != 3 && settings.protocol != 4)
+	{
+		qCritical() << "Unsupported protocol version " << settings.protocol;
+		return 1;
+	}
+
+	qsrand(QDateTime::currentMSecsSinceEpoch());
+
+	StandInServer server(settings);
+	if (!server.start())
+		return 1;
+
+	return app.exec();
+}
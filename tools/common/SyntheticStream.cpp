@@ -0,0 +1,396 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "stdafx.h"
+#include "SyntheticStream.h"
+
+#include <QDebug>
+#include <cmath>
+
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_CHANNELS 2
+#define AUDIO_TONE_HZ 440.0
+
+//------------------------------------------
+SyntheticStream::SyntheticStream() :
+	mFrameNumber(0),
+	mAudioSamples(0),
+	mKeyFrameRequested(false),
+	mPattern(PATTERN_MOVING),
+	mMarker(false),
+	mVideoCtx(nullptr),
+	mVideoFrame(nullptr),
+	mVideoBuffer(nullptr),
+	mAudioCtx(nullptr),
+	mAudioFrame(nullptr),
+	mAudioBuffer(nullptr)
+{
+
+}
+//------------------------------------------
+SyntheticStream::~SyntheticStream()
+{
+	close();
+}
+//------------------------------------------
+bool SyntheticStream::open(int width, int height, int fps, int bitrateKbps, bool audio)
+{
+	close();
+
+	ffmpeg::avcodec_register_all();
+
+	ffmpeg::AVCodec* videoCodec = ffmpeg::avcodec_find_encoder(ffmpeg::CODEC_ID_H264);
+	if (!videoCodec)
+	{
+		qWarning() << "No H264 encoder available (FFmpeg needs to be built with libx264)";
+		return false;
+	}
+
+	mVideoCtx = ffmpeg::avcodec_alloc_context3(videoCodec);
+	mVideoCtx->width = width;
+	mVideoCtx->height = height;
+	mVideoCtx->pix_fmt = ffmpeg::PIX_FMT_YUV420P;
+	mVideoCtx->time_base.num = 1;
+	mVideoCtx->time_base.den = fps;
+	mVideoCtx->bit_rate = bitrateKbps * 1000;
+	mVideoCtx->gop_size = fps * 2;
+	mVideoCtx->max_b_frames = 0;
+
+	// Same trade-offs as a phone hardware encoder: no lookahead, no B-frames
+	ffmpeg::av_opt_set(mVideoCtx->priv_data, "preset", "ultrafast", 0);
+	ffmpeg::av_opt_set(mVideoCtx->priv_data, "tune", "zerolatency", 0);
+
+	if (ffmpeg::avcodec_open2(mVideoCtx, videoCodec, NULL) < 0)
+	{
+		qWarning() << "Could not open H264 encoder";
+		close();
+		return false;
+	}
+
+	mVideoFrame = ffmpeg::av_frame_alloc();
+	mVideoFrame->format = ffmpeg::PIX_FMT_YUV420P;
+	mVideoFrame->width = width;
+	mVideoFrame->height = height;
+
+	int numBytes = ffmpeg::avpicture_get_size(ffmpeg::PIX_FMT_YUV420P, width, height);
+	mVideoBuffer = (uint8_t*) ffmpeg::av_malloc(numBytes);
+	ffmpeg::avpicture_fill((ffmpeg::AVPicture*) mVideoFrame, mVideoBuffer, ffmpeg::PIX_FMT_YUV420P, width, height);
+
+	if (!audio)
+		return true;
+
+	ffmpeg::AVCodec* audioCodec = ffmpeg::avcodec_find_encoder(ffmpeg::CODEC_ID_AAC);
+	if (!audioCodec)
+	{
+		qWarning() << "No AAC encoder available";
+		close();
+		return false;
+	}
+
+	mAudioCtx = ffmpeg::avcodec_alloc_context3(audioCodec);
+	mAudioCtx->sample_fmt = ffmpeg::AV_SAMPLE_FMT_FLTP;
+	mAudioCtx->sample_rate = AUDIO_SAMPLE_RATE;
+	mAudioCtx->channels = AUDIO_CHANNELS;
+	mAudioCtx->channel_layout = AV_CH_LAYOUT_STEREO;
+	mAudioCtx->bit_rate = 128000;
+	mAudioCtx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+
+	if (ffmpeg::avcodec_open2(mAudioCtx, audioCodec, NULL) < 0)
+	{
+		qWarning() << "Could not open AAC encoder";
+		close();
+		return false;
+	}
+
+	mAudioFrame = ffmpeg::av_frame_alloc();
+	mAudioFrame->nb_samples = mAudioCtx->frame_size;
+	mAudioFrame->format = mAudioCtx->sample_fmt;
+	mAudioFrame->channel_layout = mAudioCtx->channel_layout;
+
+	int audioBytes = ffmpeg::av_samples_get_buffer_size(NULL, AUDIO_CHANNELS, mAudioCtx->frame_size, mAudioCtx->sample_fmt, 0);
+	mAudioBuffer = (uint8_t*) ffmpeg::av_malloc(audioBytes);
+	ffmpeg::avcodec_fill_audio_frame(mAudioFrame, AUDIO_CHANNELS, mAudioCtx->sample_fmt, mAudioBuffer, audioBytes, 0);
+
+	return true;
+}
+//------------------------------------------
+void SyntheticStream::close()
+{
+	if (mVideoCtx)
+	{
+		ffmpeg::avcodec_close(mVideoCtx);
+		ffmpeg::av_free(mVideoCtx);
+		mVideoCtx = nullptr;
+	}
+
+	if (mAudioCtx)
+	{
+		ffmpeg::avcodec_close(mAudioCtx);
+		ffmpeg::av_free(mAudioCtx);
+		mAudioCtx = nullptr;
+	}
+
+	ffmpeg::av_frame_free(&mVideoFrame);
+	ffmpeg::av_frame_free(&mAudioFrame);
+	ffmpeg::av_freep(&mVideoBuffer);
+	ffmpeg::av_freep(&mAudioBuffer);
+
+	mFrameNumber = 0;
+	mAudioSamples = 0;
+}
+//------------------------------------------
+int SyntheticStream::width() const
+{
+	return mVideoCtx ? mVideoCtx->width : 0;
+}
+//------------------------------------------
+int SyntheticStream::height() const
+{
+	return mVideoCtx ? mVideoCtx->height : 0;
+}
+//------------------------------------------
+int SyntheticStream::fps() const
+{
+	return mVideoCtx ? mVideoCtx->time_base.den : 0;
+}
+//------------------------------------------
+int SyntheticStream::frameNumber() const
+{
+	return mFrameNumber;
+}
+//------------------------------------------
+bool SyntheticStream::nextFrame(QByteArray& video, QByteArray& audio)
+{
+	if (!mVideoCtx)
+		return false;
+
+	drawFrame();
+	mVideoFrame->pts = mFrameNumber;
+	mVideoFrame->pict_type = mKeyFrameRequested ? ffmpeg::AV_PICTURE_TYPE_I : ffmpeg::AV_PICTURE_TYPE_NONE;
+	mKeyFrameRequested = false;
+
+	ffmpeg::AVPacket packet;
+	ffmpeg::av_init_packet(&packet);
+	packet.data = NULL;
+	packet.size = 0;
+
+	int gotPacket = 0;
+	if (ffmpeg::avcodec_encode_video2(mVideoCtx, &packet, mVideoFrame, &gotPacket) < 0)
+	{
+		qWarning() << "Error while encoding video frame";
+		return false;
+	}
+
+	video.clear();
+	if (gotPacket)
+	{
+		video = QByteArray((const char*) packet.data, packet.size);
+		ffmpeg::av_free_packet(&packet);
+	}
+
+	mFrameNumber++;
+
+	// Keep the audio clock at or ahead of the video clock
+	audio.clear();
+	if (mAudioCtx)
+	{
+		const qint64 targetSamples = (qint64) mFrameNumber * AUDIO_SAMPLE_RATE / fps();
+		while (mAudioSamples < targetSamples)
+		{
+			if (!encodeAudio(audio))
+				return false;
+		}
+	}
+
+	return true;
+}
+//------------------------------------------
+void SyntheticStream::requestKeyFrame()
+{
+	mKeyFrameRequested = true;
+}
+//------------------------------------------
+void SyntheticStream::setPattern(Pattern pattern)
+{
+	mPattern = pattern;
+}
+//------------------------------------------
+void SyntheticStream::toggleMarker()
+{
+	mMarker = !mMarker;
+}
+//------------------------------------------
+bool SyntheticStream::parsePattern(const QString& name, Pattern& pattern)
+{
+	static const char* names[] = { "moving", "static", "scroll" };
+	for (int i = 0; i < 3; i++)
+	{
+		if (name == names[i])
+		{
+			pattern = (Pattern) i;
+			return true;
+		}
+	}
+
+	return false;
+}
+//------------------------------------------
+void SyntheticStream::drawFrame()
+{
+	const int w = mVideoCtx->width, h = mVideoCtx->height;
+	const int n = (mPattern == PATTERN_MOVING) ? mFrameNumber : 0;
+	const int fps = qMax(1, mVideoCtx->time_base.den);
+
+	uint8_t* y = mVideoFrame->data[0];
+	const int lineY = mVideoFrame->linesize[0];
+
+	if (mPattern == PATTERN_SCROLL)
+	{
+		// Status bar with a clock ticking every second
+		const int bar = h / 20;
+		for (int row = 0; row < bar; row++)
+		{
+			uint8_t* line = y + row * lineY;
+			memset(line, 40, w);
+			memset(line + w - w / 6, 40 + ((mFrameNumber / fps) * 37) % 180, w / 8);
+		}
+
+		// List of text items, flung for one second then left still for one
+		const int cycle = mFrameNumber / (2 * fps);
+		const int offset = (cycle * fps + qMin(mFrameNumber % (2 * fps), fps)) * 12;
+		for (int row = bar; row < h; row++)
+		{
+			uint8_t* line = y + row * lineY;
+			const int v = row - bar + offset;
+			const int item = v / 96, inItem = v % 96;
+
+			memset(line, 200, w);
+			if (inItem == 95)
+				memset(line, 150, w);
+			else if (inItem >= 24 && inItem < 40)
+				memset(line + 32, 40, qMin(w - 32, w / 4 + (item * 37) % (w / 2)));
+		}
+	}
+	else
+	{
+		// Luma: diagonal gradient scrolling down (still when static)
+		for (int row = 0; row < h; row++)
+		{
+			uint8_t* line = y + row * lineY;
+			for (int col = 0; col < w; col++)
+				line[col] = (uint8_t) (16 + ((row + col + n * 4) & 0x7F));
+		}
+	}
+
+	if (mPattern == PATTERN_STATIC)
+	{
+		// Text cursor blinking twice a second, in the upper third
+		const int halfPeriod = qMax(1, fps / 2);
+		if ((mFrameNumber / halfPeriod) % 2 == 0)
+		{
+			const int cx = w / 3, cy = h / 3, ch = qMax(8, h / 40);
+			for (int row = cy; row < cy + ch; row++)
+				memset(y + row * lineY + cx, 235, 4);
+		}
+	}
+	else if (mPattern == PATTERN_MOVING)
+	{
+		// Bouncing white box
+		const int box = qMax(16, w / 8);
+		const int span = qMax(1, w - box);
+		int bx = (n * 8) % (2 * span);
+		if (bx >= span) bx = 2 * span - bx;
+		const int by = (h - box) / 2;
+		for (int row = by; row < by + box; row++)
+			memset(y + row * lineY + bx, 235, box);
+	}
+
+	// Latency marker, drawn over any pattern so only an input changes it
+	const int marker = qMin(LATENCY_MARKER_SIZE, qMin(w, h));
+	for (int row = 0; row < marker; row++)
+		memset(y + row * lineY, mMarker ? 235 : 16, marker);
+
+	// Chroma: slow horizontal color bars
+	for (int plane = 1; plane < 3; plane++)
+	{
+		uint8_t* c = mVideoFrame->data[plane];
+		const int lineC = mVideoFrame->linesize[plane];
+		for (int row = 0; row < h / 2; row++)
+		{
+			uint8_t* line = c + row * lineC;
+			for (int col = 0; col < w / 2; col++)
+				line[col] = (uint8_t) (64 + (((col * 8 / qMax(1, w / 2)) * (plane == 1 ? 24 : 40) + n) & 0x7F));
+		}
+	}
+}
+//------------------------------------------
+bool SyntheticStream::encodeAudio(QByteArray& out)
+{
+	const int frameSize = mAudioCtx->frame_size;
+	float* left = (float*) mAudioFrame->data[0];
+	float* right = (float*) mAudioFrame->data[1];
+
+	for (int i = 0; i < frameSize; i++)
+	{
+		float sample = 0.25f * (float) sin(2.0 * 3.14159265358979 * AUDIO_TONE_HZ * (mAudioSamples + i) / AUDIO_SAMPLE_RATE);
+		left[i] = sample;
+		right[i] = sample;
+	}
+
+	mAudioFrame->pts = mAudioSamples;
+	mAudioSamples += frameSize;
+
+	ffmpeg::AVPacket packet;
+	ffmpeg::av_init_packet(&packet);
+	packet.data = NULL;
+	packet.size = 0;
+
+	int gotPacket = 0;
+	if (ffmpeg::avcodec_encode_audio2(mAudioCtx, &packet, mAudioFrame, &gotPacket) < 0)
+	{
+		qWarning() << "Error while encoding audio frame";
+		return false;
+	}
+
+	if (gotPacket)
+	{
+		appendAdtsHeader(out, packet.size);
+		out.append((const char*) packet.data, packet.size);
+		ffmpeg::av_free_packet(&packet);
+	}
+
+	return true;
+}
+//------------------------------------------
+void SyntheticStream::appendAdtsHeader(QByteArray& out, int payloadSize)
+{
+	// AAC LC, 48 kHz, stereo, no CRC
+	const int profile = 1;
+	const int freqIndex = 3;
+	const int channelConfig = AUDIO_CHANNELS;
+	const int frameLength = payloadSize + 7;
+
+	out.append((char) 0xFF);
+	out.append((char) 0xF1);
+	out.append((char) ((profile << 6) | (freqIndex << 2) | (channelConfig >> 2)));
+	out.append((char) (((channelConfig & 3) << 6) | (frameLength >> 11)));
+	out.append((char) ((frameLength >> 3) & 0xFF));
+	out.append((char) (((frameLength & 7) << 5) | 0x1F));
+	out.append((char) 0xFC);
+}
+//------------------------------------------
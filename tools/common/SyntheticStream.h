@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _SYNTHETICSTREAM_H_
+#define _SYNTHETICSTREAM_H_
+
+#include <QByteArray>
+#include <QString>
+
+#include <QTFFmpegWrapper/ffmpeg.h>
+
+// Square in the top left corner toggled by toggleMarker(), the default
+// region of the latency measurements
+#define LATENCY_MARKER_SIZE 64
+
+// Generates a test pattern and encodes it the way the device service does:
+// H264 Annex B (SPS/PPS repeated on every IDR) and ADTS framed AAC.
+class SyntheticStream
+{
+public:
+	// ctor
+	SyntheticStream();
+
+	// dtor
+	~SyntheticStream();
+
+	bool open(int width, int height, int fps, int bitrateKbps, bool audio);
+	void close();
+
+	// Encodes the next video frame, and the audio covering its duration
+	bool nextFrame(QByteArray& video, QByteArray& audio);
+
+	// Makes the next frame an IDR, e.g. for a viewer that just joined
+	void requestKeyFrame();
+
+	enum Pattern {
+		PATTERN_MOVING,	// Full screen motion on every frame
+		PATTERN_STATIC,	// Still screen with a blinking text cursor
+		PATTERN_SCROLL	// Fixed status bar over a list flung every other second
+	};
+
+	void setPattern(Pattern pattern);
+	static bool parsePattern(const QString& name, Pattern& pattern);
+
+	// Switches the marker square between black and white from the next
+	// frame, as the visible response to an input
+	void toggleMarker();
+
+	int width() const;
+	int height() const;
+	int fps() const;
+	int frameNumber() const;
+
+protected:
+	void drawFrame();
+	bool encodeAudio(QByteArray& out);
+	static void appendAdtsHeader(QByteArray& out, int payloadSize);
+
+protected:
+	int mFrameNumber;
+	qint64 mAudioSamples;
+	bool mKeyFrameRequested;
+	Pattern mPattern;
+	bool mMarker;
+
+	ffmpeg::AVCodecContext* mVideoCtx;
+	ffmpeg::AVFrame* mVideoFrame;
+	uint8_t* mVideoBuffer;
+
+	ffmpeg::AVCodecContext* mAudioCtx;
+	ffmpeg::AVFrame* mAudioFrame;
+	uint8_t* mAudioBuffer;
+};
+
+#endif
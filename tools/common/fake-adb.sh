@@ -0,0 +1,78 @@
+#!/bin/sh
+# Stand-in for adb, to run and time the USB service bootstrap without a device.
+#
+# FAKE_ADB_DIR   root of the device files (default /tmp/fake-adb)
+# FAKE_ADB_DELAY seconds each call takes, like a round trip to a device (default 0.15)
+# FAKE_ADB_STATE ok, missing, offline or unauthorized (default ok)
+#
+# Supports "forward", and "shell" with cp, chmod, ls -l (toybox format, on a
+# GNU stat), the "cmp -s <a> <b> && [ -x <b> ] && echo <marker>" check of the
+# bootstrap, and running the service, which idles until killed.
+
+root="${FAKE_ADB_DIR:-/tmp/fake-adb}"
+sleep "${FAKE_ADB_DELAY:-0.15}"
+
+case "${FAKE_ADB_STATE:-ok}" in
+	missing) echo "error: device not found" >&2; exit 1 ;;
+	offline) echo "error: device offline" >&2; exit 1 ;;
+	unauthorized) echo "error: device unauthorized." >&2; exit 1 ;;
+esac
+
+case "$1" in
+	forward) exit 0 ;;
+	shell) shift ;;
+	*) echo "fake adb: unsupported command $1" >&2; exit 1 ;;
+esac
+
+# A command line given as one argument, as adb passes it to the device's sh
+if [ $# -eq 1 ]; then
+	set -f
+	set -- $1
+	set +f
+fi
+
+# Like older devices, the shell reports its errors on stdout and exits with 0
+case "$1" in
+	cmp)
+		# cmp -s <a> <b> && [ -x <b> ] && echo <marker>
+		if cmp -s "$root$3" "$root$4" && [ -x "$root$4" ]; then
+			echo "${12}"
+		fi
+		;;
+	cp)
+		if [ -f "$root$2" ]; then
+			mkdir -p "$(dirname "$root$3")" && cp "$root$2" "$root$3"
+		else
+			echo "cp: $2: No such file or directory"
+		fi
+		;;
+	chmod)
+		if [ -f "$root$3" ]; then
+			chmod "$2" "$root$3"
+		else
+			echo "Unable to chmod $3: No such file or directory"
+		fi
+		;;
+	ls)
+		shift
+		[ "$1" = "-l" ] && shift
+		for file in "$@"; do
+			if [ -f "$root$file" ]; then
+				echo "$(stat -c '%A' "$root$file") 1 shell shell $(stat -c '%s' "$root$file") $(date -r "$root$file" '+%Y-%m-%d %H:%M') $file"
+			else
+				echo "ls: $file: No such file or directory"
+			fi
+		done
+		;;
+	/*)
+		if [ -x "$root$1" ]; then
+			echo "Service started"
+			exec sleep 86400
+		fi
+		echo "/system/bin/sh: $1: not found"
+		;;
+	*)
+		echo "/system/bin/sh: $1: not found"
+		;;
+esac
+exit 0
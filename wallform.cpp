@@ -0,0 +1,327 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "stdafx.h"
+#include "wallform.h"
+#include "mainwindow.h"
+#include <QPainter>
+#include <QCloseEvent>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QtCore/qmath.h>
+
+#define TILE_SPACING 4
+
+//----------------------------------------------------
+WallForm::WallForm(MainWindow* win, QWidget *parent) :
+	QGLWidget(QGLFormat(QGL::DoubleBuffer | QGL::NoDepthBuffer | QGL::NoStencilBuffer), parent),
+	mParentWindow(win),
+	mFocusedTile(-1),
+	mHighQuality(false),
+	mShowFps(false)
+{
+	setWindowTitle("BBQScreen - Wall");
+	setAutoFillBackground(false);
+	setAttribute(Qt::WA_OpaquePaintEvent);
+	resize(1280, 800);
+}
+//----------------------------------------------------
+WallForm::~WallForm()
+{
+	for (auto it = mTiles.begin(); it != mTiles.end(); ++it)
+	{
+		(*it)->session->disconnect(this);
+		(*it)->session->stop();
+		delete (*it)->session;
+		delete (*it);
+	}
+	mTiles.clear();
+}
+//----------------------------------------------------
+void WallForm::addDevice(const QString& host, const QString& name)
+{
+	Tile* tile = new Tile;
+	tile->session = new StreamSession(false);
+	tile->host = host;
+	tile->name = name;
+	tile->orientation = 0;
+	tile->framesReceived = 0;
+	tile->fps = 0;
+	tile->fpsTimer.start();
+	mTiles.push_back(tile);
+
+	tile->session->setDecodePool(&DecodePool::global());
+	connect(tile->session, SIGNAL(frameReady()), this, SLOT(onFrameReady()));
+	connect(tile->session, SIGNAL(stateChanged(StreamSession::State)), this, SLOT(onSessionStateChanged(StreamSession::State)));
+
+	tile->session->connectTo(host);
+	updatePriorities();
+	update();
+}
+//----------------------------------------------------
+void WallForm::setQuality(bool high)
+{
+	mHighQuality = high;
+}
+//----------------------------------------------------
+void WallForm::setShowFps(bool show)
+{
+	mShowFps = show;
+}
+//----------------------------------------------------
+WallForm::Tile* WallForm::tileOf(QObject* session)
+{
+	for (auto it = mTiles.begin(); it != mTiles.end(); ++it)
+	{
+		if ((*it)->session == session)
+			return *it;
+	}
+
+	return nullptr;
+}
+//----------------------------------------------------
+void WallForm::onFrameReady()
+{
+	Tile* tile = tileOf(sender());
+	if (!tile)
+		return;
+
+	// Only keep a reference on the frame, it's drawn on the next repaint
+	tile->frame = tile->session->lastFrame();
+
+	// Thumbnails come at half size, keep track of the real one
+	QSize sourceSize = tile->frame.size();
+	if (tile->session->priority() == SP_THUMBNAIL)
+		sourceSize *= 2;
+
+	if (sourceSize != tile->sourceSize)
+	{
+		tile->sourceSize = sourceSize;
+		updatePriorities();
+	}
+
+	tile->orientation = tile->session->remoteOrientation();
+	tile->framesReceived++;
+
+	if (tile->fpsTimer.elapsed() > 2000)
+	{
+		tile->fps = tile->framesReceived / (tile->fpsTimer.elapsed() / 1000.0);
+		tile->framesReceived = 0;
+		tile->fpsTimer.restart();
+	}
+
+	// Repaints of all the tiles are merged by Qt
+	update(tileRect(mTiles.indexOf(tile)));
+}
+//----------------------------------------------------
+void WallForm::onSessionStateChanged(StreamSession::State state)
+{
+	Tile* tile = tileOf(sender());
+	if (!tile)
+		return;
+
+	if (state == StreamSession::SS_CONNECTED)
+	{
+		tile->framesReceived = 0;
+		tile->fpsTimer.restart();
+	}
+
+	update(tileRect(mTiles.indexOf(tile)));
+}
+//----------------------------------------------------
+void WallForm::updatePriorities()
+{
+	const bool hidden = !isVisible() || isMinimized();
+
+	for (int i = 0; i < mTiles.size(); ++i)
+	{
+		Tile* tile = mTiles.at(i);
+		QSize area = tileRect(i).size();
+
+		SessionPriority priority = SP_VISIBLE;
+		if (hidden)
+		{
+			priority = SP_HIDDEN;
+		}
+		else if (i == mFocusedTile && isActiveWindow())
+		{
+			priority = SP_FOCUSED;
+		}
+		else if (tile->sourceSize.isValid())
+		{
+			// Below half the device resolution in both directions, a half size
+			// frame looks the same once scaled
+			QSize half = tile->sourceSize / 2;
+			if (tile->orientation % 2)
+				half.transpose();
+
+			if (area.width() <= half.width() && area.height() <= half.height())
+				priority = SP_THUMBNAIL;
+		}
+
+		tile->session->setPriority(priority);
+	}
+}
+//----------------------------------------------------
+QRect WallForm::tileRect(int index) const
+{
+	if (index < 0 || mTiles.isEmpty())
+		return QRect();
+
+	const int count = mTiles.size();
+	const int columns = qCeil(qSqrt(count));
+	const int rows = (count + columns - 1) / columns;
+	const int w = width() / columns;
+	const int h = height() / rows;
+
+	return QRect((index % columns) * w, (index / columns) * h, w, h)
+		.adjusted(TILE_SPACING / 2, TILE_SPACING / 2, -TILE_SPACING / 2, -TILE_SPACING / 2);
+}
+//----------------------------------------------------
+QString WallForm::statusText(const Tile& tile) const
+{
+	switch (tile.session->state())
+	{
+	case StreamSession::SS_CONNECTING:
+		return "Connecting... (Attempt " + QString::number(tile.session->connectionAttempts()) + "/" + QString::number(MAX_CONNECTION_ATTEMPTS) + ")";
+	case StreamSession::SS_RECONNECTING:
+		return "Lost connection. Reconnecting...";
+	case StreamSession::SS_FAILED:
+		return "Unable to connect: " + tile.session->errorString();
+	case StreamSession::SS_CONNECTED:
+		if (tile.frame.isNull())
+			return "Connected, loading first frame...";
+		if (mShowFps)
+			return QString::number(tile.fps, 'f', 1) + " fps";
+		break;
+	default:
+		break;
+	}
+
+	return QString();
+}
+//----------------------------------------------------
+void WallForm::paintEvent(QPaintEvent *evt)
+{
+	Q_UNUSED(evt);
+
+	QPainter painter(this);
+	painter.setRenderHint(QPainter::SmoothPixmapTransform, mHighQuality);
+	painter.fillRect(rect(), Qt::black);
+
+	for (int i = 0; i < mTiles.size(); ++i)
+	{
+		const Tile& tile = *mTiles.at(i);
+		const QRect area = tileRect(i);
+
+		if (!tile.frame.isNull())
+		{
+			// Rotate with the painter instead of transforming the image
+			const int angle = tile.orientation * (-90);
+			const bool sideways = (tile.orientation % 2) != 0;
+			QSizeF size = sideways ? QSizeF(tile.frame.height(), tile.frame.width()) : QSizeF(tile.frame.size());
+			size.scale(area.size(), Qt::KeepAspectRatio);
+			if (sideways)
+				size.transpose();
+
+			painter.save();
+			painter.translate(area.center());
+			painter.rotate(angle);
+			painter.drawImage(QRectF(-size.width() / 2, -size.height() / 2, size.width(), size.height()), tile.frame);
+			painter.restore();
+		}
+
+		QString status = statusText(tile);
+		QString label = tile.name.isEmpty() ? tile.host : tile.name;
+		if (!status.isEmpty())
+			label += " - " + status;
+
+		if (i == mFocusedTile)
+		{
+			painter.setPen(QPen(QColor(255, 140, 0), 2));
+			painter.drawRect(area.adjusted(-1, -1, 0, 0));
+		}
+
+		painter.setPen(Qt::white);
+		painter.drawText(area.adjusted(6, 4, -6, -4), Qt::AlignTop | Qt::AlignLeft, label);
+	}
+}
+//----------------------------------------------------
+void WallForm::mousePressEvent(QMouseEvent *evt)
+{
+	// The clicked tile gets the full frame rate
+	mFocusedTile = -1;
+	for (int i = 0; i < mTiles.size(); ++i)
+	{
+		if (tileRect(i).contains(evt->pos()))
+			mFocusedTile = i;
+	}
+
+	updatePriorities();
+	update();
+	evt->accept();
+}
+//----------------------------------------------------
+void WallForm::resizeEvent(QResizeEvent *evt)
+{
+	QGLWidget::resizeEvent(evt);
+	updatePriorities();
+}
+//----------------------------------------------------
+void WallForm::showEvent(QShowEvent *evt)
+{
+	QGLWidget::showEvent(evt);
+	updatePriorities();
+}
+//----------------------------------------------------
+void WallForm::hideEvent(QHideEvent *evt)
+{
+	QGLWidget::hideEvent(evt);
+	updatePriorities();
+}
+//----------------------------------------------------
+void WallForm::changeEvent(QEvent *evt)
+{
+	QGLWidget::changeEvent(evt);
+
+	if (evt->type() == QEvent::ActivationChange || evt->type() == QEvent::WindowStateChange)
+		updatePriorities();
+}
+//----------------------------------------------------
+void WallForm::keyPressEvent(QKeyEvent *evt)
+{
+	if ((evt->modifiers() & Qt::ControlModifier) && evt->key() == Qt::Key_F)
+	{
+		if (windowState() & Qt::WindowFullScreen)
+			setWindowState(windowState() & ~Qt::WindowFullScreen);
+		else
+			setWindowState(windowState() ^ Qt::WindowFullScreen);
+	}
+
+	evt->accept();
+}
+//----------------------------------------------------
+void WallForm::closeEvent(QCloseEvent *evt)
+{
+	for (auto it = mTiles.begin(); it != mTiles.end(); ++it)
+		(*it)->session->stop();
+
+	mParentWindow->show();
+	QGLWidget::closeEvent(evt);
+}
+//----------------------------------------------------
@@ -0,0 +1,85 @@
+/**
+ * Copyright (C) 2013 Guillaume Lesniak
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef WALLFORM_H
+#define WALLFORM_H
+
+#include <QtOpenGL/QGLWidget>
+#include <QTime>
+#include <QList>
+#include "StreamSession.h"
+
+class MainWindow;
+
+// Shows many devices at once in a grid, all drawn on a single GL surface.
+// The sessions decode on the shared DecodePool and play no audio.
+class WallForm : public QGLWidget
+{
+	Q_OBJECT
+
+public:
+	explicit WallForm(MainWindow* win, QWidget *parent = 0);
+	~WallForm();
+
+	void addDevice(const QString& host, const QString& name);
+	void setQuality(bool high);
+	void setShowFps(bool show);
+
+	void closeEvent(QCloseEvent *evt);
+	void keyPressEvent(QKeyEvent *evt);
+	void mousePressEvent(QMouseEvent *evt);
+	void paintEvent(QPaintEvent *evt);
+	void resizeEvent(QResizeEvent *evt);
+	void changeEvent(QEvent *evt);
+	void showEvent(QShowEvent *evt);
+	void hideEvent(QHideEvent *evt);
+
+private slots:
+	void onFrameReady();
+	void onSessionStateChanged(StreamSession::State state);
+
+private:
+	struct Tile
+	{
+		StreamSession* session;
+		QString host;
+		QString name;
+		QImage frame;
+		QSize sourceSize;
+		int orientation;
+		int framesReceived;
+		double fps;
+		QTime fpsTimer;
+	};
+
+	Tile* tileOf(QObject* session);
+	QRect tileRect(int index) const;
+	QString statusText(const Tile& tile) const;
+	void updatePriorities();
+
+private:
+	MainWindow* mParentWindow;
+	QList<Tile*> mTiles;
+	int mFocusedTile;
+
+	bool mHighQuality;
+	bool mShowFps;
+};
+
+#endif // WALLFORM_H